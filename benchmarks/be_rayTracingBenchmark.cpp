@@ -0,0 +1,328 @@
+#include "BigoudiEngine.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <limits>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/resource.h>
+#endif
+
+/**
+ * Headless benchmark of the cpu ray tracer over the bundled models
+ *
+ * usage: BigoudiEngine_rayTracingBenchmark [--model name] [--method naive|bvh|bsh]
+ *     [--brdf color|normal|lambert|ggx|disney] [--resolution size] [--spp n]
+ *     [--seed n] [--workers n] [--wavefront 0|1] [--packet 1|4|8] [--prepared 0|1]
+ *     [--output file.json]
+ *
+ * Every filter defaults to the whole matrix, the results are written as a json array
+ * (stdout is left to the progress of the ray tracer)
+ * With --workers, the tiles are rendered by that many forked worker processes instead of threads
+ * With --wavefront 1, the paths are traced and shaded in batches, stage by stage
+ * --packet sets the width of the packets of camera and shadow rays, 1 traces them one by one
+ * With --prepared 1, each model is saved as a prepared scene and rendered from its mapping
+ * --seed fixes the random numbers of every pixel, the images do not depend on the threads nor workers
+ * The peak memory is the one of each configuration on linux, of the whole process elsewhere
+*/
+
+namespace{
+
+struct BenchmarkModel{
+    std::string _Name;
+    std::string _File;
+};
+
+const std::vector<BenchmarkModel> MODELS = {
+    {"killeroo", "killeroo.off"},
+    {"rhino", "rhino.off"},
+    {"man", "man.off"},
+    {"denis", "denis.off"},
+    {"sphere_high_res", "sphere_high_res.off"},
+};
+
+const std::vector<std::pair<std::string, be::RayTracer::BoundingVolumeMethod>> METHODS = {
+    {"naive", be::RayTracer::NAIVE_METHOD},
+    {"bvh", be::RayTracer::BVH_METHOD},
+    {"bsh", be::RayTracer::BSH_METHOD},
+};
+
+const std::vector<std::pair<std::string, be::RayTracer::BRDFModel>> BRDFS = {
+    {"color", be::RayTracer::COLOR_BRDF},
+    {"normal", be::RayTracer::NORMAL_BRDF},
+    {"lambert", be::RayTracer::LAMBERT_BRDF},
+    {"ggx", be::RayTracer::GGX_BRDF},
+    {"disney", be::RayTracer::DISNEY_BRDF},
+};
+
+const std::vector<uint32_t> RESOLUTIONS = {64, 128, 256};
+
+struct BenchmarkOptions{
+    std::string _Model = "";
+    std::string _Method = "";
+    std::string _BRDF = "";
+    uint32_t _Resolution = 0;
+    uint32_t _SamplesPerPixels = 4;
+    uint32_t _Seed = 42;
+    uint32_t _Workers = 0;
+    bool _Wavefront = false;
+    uint32_t _PacketSize = 4;
+    bool _Prepared = false;
+    std::string _Output = "rayTracingBenchmark.json";
+};
+
+/**
+ * Read a memory field of /proc/self/status
+ * @param key The field, e.g. "VmRSS:"
+ * @return The field in bytes, 0 if unknown on this platform
+*/
+uint64_t readMemoryStatus(const std::string& key){
+    #if defined(__linux__)
+    std::ifstream status("/proc/self/status");
+    std::string line;
+    while(std::getline(status, line)){
+        if(line.compare(0, key.size(), key) == 0){
+            return std::stoull(line.substr(key.size())) * 1024;
+        }
+    }
+    #endif
+    return 0;
+}
+
+/**
+ * Reset the peak resident memory of the process to its current resident memory
+ * @return false if the platform does not allow it, the peak is then the one of the whole process
+*/
+bool resetPeakMemory(){
+    #if defined(__linux__)
+    std::ofstream clearRefs("/proc/self/clear_refs");
+    clearRefs << "5";
+    clearRefs.flush();
+    return static_cast<bool>(clearRefs);
+    #else
+    return false;
+    #endif
+}
+
+/**
+ * Getter for the peak resident memory of the process, since the last reset
+ * @return The peak in bytes, 0 if unknown on this platform
+*/
+uint64_t getPeakMemory(){
+    #if defined(__linux__)
+    return readMemoryStatus("VmHWM:");
+    #elif defined(__APPLE__)
+    rusage usage{};
+    getrusage(RUSAGE_SELF, &usage);
+    return static_cast<uint64_t>(usage.ru_maxrss);
+    #elif defined(__unix__)
+    rusage usage{};
+    getrusage(RUSAGE_SELF, &usage);
+    return static_cast<uint64_t>(usage.ru_maxrss) * 1024;
+    #else
+    return 0;
+    #endif
+}
+
+BenchmarkOptions parseOptions(int argc, char** argv){
+    BenchmarkOptions options{};
+    for(int i = 1; i+1 < argc; i+=2){
+        std::string key = argv[i];
+        std::string value = argv[i+1];
+        if(key == "--model"){
+            options._Model = value;
+        } else if(key == "--method"){
+            options._Method = value;
+        } else if(key == "--brdf"){
+            options._BRDF = value;
+        } else if(key == "--resolution"){
+            options._Resolution = static_cast<uint32_t>(std::stoul(value));
+        } else if(key == "--spp"){
+            options._SamplesPerPixels = static_cast<uint32_t>(std::stoul(value));
+        } else if(key == "--seed"){
+            options._Seed = static_cast<uint32_t>(std::stoul(value));
+        } else if(key == "--workers"){
+            options._Workers = static_cast<uint32_t>(std::stoul(value));
+        } else if(key == "--wavefront"){
+            options._Wavefront = std::stoul(value) != 0;
+        } else if(key == "--packet"){
+            options._PacketSize = static_cast<uint32_t>(std::stoul(value));
+        } else if(key == "--prepared"){
+            options._Prepared = std::stoul(value) != 0;
+        } else if(key == "--output"){
+            options._Output = value;
+        } else {
+            be::ErrorHandler::handle(
+                __FILE__, __LINE__,
+                be::ErrorCode::BAD_VALUE_ERROR,
+                "Unknown benchmark option `" + key + "'!\n"
+            );
+        }
+    }
+    return options;
+}
+
+/**
+ * Build the fixed setup of a model: the model normalized in a unit box at the origin,
+ * lit by a key point light, a fill point light and a directional light
+ * @param model The model to load
+ * @return The scene, living only on the cpu
+*/
+be::ScenePtr createScene(const BenchmarkModel& model){
+    be::VertexDataBuilder builder{};
+    builder.loadOffModel(std::string(ENGINE_DIRECTORY_PATH) + "/resources/models/" + model._File);
+
+    // fit the model in a unit box
+    be::Vector3 minPos{std::numeric_limits<float>::max()};
+    be::Vector3 maxPos{std::numeric_limits<float>::lowest()};
+    for(const auto& vertex : builder._Vertices){
+        minPos = {
+            std::min(minPos.x(), vertex._Pos.x()),
+            std::min(minPos.y(), vertex._Pos.y()),
+            std::min(minPos.z(), vertex._Pos.z())
+        };
+        maxPos = {
+            std::max(maxPos.x(), vertex._Pos.x()),
+            std::max(maxPos.y(), vertex._Pos.y()),
+            std::max(maxPos.z(), vertex._Pos.z())
+        };
+    }
+    be::Vector3 extent = maxPos - minPos;
+    float scale = 1.f / std::max(std::max(extent.x(), extent.y()), std::max(extent.z(), 1e-6f));
+
+    be::TransformPtr transform = be::TransformPtr(new be::Transform());
+    transform->_Scale = be::Vector3(scale, scale, scale);
+    transform->_Position = -scale * (minPos + 0.5f * extent);
+
+    be::ScenePtr scene = be::ScenePtr(new be::Scene());
+    be::GameObject object = be::RenderSystem::createRenderableObject(
+        {},
+        be::ComponentModel::create(nullptr, be::MeshPtr(new be::Mesh(std::move(builder)))),
+        {._Transform = transform},
+        {},
+        {}
+    );
+    scene->addGameObject(object);
+    scene->addGamePointLight({1.5f, 1.5f, 1.5f}, be::Color::WHITE, 2.f);
+    scene->addGamePointLight({-1.5f, 0.5f, 1.f}, be::Color::WHITE, 0.5f);
+    scene->addGameDirectionalLight({0.f, -1.f, -1.f}, be::Color::WHITE, 0.5f);
+    return scene;
+}
+
+bool isSelected(const std::string& filter, const std::string& name){
+    return filter.empty() || filter == name;
+}
+
+}
+
+int main(int argc, char** argv){
+    BenchmarkOptions options = parseOptions(argc, argv);
+    be::Components::registerComponents();
+
+    std::vector<uint32_t> resolutions = RESOLUTIONS;
+    if(options._Resolution != 0){
+        resolutions = {options._Resolution};
+    }
+
+    std::ofstream out(options._Output.c_str());
+    if(!out){
+        be::ErrorHandler::handle(
+            __FILE__, __LINE__,
+            be::ErrorCode::IO_ERROR,
+            "Cannot open the file `" + options._Output + "', to store the benchmark!\n"
+        );
+    }
+
+    out << "[";
+    bool first = true;
+    for(const auto& model : MODELS){
+        if(!isSelected(options._Model, model._Name)){
+            continue;
+        }
+        be::ScenePtr scene = createScene(model);
+        be::PreparedScenePtr preparedScene = nullptr;
+        if(options._Prepared){
+            std::string fileName = model._Name + ".beps";
+            be::PreparedScene::save(scene, fileName);
+            preparedScene = std::make_shared<be::PreparedScene>(fileName);
+            scene = preparedScene->createScene();
+        }
+
+        for(uint32_t resolution : resolutions){
+            be::FrameInfo frame{};
+            frame._CommandBuffer = VK_NULL_HANDLE;
+            frame._Camera = be::CameraPtr(new be::Camera(
+                {0.f, 0.f, 2.f},
+                static_cast<float>(resolution),
+                static_cast<float>(resolution)
+            ));
+
+            for(const auto& [methodName, method] : METHODS){
+                if(!isSelected(options._Method, methodName)){
+                    continue;
+                }
+                for(const auto& [brdfName, brdf] : BRDFS){
+                    if(!isSelected(options._BRDF, brdfName)){
+                        continue;
+                    }
+
+                    be::RayTracer rayTracer{scene, resolution, resolution};
+                    rayTracer.setBoundingVolumeMethod(method);
+                    rayTracer.setBRDF(brdf);
+                    rayTracer._SamplesPerPixels = options._SamplesPerPixels;
+                    rayTracer._MaxBounces = 0;
+                    rayTracer._NbWorkerProcesses = options._Workers;
+                    rayTracer._UseWavefront = options._Wavefront;
+                    rayTracer._PacketSize = options._PacketSize;
+                    rayTracer.setPreparedScene(preparedScene);
+
+                    rayTracer._Seed = options._Seed;
+
+                    // the peak of this configuration only, the earlier ones are freed by now
+                    uint64_t residentMemory = readMemoryStatus("VmRSS:");
+                    bool isPeakPerConfig = resetPeakMemory();
+                    rayTracer.run(frame, be::Color::BLACK);
+                    uint64_t peakMemory = getPeakMemory();
+
+                    const be::RayTracingStats& stats = rayTracer.getStats();
+                    double renderSeconds = stats._RenderTime / 1000.;
+                    double mrays = renderSeconds > 0.
+                        ? static_cast<double>(stats._Counters._TracedRays) / renderSeconds / 1e6
+                        : 0.;
+
+                    out << (first ? "\n" : ",\n")
+                        << "{\n"
+                        << "\"model\": \"" << model._Name << "\",\n"
+                        << "\"method\": \"" << methodName << "\",\n"
+                        << "\"brdf\": \"" << brdfName << "\",\n"
+                        << "\"width\": " << resolution << ",\n"
+                        << "\"height\": " << resolution << ",\n"
+                        << "\"samplesPerPixels\": " << options._SamplesPerPixels << ",\n"
+                        << "\"seed\": " << options._Seed << ",\n"
+                        << "\"workers\": " << options._Workers << ",\n"
+                        << "\"wavefront\": " << (options._Wavefront ? "true" : "false") << ",\n"
+                        << "\"packetSize\": " << options._PacketSize << ",\n"
+                        << "\"prepared\": " << (options._Prepared ? "true" : "false") << ",\n"
+                        << "\"mraysPerSecond\": " << mrays << ",\n"
+                        << "\"buildTimeMs\": " << stats._AccelerationStructuresTime << ",\n"
+                        << "\"renderTimeMs\": " << stats._RenderTime << ",\n"
+                        << "\"residentMemoryBytes\": " << residentMemory << ",\n"
+                        << "\"peakMemoryBytes\": " << peakMemory << ",\n"
+                        << "\"peakMemoryPerConfig\": " << (isPeakPerConfig ? "true" : "false") << ",\n"
+                        << "\"stats\": " << stats.toJSON()
+                        << "}";
+                    out.flush();
+                    first = false;
+                }
+            }
+        }
+    }
+    out << "\n]\n";
+    out.close();
+    return EXIT_SUCCESS;
+}
@@ -1,3 +1,4 @@
 #pragma once
 
-#include "be_errorHandler.hpp" // IWYU pragma: keep
\ No newline at end of file
+#include "be_errorHandler.hpp" // IWYU pragma: keep
+#include "be_rayTracingStats.hpp" // IWYU pragma: keep
\ No newline at end of file
@@ -0,0 +1,112 @@
+#include "be_rayTracingStats.hpp"
+#include "be_errorHandler.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <sstream>
+
+namespace be{
+
+void RayTracingCounters::merge(const RayTracingCounters& counters){
+    _PrimaryRays += counters._PrimaryRays;
+    _ShadowRays += counters._ShadowRays;
+    _BounceRays += counters._BounceRays;
+    _LightPathRays += counters._LightPathRays;
+    _TracedRays += counters._TracedRays;
+    _Hits += counters._Hits;
+    _NodeVisits += counters._NodeVisits;
+    _TriangleTests += counters._TriangleTests;
+    _PrimitiveTests += counters._PrimitiveTests;
+    _LightCuts += counters._LightCuts;
+    _LightCutClusters += counters._LightCutClusters;
+    _MaxLightCutSize = std::max(_MaxLightCutSize, counters._MaxLightCutSize);
+}
+
+RayTracingCounterRegistry::RayTracingCounterRegistry() : _ID([]{
+    static std::atomic<uint64_t> nextID{1};
+    return nextID.fetch_add(1, std::memory_order_relaxed);
+}()){
+}
+
+RayTracingCounters* RayTracingCounterRegistry::registerThread(){
+    // only once per thread and registry, unless the thread alternates between registries
+    std::lock_guard<std::mutex> lock(_ThreadCountersMutex);
+    std::unique_ptr<ThreadCounters>& threadCounters = _ThreadCounters[std::this_thread::get_id()];
+    if(threadCounters == nullptr){
+        threadCounters = std::make_unique<ThreadCounters>();
+    }
+    return &threadCounters->_Counters;
+}
+
+void RayTracingCounterRegistry::reset(){
+    std::lock_guard<std::mutex> lock(_ThreadCountersMutex);
+    for(auto& [id, threadCounters] : _ThreadCounters){
+        threadCounters->_Counters = {};
+    }
+}
+
+RayTracingCounters RayTracingCounterRegistry::merge(){
+    std::lock_guard<std::mutex> lock(_ThreadCountersMutex);
+    RayTracingCounters counters{};
+    for(const auto& [id, threadCounters] : _ThreadCounters){
+        counters.merge(threadCounters->_Counters);
+    }
+    return counters;
+}
+
+std::string RayTracingStats::toJSON() const {
+    auto ratio = [](uint64_t num, uint64_t den){
+        return den == 0 ? 0. : static_cast<double>(num) / static_cast<double>(den);
+    };
+    std::ostringstream out;
+    out << "{\n"
+        << "    \"rays\": {\n"
+        << "        \"primary\": " << _Counters._PrimaryRays << ",\n"
+        << "        \"shadow\": " << _Counters._ShadowRays << ",\n"
+        << "        \"bounce\": " << _Counters._BounceRays << ",\n"
+        << "        \"lightPath\": " << _Counters._LightPathRays << ",\n"
+        << "        \"traced\": " << _Counters._TracedRays << "\n"
+        << "    },\n"
+        << "    \"traversal\": {\n"
+        << "        \"nodeVisits\": " << _Counters._NodeVisits << ",\n"
+        << "        \"triangleTests\": " << _Counters._TriangleTests << ",\n"
+        << "        \"primitiveTests\": " << _Counters._PrimitiveTests << ",\n"
+        << "        \"hits\": " << _Counters._Hits << ",\n"
+        << "        \"nodeVisitsPerRay\": " << ratio(_Counters._NodeVisits, _Counters._TracedRays) << ",\n"
+        << "        \"triangleTestsPerRay\": " << ratio(_Counters._TriangleTests, _Counters._TracedRays) << ",\n"
+        << "        \"primitiveTestsPerRay\": " << ratio(_Counters._PrimitiveTests, _Counters._TracedRays) << ",\n"
+        << "        \"hitsPerRay\": " << ratio(_Counters._Hits, _Counters._TracedRays) << "\n"
+        << "    },\n"
+        << "    \"lightcuts\": {\n"
+        << "        \"cuts\": " << _Counters._LightCuts << ",\n"
+        << "        \"clusters\": " << _Counters._LightCutClusters << ",\n"
+        << "        \"averageCutSize\": " << ratio(_Counters._LightCutClusters, _Counters._LightCuts) << ",\n"
+        << "        \"maxCutSize\": " << _Counters._MaxLightCutSize << "\n"
+        << "    },\n"
+        << "    \"timingsMs\": {\n"
+        << "        \"sceneFlattening\": " << _SceneFlatteningTime << ",\n"
+        << "        \"accelerationStructures\": " << _AccelerationStructuresTime << ",\n"
+        << "        \"lightTree\": " << _LightTreeTime << ",\n"
+        << "        \"render\": " << _RenderTime << ",\n"
+        << "        \"denoise\": " << _DenoiseTime << ",\n"
+        << "        \"total\": " << _TotalTime << "\n"
+        << "    }\n"
+        << "}\n";
+    return out.str();
+}
+
+void RayTracingStats::saveJSON(const std::string& fileName) const {
+    std::ofstream out(fileName.c_str());
+    if (!out){
+        ErrorHandler::handle(
+            __FILE__, __LINE__,
+            ErrorCode::IO_ERROR,
+            "Cannot open the file `" + fileName + "', to store the statistics!\n"
+        );
+    }
+    out << toJSON();
+    out.close();
+}
+
+}
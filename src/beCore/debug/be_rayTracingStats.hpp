@@ -0,0 +1,148 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace be{
+
+/**
+ * The counters of a ray tracing run
+*/
+struct RayTracingCounters{
+    uint64_t _PrimaryRays = 0;
+    uint64_t _ShadowRays = 0;
+    uint64_t _BounceRays = 0;
+    uint64_t _LightPathRays = 0;
+
+    /**
+     * The number of rays traced through the acceleration structures
+    */
+    uint64_t _TracedRays = 0;
+    uint64_t _Hits = 0;
+    uint64_t _NodeVisits = 0;
+    uint64_t _TriangleTests = 0;
+    uint64_t _PrimitiveTests = 0; // analytic primitives
+
+    uint64_t _LightCuts = 0;
+    uint64_t _LightCutClusters = 0;
+    uint64_t _MaxLightCutSize = 0;
+
+    /**
+     * Accumulate the counters of another thread
+     * @param counters The counters to add
+    */
+    void merge(const RayTracingCounters& counters);
+
+    /**
+     * Record the size of a finished lightcut
+     * @param size The number of clusters in the cut
+    */
+    void addLightCut(uint64_t size){
+        _LightCuts++;
+        _LightCutClusters += size;
+        _MaxLightCutSize = size > _MaxLightCutSize ? size : _MaxLightCutSize;
+    }
+};
+
+/**
+ * The counters of every thread taking part in a ray tracing run
+ * @note Counters are written lock free in a slot owned by each thread, and merged at the end of the run
+*/
+class RayTracingCounterRegistry{
+    private:
+        struct alignas(64) ThreadCounters{
+            RayTracingCounters _Counters{};
+        };
+
+        /**
+         * The counters of every thread that ever counted something in this registry
+        */
+        std::unordered_map<std::thread::id, std::unique_ptr<ThreadCounters>> _ThreadCounters{};
+        std::mutex _ThreadCountersMutex{};
+
+        /**
+         * Unique among the registries of the process, so that a thread never reuses the slot of a dead registry
+        */
+        const uint64_t _ID;
+
+    public:
+        RayTracingCounterRegistry();
+
+        RayTracingCounterRegistry(const RayTracingCounterRegistry&) = delete;
+        RayTracingCounterRegistry& operator=(const RayTracingCounterRegistry&) = delete;
+
+    public:
+        /**
+         * Getter for the counters of the calling thread
+         * @return The counters, only ever written by the calling thread
+         * @note Fetch them once per traversal or per tile and pass them down, rather than on every node
+        */
+        RayTracingCounters& getThreadCounters(){
+            struct Cache{
+                uint64_t _RegistryID = 0;
+                RayTracingCounters* _Counters = nullptr;
+            };
+            thread_local Cache cache{};
+            if(cache._RegistryID != _ID){
+                cache = {_ID, registerThread()};
+            }
+            return *cache._Counters;
+        }
+
+        /**
+         * Reset the counters of every thread
+         * @note Must not be called while other threads are counting
+        */
+        void reset();
+
+        /**
+         * Merge the counters of every thread
+         * @return The sum of the counters
+         * @note Must not be called while other threads are counting
+        */
+        RayTracingCounters merge();
+
+    private:
+        RayTracingCounters* registerThread();
+};
+
+using RayTracingCounterRegistryPtr = std::shared_ptr<RayTracingCounterRegistry>;
+
+/**
+ * The statistics of a ray tracing run
+*/
+class RayTracingStats{
+    public:
+        /**
+         * The merged counters
+        */
+        RayTracingCounters _Counters{};
+
+        // timings of the phases, in milliseconds
+        double _SceneFlatteningTime = 0.;
+        double _AccelerationStructuresTime = 0.;
+        double _LightTreeTime = 0.;
+        double _RenderTime = 0.;
+        double _DenoiseTime = 0.;
+        double _TotalTime = 0.;
+
+    public:
+        /**
+         * Convert the statistics into a json object
+         * @return A std::string
+        */
+        std::string toJSON() const;
+
+        /**
+         * Write the statistics as json
+         * @param fileName The path of the file
+        */
+        void saveJSON(const std::string& fileName) const;
+};
+
+}
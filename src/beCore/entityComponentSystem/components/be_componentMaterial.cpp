@@ -92,10 +92,9 @@ void ComponentMaterial::add(GameObject object, MaterialPtr material){
 
 void ComponentMaterial::add(GameObject object, GameObject objectWithMaterialToCopy){
     auto objectMaterial = be::GameCoordinator::getComponent<be::ComponentMaterial>(objectWithMaterialToCopy);
-    GameCoordinator::addComponent(
-        object, 
-        ComponentMaterial::create(objectMaterial.getId(), objectMaterial._Material)
-    );
+    ComponentMaterial newComponent = ComponentMaterial::create(objectMaterial.getId(), objectMaterial._Material);
+    newComponent._Textures = objectMaterial._Textures;
+    GameCoordinator::addComponent(object, newComponent);
 }
 
 
@@ -13,6 +13,7 @@ namespace be{
 struct ComponentMaterial{
     MaterialPtr _Material = MaterialPtr(new Material());
     uint32_t _MaterialId = 0;
+    MaterialTextures _Textures{}; // ray tracer only
 
     private:
         static uint32_t _NbMaterialCreated;
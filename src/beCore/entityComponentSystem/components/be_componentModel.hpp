@@ -24,6 +24,15 @@ struct ComponentModel{
         return {._Model = ModelPtr(new Model(vulkanApp, filePath))};
     }
 
+    /**
+     * Create the component from a cpu mesh
+     * @param vulkanApp The vulkan application, null to only ray trace the object
+     * @param mesh The mesh, the gpu buffers are created when the model is first drawn
+    */
+    static ComponentModel create(VulkanAppPtr vulkanApp, MeshPtr mesh){
+        return {._Model = ModelPtr(new Model(vulkanApp, mesh))};
+    }
+
     static void add(GameObject object, VulkanAppPtr vulkanApp, const VertexDataBuilder& dataBuilder){
         GameCoordinator::addComponent(
             object, 
@@ -37,6 +46,13 @@ struct ComponentModel{
             create(vulkanApp, filePath)
         );
     }
+
+    static void add(GameObject object, VulkanAppPtr vulkanApp, MeshPtr mesh){
+        GameCoordinator::addComponent(
+            object, 
+            create(vulkanApp, mesh)
+        );
+    }
 };
 
 };
\ No newline at end of file
@@ -1,6 +1,11 @@
 #include "be_boundingVolume.hpp"
 #include <cassert>
 #include "be_matrix3x3.hpp"
+#include "be_physicsConstants.hpp"
+#include "be_rayTracingStats.hpp"
+#include "be_trigonometry.hpp"
+#include <algorithm>
+#include <numeric>
 
 namespace be{
 
@@ -143,6 +148,46 @@ float AxisAlignedBoundingBox::getDistance(AxisAlignedBoundingBox::Axis axis) con
     return -1.f;
 }
 
+BoundingCone BoundingCone::merge(const BoundingCone& bc1, const BoundingCone& bc2){
+    if(!bc1.isOriented() || !bc2.isOriented()){
+        return {};
+    }
+    Vector3 tip = (bc1._Tip + bc2._Tip) / 2.f;
+    // the widest cone is a
+    const BoundingCone& a = bc1.getHalfAngle() >= bc2.getHalfAngle() ? bc1 : bc2;
+    const BoundingCone& b = bc1.getHalfAngle() >= bc2.getHalfAngle() ? bc2 : bc1;
+    Vector3 axisA = Vector3::normalize(a._Axis);
+    Vector3 axisB = Vector3::normalize(b._Axis);
+
+    // angle between the two axis
+    float cosAxis = std::clamp(Vector3::dot(axisA, axisB), -1.f, 1.f);
+    float thetaD = std::acos(cosAxis);
+    float thetaA = a.getHalfAngle();
+    float thetaB = b.getHalfAngle();
+
+    // b is already inside a
+    if(std::min(thetaD + thetaB, static_cast<float>(PI)) <= thetaA){
+        return BoundingCone(tip, axisA, a._AngularSpan);
+    }
+
+    // the merged cone covers every directions
+    float thetaO = (thetaA + thetaD + thetaB) / 2.f;
+    if(thetaO >= PI){
+        return BoundingCone(tip, axisA, 2.f*PI);
+    }
+
+    // rotate the axis of a toward the axis of b
+    float thetaR = thetaO - thetaA;
+    Vector3 ortho = axisB - cosAxis*axisA;
+    if(ortho.getSquaredNorm() < EPSILON){
+        // opposite axis, any orthogonal direction works
+        ortho = std::fabs(axisA.x()) < 0.9f ? Vector3::cross(axisA, {1.f, 0.f, 0.f}) : Vector3::cross(axisA, {0.f, 1.f, 0.f});
+    }
+    ortho.normalize();
+    Vector3 axis = std::cos(thetaR)*axisA + std::sin(thetaR)*ortho;
+    return BoundingCone(tip, Vector3::normalize(axis), 2.f*thetaO);
+}
+
 BoundingSphere::BoundingSphere(const AxisAlignedBoundingBox& aabb){
     _Center = aabb.getCenter();
     auto dominantAxis = aabb.getDominantAxis();
@@ -216,19 +261,24 @@ BSH::BSH(const std::vector<Triangle>& triangles): _Triangles(triangles){
     _Tree = BSHTree::init(triangles);
 }
 
-void BSH::BSHNode::getIntersections(const std::vector<Triangle>& triangles, const RayPtr& ray, const Vector3& cameraPos, RayHits& hits) const{
-    if(ray->raySphereIntersection(_Sphere->_Center, _Sphere->_Radius)){
+void BSH::BSHNode::getIntersections(const std::vector<Triangle>& triangles, Ray& ray, RayHitOpt& closestHit,
+        RayTracingCounters& counters) const{
+    counters._NodeVisits++;
+    if(ray.raySphereIntersection(_Sphere->_Center, _Sphere->_Radius)){
         if(isLeaf()){
+            counters._TriangleTests += _TriangleIndices.size();
             for(uint32_t triangleIndex : _TriangleIndices){
                 auto& triangle = triangles[triangleIndex];
-                RayHitOpt hit = ray->rayTriangleIntersection(triangle);
+                RayHitOpt hit = ray.rayTriangleIntersection(triangle, triangleIndex);
                 if(hit.has_value()){
-                    hits.addHit(hit.value());
+                    // farther triangles and nodes are culled from now on
+                    ray._TMax = hit->getParametricT();
+                    closestHit = hit;
                 }
             }
         } else {
-            _LeftChild->getIntersections(triangles, ray, cameraPos, hits);
-            _RightChild->getIntersections(triangles, ray, cameraPos, hits);
+            _LeftChild->getIntersections(triangles, ray, closestHit, counters);
+            _RightChild->getIntersections(triangles, ray, closestHit, counters);
         }
     }
 }
@@ -296,19 +346,24 @@ BVH::BVH(const std::vector<Triangle>& triangles): _Triangles(triangles){
     _Tree = BVHTree::init(triangles);
 }
 
-void BVH::BVHNode::getIntersections(const std::vector<Triangle>& triangles, const RayPtr& ray, const Vector3& cameraPos, RayHits& hits) const{
-    if(ray->rayBoxIntersection(_AABB->_MinX, _AABB->_MaxX, _AABB->_MinY, _AABB->_MaxY, _AABB->_MinZ, _AABB->_MaxZ)){
+void BVH::BVHNode::getIntersections(const std::vector<Triangle>& triangles, Ray& ray, RayHitOpt& closestHit,
+        RayTracingCounters& counters) const{
+    counters._NodeVisits++;
+    if(ray.rayBoxIntersection(_AABB->_MinX, _AABB->_MaxX, _AABB->_MinY, _AABB->_MaxY, _AABB->_MinZ, _AABB->_MaxZ)){
         if(isLeaf()){
+            counters._TriangleTests += _TriangleIndices.size();
             for(uint32_t triangleIndex : _TriangleIndices){
                 auto& triangle = triangles[triangleIndex];
-                RayHitOpt hit = ray->rayTriangleIntersection(triangle);
+                RayHitOpt hit = ray.rayTriangleIntersection(triangle, triangleIndex);
                 if(hit.has_value()){
-                    hits.addHit(hit.value());
+                    // farther triangles and nodes are culled from now on
+                    ray._TMax = hit->getParametricT();
+                    closestHit = hit;
                 }
             }
         } else {
-            _LeftChild->getIntersections(triangles, ray, cameraPos, hits);
-            _RightChild->getIntersections(triangles, ray, cameraPos, hits);
+            _LeftChild->getIntersections(triangles, ray, closestHit, counters);
+            _RightChild->getIntersections(triangles, ray, closestHit, counters);
         }
     }
 }
@@ -363,6 +418,78 @@ AxisAlignedBoundingBox AxisAlignedBoundingBox::rotate(float angle) const{
     return AxisAlignedBoundingBox(minX, maxX, minY, maxY, minZ, maxZ);
 }
 
+AxisAlignedBoundingBox AxisAlignedBoundingBox::transform(const Matrix4x4& model) const{
+    Vector3 minPos{INFINITY};
+    Vector3 maxPos{-INFINITY};
+    for(uint32_t corner = 0; corner<8; corner++){
+        Vector4 objectCorner{
+            (corner & 1) ? _MaxX : _MinX,
+            (corner & 2) ? _MaxY : _MinY,
+            (corner & 4) ? _MaxZ : _MinZ,
+            1.f
+        };
+        Vector3 transformedCorner = (model * objectCorner).xyz();
+        for(int k=0; k<3; k++){
+            minPos[k] = std::min(minPos[k], transformedCorner[k]);
+            maxPos[k] = std::max(maxPos[k], transformedCorner[k]);
+        }
+    }
+    return AxisAlignedBoundingBox(minPos.x(), maxPos.x(), minPos.y(), maxPos.y(), minPos.z(), maxPos.z());
+}
+
+AxisAlignedBoundingBox::AxisAlignedBoundingBox(const AnalyticPrimitive& primitive){
+    Vector3 minPos{};
+    Vector3 maxPos{};
+    primitive.getBounds(minPos, maxPos);
+    _MinX = minPos.x();
+    _MaxX = maxPos.x();
+    _MinY = minPos.y();
+    _MaxY = maxPos.y();
+    _MinZ = minPos.z();
+    _MaxZ = maxPos.z();
+}
+
+void BoxHierarchy::build(const std::vector<AxisAlignedBoundingBox>& bounds, uint32_t maxLeafSize,
+        std::vector<Node>& nodes, std::vector<uint32_t>& order){
+    order.resize(bounds.size());
+    std::iota(order.begin(), order.end(), 0);
+    if(bounds.empty()){
+        return;
+    }
+    addNode(bounds, maxLeafSize, nodes, order, 0, order.size());
+}
+
+uint32_t BoxHierarchy::addNode(const std::vector<AxisAlignedBoundingBox>& bounds, uint32_t maxLeafSize,
+        std::vector<Node>& nodes, std::vector<uint32_t>& order, uint32_t begin, uint32_t end){
+    uint32_t nodeIndex = nodes.size();
+    nodes.push_back({});
+
+    AxisAlignedBoundingBox nodeBounds = bounds[order[begin]];
+    for(uint32_t i = begin+1; i<end; i++){
+        nodeBounds = AxisAlignedBoundingBox::merge(nodeBounds, bounds[order[i]]);
+    }
+    nodes[nodeIndex]._Bounds = nodeBounds;
+
+    if(end - begin <= maxLeafSize){
+        nodes[nodeIndex]._First = begin;
+        nodes[nodeIndex]._Count = end - begin;
+        return nodeIndex;
+    }
+
+    int axis = static_cast<int>(nodeBounds.getDominantAxis());
+    uint32_t middle = begin + (end - begin) / 2;
+    std::nth_element(order.begin() + begin, order.begin() + middle, order.begin() + end,
+        [&bounds, axis](uint32_t i1, uint32_t i2){
+            return bounds[i1].getCenter()[axis] < bounds[i2].getCenter()[axis];
+        }
+    );
+
+    addNode(bounds, maxLeafSize, nodes, order, begin, middle);
+    uint32_t rightChild = addNode(bounds, maxLeafSize, nodes, order, middle, end);
+    nodes[nodeIndex]._RightChild = rightChild;
+    return nodeIndex;
+}
+
 
 }
 
@@ -2,8 +2,16 @@
 
 #include "be_model.hpp"
 #include "be_ray.hpp"
+#include "be_rayPacket.hpp"
+#include "be_rayTracingStats.hpp"
 #include "be_vector3.hpp"
 
+#include <array>
+#include <bit>
+#include <span>
+#include <type_traits>
+#include <vector>
+
 
 namespace be{
 
@@ -112,22 +120,37 @@ class BoundingCone : public Bounding{
         */
         BoundingCone(){};
 
+        /**
+         * A basic constructor
+         * @param tip The tip of the cone
+         * @param axis The axis of the cone
+         * @param angularSpan The angle of the cone opening
+        */
+        BoundingCone(const Vector3& tip, const Vector3& axis, float angularSpan)
+            :_Tip(tip), _Axis(axis), _AngularSpan(angularSpan){
+        };
+
         /**
          * A getter for the half of the cone
          * @return Half of the angular span
         */
         float getHalfAngle() const{return _AngularSpan / 2.f;}
 
+        /**
+         * Tells if the cone bounds a set of directions
+         * @return False for empty cones, i.e. for non oriented lights
+        */
+        bool isOriented() const{return !_Axis.isZero();}
+
         /**
          * Merge two bounding cones
          * @param bc1 The first bounding cone
          * @param bc2 The second bounding cone
-         * @return The merged bounding cone
-        // TODO:
+         * @return The smallest cone containing the directions of both cones
+         * @note Merging with a non oriented cone gives a non oriented cone
+         * @note The tip of the merged cone is the middle of both tips
         */
-        static BoundingCone merge(const BoundingCone& bc1, const BoundingCone& bc2){
-            return bc1._AngularSpan > bc2._AngularSpan ? bc1 : bc2;
-        }
+        static BoundingCone merge(const BoundingCone& bc1, const BoundingCone& bc2);
 };
 
 /**
@@ -199,6 +222,12 @@ class AxisAlignedBoundingBox : public Bounding{
         */
         AxisAlignedBoundingBox(const std::vector<Triangle>& triangles);
 
+        /**
+         * A basic constructor
+         * @param primitive The analytic primitive that we want to bound
+        */
+        AxisAlignedBoundingBox(const AnalyticPrimitive& primitive);
+
         /**
          * Merge two AABB
          * @param aabb1 The first AABB
@@ -248,6 +277,13 @@ class AxisAlignedBoundingBox : public Bounding{
         float getDistance(const Vector3& point) const;
         Vector3 getClosestPoint(const Vector3& point) const;
         AxisAlignedBoundingBox rotate(float angle) const;
+
+        /**
+         * Get the box of the transformed corners of the box
+         * @param model The transformation, applied to column vectors
+         * @return The box in the transformed space
+        */
+        AxisAlignedBoundingBox transform(const Matrix4x4& model) const;
 };
 
 /**
@@ -287,6 +323,62 @@ class BoundingSphere : public Bounding{
 };
 
 
+/**
+ * A hierarchy of boxes in a flat array, with a median split of their centers along the dominant axis
+ * @note The nodes are trivially copyable, the prepared scenes store them as they are
+ * @see PreparedScene
+*/
+class BoxHierarchy{
+    public:
+        static constexpr uint32_t NO_NODE = UINT32_MAX;
+        static constexpr uint32_t MAX_DEPTH = 64;
+
+        /**
+         * A node of the hierarchy, in depth first order, the root is the first node
+        */
+        struct Node{
+            AxisAlignedBoundingBox _Bounds{};
+            uint32_t _First = 0; // leaves only, index of the first primitive in the order of the leaves
+            uint32_t _Count = 0; // leaves only
+            uint32_t _RightChild = NO_NODE; // left child is always the next node
+
+            bool isLeaf() const {return _RightChild == NO_NODE;}
+        };
+
+    public:
+        /**
+         * Build a hierarchy over a set of boxes
+         * @param bounds The boxes of the primitives
+         * @param maxLeafSize The maximum number of primitives in a leaf
+         * @param nodes The nodes, appended in depth first order
+         * @param order The primitives in the order of the leaves, the leaves index this order
+         * @note The median split keeps the depth logarithmic, far below MAX_DEPTH
+        */
+        static void build(const std::vector<AxisAlignedBoundingBox>& bounds, uint32_t maxLeafSize,
+            std::vector<Node>& nodes, std::vector<uint32_t>& order
+        );
+
+        /**
+         * Get the closest intersection with the given ray
+         * @param nodes The hierarchy
+         * @param primitives The triangles or the analytic primitives, in the order of the leaves
+         * @param ray To ray to try, its _TMax is shrunk to the closest hit
+         * @param closestHit The closest hit, updated if a closer intersection is found
+         * @param counters The counters of the calling thread
+         * @note The primitive ID of a hit is the index of its primitive in that order
+        */
+        template<typename Primitive>
+        static void getIntersections(std::span<const Node> nodes, std::span<const Primitive> primitives,
+            Ray& ray, RayHitOpt& closestHit, RayTracingCounters& counters
+        );
+
+    private:
+        static uint32_t addNode(const std::vector<AxisAlignedBoundingBox>& bounds, uint32_t maxLeafSize,
+            std::vector<Node>& nodes, std::vector<uint32_t>& order, uint32_t begin, uint32_t end
+        );
+};
+
+
 /**
  * A class representing a bounding sphere hierarchy
  * @see BoundingSphere
@@ -355,13 +447,15 @@ class BSH{
                 bool isLeaf() const {return _LeftChild == nullptr && _RightChild == nullptr;}
 
                 /**
-                 * Get the list of intersections from the given ray
+                 * Get the closest intersection with the given ray
                  * @param triangles The triangles to intersect
-                 * @param ray To ray to try
-                 * @param cameraPos The camera position
-                 * @param hits The hits heap filled if an intersection is found
+                 * @param ray To ray to try, its _TMax is shrunk to the closest hit
+                 * @param closestHit The closest hit, updated if a closer intersection is found
+                 * @param counters The counters of the calling thread
                 */
-                void getIntersections(const std::vector<Triangle>& triangles, const RayPtr& ray, const Vector3& cameraPos, RayHits& hits) const;
+                void getIntersections(const std::vector<Triangle>& triangles, Ray& ray, RayHitOpt& closestHit,
+                    RayTracingCounters& counters
+                ) const;
         };
 
         class BSHTree{
@@ -372,8 +466,9 @@ class BSH{
                 BSHTree(){};
                 static BSHTreePtr init(const std::vector<Triangle>& triangles);
 
-                void getIntersections(const std::vector<Triangle>& triangles, const RayPtr& ray, const Vector3& cameraPos, RayHits& hits) const{
-                    _Root->getIntersections(triangles, ray, cameraPos, hits);
+                void getIntersections(const std::vector<Triangle>& triangles, Ray& ray, RayHitOpt& closestHit,
+                        RayTracingCounters& counters) const{
+                    _Root->getIntersections(triangles, ray, closestHit, counters);
                 }
         };
 
@@ -386,9 +481,16 @@ class BSH{
     public:
         BSH(const std::vector<Triangle>& triangles);
 
-        void getIntersections(const RayPtr& ray, const Vector3& cameraPos, RayHits& hits) const{
+        /**
+         * Get the closest intersection with the given ray
+         * @param ray To ray to try, its _TMax is shrunk to the closest hit
+         * @param closestHit The closest hit, updated if a closer intersection is found
+         * @param counters The counters of the calling thread
+         * @note The primitive ID of a hit is the index of its triangle
+        */
+        void getIntersections(Ray& ray, RayHitOpt& closestHit, RayTracingCounters& counters) const{
             if(_Triangles.empty()){return;}
-            _Tree->getIntersections(_Triangles, ray, cameraPos, hits);
+            _Tree->getIntersections(_Triangles, ray, closestHit, counters);
         }
 
 };
@@ -413,7 +515,13 @@ class BVH{
             public:
                 BVHNode(const std::vector<Triangle>& triangles, const std::vector<uint32_t>& indices, uint32_t depth = 0);
                 bool isLeaf() const {return _LeftChild == nullptr && _RightChild == nullptr;}
-                void getIntersections(const std::vector<Triangle>& triangles, const RayPtr& ray, const Vector3& cameraPos, RayHits& hits) const;
+                void getIntersections(const std::vector<Triangle>& triangles, Ray& ray, RayHitOpt& closestHit,
+                    RayTracingCounters& counters
+                ) const;
+
+                template<uint32_t N>
+                void getIntersections(const std::vector<Triangle>& triangles, RayPacket<N>& packet,
+                    std::array<RayHitOpt, N>& closestHits, uint32_t mask, RayTracingCounters& counters) const;
         };
 
         class BVHTree{
@@ -424,8 +532,9 @@ class BVH{
                 BVHTree(){};
                 static BVHTreePtr init(const std::vector<Triangle>& triangles);
 
-                void getIntersections(const std::vector<Triangle>& triangles, const RayPtr& ray, const Vector3& cameraPos, RayHits& hits) const{
-                    _Root->getIntersections(triangles, ray, cameraPos, hits);
+                void getIntersections(const std::vector<Triangle>& triangles, Ray& ray, RayHitOpt& closestHit,
+                        RayTracingCounters& counters) const{
+                    _Root->getIntersections(triangles, ray, closestHit, counters);
                 }
         };
 
@@ -438,11 +547,107 @@ class BVH{
     public:
         BVH(const std::vector<Triangle>& triangles);
 
-        void getIntersections(const RayPtr& ray, const Vector3& cameraPos, RayHits& hits) const{
+        /**
+         * Get the closest intersection with the given ray
+         * @param ray To ray to try, its _TMax is shrunk to the closest hit
+         * @param closestHit The closest hit, updated if a closer intersection is found
+         * @param counters The counters of the calling thread
+         * @note The primitive ID of a hit is the index of its triangle
+        */
+        void getIntersections(Ray& ray, RayHitOpt& closestHit, RayTracingCounters& counters) const{
             if(_Triangles.empty()){return;}
-            _Tree->getIntersections(_Triangles, ray, cameraPos, hits);
+            _Tree->getIntersections(_Triangles, ray, closestHit, counters);
+        }
+
+        /**
+         * Get the closest intersections of a packet of rays
+         * @param packet The rays, the _TMax of each lane is shrunk to its closest hit
+         * @param closestHits The closest hit of each lane, updated if a closer intersection is found
+         * @param counters The counters of the calling thread
+         * @note The lanes go on one by one below the nodes that too few of them overlap
+        */
+        template<uint32_t N>
+        void getIntersections(RayPacket<N>& packet, std::array<RayHitOpt, N>& closestHits, RayTracingCounters& counters) const{
+            if(_Triangles.empty()){return;}
+            _Tree->_Root->getIntersections<N>(_Triangles, packet, closestHits, packet._Active, counters);
         }
 
 };
 
+template<typename Primitive>
+void BoxHierarchy::getIntersections(std::span<const Node> nodes, std::span<const Primitive> primitives,
+        Ray& ray, RayHitOpt& closestHit, RayTracingCounters& counters){
+    if(nodes.empty()){
+        return;
+    }
+    std::array<uint32_t, MAX_DEPTH> stack;
+    uint32_t stackSize = 0;
+    stack[stackSize++] = 0;
+    while(stackSize > 0){
+        uint32_t nodeIndex = stack[--stackSize];
+        const Node& node = nodes[nodeIndex];
+        counters._NodeVisits++;
+        const AxisAlignedBoundingBox& bounds = node._Bounds;
+        if(!ray.rayBoxIntersection(bounds._MinX, bounds._MaxX, bounds._MinY, bounds._MaxY, bounds._MinZ, bounds._MaxZ)){
+            continue;
+        }
+        if(node.isLeaf()){
+            for(uint32_t k = node._First; k<node._First + node._Count; k++){
+                RayHitOpt hit = RayHit::NO_HIT;
+                if constexpr(std::is_same_v<Primitive, AnalyticPrimitive>){
+                    counters._PrimitiveTests++;
+                    hit = ray.rayPrimitiveIntersection(primitives[k], k);
+                } else {
+                    counters._TriangleTests++;
+                    hit = ray.rayTriangleIntersection(primitives[k], k);
+                }
+                if(hit.has_value()){
+                    ray._TMax = hit->getParametricT();
+                    closestHit = hit;
+                }
+            }
+        } else {
+            stack[stackSize++] = node._RightChild;
+            stack[stackSize++] = nodeIndex + 1;
+        }
+    }
+}
+
+template<uint32_t N>
+void BVH::BVHNode::getIntersections(const std::vector<Triangle>& triangles, RayPacket<N>& packet,
+        std::array<RayHitOpt, N>& closestHits, uint32_t mask, RayTracingCounters& counters) const{
+    counters._NodeVisits++;
+    mask = packet.intersectBox(_AABB->_MinX, _AABB->_MaxX, _AABB->_MinY, _AABB->_MaxY, _AABB->_MinZ, _AABB->_MaxZ, mask);
+    if(mask == 0){
+        return;
+    }
+
+    if(RayPacket<N>::isIncoherent(mask)){
+        for(; mask != 0; mask &= mask - 1){
+            uint32_t lane = std::countr_zero(mask);
+            getIntersections(triangles, packet._Rays[lane], closestHits[lane], counters);
+            packet.setTMax(lane, packet._Rays[lane]._TMax);
+        }
+        return;
+    }
+
+    if(isLeaf()){
+        counters._TriangleTests += _TriangleIndices.size() * std::popcount(mask);
+        for(uint32_t triangleIndex : _TriangleIndices){
+            const Triangle& triangle = triangles[triangleIndex];
+            for(uint32_t lanes = mask; lanes != 0; lanes &= lanes - 1){
+                uint32_t lane = std::countr_zero(lanes);
+                RayHitOpt hit = packet._Rays[lane].rayTriangleIntersection(triangle, triangleIndex);
+                if(hit.has_value()){
+                    packet.setTMax(lane, hit->getParametricT());
+                    closestHits[lane] = hit;
+                }
+            }
+        }
+    } else {
+        _LeftChild->getIntersections<N>(triangles, packet, closestHits, mask, counters);
+        _RightChild->getIntersections<N>(triangles, packet, closestHits, mask, counters);
+    }
+}
+
 }
\ No newline at end of file
@@ -2,8 +2,12 @@
 
 #include "be_errorHandler.hpp"
 #include "be_mathsFcts.hpp"
+#include "be_trigonometry.hpp"
 
 #include <algorithm>
+#include <functional>
+#include <numeric>
+#include <queue>
 
 namespace be{
 
@@ -85,20 +89,32 @@ std::string OrientedLight::toString() const {
         + ", position: " + _Position.toString() 
         + ", color: " + _Color.toString() 
         + ", intensity: " + std::to_string(_Intensity) 
-        + ", angle: " + std::to_string(_Intensity) 
+        + ", angle: " + std::to_string(_Angle) 
         + "}";
 }
 
 /**
  * Getter for the light bounding cone
- * @return The bounding cone
+ * @return The bounding cone of the emitted directions
  * @see BoundingCone
- // TODO:
 */
 BoundingCone OrientedLight::getBoundingCone() const {
-    return {};
+    return BoundingCone(_Position.xyz(), Vector3::normalize(_Direction.xyz()), _Angle);
 };
 
+/**
+ * Get the emission factor of the light in a given direction
+ * @param direction The normalized direction from the light
+ * @return 1 inside the light cone, or the cosine to the light direction for a cosine lobe, 0 outside
+*/
+float OrientedLight::getEmission(const Vector3& direction) const {
+    float cosAngle = Vector3::dot(Vector3::normalize(_Direction.xyz()), direction);
+    if(cosAngle < std::cos(_Angle / 2.f)){
+        return 0.f;
+    }
+    return _IsCosineLobe ? std::max(cosAngle, 0.f) : 1.f;
+}
+
 
 /**
  * Update the container given the frameIndex
@@ -231,12 +247,26 @@ bool LightCutsTree::LightNode::isLeaf() const {
 
 /**
  * Get the size metric of the node
+ * @param orientedScaling The relative scaling for oriented lights
+*/
+float LightCutsTree::LightNode::getSizeMetric(float orientedScaling) const{
+    return getSizeMetric(_TotalIntensity, _AABB, _BoundingCone, orientedScaling);
+}
+
+/**
+ * Get the size metric of a cluster
+ * @param intensity The total intensity of the cluster
+ * @param aabb The bounding box of the cluster
+ * @param cone The bounding cone of the cluster
+ * @param orientedScaling The relative scaling for oriented lights
+ * @note The scaling is only used for oriented clusters
 */
-float LightCutsTree::LightNode::getSizeMetric() const{
-    float i_c = _TotalIntensity;
-    float alpha_c = _AABB.getDiagonalLength();
-    float beta_c = _BoundingCone.getHalfAngle();
-    float c = _Type == ORIENTED_LIGHT ? RELATIVE_SCALING_ORIENTED : RELATIVE_SCALING_NOT_ORIENTED;
+float LightCutsTree::LightNode::getSizeMetric(float intensity, const AxisAlignedBoundingBox& aabb, 
+        const BoundingCone& cone, float orientedScaling){
+    float i_c = intensity;
+    float alpha_c = aabb.getDiagonalLength();
+    float beta_c = std::min(cone.getHalfAngle(), static_cast<float>(PI));
+    float c = cone.isOriented() ? orientedScaling : RELATIVE_SCALING_NOT_ORIENTED;
 
     return (i_c*i_c)*(alpha_c*alpha_c + c*c*(1-cos(beta_c))*(1-cos(beta_c)));
 }
@@ -312,38 +342,78 @@ LightCutsTree::LightNodePtr LightCutsTree::LightNode::createLeafNode(LightPtr li
 }
 
 /**
- * Merge the two best nodes, add the new node in the list and remove the old ones from the list 
+ * Merge the two best nodes until only the root is left in the list
  * @param allNodes The list of nodes
+ * @param orientedScaling The relative scaling for oriented lights
  * @note The given list will be modified
+ * @note Each node keeps its best partner in a heap instead of testing all the pairs at each merge,
+ * the metric of a pair only grows when one of its nodes is merged, so a partner is only searched again
+ * when it has been merged, see Walter et al. 2008, Fast Agglomerative Clustering for Rendering
 */
-void LightCutsTree::LightNode::mergeTwoBestNodes(std::vector<LightNodePtr>& allNodes){
-    // find two best node to merge
-    LightNodePtr leftChild = nullptr;
-    LightNodePtr rightChild = nullptr;
-    LightNodePtr newNode = nullptr;
-    float minClusterMetric = INFINITY;
-    // test all possible new cluster
-    for(auto n1 : allNodes){
-        for(auto n2 : allNodes){
-            if(n1 == n2) continue; // can't use same child
-            // get the metric
-            LightNodePtr newNodeTmp = createParent(n1, n2);
-            float curClusterMetric = newNodeTmp->getSizeMetric();
-            // keep the best one
-            if(curClusterMetric < minClusterMetric){
-                leftChild = n1;
-                rightChild = n2;
-                newNode = newNodeTmp;
-                minClusterMetric = curClusterMetric;
+void LightCutsTree::LightNode::mergeAllNodes(std::vector<LightNodePtr>& allNodes, float orientedScaling){
+    struct Candidate{
+        float _Metric = INFINITY;
+        uint32_t _Node = 0;
+        uint32_t _Partner = 0;
+        bool operator>(const Candidate& other) const {return _Metric > other._Metric;}
+    };
+    std::vector<LightNodePtr> nodes = allNodes;
+    std::vector<uint8_t> isMerged(nodes.size(), false);
+    std::vector<uint32_t> remaining(nodes.size());
+    std::iota(remaining.begin(), remaining.end(), 0);
+
+    // get the metric without building the node, the metric is symmetric
+    auto findBestPartner = [&](uint32_t node){
+        Candidate best{};
+        best._Node = node;
+        const LightNodePtr& n1 = nodes[node];
+        for(uint32_t partner : remaining){
+            if(partner == node){
+                continue;
+            }
+            const LightNodePtr& n2 = nodes[partner];
+            float metric = getSizeMetric(
+                n1->_TotalIntensity + n2->_TotalIntensity,
+                AxisAlignedBoundingBox::merge(n1->_AABB, n2->_AABB),
+                BoundingCone::merge(n1->_BoundingCone, n2->_BoundingCone),
+                orientedScaling
+            );
+            if(metric < best._Metric){
+                best._Metric = metric;
+                best._Partner = partner;
             }
         }
-    }
+        return best;
+    };
 
-    // remove two best nodes from list
-    allNodes.erase(std::find(allNodes.begin(), allNodes.end(), leftChild));
-    allNodes.erase(std::find(allNodes.begin(), allNodes.end(), rightChild));
-    // add new node to list
-    allNodes.push_back(newNode);
+    std::priority_queue<Candidate, std::vector<Candidate>, std::greater<Candidate>> candidates{};
+    if(remaining.size() > 1){
+        for(uint32_t node : remaining){
+            candidates.push(findBestPartner(node));
+        }
+    }
+    while(remaining.size() > 1){
+        Candidate best = candidates.top();
+        candidates.pop();
+        if(isMerged[best._Node]){
+            continue;
+        }
+        if(isMerged[best._Partner]){
+            candidates.push(findBestPartner(best._Node));
+            continue;
+        }
+        // merge the best pair and replace it by the new node
+        nodes.push_back(createParent(nodes[best._Node], nodes[best._Partner]));
+        isMerged.push_back(false);
+        isMerged[best._Node] = true;
+        isMerged[best._Partner] = true;
+        std::erase_if(remaining, [&isMerged](uint32_t node){return isMerged[node];});
+        remaining.push_back(static_cast<uint32_t>(nodes.size() - 1));
+        if(remaining.size() > 1){
+            candidates.push(findBestPartner(remaining.back()));
+        }
+    }
+    allNodes = {nodes[remaining[0]]};
 }
 
 /**
@@ -374,11 +444,32 @@ LightCutsTree::LightCutsTree(
         );
     }
 
-    // build the tree from bottom-up
-    while(allNodes.size() != 1){
-        LightCutsTree::LightNode::mergeTwoBestNodes(allNodes);
+    // oriented lights are scaled by the diagonal of the scene bounding box
+    AxisAlignedBoundingBox sceneAABB = allNodes[0]->_AABB;
+    for(auto& node : allNodes){
+        sceneAABB = AxisAlignedBoundingBox::merge(sceneAABB, node->_AABB);
     }
+    float orientedScaling = sceneAABB.getDiagonalLength();
+
+    // build the tree from bottom-up
+    LightCutsTree::LightNode::mergeAllNodes(allNodes, orientedScaling);
     _LightsTree = allNodes[0];
+
+    // flatten the tree for the ray tracer
+    std::unordered_map<const Light*, uint32_t> lightIndices = {};
+    for(uint32_t i=0; i<pointLights.size(); i++){
+        lightIndices[pointLights[i].get()] = i;
+    }
+    for(uint32_t i=0; i<directionalLights.size(); i++){
+        lightIndices[directionalLights[i].get()] = i;
+    }
+    for(uint32_t i=0; i<orientedLights.size(); i++){
+        lightIndices[orientedLights[i].get()] = i;
+    }
+    _FlatTree._PointLights = pointLights;
+    _FlatTree._DirectionalLights = directionalLights;
+    _FlatTree._OrientedLights = orientedLights;
+    _FlatTree.addNode(_LightsTree, lightIndices);
     
     // display the tree if in debug mode
     #ifndef NDEBUG
@@ -452,6 +543,12 @@ float LightCutsTree::LightNode::getGeometric(const Vector3& pointToShade) const{
             Vector4 lightPos = pointLight->_Position;
             return 1.f / (lightPos.xyz() - pointToShade).getSquaredNorm();
         }
+        case ORIENTED_LIGHT:{
+            OrientedLightPtr orientedLight = std::dynamic_pointer_cast<OrientedLight>(_Representative);
+            Vector3 toPoint = pointToShade - orientedLight->_Position.xyz();
+            float d2 = toPoint.getSquaredNorm();
+            return orientedLight->getEmission(Vector3::normalize(toPoint)) / d2;
+        }
         // TODO:
         default:
             return 0.f;
@@ -459,4 +556,178 @@ float LightCutsTree::LightNode::getGeometric(const Vector3& pointToShade) const{
 }
 
 
-}
\ No newline at end of file
+
+/**
+ * Append a node and its subtree
+ * @param node The node to flatten
+ * @param lightIndices The index of each light in the list matching its type
+ * @return The index of the flattened node
+*/
+uint32_t LightCutsTree::FlatTree::addNode(LightNodePtr node, const std::unordered_map<const Light*, uint32_t>& lightIndices){
+    uint32_t index = size();
+    const AxisAlignedBoundingBox& aabb = node->_AABB;
+    _MinX.push_back(aabb._MinX);
+    _MaxX.push_back(aabb._MaxX);
+    _MinY.push_back(aabb._MinY);
+    _MaxY.push_back(aabb._MaxY);
+    _MinZ.push_back(aabb._MinZ);
+    _MaxZ.push_back(aabb._MaxZ);
+    _Center.push_back(aabb.getCenter());
+    _HalfExtent.push_back(Vector3(aabb._MaxX - aabb._MinX, aabb._MaxY - aabb._MinY, aabb._MaxZ - aabb._MinZ) / 2.f);
+    _TotalIntensity.push_back(node->_TotalIntensity);
+    _TotalColor.push_back(node->_TotalColor);
+    _Type.push_back(node->_Type);
+    _Representative.push_back(lightIndices.at(node->_Representative.get()));
+    _LeftChild.push_back(NO_NODE);
+    _RightChild.push_back(NO_NODE);
+    _Parent.push_back(NO_NODE);
+    _IsLeftChildSame.push_back(node->_IsLeftChildSame);
+    const BoundingCone& cone = node->_BoundingCone;
+    float halfAngle = std::min(cone.getHalfAngle(), static_cast<float>(PI));
+    _IsOriented.push_back(cone.isOriented());
+    _ConeAxis.push_back(cone.isOriented() ? Vector3::normalize(cone._Axis) : Vector3::zeros());
+    _ConeCosHalfAngle.push_back(std::cos(halfAngle));
+    _ConeSinHalfAngle.push_back(std::sin(halfAngle));
+
+    if(!node->isLeaf()){
+        // depth first, the left child directly follows its parent
+        uint32_t left = addNode(node->_LeftChild, lightIndices);
+        uint32_t right = addNode(node->_RightChild, lightIndices);
+        _LeftChild[index] = left;
+        _RightChild[index] = right;
+        _Parent[left] = index;
+        _Parent[right] = index;
+    }
+    return index;
+}
+
+/**
+ * Get the squared distance between a point and a node's bounding box
+ * @param node The index of the node
+ * @param point The point
+ * @return The squared distance, 0 if the point is inside the box
+*/
+float LightCutsTree::FlatTree::getSquaredDistance(uint32_t node, const Vector3& point) const {
+    float dx = std::max(0.f, std::max(_MinX[node] - point.x(), point.x() - _MaxX[node]));
+    float dy = std::max(0.f, std::max(_MinY[node] - point.y(), point.y() - _MaxY[node]));
+    float dz = std::max(0.f, std::max(_MinZ[node] - point.z(), point.z() - _MaxZ[node]));
+    return dx*dx + dy*dy + dz*dz;
+}
+
+/**
+ * Get the squared distance between a box and a node's bounding box
+ * @param node The index of the node
+ * @param center The center of the box
+ * @param halfExtent The half extent of the box
+ * @return The squared distance, 0 if the boxes overlap
+*/
+float LightCutsTree::FlatTree::getSquaredDistance(uint32_t node, const Vector3& center, const Vector3& halfExtent) const {
+    const Vector3& nodeCenter = _Center[node];
+    const Vector3& nodeExtent = _HalfExtent[node];
+    float dx = std::max(0.f, std::fabs(nodeCenter.x() - center.x()) - nodeExtent.x() - halfExtent.x());
+    float dy = std::max(0.f, std::fabs(nodeCenter.y() - center.y()) - nodeExtent.y() - halfExtent.y());
+    float dz = std::max(0.f, std::fabs(nodeCenter.z() - center.z()) - nodeExtent.z() - halfExtent.z());
+    return dx*dx + dy*dy + dz*dz;
+}
+
+/**
+ * Get an upper bound of the cosine between a normal and any direction toward a node's bounding box
+ * @param node The index of the node
+ * @param point The shaded point
+ * @param tangent The first tangent of the shaded point
+ * @param bitangent The second tangent of the shaded point
+ * @param normal The normal of the shaded point
+ * @return The bound, clamped in [0,1]
+ * @note The tangent frame must be orthonormal
+ * @see https://www.cs.cornell.edu/~kb/projects/lightcuts/
+*/
+float LightCutsTree::FlatTree::getCosineBound(uint32_t node, const Vector3& point,
+        const Vector3& tangent, const Vector3& bitangent, const Vector3& normal) const {
+    return getCosineBound(node, point, Vector3::zeros(), tangent, bitangent, normal);
+}
+
+/**
+ * Get an upper bound of the cosine between a normal and any direction from a box toward a node's bounding box
+ * @param node The index of the node
+ * @param center The center of the box
+ * @param halfExtent The half extent of the box
+ * @param tangent The first tangent of the normal
+ * @param bitangent The second tangent of the normal
+ * @param normal The normal
+ * @return The bound, clamped in [0,1]
+ * @note The tangent frame must be orthonormal
+*/
+float LightCutsTree::FlatTree::getCosineBound(uint32_t node, const Vector3& center, const Vector3& halfExtent,
+        const Vector3& tangent, const Vector3& bitangent, const Vector3& normal) const {
+    // the directions between both boxes are bounded by their minkowski difference,
+    // expressed in the local frame of the normal (z along the normal)
+    Vector3 offset = _Center[node] - center;
+    Vector3 extent = _HalfExtent[node] + halfExtent;
+    float cx = Vector3::dot(offset, tangent);
+    float cy = Vector3::dot(offset, bitangent);
+    float cz = Vector3::dot(offset, normal);
+    float ex = std::fabs(tangent.x())*extent.x() + std::fabs(tangent.y())*extent.y() + std::fabs(tangent.z())*extent.z();
+    float ey = std::fabs(bitangent.x())*extent.x() + std::fabs(bitangent.y())*extent.y() + std::fabs(bitangent.z())*extent.z();
+    float ez = std::fabs(normal.x())*extent.x() + std::fabs(normal.y())*extent.y() + std::fabs(normal.z())*extent.z();
+
+    float maxZ = cz + ez;
+    if(maxZ <= 0.f){
+        return 0.f;
+    }
+    // smallest lateral distances, null if the box straddles the normal axis
+    float minX = std::max(0.f, std::fabs(cx) - ex);
+    float minY = std::max(0.f, std::fabs(cy) - ey);
+    float den = minX*minX + minY*minY + maxZ*maxZ;
+    if(Maths::isZero(den)){
+        return 1.f;
+    }
+    return std::min(1.f, maxZ / std::sqrt(den));
+}
+
+/**
+ * Get an upper bound of the emission of a node toward a point
+ * @param node The index of the node
+ * @param point The shaded point
+ * @return 0 if the point is outside the bounding cone of every light in the node, 1 otherwise
+ * @note Always 1 for non oriented nodes
+*/
+float LightCutsTree::FlatTree::getOrientationBound(uint32_t node, const Vector3& point) const {
+    return getOrientationBound(node, point, 0.f);
+}
+
+/**
+ * Get an upper bound of the emission of a node toward a sphere
+ * @param node The index of the node
+ * @param center The center of the sphere
+ * @param radius The radius of the sphere
+ * @return 0 if the sphere is outside the bounding cone of every light in the node, 1 otherwise
+ * @note Always 1 for non oriented nodes
+*/
+float LightCutsTree::FlatTree::getOrientationBound(uint32_t node, const Vector3& center, float radius) const {
+    if(!_IsOriented[node]){
+        return 1.f;
+    }
+    // the directions from the box to the sphere are in a cone of half angle asin((r+radius)/d)
+    Vector3 toPoint = center - _Center[node];
+    float d2 = toPoint.getSquaredNorm();
+    float r = _HalfExtent[node].getNorm() + radius;
+    float r2 = r*r;
+    if(d2 <= r2){
+        return 1.f;
+    }
+    float d = std::sqrt(d2);
+    float sinBox = r / d;
+    float cosBox = std::sqrt(1.f - sinBox*sinBox);
+    float cosCone = _ConeCosHalfAngle[node];
+    float sinCone = _ConeSinHalfAngle[node];
+    // both cones together cover every directions
+    if(cosCone <= 0.f && sinBox >= sinCone){
+        return 1.f;
+    }
+    // cos(coneAngle + boxAngle)
+    float cosMax = cosCone*cosBox - sinCone*sinBox;
+    float cosAngle = Vector3::dot(_ConeAxis[node], toPoint) / d;
+    return cosAngle >= cosMax ? 1.f : 0.f;
+}
+
+}
@@ -6,6 +6,7 @@
 #include "be_color.hpp"
 #include <cstdint>
 #include <set>
+#include <unordered_map>
 
 namespace be{
 
@@ -191,6 +192,18 @@ struct OrientedLight: public Light{
     */
     float _Angle = 0.f;
 
+    /**
+     * The squared distance under which the falloff is clamped
+     * @note Used by virtual point lights to avoid the 1/d^2 singularity
+    */
+    float _MinSquaredDistance = 0.f;
+
+    /**
+     * Whether the intensity falls off with the cosine to the light direction
+     * @note Used by virtual point lights, which emit like a lambertian surface
+    */
+    bool _IsCosineLobe = false;
+
     /**
      * Getter for the light intensity
      * @return The intensity as a float
@@ -218,12 +231,18 @@ struct OrientedLight: public Light{
 
     /**
      * Getter for the light bounding cone
-     * @return The bounding cone
+     * @return The bounding cone of the emitted directions
      * @see BoundingCone
-    // TODO:
     */
     virtual BoundingCone getBoundingCone() const override;
 
+    /**
+     * Get the emission factor of the light in a given direction
+     * @param direction The normalized direction from the light
+     * @return 1 inside the light cone, or the cosine to the light direction for a cosine lobe, 0 outside
+    */
+    float getEmission(const Vector3& direction) const;
+
 };
 
 
@@ -393,12 +412,6 @@ class LightCutsTree{
             */
             BoundingCone _BoundingCone = {};
 
-            /**
-             * The relative scaling for oriented lights
-             // TODO:
-            */
-            static constexpr float RELATIVE_SCALING_ORIENTED = 0.f;
-
             /**
              * The relative scaling for non oriented lights
             */
@@ -432,8 +445,20 @@ class LightCutsTree{
 
             /**
              * Get the size metric of the node
+             * @param orientedScaling The relative scaling for oriented lights
+            */
+            float getSizeMetric(float orientedScaling) const;
+
+            /**
+             * Get the size metric of a cluster
+             * @param intensity The total intensity of the cluster
+             * @param aabb The bounding box of the cluster
+             * @param cone The bounding cone of the cluster
+             * @param orientedScaling The relative scaling for oriented lights
+             * @note The scaling is only used for oriented clusters
             */
-            float getSizeMetric() const;
+            static float getSizeMetric(float intensity, const AxisAlignedBoundingBox& aabb, 
+                const BoundingCone& cone, float orientedScaling);
 
             float getVisibility() const;
             float getGeometric(const Vector3& pointToShade) const;
@@ -466,20 +491,202 @@ class LightCutsTree{
             static LightNodePtr createLeafNode(LightPtr light);
 
             /**
-             * Merge the two best nodes, add the new node in the list and remove the old ones from the list 
+             * Merge the two best nodes until only the root is left in the list
              * @param allNodes The list of nodes
+             * @param orientedScaling The relative scaling for oriented lights
              * @note The given list will be modified
+             * @see https://www.cs.cornell.edu/~kb/projects/lightcuts/
             */
-            static void mergeTwoBestNodes(std::vector<LightNodePtr>& allNodes);
+            static void mergeAllNodes(std::vector<LightNodePtr>& allNodes, float orientedScaling);
 
         };
 
+        /**
+         * A structure of arrays representing the light tree flattened in depth first order
+         * @note The left child of an inner node is always stored right after its parent
+         * @note The root is always the node 0
+        */
+        struct FlatTree{
+            /**
+             * The index used to represent a missing node
+            */
+            static const uint32_t NO_NODE = UINT32_MAX;
+
+            /**
+             * The bounds of each node
+            */
+            std::vector<float> _MinX{}, _MaxX{};
+            std::vector<float> _MinY{}, _MaxY{};
+            std::vector<float> _MinZ{}, _MaxZ{};
+
+            /**
+             * The center and half extents of each node's bounding box
+             * @note Precomputed for the cosine bound
+            */
+            std::vector<Vector3> _Center{};
+            std::vector<Vector3> _HalfExtent{};
+
+            /**
+             * The bounding cone of each node
+             * @note The cosine and sine of the half angle are precomputed
+            */
+            std::vector<uint8_t> _IsOriented{};
+            std::vector<Vector3> _ConeAxis{};
+            std::vector<float> _ConeCosHalfAngle{};
+            std::vector<float> _ConeSinHalfAngle{};
+
+            /**
+             * The total intensity of each node
+            */
+            std::vector<float> _TotalIntensity{};
+
+            /**
+             * The total color of each node
+            */
+            std::vector<Vector3> _TotalColor{};
+
+            /**
+             * The type of the representative light of each node
+            */
+            std::vector<LightType> _Type{};
+
+            /**
+             * The index of the representative light of each node in the list matching its type
+            */
+            std::vector<uint32_t> _Representative{};
+
+            /**
+             * The children of each node, NO_NODE for leaves
+            */
+            std::vector<uint32_t> _LeftChild{};
+            std::vector<uint32_t> _RightChild{};
+
+            /**
+             * The parent of each node, NO_NODE for the root
+            */
+            std::vector<uint32_t> _Parent{};
+
+            /**
+             * Tells if the left child shares the node representative
+            */
+            std::vector<uint8_t> _IsLeftChildSame{};
+
+            /**
+             * The lights referenced by the representatives
+            */
+            std::vector<PointLightPtr> _PointLights{};
+            std::vector<DirectionalLightPtr> _DirectionalLights{};
+            std::vector<OrientedLightPtr> _OrientedLights{};
+
+            /**
+             * Get the number of nodes
+             * @return The number of nodes
+            */
+            uint32_t size() const {return _TotalIntensity.size();}
+
+            /**
+             * Tells if a node is a leaf
+             * @param node The index of the node
+             * @return True if the node is a leaf
+            */
+            bool isLeaf(uint32_t node) const {return _LeftChild[node] == NO_NODE;}
+
+            /**
+             * Get the sibling of a node
+             * @param node The index of the node
+             * @return The index of the sibling, NO_NODE for the root
+            */
+            uint32_t getSibling(uint32_t node) const {
+                uint32_t parent = _Parent[node];
+                if(parent == NO_NODE){
+                    return NO_NODE;
+                }
+                return _LeftChild[parent] == node ? _RightChild[parent] : _LeftChild[parent];
+            }
+
+            /**
+             * Get the squared distance between a point and a node's bounding box
+             * @param node The index of the node
+             * @param point The point
+             * @return The squared distance, 0 if the point is inside the box
+            */
+            float getSquaredDistance(uint32_t node, const Vector3& point) const;
+
+            /**
+             * Get the squared distance between a box and a node's bounding box
+             * @param node The index of the node
+             * @param center The center of the box
+             * @param halfExtent The half extent of the box
+             * @return The squared distance, 0 if the boxes overlap
+            */
+            float getSquaredDistance(uint32_t node, const Vector3& center, const Vector3& halfExtent) const;
+
+            /**
+             * Get an upper bound of the cosine between a normal and any direction toward a node's bounding box
+             * @param node The index of the node
+             * @param point The shaded point
+             * @param tangent The first tangent of the shaded point
+             * @param bitangent The second tangent of the shaded point
+             * @param normal The normal of the shaded point
+             * @return The bound, clamped in [0,1]
+             * @note The tangent frame must be orthonormal
+            */
+            float getCosineBound(uint32_t node, const Vector3& point,
+                const Vector3& tangent, const Vector3& bitangent, const Vector3& normal) const;
+
+            /**
+             * Get an upper bound of the cosine between a normal and any direction from a box toward a node's bounding box
+             * @param node The index of the node
+             * @param center The center of the box
+             * @param halfExtent The half extent of the box
+             * @param tangent The first tangent of the normal
+             * @param bitangent The second tangent of the normal
+             * @param normal The normal
+             * @return The bound, clamped in [0,1]
+             * @note The tangent frame must be orthonormal
+            */
+            float getCosineBound(uint32_t node, const Vector3& center, const Vector3& halfExtent,
+                const Vector3& tangent, const Vector3& bitangent, const Vector3& normal) const;
+
+            /**
+             * Get an upper bound of the emission of a node toward a point
+             * @param node The index of the node
+             * @param point The shaded point
+             * @return 0 if the point is outside the bounding cone of every light in the node, 1 otherwise
+             * @note Always 1 for non oriented nodes
+            */
+            float getOrientationBound(uint32_t node, const Vector3& point) const;
+
+            /**
+             * Get an upper bound of the emission of a node toward a sphere
+             * @param node The index of the node
+             * @param center The center of the sphere
+             * @param radius The radius of the sphere
+             * @return 0 if the sphere is outside the bounding cone of every light in the node, 1 otherwise
+             * @note Always 1 for non oriented nodes
+            */
+            float getOrientationBound(uint32_t node, const Vector3& center, float radius) const;
+
+            /**
+             * Append a node and its subtree
+             * @param node The node to flatten
+             * @param lightIndices The index of each light in the list matching its type
+             * @return The index of the flattened node
+            */
+            uint32_t addNode(LightNodePtr node, const std::unordered_map<const Light*, uint32_t>& lightIndices);
+        };
+
     private:
         /**
          * The light tree
         */
         LightNodePtr _LightsTree = nullptr;
 
+        /**
+         * The flattened light tree
+        */
+        FlatTree _FlatTree{};
+
     public:
         /**
          * An empty constructor
@@ -502,6 +709,14 @@ class LightCutsTree{
             return _LightsTree;
         }
 
+        /**
+         * Getter for the flattened tree
+         * @return The tree as a structure of arrays
+        */
+        const FlatTree& getFlatTree() const {
+            return _FlatTree;
+        }
+
     private:
         /**
          * Create point light leaves
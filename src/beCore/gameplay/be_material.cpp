@@ -1,6 +1,8 @@
 #include "be_material.hpp"
 #include "be_errorHandler.hpp"
 
+#include <filesystem>
+
 namespace be{
 
 const std::array<std::string, Material::COMPONENT_MATERIAL_NB_ELEMENTS> 
@@ -265,4 +267,23 @@ std::string Material::toString() const {
             + "\n}";
 }
 
+MaterialTextures MaterialTextures::fromPBRSet(const std::string& directory){
+    if(!std::filesystem::is_directory(directory)){
+        ErrorHandler::handle(__FILE__, __LINE__,
+            ErrorCode::IO_ERROR,
+            "The material directory `" + directory + "' does not exist!\n"
+        );
+    }
+    auto getMap = [&directory](const std::string& name){
+        std::filesystem::path path = std::filesystem::path(directory) / name;
+        return std::filesystem::exists(path) ? path.string() : std::string("");
+    };
+
+    MaterialTextures textures{};
+    textures._BaseColor = getMap("Base_Color.png");
+    textures._Roughness = getMap("Roughness.png");
+    textures._Metallic = getMap("Metallic.png");
+    return textures;
+}
+
 };
\ No newline at end of file
@@ -153,6 +153,28 @@ struct Material {
         std::string toString() const;
 };
 
+/**
+ * The texture maps of a material, only sampled by the ray tracer
+ * @note Kept out of Material, which is copied as is in the uniform buffers
+ * @note An empty path keeps the constant value of the material
+*/
+struct MaterialTextures{
+    std::string _BaseColor = "";
+    std::string _Roughness = "";
+    std::string _Metallic = "";
+
+    /**
+     * Find the maps of a PBR set, e.g. a directory of resources/materials
+     * @param directory The directory of the set
+     * @return The maps of the set, Base_Color.png, Roughness.png and Metallic.png when they exist
+    */
+    static MaterialTextures fromPBRSet(const std::string& directory);
+
+    bool isEmpty() const {
+        return _BaseColor.empty() && _Roughness.empty() && _Metallic.empty();
+    }
+};
+
 struct MaterialUboData: public UboData{
     Material _Materials[MAX_NB_MATERIALS];
 };
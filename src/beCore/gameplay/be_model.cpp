@@ -2,6 +2,8 @@
 
 #include "be_buffer.hpp"
 #include "be_errorHandler.hpp"
+#include <algorithm>
+#include <cmath>
 #include <cstdint>
 #include <unordered_map>
 #include <fstream>
@@ -573,47 +575,28 @@ VertexDataBuilder VertexDataBuilder::primitiveFrame(){
     return builder;
 }
 
-const std::map<std::string, Model::ModelExtension> Model::MODEL_EXTENSIONS_MAP = {
+const std::map<std::string, Mesh::MeshExtension> Mesh::MESH_EXTENSIONS_MAP = {
     {"off", OFF},
     {"obj", OBJ},
 };
 
-void Model::bind(VkCommandBuffer commandBuffer){
-    VkBuffer buffers[] = {_VertexBuffer->getBuffer()};
-    VkDeviceSize offsets[] = {0};
-    vkCmdBindVertexBuffers(commandBuffer, 0, 1, buffers, offsets);
-    if(_HasIndexBuffer){
-        vkCmdBindIndexBuffer(commandBuffer, _IndexBuffer->getBuffer(), 0, VK_INDEX_TYPE_UINT32);
-    }
+Mesh::Mesh(const VertexDataBuilder& dataBuilder)
+    : _VertexDataBuilder(dataBuilder){
 }
 
-void Model::draw(VkCommandBuffer commandBuffer){
-    if(_HasIndexBuffer){
-        vkCmdDrawIndexed(commandBuffer, _IndexCount, 1, 0, 0, 0);
-    } else {
-        vkCmdDraw(commandBuffer, _VertexCount, 1, 0, 0);
-    }
+Mesh::Mesh(VertexDataBuilder&& dataBuilder)
+    : _VertexDataBuilder(std::move(dataBuilder)){
 }
 
-void Model::cleanUp(){
-    if(_VertexBuffer != nullptr){
-        _VertexBuffer->cleanUp();
-        _VertexBuffer = nullptr;
-    }
-    if(_IndexBuffer != nullptr){
-        _IndexBuffer->cleanUp();
-        _IndexBuffer = nullptr;
-    }
+Mesh::Mesh(std::vector<AnalyticPrimitive> primitives)
+    : _AnalyticPrimitives(std::move(primitives)){
 }
 
-Model::Model(VulkanAppPtr vulkanApp, const VertexDataBuilder& dataBuilder) 
-    : _VulkanApp(vulkanApp), _VertexDataBuilder(dataBuilder){
-    createVertexBuffer(dataBuilder._Vertices);
-    createIndexBuffer(dataBuilder._Indices);
+void Mesh::addAnalyticPrimitives(const std::vector<AnalyticPrimitive>& primitives){
+    _AnalyticPrimitives.insert(_AnalyticPrimitives.end(), primitives.begin(), primitives.end());
 }
 
-Model::Model(VulkanAppPtr vulkanApp, const std::string& filePath)
-    : _VulkanApp(vulkanApp){
+Mesh::Mesh(const std::string& filePath){
     // check extension type
     size_t dotPosition = filePath.find_last_of(".");
     std::string extension = "";
@@ -628,14 +611,14 @@ Model::Model(VulkanAppPtr vulkanApp, const std::string& filePath)
         );
     }
     
-    auto it = MODEL_EXTENSIONS_MAP.find(extension);
-    if(it == MODEL_EXTENSIONS_MAP.end()){
+    auto it = MESH_EXTENSIONS_MAP.find(extension);
+    if(it == MESH_EXTENSIONS_MAP.end()){
         ErrorHandler::handle(__FILE__, __LINE__, 
             ErrorCode::BAD_VALUE_ERROR,
             "Trying to load a model from a file with an unkown extension: " + filePath +"!\n"
         );
     }
-    ModelExtension extensionFormat = it->second; 
+    MeshExtension extensionFormat = it->second; 
     _VertexDataBuilder = {};
     switch(extensionFormat) {
         case OFF:
@@ -650,12 +633,11 @@ Model::Model(VulkanAppPtr vulkanApp, const std::string& filePath)
                 "Error creating a model from a file, this error shouldn't have occured!\n"
             );
     }
-    createVertexBuffer(_VertexDataBuilder._Vertices);
-    createIndexBuffer(_VertexDataBuilder._Indices);
 }
 
-std::vector<Triangle> Model::getTrianglePrimitives() const{
+std::vector<Triangle> Mesh::getTrianglePrimitives() const{
     std::vector<Triangle> triangles{};
+    triangles.reserve(_VertexDataBuilder._Indices.size() / 3);
     for(uint32_t i=0; i<uint32_t(_VertexDataBuilder._Indices.size()); i+=3){
         uint32_t idx0 = _VertexDataBuilder._Indices[i];
         uint32_t idx1 = _VertexDataBuilder._Indices[i+1];
@@ -683,10 +665,140 @@ std::vector<Triangle> Model::getTrianglePrimitives() const{
     return triangles;
 }
 
+void Model::upload(){
+    if(isUploaded()){
+        return;
+    }
+    if(_VulkanApp == nullptr){
+        ErrorHandler::handle(__FILE__, __LINE__, 
+            ErrorCode::BAD_VALUE_ERROR,
+            "Trying to upload a model without vulkan application!\n"
+        );
+        return;
+    }
+    createVertexBuffer(_Mesh->getVertices());
+    createIndexBuffer(_Mesh->getIndices());
+}
+
+void Model::bind(VkCommandBuffer commandBuffer){
+    upload();
+    VkBuffer buffers[] = {_VertexBuffer->getBuffer()};
+    VkDeviceSize offsets[] = {0};
+    vkCmdBindVertexBuffers(commandBuffer, 0, 1, buffers, offsets);
+    if(_HasIndexBuffer){
+        vkCmdBindIndexBuffer(commandBuffer, _IndexBuffer->getBuffer(), 0, VK_INDEX_TYPE_UINT32);
+    }
+}
+
+void Model::draw(VkCommandBuffer commandBuffer){
+    if(_HasIndexBuffer){
+        vkCmdDrawIndexed(commandBuffer, _IndexCount, 1, 0, 0, 0);
+    } else {
+        vkCmdDraw(commandBuffer, _VertexCount, 1, 0, 0);
+    }
+}
+
+void Model::cleanUp(){
+    if(_VertexBuffer != nullptr){
+        _VertexBuffer->cleanUp();
+        _VertexBuffer = nullptr;
+    }
+    if(_IndexBuffer != nullptr){
+        _IndexBuffer->cleanUp();
+        _IndexBuffer = nullptr;
+    }
+}
+
+Model::Model(VulkanAppPtr vulkanApp, MeshPtr mesh)
+    : _VulkanApp(vulkanApp), _Mesh(mesh){
+}
+
+Model::Model(VulkanAppPtr vulkanApp, const VertexDataBuilder& dataBuilder) 
+    : Model(vulkanApp, MeshPtr(new Mesh(dataBuilder))){
+}
+
+Model::Model(VulkanAppPtr vulkanApp, const std::string& filePath)
+    : Model(vulkanApp, MeshPtr(new Mesh(filePath))){
+}
+
+std::vector<Triangle> Model::getTrianglePrimitives() const{
+    return _Mesh->getTrianglePrimitives();
+}
+
 bool Triangle::isWorldP0LeftOfPlane(const Vector3& planePosition, const Vector3& planeNormal) const{
     Vector3 planeToPoint = _WorldPos0 - planePosition;
     return Vector3::dot(planeToPoint, planeNormal) > 0;
 }
 
+AnalyticPrimitive AnalyticPrimitive::sphere(const Vector3& center, float radius, const Vector4& c){
+    return {._Center = center, ._Col = c, ._Radius = radius, ._Type = SPHERE};
+}
+
+AnalyticPrimitive AnalyticPrimitive::quad(const Vector3& center, uint32_t axis, const Vector2& halfSize, const Vector4& c){
+    return {._Center = center, ._Col = c, ._HalfSize = halfSize, ._Type = QUAD, ._Axis = axis};
+}
+
+AnalyticPrimitive AnalyticPrimitive::disk(const Vector3& center, uint32_t axis, float radius, const Vector4& c){
+    return {._Center = center, ._Col = c, ._Radius = radius, ._Type = DISK, ._Axis = axis};
+}
+
+void AnalyticPrimitive::getBounds(Vector3& min, Vector3& max) const{
+    Vector3 halfExtent{_Radius, _Radius, _Radius};
+    if(_Type != SPHERE){
+        // flat along the axis
+        halfExtent[_Axis] = 0.f;
+        if(_Type == QUAD){
+            halfExtent[(_Axis + 1) % 3] = _HalfSize.x();
+            halfExtent[(_Axis + 2) % 3] = _HalfSize.y();
+        }
+    }
+    min = _Center - halfExtent;
+    max = _Center + halfExtent;
+}
+
+Vector3 AnalyticPrimitive::getNormal(const Vector3& pos) const{
+    if(_Type == SPHERE){
+        return Vector3::normalize(pos - _Center);
+    }
+    Vector3 normal{0.f, 0.f, 0.f};
+    normal[_Axis] = 1.f;
+    return normal;
+}
+
+Vector2 AnalyticPrimitive::getTex(const Vector3& pos) const{
+    Vector3 local = pos - _Center;
+    if(_Type == SPHERE){
+        // the angles of primitiveSphere: phi from the y axis, theta from the z axis toward the x axis
+        float phi = std::acos(std::clamp(local.y() / _Radius, -1.f, 1.f));
+        float theta = std::atan2(local.x(), local.z());
+        if(theta < 0.f){
+            theta += 2.f * PI;
+        }
+        return Vector2(theta / (2.f * PI), phi / PI);
+    }
+    Vector2 halfSize = _Type == QUAD ? _HalfSize : Vector2{_Radius, _Radius};
+    return {
+        0.5f + 0.5f * local[(_Axis + 1) % 3] / halfSize.x(),
+        0.5f + 0.5f * local[(_Axis + 2) % 3] / halfSize.y()
+    };
+}
+
+void AnalyticPrimitive::getTexDerivatives(const Vector3& pos, Vector3& dPdU, Vector3& dPdV) const{
+    if(_Type == SPHERE){
+        Vector3 local = pos - _Center;
+        float phi = std::acos(std::clamp(local.y() / _Radius, -1.f, 1.f));
+        float theta = std::atan2(local.x(), local.z());
+        // u = theta / 2pi and v = phi / pi, the derivatives vanish at the poles
+        dPdU = 2.f * PI * _Radius * std::sin(phi) * Vector3{std::cos(theta), 0.f, -std::sin(theta)};
+        dPdV = PI * _Radius * Vector3{std::cos(phi) * std::sin(theta), -std::sin(phi), std::cos(phi) * std::cos(theta)};
+        return;
+    }
+    Vector2 halfSize = _Type == QUAD ? _HalfSize : Vector2{_Radius, _Radius};
+    dPdU = Vector3{0.f, 0.f, 0.f};
+    dPdV = Vector3{0.f, 0.f, 0.f};
+    dPdU[(_Axis + 1) % 3] = 2.f * halfSize.x();
+    dPdV[(_Axis + 2) % 3] = 2.f * halfSize.y();
+}
+
 
 };
\ No newline at end of file
@@ -30,6 +30,18 @@ class Model;
 */
 using ModelPtr = std::shared_ptr<Model>;
 
+/**
+ * Forward definition of the mesh class
+ * @see Mesh
+*/
+class Mesh;
+
+/**
+ * Shared pointer to a mesh
+ * @see Mesh
+*/
+using MeshPtr = std::shared_ptr<Mesh>;
+
 /**
  * A structure handling the data send to vertex shaders
 */
@@ -195,37 +207,147 @@ struct VertexDataBuilder{
 };
 
 
-struct Triangle{
+/**
+ * The shading attributes of a triangle, in the space of its mesh
+ * @note Trivially copyable, the ray tracer can point to triangles stored in a prepared scene file
+ * @see RayHit, PreparedScene
+*/
+struct TriangleAttributes{
+    Vector3 _Pos0{};
+    Vector4 _Col0{};
+    Vector3 _Norm0{};
+    Vector2 _Tex0{};
+
+    Vector3 _Pos1{};
+    Vector4 _Col1{};
+    Vector3 _Norm1{};
+    Vector2 _Tex1{};
+
+    Vector3 _Pos2{};
+    Vector4 _Col2{};
+    Vector3 _Norm2{};
+    Vector2 _Tex2{};
+};
+
+/**
+ * A primitive the ray tracer intersects in closed form, in the space of its mesh
+ * @note A quad or a disk lies in the plane through its center orthogonal to its axis and faces
+ * the positive side of the axis, like the triangles only their front is hit
+ * @note The texture coordinates of a quad or a disk follow the two next axes,
+ * the ones of a sphere match primitiveSphere
+ * @note Trivially copyable, like TriangleAttributes
+ * @see Mesh, RayHit
+*/
+struct AnalyticPrimitive{
+    enum Type : uint32_t{
+        SPHERE,
+        QUAD,
+        DISK,
+    };
+
+    Vector3 _Center{};
+    Vector4 _Col{1.f,1.f,1.f,1.f};
+    Vector2 _HalfSize{}; // quads only, along the two next axes
+    float _Radius = 0.f; // spheres and disks
+    uint32_t _Type = SPHERE;
+    uint32_t _Axis = 2; // quads and disks, the axis of the normal
+
+    /**
+     * Create a sphere
+     * @param center The center of the sphere
+     * @param radius The radius of the sphere
+     * @param c The uniform color of the sphere
+     * @return The primitive
+    */
+    static AnalyticPrimitive sphere(
+        const Vector3& center,
+        float radius,
+        const Vector4& c = Vector4{1.f,1.f,1.f,1.f}
+    );
+
+    /**
+     * Create an axis aligned rectangle
+     * @param center The center of the rectangle
+     * @param axis The axis of its normal, 0, 1 or 2
+     * @param halfSize The half of its sizes along the axes (axis+1)%3 and (axis+2)%3
+     * @param c The uniform color of the rectangle
+     * @return The primitive
+    */
+    static AnalyticPrimitive quad(
+        const Vector3& center,
+        uint32_t axis,
+        const Vector2& halfSize,
+        const Vector4& c = Vector4{1.f,1.f,1.f,1.f}
+    );
+
+    /**
+     * Create an axis aligned disk
+     * @param center The center of the disk
+     * @param axis The axis of its normal, 0, 1 or 2
+     * @param radius The radius of the disk
+     * @param c The uniform color of the disk
+     * @return The primitive
+    */
+    static AnalyticPrimitive disk(
+        const Vector3& center,
+        uint32_t axis,
+        float radius,
+        const Vector4& c = Vector4{1.f,1.f,1.f,1.f}
+    );
+
+    /**
+     * Get the corners of the bounding box of the primitive
+     * @param min The minimum corner
+     * @param max The maximum corner
+    */
+    void getBounds(Vector3& min, Vector3& max) const;
+
+    /**
+     * Get the normal of the primitive at a point of its surface
+     * @param pos The point
+     * @return The unit normal
+    */
+    Vector3 getNormal(const Vector3& pos) const;
+
+    /**
+     * Get the texture coordinates of a point of the surface
+     * @param pos The point
+     * @return The coordinates, in [0,1]
+    */
+    Vector2 getTex(const Vector3& pos) const;
+
+    /**
+     * Get the derivatives of the position with respect to the texture coordinates
+     * @param pos The point
+     * @param dPdU The derivative along u
+     * @param dPdV The derivative along v
+     * @note The norm of their cross product is the area covered by a unit of texture
+    */
+    void getTexDerivatives(const Vector3& pos, Vector3& dPdU, Vector3& dPdV) const;
+};
+
+struct Triangle : TriangleAttributes{
     MaterialPtr _Material = nullptr;
     Matrix4x4 _Model = {};
     Matrix4x4 _NormalMat = {};
 
-    Vector3 _Pos0{};    
     Vector3 _WorldPos0{};
     Vector3 _ViewPos0{};
-    Vector4 _Col0{};
-    Vector3 _Norm0{};
     Vector3 _ViewNorm0{};
-    Vector2 _Tex0{};
 
-    Vector3 _Pos1{};    
     Vector3 _WorldPos1{};
     Vector3 _ViewPos1{};
-    Vector4 _Col1{};
-    Vector3 _Norm1{};
     Vector3 _ViewNorm1{};
-    Vector2 _Tex1{};
 
-    Vector3 _Pos2{};    
     Vector3 _WorldPos2{};
     Vector3 _ViewPos2{};
-    Vector4 _Col2{};
-    Vector3 _Norm2{};
     Vector3 _ViewNorm2{};
-    Vector2 _Tex2{};
 
     bool _IsLight = false;
 
+    uint32_t _ObjectID = UINT32_MAX;
+    uint32_t _MaterialID = UINT32_MAX;
+
     std::string toString() const {
         return
             "{\np0: " + _Pos0.toString() 
@@ -256,24 +378,104 @@ struct Triangle{
 };
 
 /**
- * A class to represent a 3D model
+ * A class to represent a 3D mesh living on the cpu
+ * @note This is all the ray tracer needs, the gpu copy is owned by a Model
+ * @see Model
 */
-class Model{
+class Mesh{
 
     private:
         /**
          * The supported extensions
         */
-        enum ModelExtension{
+        enum MeshExtension{
             OFF,
             OBJ,
         };
 
         /**
-         * A map to bind string representation of the format to the model extension enum
-         * @see ModelExtension
+         * A map to bind string representation of the format to the mesh extension enum
+         * @see MeshExtension
+        */
+        static const std::map<std::string, MeshExtension> MESH_EXTENSIONS_MAP;
+
+    private:
+        /**
+         * The vertices and indices of the mesh
+        */
+        VertexDataBuilder _VertexDataBuilder{};
+
+        /**
+         * The analytic primitives of the mesh, next to its triangles
         */
-        static const std::map<std::string, ModelExtension> MODEL_EXTENSIONS_MAP;
+        std::vector<AnalyticPrimitive> _AnalyticPrimitives{};
+
+    public:
+        /**
+         * Build a mesh from a vertex data builder
+         * @param dataBuilder The vertex data builder
+        */
+        Mesh(const VertexDataBuilder& dataBuilder);
+
+        /**
+         * Build a mesh from a vertex data builder, without copying it
+         * @param dataBuilder The vertex data builder
+        */
+        Mesh(VertexDataBuilder&& dataBuilder);
+
+        /**
+         * Build a mesh from an object file
+         * @param filePath The path to the file containing the mesh
+         * @note The file must have a supported extension
+         * @see MeshExtension
+        */
+        Mesh(const std::string& filePath);
+
+        /**
+         * Build a mesh of analytic primitives
+         * @param primitives The primitives
+         * @note Only the ray tracer draws analytic primitives, the model of a mesh without
+         * triangles must be created without vulkan application
+        */
+        Mesh(std::vector<AnalyticPrimitive> primitives);
+
+        /**
+         * Add analytic primitives to the mesh, next to its triangles
+         * @param primitives The primitives
+        */
+        void addAnalyticPrimitives(const std::vector<AnalyticPrimitive>& primitives);
+
+        /**
+         * Getter for the analytic primitives
+         * @return The list of primitives
+        */
+        const std::vector<AnalyticPrimitive>& getAnalyticPrimitives() const {return _AnalyticPrimitives;}
+
+        /**
+         * Getter for the vertices
+         * @return The list of vertices
+        */
+        const std::vector<VertexData>& getVertices() const {return _VertexDataBuilder._Vertices;}
+
+        /**
+         * Getter for the indices
+         * @return The list of indices, three per triangle
+        */
+        const std::vector<uint32_t>& getIndices() const {return _VertexDataBuilder._Indices;}
+
+        /**
+         * Get the list of triangles in the mesh
+         * @return A vector of triangle
+        */
+        std::vector<Triangle> getTrianglePrimitives() const;
+};
+
+/**
+ * A class to represent a 3D model, a mesh and its copy on the gpu
+ * @note The gpu buffers are only created when the model is first bound, or explicitly uploaded,
+ * so a model without vulkan application can be used by the ray tracer
+*/
+class Model{
 
     public:
         /**
@@ -288,6 +490,12 @@ class Model{
         */
         VulkanAppPtr _VulkanApp = nullptr; 
 
+        /**
+         * A smart pointer to the cpu mesh
+         * @see Mesh
+        */
+        MeshPtr _Mesh = nullptr;
+
         /**
          * A smart pointer to the buffer containing the vertices informations
          * @see Buffer
@@ -315,28 +523,42 @@ class Model{
         */
         uint32_t _IndexCount = 0;
 
+    public:
         /**
-         * The vertex builder
+         * Build a model from a vulkan application and a mesh
+         * @param vulkanApp The vulkan application, can be null if the model is never drawn
+         * @param mesh The mesh, it can be shared between models
         */
-        VertexDataBuilder _VertexDataBuilder{};
+        Model(VulkanAppPtr vulkanApp, MeshPtr mesh);
 
-    public:
         /**
          * Build a model from a vulkan application and a vertex data builder
-         * @param vulkanApp The vulkan application
+         * @param vulkanApp The vulkan application, can be null if the model is never drawn
          * @param dataBuilder The vertex data builder
         */
         Model(VulkanAppPtr vulkanApp, const VertexDataBuilder& dataBuilder);
 
         /**
          * Build a model from a vulkan application and an object file
-         * @param vulkanApp The vulkan application
+         * @param vulkanApp The vulkan application, can be null if the model is never drawn
          * @param filePath The path to the file containing the model
          * @note The sile must have a supported extension
-         * @see ModelExtension
+         * @see Mesh
         */
         Model(VulkanAppPtr vulkanApp, const std::string& filePath);
 
+        /**
+         * Create the gpu buffers of the model if they do not exist yet
+         * @note Called by bind, call it beforehand to avoid a transfer while recording a frame
+        */
+        void upload();
+
+        /**
+         * Tell if the gpu buffers of the model exist
+         * @return True if the model has been uploaded
+        */
+        bool isUploaded() const {return _VertexBuffer != nullptr;}
+
         /**
          * Register a bind command for the current model
          * @param commandBuffer The current command buffer
@@ -352,10 +574,16 @@ class Model{
         void draw(VkCommandBuffer commandBuffer);
         
         /**
-         * Cleanup the model
+         * Cleanup the gpu buffers of the model, the mesh is kept
         */
         void cleanUp();
 
+        /**
+         * Getter for the cpu mesh
+         * @return A smart pointer to the mesh
+        */
+        MeshPtr getMesh() const {return _Mesh;}
+
         /**
          * Get the list of triangles in the model
          * @return A vector of triangle
@@ -65,6 +65,26 @@ void Scene::addGameDirectionalLight(DirectionalLightPtr light){
     _DirectionalLights.push_back(light);
 }
 
+/**
+* Add an oriented light to the scene
+* @param light The light to add
+*/
+void Scene::addGameOrientedLight(OrientedLightPtr light){
+    // do not add twice the same light
+    for(auto& curOrientedLight : _OrientedLights){
+        if(curOrientedLight == light){
+            ErrorHandler::handle(
+                __FILE__, __LINE__,
+                ErrorCode::BAD_VALUE_ERROR,
+                "Can't add twice the same oriented light to the scene",
+                ErrorLevel::WARNING
+            );
+            return;
+        }
+    }
+    _OrientedLights.push_back(light);
+}
+
 /**
 * Add a point light to the scene
 * @param position The light position
@@ -96,6 +116,24 @@ void Scene::addGameDirectionalLight(const Vector3& direction, const Vector3& col
     _DirectionalLights.push_back(newLight);
 }
 
+/**
+* Add an oriented light to the scene
+* @param position The light position
+* @param direction The light direction
+* @param color The light color
+* @param intensity The light intensity
+* @param angle The light opening angle
+*/
+void Scene::addGameOrientedLight(const Vector3& position, const Vector3& direction, const Vector3& color, float intensity, float angle){
+    OrientedLightPtr newLight = OrientedLightPtr(new OrientedLight());
+    newLight->_Color = Vector4(color, 1.f);
+    newLight->_Intensity = intensity;
+    newLight->_Position = Vector4(position, 1.f);
+    newLight->_Direction = Vector4(direction, 0.f);
+    newLight->_Angle = angle;
+    _OrientedLights.push_back(newLight);
+}
+
 /**
 * Getter to the scene point lights
 * @return The vector of point lights
@@ -112,6 +150,14 @@ std::vector<DirectionalLightPtr> Scene::getDirectionalLights() const {
     return _DirectionalLights;
 }
 
+/**
+* Getter to the scene oriented lights
+* @return The vector of oriented lights
+*/
+std::vector<OrientedLightPtr> Scene::getOrientedLights() const {
+    return _OrientedLights;
+}
+
 
 
 
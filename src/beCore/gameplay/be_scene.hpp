@@ -56,6 +56,12 @@ class Scene{
         */
         std::vector<DirectionalLightPtr> _DirectionalLights = {};
 
+        /**
+         * The list of oriented lights
+         * @see Light
+        */
+        std::vector<OrientedLightPtr> _OrientedLights = {};
+
         /**
          * The light-tree for lightcuts acceleration
          * @see Light
@@ -75,6 +81,12 @@ class Scene{
         */
         Scene(VulkanAppPtr vulkanApp): _VulkanApp(vulkanApp){};
 
+        /**
+         * A constructor for a scene living only on the cpu, its models are never uploaded
+         * @note Enough for the ray tracer, no vulkan application is needed
+        */
+        Scene() = default;
+
         /**
          * A getter to the list of game objects
          * @return the list of objects
@@ -99,6 +111,12 @@ class Scene{
         */
         void addGameDirectionalLight(DirectionalLightPtr light);
 
+        /**
+         * Add an oriented light to the scene
+         * @param light The light to add
+        */
+        void addGameOrientedLight(OrientedLightPtr light);
+
         /**
          * Add a point light to the scene
          * @param position The light position
@@ -116,6 +134,16 @@ class Scene{
         */
         void addGameDirectionalLight(const Vector3& direction, const Vector3& color, float intensity);
 
+        /**
+         * Add an oriented light to the scene
+         * @param position The light position
+         * @param direction The light direction
+         * @param color The light color
+         * @param intensity The light intensity
+         * @param angle The light opening angle
+        */
+        void addGameOrientedLight(const Vector3& position, const Vector3& direction, const Vector3& color, float intensity, float angle);
+
         /**
          * Getter to the scene point lights
          * @return The vector of point lights
@@ -128,12 +156,22 @@ class Scene{
         */
         std::vector<DirectionalLightPtr> getDirectionalLights() const;
 
+        /**
+         * Getter to the scene oriented lights
+         * @return The vector of oriented lights
+        */
+        std::vector<OrientedLightPtr> getOrientedLights() const;
+
         void buildTree(){
             _LightTree = LightCutsTreePtr(new LightCutsTree(
-                _PointLights, _DirectionalLights, {}
+                _PointLights, _DirectionalLights, _OrientedLights
             ));
         }
 
+        LightCutsTreePtr getLightTree() const {
+            return _LightTree;
+        }
+
         LightCutsTree::LightNodePtr getLightTreeRoot() const {
             return _LightTree->getRoot();
         }
@@ -109,7 +109,8 @@ TextureImage TextureImage::load(VulkanAppPtr vulkanApp, ImagePtr image){
     );
 
     buffer.map();
-    buffer.writeToBuffer(Image::pixelsToVectorOfBytes(image->getPixels()).data());
+    // convert straight into the staging buffer
+    Image::pixelsToBytes(*image, {static_cast<unsigned char*>(buffer.getMappedMemory()), static_cast<size_t>(imageSize)});
     buffer.unmap();
 
     newImage.init(
@@ -42,6 +42,14 @@ class Color: public Vector3{
             return newVec;
         }
 
+        static float sRGBToLinear(float srgb){
+            if (srgb <= 0.04045f) {
+                return srgb / 12.92f;
+            } else {
+                return std::pow((srgb + 0.055f) / 1.055f, 2.4f);
+            }
+        }
+
         static float linearToGamma(float linear){
             if(linear < 0){
                 ErrorHandler::handle(
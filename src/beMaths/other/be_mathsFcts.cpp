@@ -1,11 +1,37 @@
 #include "be_mathsFcts.hpp"
 #include <algorithm>
-#include <cstdlib>
 
 namespace be{
 
+namespace{
+
+// splitmix64, cheap enough to be reseeded for every pixel
+thread_local uint64_t randomState = 0x9e3779b97f4a7c15ull;
+
+uint64_t mix(uint64_t z){
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    return z ^ (z >> 31);
+}
+
+uint64_t nextRandom(){
+    randomState += 0x9e3779b97f4a7c15ull;
+    return mix(randomState);
+}
+
+}
+
+void Maths::seedRandom(uint64_t seed){
+    randomState = seed;
+}
+
+uint64_t Maths::hashSeed(uint64_t seed, uint64_t value){
+    return mix(seed + 0x9e3779b97f4a7c15ull * (value + 1));
+}
+
 float Maths::random_float(){
-    return rand() / (RAND_MAX + 1.f);
+    // the 24 high bits, so that the result stays below 1
+    return static_cast<float>(nextRandom() >> 40) / 16777216.f;
 }
 
 float Maths::random_float(float min, float max){
@@ -13,7 +39,8 @@ float Maths::random_float(float min, float max){
 }
 
 int Maths::random_int(){
-    return rand();
+    // in [0, 2^31), as rand() with glibc
+    return static_cast<int>(nextRandom() >> 33);
 }
 
 int Maths::random_int(int min, int max){
@@ -1,5 +1,7 @@
 #pragma once
 
+#include <cstdint>
+
 namespace be{
 
 class Maths{
@@ -8,6 +10,20 @@ class Maths{
         Maths(){}
 
     public:
+        /**
+         * Seed the random numbers of the calling thread, each thread draws from its own stream
+         * @param seed The seed, the same seed gives the same numbers
+        */
+        static void seedRandom(uint64_t seed);
+
+        /**
+         * Mix values into a seed, to derive independent streams from one seed
+         * @param seed The seed
+         * @param value The value to mix, e.g. the index of a pixel
+         * @return The derived seed
+        */
+        static uint64_t hashSeed(uint64_t seed, uint64_t value);
+
         static float random_float();
         static float random_float(float min, float max);
         static int random_int();
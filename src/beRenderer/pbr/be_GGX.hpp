@@ -1,5 +1,6 @@
 #pragma once
 
+#include "be_brdfBatch.hpp"
 #include "be_lights.hpp"
 #include "be_mathsFcts.hpp"
 #include "be_physicsConstants.hpp"
@@ -58,6 +59,16 @@ class GGX{
             return D*F*G / den;
         }
 
+        // the helpers of the batched BRDF, inlined in its simd loop
+        static float getSaturated(float x){
+            return std::min(std::max(x, 0.f), 1.f);
+        }
+
+        static float getPow5(float x){
+            float x2 = x*x;
+            return x2*x2*x;
+        }
+
     
     public:
         static Vector3 BRDF(const Vector3& wi, const Vector3& wo, const Vector3& n,  const Vector3& albedo, float roughness, float metallic){
@@ -66,6 +77,77 @@ class GGX{
             return diffuse + specular;
         }
 
+        /**
+         * Evaluate a range of a batch, the simd version of BRDF
+         * @param batch The inputs, the reflectances are written back
+         * @param first The first evaluation of the range
+         * @param last The end of the range
+         * @note The results match BRDF up to the rounding, a zero half vector gives the
+         * same zero specular without the error of the normalization
+        */
+        static void BRDF(BRDFBatch& batch, size_t first, size_t last){
+            const float* wiX = batch._WiX.data();
+            const float* wiY = batch._WiY.data();
+            const float* wiZ = batch._WiZ.data();
+            const float* woX = batch._WoX.data();
+            const float* woY = batch._WoY.data();
+            const float* woZ = batch._WoZ.data();
+            const float* nX = batch._NormalX.data();
+            const float* nY = batch._NormalY.data();
+            const float* nZ = batch._NormalZ.data();
+            const float* albedoR = batch._AlbedoR.data();
+            const float* albedoG = batch._AlbedoG.data();
+            const float* albedoB = batch._AlbedoB.data();
+            const float* roughness = batch._Roughness.data();
+            const float* metallic = batch._Metallic.data();
+            float* outR = batch._ReflectanceR.data();
+            float* outG = batch._ReflectanceG.data();
+            float* outB = batch._ReflectanceB.data();
+            // PI is a double, it would widen the lanes
+            const float pi = static_cast<float>(PI);
+
+            #pragma omp simd simdlen(8)
+            for(size_t k = first; k<last; k++){
+                float hX = wiX[k] + woX[k];
+                float hY = wiY[k] + woY[k];
+                float hZ = wiZ[k] + woZ[k];
+                float hNorm = std::sqrt(hX*hX + hY*hY + hZ*hZ);
+                float invHNorm = 1.f / std::max(hNorm, EPSILON); // a zero half vector stays zero
+                hX *= invHNorm;
+                hY *= invHNorm;
+                hZ *= invHNorm;
+
+                float alpha = roughness[k] * roughness[k];
+                float a2 = alpha * alpha;
+
+                // distribution
+                float nDotH = getSaturated(nX[k]*hX + nY[k]*hY + nZ[k]*hZ);
+                float dFactor = 1.f + (a2 - 1.f) * nDotH * nDotH;
+                float D = a2 / (pi * dFactor * dFactor + EPSILON);
+
+                // geometric
+                float nDotWi = getSaturated(nX[k]*wiX[k] + nY[k]*wiY[k] + nZ[k]*wiZ[k]);
+                float nDotWo = getSaturated(nX[k]*woX[k] + nY[k]*woY[k] + nZ[k]*woZ[k]);
+                float g1Wi = (2.f*nDotWi) / (nDotWi + std::sqrt(a2 + (1.f - a2) * nDotWi * nDotWi) + EPSILON);
+                float g1Wo = (2.f*nDotWo) / (nDotWo + std::sqrt(a2 + (1.f - a2) * nDotWo * nDotWo) + EPSILON);
+
+                float specular = D * g1Wi * g1Wo / (4.f * nDotWi * nDotWo + EPSILON);
+
+                // fresnel, f0 with a reflectance of 1
+                float metal = metallic[k];
+                float fresnel = getPow5(1.f - getSaturated(wiX[k]*hX + wiY[k]*hY + wiZ[k]*hZ));
+                float f0 = 0.16f * (1.f - metal);
+                float f0R = f0 + albedoR[k] * metal;
+                float f0G = f0 + albedoG[k] * metal;
+                float f0B = f0 + albedoB[k] * metal;
+
+                float diffuse = (1.f - metal) / pi;
+                outR[k] = diffuse * albedoR[k] + (f0R + (1.f - f0R) * fresnel) * specular;
+                outG[k] = diffuse * albedoG[k] + (f0G + (1.f - f0G) * fresnel) * specular;
+                outB[k] = diffuse * albedoB[k] + (f0B + (1.f - f0B) * fresnel) * specular;
+            }
+        }
+
         static Vector3 getAttenuation(PointLightPtr pointLight, const Vector3& shadePos){
             float d2 = (pointLight->_Position.xyz() - shadePos).getSquaredNorm();
             d2 += EPSILON;
@@ -76,6 +158,14 @@ class GGX{
             return directionalLight->_Intensity * directionalLight->_Color.xyz();
         }
 
+        static Vector3 getAttenuation(OrientedLightPtr orientedLight, const Vector3& shadePos){
+            Vector3 toShadePos = shadePos - orientedLight->_Position.xyz();
+            float d2 = toShadePos.getSquaredNorm();
+            float emission = orientedLight->getEmission(Vector3::normalize(toShadePos));
+            d2 = std::max(d2, orientedLight->_MinSquaredDistance) + EPSILON;
+            return emission * orientedLight->_Intensity * orientedLight->_Color.xyz() / d2;
+        }
+
 };
 
 };
\ No newline at end of file
@@ -0,0 +1,120 @@
+#pragma once
+
+#include "be_material.hpp"
+#include "be_materialConstants.hpp"
+#include "be_vector3.hpp"
+#include <cstddef>
+#include <vector>
+
+namespace be{
+
+/**
+ * The inputs and results of many BRDF evaluations, one array per component
+ * @note The kernels of GGX and Disney go over the arrays in simd loops, 8 evaluations per
+ * instruction stream on an AVX2 build
+ * @see GGX::BRDF, Disney::BRDF
+*/
+struct BRDFBatch{
+    std::vector<float> _WiX = {};
+    std::vector<float> _WiY = {};
+    std::vector<float> _WiZ = {};
+    std::vector<float> _WoX = {};
+    std::vector<float> _WoY = {};
+    std::vector<float> _WoZ = {};
+    std::vector<float> _NormalX = {};
+    std::vector<float> _NormalY = {};
+    std::vector<float> _NormalZ = {};
+    std::vector<float> _AlbedoR = {};
+    std::vector<float> _AlbedoG = {};
+    std::vector<float> _AlbedoB = {};
+    std::vector<float> _Roughness = {};
+    std::vector<float> _Metallic = {};
+    // the other parameters and the material constants, only read by Disney
+    std::vector<float> _Subsurface = {};
+    std::vector<float> _SpecularTint = {};
+    std::vector<float> _SheenTint = {};
+    std::vector<float> _MetalAlpha2 = {};
+    std::vector<float> _SpecularF0 = {};
+    std::vector<float> _DiffuseWeight = {};
+    std::vector<float> _MetalWeight = {};
+    std::vector<float> _ClearcoatWeight = {};
+    std::vector<float> _SheenWeight = {};
+    std::vector<float> _ClearcoatAlpha2 = {};
+    std::vector<float> _ClearcoatNormalization = {};
+    std::vector<float> _LightIntensity = {};
+    // the reflectances, written by the kernels
+    std::vector<float> _ReflectanceR = {};
+    std::vector<float> _ReflectanceG = {};
+    std::vector<float> _ReflectanceB = {};
+
+    size_t size() const {return _WiX.size();}
+
+    /**
+     * Resize the arrays, all the evaluations are reset to zeros
+     * @param size The number of evaluations
+    */
+    void resize(size_t size){
+        for(std::vector<float>* array : {
+            &_WiX, &_WiY, &_WiZ, &_WoX, &_WoY, &_WoZ, &_NormalX, &_NormalY, &_NormalZ,
+            &_AlbedoR, &_AlbedoG, &_AlbedoB, &_Roughness, &_Metallic,
+            &_Subsurface, &_SpecularTint, &_SheenTint, &_MetalAlpha2, &_SpecularF0,
+            &_DiffuseWeight, &_MetalWeight, &_ClearcoatWeight, &_SheenWeight,
+            &_ClearcoatAlpha2, &_ClearcoatNormalization, &_LightIntensity,
+            &_ReflectanceR, &_ReflectanceG, &_ReflectanceB
+        }){
+            array->assign(size, 0.f);
+        }
+    }
+
+    /**
+     * Set the inputs of an evaluation, the same as those of the per hit BRDFs
+     * @param index The index of the evaluation
+     * @param wi The incoming direction
+     * @param wo The outgoing direction
+     * @param n The normal
+     * @param albedo The color of the surface
+     * @param material The material of the surface
+     * @param constants The constants of the material
+     * @param lightIntensity The intensity of the light, only read by Disney
+    */
+    void set(size_t index, const Vector3& wi, const Vector3& wo, const Vector3& n,
+        const Vector3& albedo, const Material& material, const MaterialConstants& constants, float lightIntensity){
+        _WiX[index] = wi.x();
+        _WiY[index] = wi.y();
+        _WiZ[index] = wi.z();
+        _WoX[index] = wo.x();
+        _WoY[index] = wo.y();
+        _WoZ[index] = wo.z();
+        _NormalX[index] = n.x();
+        _NormalY[index] = n.y();
+        _NormalZ[index] = n.z();
+        _AlbedoR[index] = albedo.r();
+        _AlbedoG[index] = albedo.g();
+        _AlbedoB[index] = albedo.b();
+        _Roughness[index] = material._Roughness;
+        _Metallic[index] = material._Metallic;
+        _Subsurface[index] = material._Subsurface;
+        _SpecularTint[index] = material._SpecularTint;
+        _SheenTint[index] = material._SheenTint;
+        _MetalAlpha2[index] = constants._MetalAlphaX * constants._MetalAlphaY;
+        _SpecularF0[index] = constants._SpecularF0;
+        _DiffuseWeight[index] = constants._DiffuseWeight;
+        _MetalWeight[index] = constants._MetalWeight;
+        _ClearcoatWeight[index] = constants._ClearcoatWeight;
+        _SheenWeight[index] = constants._SheenWeight;
+        _ClearcoatAlpha2[index] = constants._ClearcoatAlpha2;
+        _ClearcoatNormalization[index] = constants._ClearcoatNormalization;
+        _LightIntensity[index] = lightIntensity;
+    }
+
+    /**
+     * Getter for the result of an evaluation
+     * @param index The index of the evaluation
+     * @return The reflectance
+    */
+    Vector3 getReflectance(size_t index) const {
+        return Vector3(_ReflectanceR[index], _ReflectanceG[index], _ReflectanceB[index]);
+    }
+};
+
+}
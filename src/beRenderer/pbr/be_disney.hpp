@@ -1,6 +1,8 @@
 #pragma once
 
+#include "be_brdfBatch.hpp"
 #include "be_lights.hpp"
+#include "be_materialConstants.hpp"
 #include "be_mathsFcts.hpp"
 #include "be_physicsConstants.hpp"
 #include "be_trigonometry.hpp"
@@ -15,6 +17,7 @@ class Disney{
         struct Input{
             Vector3 _BaseColor;
             MaterialPtr _Material;
+            const MaterialConstants* _Constants;
             Vector3 _Win;
             Vector3 _Wout;
             Vector3 _H;
@@ -86,18 +89,12 @@ class Disney{
             return r0*Vector3(1.f, 1.f, 1.f) + (1.f - r0)*hw*Vector3(1.f, 1.f, 1.f);
         }
         // Dc
-        static float getAlphag(float clearcoatGloss){
-            return (1.f - clearcoatGloss) * 0.1f + clearcoatGloss * 0.001;
-        }
         // TODO:
         // need surface tangents to use the BSDF 
-        static float getDclearcoat(float clearcoatGloss, const Vector3& h, const Vector3& n){
+        static float getDclearcoat(float alpha2, float normalization, const Vector3& h, const Vector3& n){
             // Vector3 hl = normalize(h.x*localTangent + h.y*localBiTangent + h.z*localNormal);
             float hn = Maths::clamp(Vector3::dot(n, h), 0.f, 1.f);
-            float ag = getAlphag(clearcoatGloss) * getAlphag(clearcoatGloss);
-            float num = ag - 1.f;
-            float den = PI * log(ag) * (1.f + (ag - 1.f) * (hn * hn));
-            return num / den;
+            return normalization / (1.f + (alpha2 - 1.f) * (hn * hn));
         }
         // Gc
         // TODO:
@@ -124,7 +121,7 @@ class Disney{
         // f clearcoat
         static Vector3 getClearcoat(Input i){
             Vector3 Fc = getFclearcoat(i._H, i._Wout);
-            float Dc = getDclearcoat(i._Material->_ClearcoatGloss, i._H, i._ShadingNormal);
+            float Dc = getDclearcoat(i._Constants->_ClearcoatAlpha2, i._Constants->_ClearcoatNormalization, i._H, i._ShadingNormal);
             float Gc = getGclearcoat(i._Win, i._Wout, i._ShadingNormal);
             return (Fc * Dc * Gc) / (4.f*std::abs(Vector3::dot(i._ShadingNormal, i._Win)));
         }
@@ -148,10 +145,10 @@ class Disney{
 
         // Metals
         // Fm
-        static Vector3 getFmetal(const Vector3& baseColor, const Vector3& h, const Vector3& wout, float specularTint, float intensity, float specular, float metallic){
+        static Vector3 getFmetal(const Vector3& baseColor, const Vector3& h, const Vector3& wout, float specularTint, float intensity, float specularF0, float metallic){
             Vector3 ks = (1.f - specularTint)*Vector3(1.f, 1.f, 1.f) + specularTint*getCtint(baseColor, intensity);
             // TODO: use eta instead of 1.5f
-            Vector3 c0 = specular*getR0eta(1.5f)*(1.f - metallic)*ks + metallic*baseColor;
+            Vector3 c0 = specularF0*ks + metallic*baseColor;
             float hwout = std::abs(Vector3::dot(h, wout));
             return c0 + (Vector3(1.f, 1.f, 1.f) - c0)*(1.f-pow(hwout, 5));
             // return baseColor + (Vector3::ones() - baseColor) * (1.f-pow(hwout, 5));
@@ -172,11 +169,8 @@ class Disney{
         }
         // TODO:
         // need surface tangents to use the BSDF 
-        static float getDmetal(float roughness, float anisotropic, const Vector3& h, const Vector3& n){
+        static float getDmetal(float alphaX, float alphaY, const Vector3& h, const Vector3& n){
             float hn = Maths::clamp(Vector3::dot(n, h), 0.f, 1.f);
-            float r = roughness;
-            float alphaX = getAlphaX(r, anisotropic);
-            float alphaY = getAlphaY(r, anisotropic);
             float a2 = alphaX * alphaY;
 
             float den = PI * Maths::sqr(1+(a2-1)*Maths::sqr(hn)) + EPSILON;
@@ -217,54 +211,196 @@ class Disney{
         }
         // f metal
         static Vector3 getMetal(Input i){
-            Vector3 Fm = getFmetal(i._BaseColor, i._H, i._Wout, i._Material->_SpecularTint, i._Intensity, i._Material->_Specular, i._Material->_Metallic);
+            Vector3 Fm = getFmetal(i._BaseColor, i._H, i._Wout, i._Material->_SpecularTint, i._Intensity, i._Constants->_SpecularF0, i._Material->_Metallic);
             // float Dm = getDmetal(i._H, i._Material->_Roughness, i._Material->_Anisotropic, i._ShadingNormal, i._Tangent, i._Bitangent);
             // float Gm = getGmetal(i._Material->_Roughness, i._Material->_Anisotropic, i._Win, i._Wout, i._ShadingNormal, i._Tangent, i._Bitangent);
-            float Dm = getDmetal(i._Material->_Roughness, i._Material->_Anisotropic, i._H, i._ShadingNormal);
+            float Dm = getDmetal(i._Constants->_MetalAlphaX, i._Constants->_MetalAlphaY, i._H, i._ShadingNormal);
             float Gm = getGmetal(i._Material->_Roughness, i._Material->_Anisotropic, i._Win, i._Wout, i._ShadingNormal);
             return (Fm * Dm * Gm) / (4.f*std::abs(Vector3::dot(i._ShadingNormal, i._Win)) + EPSILON);
         }
 
+        // the helpers of the batched BRDF, inlined in its simd loop
+        static float getSaturated(float x){
+            return std::min(std::max(x, 0.f), 1.f);
+        }
+
+        static float getPow5(float x){
+            float x2 = x*x;
+            return x2*x2*x;
+        }
+
+        static float getGmetalSmith(float dotNW, float a2){
+            return (2.f*dotNW) / (dotNW + std::sqrt(a2 + (1.f - a2) * dotNW * dotNW) + EPSILON);
+        }
+
+        static float getGclearcoatW(float dotNW){
+            return 1.f / (1.f + (std::sqrt(1.f + dotNW) - 1.f) / 2.f);
+        }
+
     
     public:
+        /**
+         * Evaluate the BRDF with the precomputed constants of the material
+         * @param constants The constants of the material, built from the same values
+         * @see MaterialConstants::fromMaterial
+        */
         static Vector3 BRDF(const Vector3& wi, const Vector3& wo, const Vector3& n,
-            const Vector3& albedo, MaterialPtr material, PointLightPtr pointLight){
+            const Vector3& albedo, MaterialPtr material, const MaterialConstants& constants, float lightIntensity){
             Input i{};
             i._Win = wi;
             i._Wout = wo;
             i._H = Vector3::normalize(wi + wo);
             i._Material = material;
+            i._Constants = &constants;
             i._ShadingNormal = n;
             i._BaseColor = albedo;
-            i._Intensity = pointLight->getIntensity();
+            i._Intensity = lightIntensity;
             
             
-            Vector3 diffuse = (1.f - i._Material->_Specular) * (1.f - i._Material->_Metallic) * getDiffuse(i);
-            Vector3 metal = (1.f - i._Material->_Specular * (1.f - i._Material->_Metallic)) * getMetal(i);
-            Vector3 clearcoat = 0.25f * i._Material->_Clearcoat * getClearcoat(i);
-            Vector3 sheen = (1.f - i._Material->_Metallic) * i._Material->_Sheen * getSheen(i);
+            Vector3 diffuse = constants._DiffuseWeight * getDiffuse(i);
+            Vector3 metal = constants._MetalWeight * getMetal(i);
+            Vector3 clearcoat = constants._ClearcoatWeight * getClearcoat(i);
+            Vector3 sheen = constants._SheenWeight * getSheen(i);
+
+            return diffuse + metal + clearcoat + sheen;
+        }
+
+        static Vector3 BRDF(const Vector3& wi, const Vector3& wo, const Vector3& n,
+            const Vector3& albedo, MaterialPtr material, float lightIntensity){
+            return BRDF(wi, wo, n, albedo, material, MaterialConstants::fromMaterial(*material), lightIntensity);
+        }
+
+        /**
+         * Evaluate a range of a batch, the simd version of BRDF
+         * @param batch The inputs, the reflectances are written back
+         * @param first The first evaluation of the range
+         * @param last The end of the range
+         * @note The results match BRDF up to the rounding, a zero half vector gives the
+         * same zero terms without the error of the normalization
+        */
+        static void BRDF(BRDFBatch& batch, size_t first, size_t last){
+            const float* wiX = batch._WiX.data();
+            const float* wiY = batch._WiY.data();
+            const float* wiZ = batch._WiZ.data();
+            const float* woX = batch._WoX.data();
+            const float* woY = batch._WoY.data();
+            const float* woZ = batch._WoZ.data();
+            const float* nX = batch._NormalX.data();
+            const float* nY = batch._NormalY.data();
+            const float* nZ = batch._NormalZ.data();
+            const float* albedoR = batch._AlbedoR.data();
+            const float* albedoG = batch._AlbedoG.data();
+            const float* albedoB = batch._AlbedoB.data();
+            const float* roughness = batch._Roughness.data();
+            const float* metallic = batch._Metallic.data();
+            const float* subsurface = batch._Subsurface.data();
+            const float* specularTint = batch._SpecularTint.data();
+            const float* sheenTint = batch._SheenTint.data();
+            const float* metalAlpha2 = batch._MetalAlpha2.data();
+            const float* specularF0 = batch._SpecularF0.data();
+            const float* diffuseWeight = batch._DiffuseWeight.data();
+            const float* metalWeight = batch._MetalWeight.data();
+            const float* clearcoatWeight = batch._ClearcoatWeight.data();
+            const float* sheenWeight = batch._SheenWeight.data();
+            const float* clearcoatAlpha2 = batch._ClearcoatAlpha2.data();
+            const float* clearcoatNormalization = batch._ClearcoatNormalization.data();
+            const float* lightIntensity = batch._LightIntensity.data();
+            float* outR = batch._ReflectanceR.data();
+            float* outG = batch._ReflectanceG.data();
+            float* outB = batch._ReflectanceB.data();
+            // PI is a double, it would widen the lanes
+            const float pi = static_cast<float>(PI);
+            const float r0 = getR0eta(1.5f);
+
+            #pragma omp simd simdlen(8)
+            for(size_t k = first; k<last; k++){
+                float hX = wiX[k] + woX[k];
+                float hY = wiY[k] + woY[k];
+                float hZ = wiZ[k] + woZ[k];
+                float hNorm = std::sqrt(hX*hX + hY*hY + hZ*hZ);
+                float invHNorm = 1.f / std::max(hNorm, EPSILON); // a zero half vector stays zero
+                hX *= invHNorm;
+                hY *= invHNorm;
+                hZ *= invHNorm;
+
+                float nDotWi = nX[k]*wiX[k] + nY[k]*wiY[k] + nZ[k]*wiZ[k];
+                float nDotWo = nX[k]*woX[k] + nY[k]*woY[k] + nZ[k]*woZ[k];
+                float absNDotWi = std::abs(nDotWi);
+                float absNDotWo = std::abs(nDotWo);
+                float absHDotWo = std::abs(hX*woX[k] + hY*woY[k] + hZ*woZ[k]);
+                float nDotH = getSaturated(nX[k]*hX + nY[k]*hY + nZ[k]*hZ);
+                float r = roughness[k];
+                float metal = metallic[k];
+
+                // diffuse, the base and subsurface lobes scale the albedo
+                float fresnelWi = 1.f - getPow5(absNDotWi);
+                float fresnelWo = 1.f - getPow5(absNDotWo);
+                float fd90 = 0.5f + 2.f * r * absHDotWo * absHDotWo;
+                float baseDiffuse = absNDotWo * (1.f + (fd90 - 1.f) * fresnelWi) * (1.f + (fd90 - 1.f) * fresnelWo) / pi;
+                float fss90 = r * absHDotWo * absHDotWo;
+                float fss = (1.f + (fss90 - 1.f) * fresnelWi) * (1.f + (fss90 - 1.f) * fresnelWo);
+                float subsurfaceDiffuse = 1.25f / pi * (fss * (1.f / (absNDotWi + absNDotWo) - 0.5f) + 0.5f) * absNDotWo;
+                float diffuse = diffuseWeight[k] * ((1.f - subsurface[k]) * baseDiffuse + subsurface[k] * subsurfaceDiffuse);
+
+                // the tint is the albedo over the light intensity
+                float intensity = lightIntensity[k];
+                bool hasTint = std::abs(intensity) > EPSILON;
+                float invIntensity = 1.f / (hasTint ? intensity : 1.f);
+                float tintR = hasTint ? albedoR[k] * invIntensity : 1.f;
+                float tintG = hasTint ? albedoG[k] * invIntensity : 1.f;
+                float tintB = hasTint ? albedoB[k] * invIntensity : 1.f;
 
-            return diffuse + clearcoat + sheen + metal;
+                // metal
+                float specTint = specularTint[k];
+                float c0R = specularF0[k] * ((1.f - specTint) + specTint * tintR) + metal * albedoR[k];
+                float c0G = specularF0[k] * ((1.f - specTint) + specTint * tintG) + metal * albedoG[k];
+                float c0B = specularF0[k] * ((1.f - specTint) + specTint * tintB) + metal * albedoB[k];
+                float fresnelM = 1.f - getPow5(absHDotWo);
+                float aM2 = metalAlpha2[k];
+                float dMFactor = 1.f + (aM2 - 1.f) * nDotH * nDotH;
+                float Dm = aM2 / (pi * dMFactor * dMFactor + EPSILON);
+                float Gm = getGmetalSmith(getSaturated(nDotWi), r * r) * getGmetalSmith(getSaturated(nDotWo), r * r);
+                float metalScale = metalWeight[k] * Dm * Gm / (4.f * absNDotWi + EPSILON);
+
+                // clearcoat
+                float fresnelH = getPow5(1.f - absHDotWo);
+                float Fc = r0 + (1.f - r0) * fresnelH;
+                float Dc = clearcoatNormalization[k] / (1.f + (clearcoatAlpha2[k] - 1.f) * nDotH * nDotH);
+                float Gc = getGclearcoatW(getSaturated(nDotWi)) * getGclearcoatW(getSaturated(nDotWo));
+                float clearcoatTerm = clearcoatWeight[k] * Fc * Dc * Gc / (4.f * absNDotWi);
+
+                // sheen
+                float tint = sheenTint[k];
+                float sheenScale = sheenWeight[k] * fresnelH * absNDotWo;
+
+                outR[k] = diffuse * albedoR[k]
+                    + (c0R + (1.f - c0R) * fresnelM) * metalScale
+                    + clearcoatTerm
+                    + ((1.f - tint) + tint * tintR) * sheenScale;
+                outG[k] = diffuse * albedoG[k]
+                    + (c0G + (1.f - c0G) * fresnelM) * metalScale
+                    + clearcoatTerm
+                    + ((1.f - tint) + tint * tintG) * sheenScale;
+                outB[k] = diffuse * albedoB[k]
+                    + (c0B + (1.f - c0B) * fresnelM) * metalScale
+                    + clearcoatTerm
+                    + ((1.f - tint) + tint * tintB) * sheenScale;
+            }
+        }
+
+        static Vector3 BRDF(const Vector3& wi, const Vector3& wo, const Vector3& n,
+            const Vector3& albedo, MaterialPtr material, PointLightPtr pointLight){
+            return BRDF(wi, wo, n, albedo, material, pointLight->getIntensity());
         }
 
         static Vector3 BRDF(const Vector3& wi, const Vector3& wo, const Vector3& n,
             const Vector3& albedo, MaterialPtr material, DirectionalLightPtr directionalLight){
-            Input i{};
-            i._Win = wi;
-            i._Wout = wo;
-            i._H = Vector3::normalize(wi + wo);
-            i._Material = material;
-            i._ShadingNormal = n;
-            i._BaseColor = albedo;
-            i._Intensity = directionalLight->getIntensity();
-            
-            
-            Vector3 diffuse = (1.f - i._Material->_Specular) * (1.f - i._Material->_Metallic) * getDiffuse(i);
-            Vector3 metal = (1.f - i._Material->_Specular * (1.f - i._Material->_Metallic)) * getMetal(i);
-            Vector3 clearcoat = 0.25f * i._Material->_Clearcoat * getClearcoat(i);
-            Vector3 sheen = (1.f - i._Material->_Metallic) * i._Material->_Sheen * getSheen(i);
+            return BRDF(wi, wo, n, albedo, material, directionalLight->getIntensity());
+        }
 
-            return diffuse + metal + clearcoat + sheen;
+        static Vector3 BRDF(const Vector3& wi, const Vector3& wo, const Vector3& n,
+            const Vector3& albedo, MaterialPtr material, OrientedLightPtr orientedLight){
+            return BRDF(wi, wo, n, albedo, material, orientedLight->getIntensity());
         }
 
         static Vector3 getAttenuation(PointLightPtr pointLight, const Vector3& shadePos){
@@ -277,6 +413,14 @@ class Disney{
             return directionalLight->_Intensity * directionalLight->_Color.xyz();
         }
 
+        static Vector3 getAttenuation(OrientedLightPtr orientedLight, const Vector3& shadePos){
+            Vector3 toShadePos = shadePos - orientedLight->_Position.xyz();
+            float d2 = toShadePos.getSquaredNorm();
+            float emission = orientedLight->getEmission(Vector3::normalize(toShadePos));
+            d2 = std::max(d2, orientedLight->_MinSquaredDistance) + EPSILON;
+            return emission * orientedLight->_Intensity * orientedLight->_Color.xyz() / d2;
+        }
+
 };
 
 };
\ No newline at end of file
@@ -0,0 +1,58 @@
+#pragma once
+
+#include "be_material.hpp"
+#include "be_trigonometry.hpp"
+#include <algorithm>
+#include <cmath>
+
+namespace be{
+
+/**
+ * The quantities of the Disney BRDF that only depend on the material
+ * @note The ray tracer builds them once per material when it flattens the scene,
+ * a material edited between two runs is picked up by the next one
+ * @note The tints depend on the albedo at the hit and on the light, they are not cached
+ * @see Disney::BRDF
+*/
+struct MaterialConstants{
+    float _MetalAlphaX = 0.f; // alphas of the anisotropic metal distribution
+    float _MetalAlphaY = 0.f;
+    float _ClearcoatAlpha2 = 0.f; // squared alpha of the clearcoat distribution
+    float _ClearcoatNormalization = 0.f; // (alpha2 - 1) / (PI log(alpha2)), its factor
+    float _SpecularF0 = 0.f; // the dielectric part of the metal F0, before the tint
+    float _DiffuseWeight = 0.f;
+    float _MetalWeight = 0.f;
+    float _ClearcoatWeight = 0.f;
+    float _SheenWeight = 0.f;
+
+    /**
+     * Derive the constants of a material
+     * @param material The material
+     * @return The constants
+    */
+    static MaterialConstants fromMaterial(const Material& material){
+        MaterialConstants constants{};
+
+        float aspect = std::sqrt(1.f - 0.9f * material._Anisotropic);
+        float alphaMin = 1e-4;
+        constants._MetalAlphaX = std::max(alphaMin, material._Roughness * material._Roughness * aspect);
+        constants._MetalAlphaY = std::max(alphaMin, material._Roughness * material._Roughness / aspect);
+
+        float alphaG = (1.f - material._ClearcoatGloss) * 0.1f + material._ClearcoatGloss * 0.001f;
+        constants._ClearcoatAlpha2 = alphaG * alphaG;
+        constants._ClearcoatNormalization = (constants._ClearcoatAlpha2 - 1.f)
+            / (static_cast<float>(PI) * std::log(constants._ClearcoatAlpha2));
+
+        // reflectance at normal incidence of an interface of index 1.5
+        float r0 = (1.5f - 1.f) * (1.5f - 1.f) / ((1.5f + 1.f) * (1.5f + 1.f));
+        constants._SpecularF0 = material._Specular * r0 * (1.f - material._Metallic);
+
+        constants._DiffuseWeight = (1.f - material._Specular) * (1.f - material._Metallic);
+        constants._MetalWeight = 1.f - material._Specular * (1.f - material._Metallic);
+        constants._ClearcoatWeight = 0.25f * material._Clearcoat;
+        constants._SheenWeight = (1.f - material._Metallic) * material._Sheen;
+        return constants;
+    }
+};
+
+}
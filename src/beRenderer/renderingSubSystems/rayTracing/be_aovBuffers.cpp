@@ -0,0 +1,58 @@
+#include "be_aovBuffers.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <utility>
+
+namespace be{
+
+AOVBuffers::AOVBuffers(uint32_t width, uint32_t height)
+    : _Width(width), _Height(height){
+    size_t size = static_cast<size_t>(width) * height;
+    _Albedo = std::make_shared<Image>(width, height);
+    _Normal = std::make_shared<Image>(width, height);
+    _Depth = std::vector<float>(size, 0.f);
+    _ObjectID = std::vector<uint32_t>(size, NO_ID);
+    _MaterialID = std::vector<uint32_t>(size, NO_ID);
+    _HitCount = std::vector<uint32_t>(size, 0);
+    _SampleCount = std::vector<uint32_t>(size, 0);
+}
+
+void AOVBuffers::clear(){
+    _Albedo->clear();
+    _Normal->clear();
+    std::fill(_Depth.begin(), _Depth.end(), 0.f);
+    std::fill(_ObjectID.begin(), _ObjectID.end(), NO_ID);
+    std::fill(_MaterialID.begin(), _MaterialID.end(), NO_ID);
+    std::fill(_HitCount.begin(), _HitCount.end(), 0);
+    std::fill(_SampleCount.begin(), _SampleCount.end(), 0);
+}
+
+void AOVBuffers::pack(uint32_t i, uint32_t j, std::span<float> packed) const {
+    size_t index = static_cast<size_t>(j) * _Width + i;
+    auto albedo = std::as_const(*_Albedo).getRow(j).subspan(i * Image::CHANNELS, Image::CHANNELS);
+    auto normal = std::as_const(*_Normal).getRow(j).subspan(i * Image::CHANNELS, Image::CHANNELS);
+    auto out = std::copy(albedo.begin(), albedo.end(), packed.begin());
+    out = std::copy(normal.begin(), normal.end(), out);
+    *out++ = _Depth[index];
+    *out++ = std::bit_cast<float>(_ObjectID[index]);
+    *out++ = std::bit_cast<float>(_MaterialID[index]);
+    *out++ = std::bit_cast<float>(_HitCount[index]);
+    *out++ = std::bit_cast<float>(_SampleCount[index]);
+}
+
+void AOVBuffers::unpack(uint32_t i, uint32_t j, std::span<const float> packed){
+    size_t index = static_cast<size_t>(j) * _Width + i;
+    auto in = packed.begin();
+    std::copy_n(in, Image::CHANNELS, _Albedo->getRow(j).begin() + i * Image::CHANNELS);
+    in += Image::CHANNELS;
+    std::copy_n(in, Image::CHANNELS, _Normal->getRow(j).begin() + i * Image::CHANNELS);
+    in += Image::CHANNELS;
+    _Depth[index] = *in++;
+    _ObjectID[index] = std::bit_cast<uint32_t>(*in++);
+    _MaterialID[index] = std::bit_cast<uint32_t>(*in++);
+    _HitCount[index] = std::bit_cast<uint32_t>(*in++);
+    _SampleCount[index] = std::bit_cast<uint32_t>(*in++);
+}
+
+}
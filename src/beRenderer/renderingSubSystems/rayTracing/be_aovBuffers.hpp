@@ -0,0 +1,102 @@
+#pragma once
+
+#include "be_image.hpp"
+
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <vector>
+
+namespace be{
+
+class AOVBuffers;
+using AOVBuffersPtr = std::shared_ptr<AOVBuffers>;
+
+/**
+ * Arbitrary output variables written alongside the beauty pass of the ray tracer
+ * @note Geometric values are averaged over the samples of a pixel that hit something,
+ * identifiers are the ones of its first sample with a hit
+*/
+class AOVBuffers{
+    public:
+        /**
+         * The identifier of a pixel without any hit
+        */
+        static constexpr uint32_t NO_ID = UINT32_MAX;
+
+        /**
+         * The number of floats of a packed pixel: albedo, normal, depth, object, material, hit and sample counts
+        */
+        static constexpr uint32_t PACKED_FLOATS = 2 * Image::CHANNELS + 5;
+
+    private:
+        uint32_t _Width = 0;
+        uint32_t _Height = 0;
+
+    public:
+        /**
+         * The albedo of the first hits
+        */
+        ImagePtr _Albedo = nullptr;
+
+        /**
+         * The world normal of the first hits
+        */
+        ImagePtr _Normal = nullptr;
+
+        /**
+         * The distance between the camera and the first hits, 0 without hit, row major
+        */
+        std::vector<float> _Depth = {};
+
+        /**
+         * The game object of the first hit, row major
+        */
+        std::vector<uint32_t> _ObjectID = {};
+
+        /**
+         * The material of the first hit, row major
+        */
+        std::vector<uint32_t> _MaterialID = {};
+
+        /**
+         * The number of camera samples of each pixel that hit something, row major
+        */
+        std::vector<uint32_t> _HitCount = {};
+
+        /**
+         * The number of camera samples traced for each pixel, row major
+        */
+        std::vector<uint32_t> _SampleCount = {};
+
+    public:
+        AOVBuffers(uint32_t width, uint32_t height);
+
+    public:
+        uint32_t getWidth() const {return _Width;}
+        uint32_t getHeight() const {return _Height;}
+
+        /**
+         * Reset every buffer to its value for a pixel without any sample
+        */
+        void clear();
+
+        /**
+         * Pack the variables of a pixel, to send them to another process
+         * @param i The column of the pixel
+         * @param j The row of the pixel
+         * @param packed The output, PACKED_FLOATS floats
+         * @note The identifiers and counts are copied bit for bit
+        */
+        void pack(uint32_t i, uint32_t j, std::span<float> packed) const;
+
+        /**
+         * Unpack the variables of a pixel packed by pack
+         * @param i The column of the pixel
+         * @param j The row of the pixel
+         * @param packed The input, PACKED_FLOATS floats
+        */
+        void unpack(uint32_t i, uint32_t j, std::span<const float> packed);
+};
+
+}
@@ -0,0 +1,100 @@
+#include "be_cameraRayGenerator.hpp"
+
+#include "be_vector4.hpp"
+
+#include <cassert>
+#include <cmath>
+
+namespace be{
+
+CameraRayGenerator::CameraRayGenerator(
+        const Matrix4x4& viewInv,
+        const Matrix4x4& projInv,
+        float width,
+        float height,
+        const Vector3& cameraPos
+    ) : _Origin(cameraPos){
+    Matrix4x4 clipToWorld = viewInv * projInv;
+
+    // homogeneous world point of the image coordinates, before the perspective divide
+    auto getPoint = [&](float x, float y){
+        float ndcX = (2.f * x) / width - 1.f;
+        float ndcY = 1.f - (2.f * y) / height;
+        return clipToWorld * Vector4(ndcX, ndcY, -1.f, 1.f);
+    };
+    // w * (point / w - cameraPos) is affine in x and y, and has the direction of the ray if w > 0
+    float sign = getPoint(0.5f * width, 0.5f * height).w() < 0.f ? -1.f : 1.f;
+    auto getDirection = [&](float x, float y){
+        Vector4 point = getPoint(x, y);
+        return sign * (point.xyz() - point.w() * cameraPos);
+    };
+
+    _Direction = getDirection(0.f, 0.f);
+    _StepX = getDirection(1.f, 0.f) - _Direction;
+    _StepY = getDirection(0.f, 1.f) - _Direction;
+    _PixelSpreadAngle = _StepY.getNorm() / getDirection(0.5f * width, 0.5f * height).getNorm();
+}
+
+void CameraRayGenerator::generate(
+        std::span<const float> x, std::span<const float> y,
+        std::span<float> directionX, std::span<float> directionY, std::span<float> directionZ
+    ) const {
+    assert(y.size() == x.size());
+    assert(directionX.size() >= x.size() && directionY.size() >= x.size() && directionZ.size() >= x.size());
+
+    const float dirX = _Direction.x(), dirY = _Direction.y(), dirZ = _Direction.z();
+    const float stepXX = _StepX.x(), stepXY = _StepX.y(), stepXZ = _StepX.z();
+    const float stepYX = _StepY.x(), stepYY = _StepY.y(), stepYZ = _StepY.z();
+    const size_t size = x.size();
+
+    #pragma omp simd
+    for(size_t k = 0; k<size; k++){
+        float dx = dirX + x[k]*stepXX + y[k]*stepYX;
+        float dy = dirY + x[k]*stepXY + y[k]*stepYY;
+        float dz = dirZ + x[k]*stepXZ + y[k]*stepYZ;
+        float invNorm = 1.f / std::sqrt(dx*dx + dy*dy + dz*dz);
+        directionX[k] = dx * invNorm;
+        directionY[k] = dy * invNorm;
+        directionZ[k] = dz * invNorm;
+    }
+}
+
+void CameraRayGenerator::generateTile(
+        uint32_t minI, uint32_t minJ, uint32_t maxI, uint32_t maxJ, uint32_t imageHeight,
+        std::span<const float> offsetsI, std::span<const float> offsetsJ,
+        std::span<float> directionX, std::span<float> directionY, std::span<float> directionZ
+    ) const {
+    assert(offsetsJ.size() == offsetsI.size());
+    const size_t nbSamples = offsetsI.size();
+    assert(directionX.size() >= (maxI - minI) * (maxJ - minJ) * nbSamples);
+
+    const float dirX = _Direction.x(), dirY = _Direction.y(), dirZ = _Direction.z();
+    const float stepXX = _StepX.x(), stepXY = _StepX.y(), stepXZ = _StepX.z();
+    const float stepYX = _StepY.x(), stepYY = _StepY.y(), stepYZ = _StepY.z();
+
+    size_t index = 0;
+    for(uint32_t j = minJ; j<maxJ; j++){
+        for(uint32_t i = minI; i<maxI; i++){
+            // only the offsets change inside a pixel
+            float x = static_cast<float>(i);
+            float y = static_cast<float>(imageHeight) - static_cast<float>(j);
+            float pixelX = dirX + x*stepXX + y*stepYX;
+            float pixelY = dirY + x*stepXY + y*stepYY;
+            float pixelZ = dirZ + x*stepXZ + y*stepYZ;
+
+            #pragma omp simd
+            for(size_t k = 0; k<nbSamples; k++){
+                float dx = pixelX + offsetsI[k]*stepXX - offsetsJ[k]*stepYX;
+                float dy = pixelY + offsetsI[k]*stepXY - offsetsJ[k]*stepYY;
+                float dz = pixelZ + offsetsI[k]*stepXZ - offsetsJ[k]*stepYZ;
+                float invNorm = 1.f / std::sqrt(dx*dx + dy*dy + dz*dz);
+                directionX[index + k] = dx * invNorm;
+                directionY[index + k] = dy * invNorm;
+                directionZ[index + k] = dz * invNorm;
+            }
+            index += nbSamples;
+        }
+    }
+}
+
+}
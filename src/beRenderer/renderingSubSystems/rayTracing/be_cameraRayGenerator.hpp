@@ -0,0 +1,128 @@
+#pragma once
+
+#include "be_matrix4x4.hpp"
+#include "be_ray.hpp"
+#include "be_vector3.hpp"
+
+#include <memory>
+#include <span>
+
+namespace be{
+
+class CameraRayGenerator;
+using CameraRayGeneratorPtr = std::shared_ptr<CameraRayGenerator>;
+
+/**
+ * Generate the primary rays of a pinhole camera without any matrix product per ray
+ * @note The unnormalized direction of Ray::rayAt is affine in the image coordinates,
+ * the generator only stores its value at the origin and its steps along x and y
+ * @see Ray::rayAt
+*/
+class CameraRayGenerator{
+    private:
+        Vector3 _Origin{};
+
+        /**
+         * The unnormalized direction at the image coordinates (0,0)
+        */
+        Vector3 _Direction{};
+
+        /**
+         * The step of the unnormalized direction for one unit along x
+        */
+        Vector3 _StepX{};
+
+        /**
+         * The step of the unnormalized direction for one unit along y
+        */
+        Vector3 _StepY{};
+
+        /**
+         * The angle covered by a pixel at the center of the image
+        */
+        float _PixelSpreadAngle = 0.f;
+
+    public:
+        CameraRayGenerator(){};
+
+        /**
+         * Precompute the image plane of a camera, once per frame
+         * @param viewInv The inverse of the view matrix
+         * @param projInv The inverse of the projection matrix
+         * @param width The viewport width
+         * @param height The viewport height
+         * @param cameraPos The camera world position
+         * @note Same parameters as Ray::rayAt
+        */
+        CameraRayGenerator(
+            const Matrix4x4& viewInv,
+            const Matrix4x4& projInv,
+            float width,
+            float height,
+            const Vector3& cameraPos
+        );
+
+    public:
+        Vector3 getOrigin() const {return _Origin;}
+
+        /**
+         * Getter for the spread angle of the ray cones of the primary rays
+         * @return The angle of a pixel, in radians
+        */
+        float getPixelSpreadAngle() const {return _PixelSpreadAngle;}
+
+        /**
+         * Get the direction of a ray
+         * @param x The x as a float for sub-pixel sampling
+         * @param y The y as a float for sub-pixel sampling
+         * @return The normalized world direction, the same as Ray::rayAt
+        */
+        Vector3 getDirection(float x, float y) const {
+            return Vector3::normalize(_Direction + x*_StepX + y*_StepY);
+        }
+
+        /**
+         * Create a ray from the camera
+         * @param x The x as a float for sub-pixel sampling
+         * @param y The y as a float for sub-pixel sampling
+         * @return A ray in world space
+        */
+        Ray getRay(float x, float y) const {
+            return Ray(_Origin, getDirection(x, y));
+        }
+
+        /**
+         * Get the directions of a batch of rays, vectorized
+         * @param x The x of each ray
+         * @param y The y of each ray, same size as x
+         * @param directionX The x component of the normalized directions, same size as x
+         * @param directionY The y component of the normalized directions, same size as x
+         * @param directionZ The z component of the normalized directions, same size as x
+         * @note All the rays start at the camera position
+        */
+        void generate(
+            std::span<const float> x, std::span<const float> y,
+            std::span<float> directionX, std::span<float> directionY, std::span<float> directionZ
+        ) const;
+
+        /**
+         * Get the directions of every sample of a block of pixels, vectorized
+         * @param minI The first column of the block
+         * @param minJ The first row of the block
+         * @param maxI The column after the block
+         * @param maxJ The row after the block
+         * @param imageHeight The height of the image, rows go downward
+         * @param offsetsI The subpixel offsets of the samples along the columns
+         * @param offsetsJ The subpixel offsets of the samples along the rows, same size as offsetsI
+         * @param directionX The x component of the directions, one per sample of each pixel, row major
+         * @param directionY The y component of the directions, same layout as directionX
+         * @param directionZ The z component of the directions, same layout as directionX
+        */
+        void generateTile(
+            uint32_t minI, uint32_t minJ, uint32_t maxI, uint32_t maxJ, uint32_t imageHeight,
+            std::span<const float> offsetsI, std::span<const float> offsetsJ,
+            std::span<float> directionX, std::span<float> directionY, std::span<float> directionZ
+        ) const;
+};
+
+}
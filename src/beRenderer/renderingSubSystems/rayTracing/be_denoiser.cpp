@@ -0,0 +1,114 @@
+#include "be_denoiser.hpp"
+#include "be_errorHandler.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace be{
+
+void Denoiser::denoise(Image& color, const Image& albedo, const Image& normal, std::span<const float> depth) const {
+    uint32_t width = color.getWidth();
+    uint32_t height = color.getHeight();
+    if(albedo.getWidth() != width || albedo.getHeight() != height
+        || normal.getWidth() != width || normal.getHeight() != height
+        || depth.size() != static_cast<size_t>(width) * height){
+        ErrorHandler::handle(
+            __FILE__, __LINE__,
+            ErrorCode::BAD_VALUE_ERROR,
+            "Can't denoise an image with guide buffers of a different size!\n"
+        );
+    }
+
+    // ping pong between the image and a scratch copy
+    Image scratch(color);
+    Image* input = &color;
+    Image* output = &scratch;
+    float colorSigma = _ColorSigma;
+    for(uint32_t i=0; i<_Iterations; i++){
+        filterPass(*input, *output, albedo, normal, depth, 1u << i, colorSigma);
+        std::swap(input, output);
+        colorSigma *= 0.5f;
+    }
+    if(input != &color){
+        color = std::move(*input);
+    }
+}
+
+void Denoiser::filterPass(const Image& input, Image& output,
+        const Image& albedo, const Image& normal, std::span<const float> depth,
+        uint32_t stepSize, float colorSigma) const {
+    // B3 spline
+    constexpr float kernel[5] = {1.f/16.f, 1.f/4.f, 3.f/8.f, 1.f/4.f, 1.f/16.f};
+    constexpr uint32_t channels = Image::CHANNELS;
+    int width = input.getWidth();
+    int height = input.getHeight();
+    int step = stepSize;
+    float invColor = 1.f / std::max(colorSigma*colorSigma, 1e-12f);
+    float invNormal = 1.f / std::max(_NormalSigma*_NormalSigma, 1e-12f);
+    float invAlbedo = 1.f / std::max(_AlbedoSigma*_AlbedoSigma, 1e-12f);
+    float invDepth = 1.f / std::max(_DepthSigma, 1e-12f);
+
+    # pragma omp parallel for schedule(static)
+    for(int y=0; y<height; y++){
+        float* dst = output.getRow(y).data();
+        const float* colorRow = input.getRow(y).data();
+        const float* albedoRow = albedo.getRow(y).data();
+        const float* normalRow = normal.getRow(y).data();
+        const float* depthRow = depth.data() + static_cast<size_t>(y) * width;
+
+        for(int x=0; x<width; x++){
+            const float* c = colorRow + x*channels;
+            const float* a = albedoRow + x*channels;
+            const float* n = normalRow + x*channels;
+            float d = depthRow[x];
+            float invD = invDepth / std::max(d, 1e-6f);
+
+            float sum[channels] = {0.f, 0.f, 0.f};
+            float weightSum = 0.f;
+            for(int ky=0; ky<5; ky++){
+                int qy = y + (ky - 2) * step;
+                if(qy < 0 || qy >= height){
+                    continue;
+                }
+                const float* colorRowQ = input.getRow(qy).data();
+                const float* albedoRowQ = albedo.getRow(qy).data();
+                const float* normalRowQ = normal.getRow(qy).data();
+                const float* depthRowQ = depth.data() + static_cast<size_t>(qy) * width;
+                for(int kx=0; kx<5; kx++){
+                    int qx = x + (kx - 2) * step;
+                    if(qx < 0 || qx >= width){
+                        continue;
+                    }
+                    const float* cq = colorRowQ + qx*channels;
+                    const float* aq = albedoRowQ + qx*channels;
+                    const float* nq = normalRowQ + qx*channels;
+                    float colorDist = 0.f;
+                    float albedoDist = 0.f;
+                    float normalDist = 0.f;
+                    for(uint32_t k=0; k<channels; k++){
+                        colorDist += (c[k] - cq[k]) * (c[k] - cq[k]);
+                        albedoDist += (a[k] - aq[k]) * (a[k] - aq[k]);
+                        normalDist += (n[k] - nq[k]) * (n[k] - nq[k]);
+                    }
+                    float depthDist = std::fabs(d - depthRowQ[qx]);
+                    float weight = kernel[ky] * kernel[kx] * std::exp(
+                        - colorDist*invColor
+                        - albedoDist*invAlbedo
+                        - normalDist*invNormal
+                        - depthDist*invD
+                    );
+                    for(uint32_t k=0; k<channels; k++){
+                        sum[k] += weight * cq[k];
+                    }
+                    weightSum += weight;
+                }
+            }
+            // weightSum is never null, the center tap weighs kernel[2]^2
+            for(uint32_t k=0; k<channels; k++){
+                dst[x*channels + k] = sum[k] / weightSum;
+            }
+        }
+    }
+}
+
+}
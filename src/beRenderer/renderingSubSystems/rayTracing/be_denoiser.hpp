@@ -0,0 +1,61 @@
+#pragma once
+
+#include "be_image.hpp"
+
+#include <memory>
+#include <span>
+
+namespace be{
+
+class Denoiser;
+using DenoiserPtr = std::shared_ptr<Denoiser>;
+
+/**
+ * An edge avoiding à-trous wavelet filter guided by albedo, normal and depth buffers
+ * @see https://jo.dreggn.org/home/2010_atrous.pdf
+*/
+class Denoiser{
+    public:
+        /**
+         * The number of filter passes, the step between taps doubles at each pass
+        */
+        uint32_t _Iterations = 5;
+
+        /**
+         * The tolerance on color differences, halved at each pass
+        */
+        float _ColorSigma = 0.6f;
+
+        /**
+         * The tolerance on normal differences
+        */
+        float _NormalSigma = 0.1f;
+
+        /**
+         * The tolerance on albedo differences
+        */
+        float _AlbedoSigma = 0.1f;
+
+        /**
+         * The tolerance on depth differences, relative to the depth of the filtered pixel
+        */
+        float _DepthSigma = 0.05f;
+
+    public:
+        /**
+         * Filter an image in place
+         * @param color The image to denoise
+         * @param albedo The albedo of the first hits, same size as color
+         * @param normal The normal of the first hits, same size as color
+         * @param depth The distance to the first hits, 0 where there is no hit, row major
+        */
+        void denoise(Image& color, const Image& albedo, const Image& normal, std::span<const float> depth) const;
+
+    private:
+        void filterPass(const Image& input, Image& output,
+            const Image& albedo, const Image& normal, std::span<const float> depth,
+            uint32_t stepSize, float colorSigma
+        ) const;
+};
+
+}
@@ -1,17 +1,18 @@
 #include "be_image.hpp"
 #include "be_errorHandler.hpp"
+#include "stb_image_write.h"
 
+#include <algorithm>
+#include <bit>
+#include <cstring>
 #include <iostream>
 #include <fstream>
 
 namespace be{
 
-Image::Image(uint32_t width, uint32_t height)
-    :_Width(width), _Height(height){
-    _Pixels = Pixels(height);
-    for(size_t i=0; i<height; i++){
-        _Pixels[i] = std::vector<Vector3>(width);
-    }
+Image::Image(uint32_t width, uint32_t height){
+    allocate(width, height);
+    std::fill_n(_Data.get(), static_cast<size_t>(_RowPitch) * _Height, 0.f);
 }
 
 Image::Image(const Pixels& pixels){
@@ -22,20 +23,38 @@ Image::Image(const Pixels& pixels){
             "Can't initialize an image with a matrix of width or height null!\n"
         );
     }
-    _Height = pixels.size();
-    _Width = pixels[0].size();
-    _Pixels = Pixels(_Height);
-    for(size_t i=0; i<_Height; i++){
-        _Pixels[i] = std::vector<Vector3>(_Width);
-        for(size_t j=0; j<_Width; j++){
-            _Pixels[i][j] = pixels[i][j]; // assume pixels is a rectangle with constant width
+    allocate(pixels[0].size(), pixels.size());
+    std::fill_n(_Data.get(), static_cast<size_t>(_RowPitch) * _Height, 0.f);
+    for(uint32_t y=0; y<_Height; y++){
+        for(uint32_t x=0; x<_Width; x++){
+            setUnchecked(x, y, pixels[y][x]); // assume pixels is a rectangle with constant width
         }
     }
 }
 
-Image::Image(ImagePtr image):Image(image->getPixels()){}
+Image::Image(ImagePtr image):Image(*image){}
 
-Image::Image(const Image& image):Image(image.getPixels()){}
+Image::Image(const Image& image){
+    allocate(image._Width, image._Height);
+    std::memcpy(_Data.get(), image._Data.get(), sizeof(float) * _RowPitch * _Height);
+}
+
+Image& Image::operator=(const Image& image){
+    if(this != &image){
+        allocate(image._Width, image._Height);
+        std::memcpy(_Data.get(), image._Data.get(), sizeof(float) * _RowPitch * _Height);
+    }
+    return *this;
+}
+
+void Image::allocate(uint32_t width, uint32_t height){
+    constexpr uint32_t floatsPerLine = ALIGNMENT / sizeof(float);
+    _Width = width;
+    _Height = height;
+    _RowPitch = (width * CHANNELS + floatsPerLine - 1) / floatsPerLine * floatsPerLine;
+    size_t size = std::max<size_t>(1, static_cast<size_t>(_RowPitch) * _Height);
+    _Data = std::unique_ptr<float[], AlignedDeleter>(new (std::align_val_t(ALIGNMENT)) float[size]);
+}
 
 void Image::checkIndices(uint32_t x, uint32_t y) const{
     if(x>=_Width){
@@ -57,58 +76,193 @@ void Image::checkIndices(uint32_t x, uint32_t y) const{
 }
 
 
+Pixels Image::getPixels() const {
+    Pixels pixels(_Height, std::vector<Vector3>(_Width));
+    for(uint32_t y=0; y<_Height; y++){
+        std::span<const float> row = getRow(y);
+        for(uint32_t x=0; x<_Width; x++){
+            pixels[y][x] = Vector3(row[x*CHANNELS], row[x*CHANNELS+1], row[x*CHANNELS+2]);
+        }
+    }
+    return pixels;
+}
+
 const Vector3 Image::get(uint32_t x, uint32_t y) const {
     checkIndices(x, y);
-    return _Pixels[y][x];
+    const float* pixel = _Data.get() + static_cast<size_t>(y) * _RowPitch + static_cast<size_t>(x) * CHANNELS;
+    return Vector3(pixel[0], pixel[1], pixel[2]);
 }
 
 void Image::set(uint32_t x, uint32_t y, const Vector3& color, Color::ColorSpace space){
     checkIndices(x, y);
-    switch(space){
-        case Color::RGB:
-            _Pixels[y][x] = color;
-            break;
-        case Color::SRGB:
-            // Vector3 gammaCorrected = Color::linearToGamma(color);
-            Vector3 gammaCorrected = color;
-            _Pixels[y][x] = Color::toSRGB(gammaCorrected);
-            break;
-    }
+    setUnchecked(x, y, color, space);
 }
 
 void Image::clear(const Vector3& color){
-    for(uint32_t y=0; y<_Height; y++){
-        for(uint32_t x=0; x<_Width; x++){
-            set(x, y, color, Color::RGB);
-        }
+    if(_Height == 0){
+        return;
+    }
+    // fill the first row then copy it to the others
+    std::span<float> firstRow = getRow(0);
+    for(uint32_t x=0; x<_Width; x++){
+        firstRow[x*CHANNELS] = color.r();
+        firstRow[x*CHANNELS+1] = color.g();
+        firstRow[x*CHANNELS+2] = color.b();
+    }
+    for(uint32_t y=1; y<_Height; y++){
+        std::copy(firstRow.begin(), firstRow.end(), getRow(y).begin());
     }
 }
 
-void Image::savePPM(const std::string& fileName) const {
+void Image::savePPM(const std::string& fileName, ErrorLevel level) const {
     std::ofstream out(fileName.c_str());
     if (!out){
         ErrorHandler::handle(
             __FILE__, __LINE__,
             ErrorCode::IO_ERROR,
-            "Cannot open the file `" + fileName + "', to store the image!\n"
+            "Cannot open the file `" + fileName + "', to store the image!\n",
+            level
         );
+        return;
     }
     out << "P3" << std::endl
         << _Width << " " << _Height << std::endl
         << "255" << std::endl;
-    for (size_t y = 0; y < _Height; y++){
-        for (size_t x = 0; x < _Width; x++) {
-            Vector3 color = get(x,y);
-            float r = color.r() * 255.f;
-            float g = color.g() * 255.f;
-            float b = color.b() * 255.f;
-            out << std::min(255u, static_cast<uint32_t>(r))<< " "
-                << std::min(255u, static_cast<uint32_t>(g))<< " "
-                << std::min(255u, static_cast<uint32_t>(b))<< " ";
+    for (uint32_t y = 0; y < _Height; y++){
+        std::span<const float> row = getRow(y);
+        for (uint32_t x = 0; x < _Width; x++) {
+            out << static_cast<uint32_t>(toSRGBByte(row[x*CHANNELS]))<< " "
+                << static_cast<uint32_t>(toSRGBByte(row[x*CHANNELS+1]))<< " "
+                << static_cast<uint32_t>(toSRGBByte(row[x*CHANNELS+2]))<< " ";
         }
         out << std::endl;
     }
     out.close();
+    if(!out){
+        ErrorHandler::handle(
+            __FILE__, __LINE__,
+            ErrorCode::IO_ERROR,
+            "Cannot write the file `" + fileName + "', to store the image!\n",
+            level
+        );
+    }
+}
+
+/**
+ * Convert the image to packed sRGB bytes, rows are converted in parallel
+ * @return The width*height*3 bytes
+*/
+std::vector<unsigned char> Image::toRGBBytes() const {
+    size_t rowSize = static_cast<size_t>(_Width) * CHANNELS;
+    std::vector<unsigned char> bytes(rowSize * _Height);
+    # pragma omp parallel for
+    for(uint32_t y=0; y<_Height; y++){
+        const float* row = getRow(y).data();
+        unsigned char* dst = bytes.data() + y * rowSize;
+        for(size_t i=0; i<rowSize; i++){
+            dst[i] = toSRGBByte(row[i]);
+        }
+    }
+    return bytes;
+}
+
+void Image::saveP6(const std::string& fileName, ErrorLevel level) const {
+    std::vector<unsigned char> bytes = toRGBBytes();
+    std::ofstream out(fileName.c_str(), std::ios::binary);
+    if (!out){
+        ErrorHandler::handle(
+            __FILE__, __LINE__,
+            ErrorCode::IO_ERROR,
+            "Cannot open the file `" + fileName + "', to store the image!\n",
+            level
+        );
+        return;
+    }
+    out << "P6\n" << _Width << " " << _Height << "\n255\n";
+    out.write(reinterpret_cast<const char*>(bytes.data()), bytes.size());
+    out.close();
+    if(!out){
+        ErrorHandler::handle(
+            __FILE__, __LINE__,
+            ErrorCode::IO_ERROR,
+            "Cannot write the file `" + fileName + "', to store the image!\n",
+            level
+        );
+    }
+}
+
+void Image::savePFM(const std::string& fileName, ErrorLevel level) const {
+    std::ofstream out(fileName.c_str(), std::ios::binary);
+    if (!out){
+        ErrorHandler::handle(
+            __FILE__, __LINE__,
+            ErrorCode::IO_ERROR,
+            "Cannot open the file `" + fileName + "', to store the image!\n",
+            level
+        );
+        return;
+    }
+    // a negative scale means little endian
+    out << "PF\n" << _Width << " " << _Height << "\n" 
+        << (std::endian::native == std::endian::little ? "-1.0" : "1.0") << "\n";
+    // the rows are stored from bottom to top, the linear floats are written as is
+    for(uint32_t y=_Height; y-- > 0;){
+        std::span<const float> row = getRow(y);
+        out.write(reinterpret_cast<const char*>(row.data()), row.size_bytes());
+    }
+    out.close();
+    if(!out){
+        ErrorHandler::handle(
+            __FILE__, __LINE__,
+            ErrorCode::IO_ERROR,
+            "Cannot write the file `" + fileName + "', to store the image!\n",
+            level
+        );
+    }
+}
+
+void Image::savePNG(const std::string& fileName, ErrorLevel level) const {
+    std::vector<unsigned char> bytes = toRGBBytes();
+    int stride = static_cast<int>(_Width * CHANNELS);
+    if(stbi_write_png(fileName.c_str(), _Width, _Height, CHANNELS, bytes.data(), stride) == 0){
+        ErrorHandler::handle(
+            __FILE__, __LINE__,
+            ErrorCode::IO_ERROR,
+            "Cannot write the file `" + fileName + "', to store the image!\n",
+            level
+        );
+    }
+}
+
+void Image::save(const std::string& fileName, FileFormat format, ErrorLevel level) const {
+    switch(format){
+        case PPM_ASCII:
+            savePPM(fileName, level);
+            return;
+        case PPM_BINARY:
+            saveP6(fileName, level);
+            return;
+        case PFM:
+            savePFM(fileName, level);
+            return;
+        case PNG:
+            savePNG(fileName, level);
+            return;
+    }
+    ErrorHandler::handle(
+        __FILE__, __LINE__,
+        ErrorCode::UNKNOWN_VALUE_ERROR,
+        "The given image format is unkown!\n",
+        level
+    );
+}
+
+std::future<void> Image::saveAsync(const Image& image, const std::string& fileName, FileFormat format){
+    auto snapshot = std::make_shared<Image>(image);
+    return std::async(std::launch::async, [snapshot, fileName, format](){
+        // exiting from here would tear down the statics under the feet of the rendering threads
+        snapshot->save(fileName, format, ErrorLevel::WARNING);
+    });
 }
 
 
@@ -116,17 +270,48 @@ std::vector<unsigned char> Image::pixelsToVectorOfBytes(const Pixels& pixels){
     std::vector<unsigned char> res = {};
     for(const auto& row : pixels){
         for(const auto& color : row){
-            float r = color.r() * 255.f;
-            float g = color.g() * 255.f;
-            float b = color.b() * 255.f;
-            res.push_back(static_cast<unsigned char>(std::min(255u, static_cast<uint32_t>(r))));
-            res.push_back(static_cast<unsigned char>(std::min(255u, static_cast<uint32_t>(g))));
-            res.push_back(static_cast<unsigned char>(std::min(255u, static_cast<uint32_t>(b))));
+            res.push_back(toSRGBByte(color.r()));
+            res.push_back(toSRGBByte(color.g()));
+            res.push_back(toSRGBByte(color.b()));
             res.push_back(0xFF);
         }
     }
     return res;
 }
 
+std::vector<unsigned char> Image::pixelsToVectorOfBytes(const Image& image){
+    std::vector<unsigned char> res(static_cast<size_t>(image._Width) * image._Height * 4);
+    pixelsToBytes(image, res);
+    return res;
+}
 
-}
\ No newline at end of file
+/**
+ * Convert the image to sRGB bytes with an opaque alpha
+ * @param image The image to convert
+ * @param bytes The destination, at least width*height*4 bytes, e.g. a mapped staging buffer
+*/
+void Image::pixelsToBytes(const Image& image, std::span<unsigned char> bytes){
+    size_t size = static_cast<size_t>(image._Width) * image._Height * 4;
+    if(bytes.size() < size){
+        ErrorHandler::handle(
+            __FILE__, __LINE__,
+            ErrorCode::OUT_OF_RANGE_ERROR,
+            "Can't convert an image of " + std::to_string(size) + " bytes in a buffer of "
+            + std::to_string(bytes.size()) + " bytes!\n"
+        );
+    }
+    unsigned char* dst = bytes.data();
+    for(uint32_t y=0; y<image._Height; y++){
+        const float* row = image.getRow(y).data();
+        for(uint32_t x=0; x<image._Width; x++){
+            for(uint32_t c=0; c<CHANNELS; c++){
+                dst[c] = toSRGBByte(row[x*CHANNELS+c]);
+            }
+            dst[3] = 0xFF;
+            dst += 4;
+        }
+    }
+}
+
+
+}
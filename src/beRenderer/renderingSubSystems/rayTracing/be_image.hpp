@@ -2,10 +2,16 @@
 
 #include "be_vector3.hpp"
 #include "be_color.hpp"
+#include "be_errorHandler.hpp"
 #include "be_timer.hpp"
 
-#include <vector>
+#include <algorithm>
+#include <cstddef>
+#include <future>
 #include <memory>
+#include <new>
+#include <span>
+#include <vector>
 
 namespace be{
 
@@ -14,36 +20,155 @@ using ImagePtr = std::shared_ptr<Image>;
 
 using Pixels = std::vector<std::vector<Vector3>>;
 
+/**
+ * A float RGB framebuffer stored as a single contiguous block
+ * @note Rows are padded so that each one starts on a cache line
+ * @note The values are linear, they are only encoded in sRGB when converted to 8 bits
+*/
 class Image{
+    public:
+        /**
+         * The number of floats per pixel
+        */
+        static constexpr uint32_t CHANNELS = 3;
+
+        /**
+         * The alignment of the buffer and of each row, in bytes
+        */
+        static constexpr size_t ALIGNMENT = 64;
+
+        enum FileFormat{
+            PPM_ASCII,  // P3, 8 bits sRGB per channel
+            PPM_BINARY, // P6, 8 bits sRGB per channel
+            PFM,        // portable float map, 32 bits linear float per channel
+            PNG,        // png through stb_image_write, 8 bits sRGB per channel
+        };
 
     private:
+        struct AlignedDeleter{
+            void operator()(float* data) const {
+                ::operator delete[](data, std::align_val_t(ALIGNMENT));
+            }
+        };
+
         uint32_t _Width = 0;
         uint32_t _Height = 0;
 
-        Pixels _Pixels = {};
+        /**
+         * The number of floats between the start of two consecutive rows
+        */
+        uint32_t _RowPitch = 0;
+
+        std::unique_ptr<float[], AlignedDeleter> _Data = nullptr;
 
     public:
         Image(uint32_t width, uint32_t height);
         Image(const Pixels& pixels);
         Image(ImagePtr image);
         Image(const Image& image);
+        Image(Image&& image) = default;
+
+        Image& operator=(const Image& image);
+        Image& operator=(Image&& image) = default;
 
     public:
         uint32_t getWidth() const {return _Width;}
         uint32_t getHeight() const {return _Height;}
-        const Pixels getPixels() const {return _Pixels;}
+        uint32_t getRowPitch() const {return _RowPitch;}
+
+        /**
+         * Getter for the whole buffer, row padding included
+         * @return A view over getRowPitch()*getHeight() floats
+        */
+        std::span<const float> getData() const {
+            return {_Data.get(), static_cast<size_t>(_RowPitch) * _Height};
+        }
+
+        /**
+         * Getter for a row of the image, without its padding
+         * @param y The ordinate of the row
+         * @return A view over getWidth()*CHANNELS floats
+        */
+        std::span<float> getRow(uint32_t y) {
+            return {_Data.get() + static_cast<size_t>(y) * _RowPitch, static_cast<size_t>(_Width) * CHANNELS};
+        }
+
+        /**
+         * Getter for a row of the image, without its padding
+         * @param y The ordinate of the row
+         * @return A view over getWidth()*CHANNELS floats
+        */
+        std::span<const float> getRow(uint32_t y) const {
+            return {_Data.get() + static_cast<size_t>(y) * _RowPitch, static_cast<size_t>(_Width) * CHANNELS};
+        }
+
+        /**
+         * Copy the pixels in a matrix
+         * @return The matrix of pixels
+         * @note Prefer getRow or getData which do not copy
+        */
+        Pixels getPixels() const;
         const Vector3 get(uint32_t x, uint32_t y) const;
 
         void set(uint32_t x, uint32_t y, const Vector3& color, Color::ColorSpace space = Color::RGB);
 
+        /**
+         * Set a pixel without checking the indices
+         * @param x The abscissa of the pixel, must be less than the width
+         * @param y The ordinate of the pixel, must be less than the height
+         * @param color The color to set
+         * @param space The color space in which to store the color
+        */
+        void setUnchecked(uint32_t x, uint32_t y, const Vector3& color, Color::ColorSpace space = Color::RGB){
+            float* pixel = _Data.get() + static_cast<size_t>(y) * _RowPitch + static_cast<size_t>(x) * CHANNELS;
+            if(space == Color::SRGB){
+                pixel[0] = Color::linearToSRGB(color.r());
+                pixel[1] = Color::linearToSRGB(color.g());
+                pixel[2] = Color::linearToSRGB(color.b());
+            } else {
+                pixel[0] = color.r();
+                pixel[1] = color.g();
+                pixel[2] = color.b();
+            }
+        }
+
     public:
         void clear(const Vector3& color = {});
-        void savePPM(const std::string& fileName = "tmp/" + Timer::getCurrentDateAndTime() + ".ppm") const;
+        // a failed writing is reported at the given level, the file is then incomplete or missing
+        void savePPM(const std::string& fileName = "tmp/" + Timer::getCurrentDateAndTime() + ".ppm", ErrorLevel level = FATAL) const;
+        void saveP6(const std::string& fileName = "tmp/" + Timer::getCurrentDateAndTime() + ".ppm", ErrorLevel level = FATAL) const;
+        void savePFM(const std::string& fileName = "tmp/" + Timer::getCurrentDateAndTime() + ".pfm", ErrorLevel level = FATAL) const;
+        void savePNG(const std::string& fileName = "tmp/" + Timer::getCurrentDateAndTime() + ".png", ErrorLevel level = FATAL) const;
+        void save(const std::string& fileName, FileFormat format, ErrorLevel level = FATAL) const;
+
+        /**
+         * Save a snapshot of an image from a background thread
+         * @param image The image to save, copied before returning
+         * @param fileName The path of the file
+         * @param format The format of the file
+         * @return A future to wait for the end of the writing
+         * @note The failures are only reported as warnings, the background thread never exits the process
+        */
+        static std::future<void> saveAsync(const Image& image, const std::string& fileName, FileFormat format);
 
         static std::vector<unsigned char> pixelsToVectorOfBytes(const Pixels& pixels);
+        static std::vector<unsigned char> pixelsToVectorOfBytes(const Image& image);
+        static void pixelsToBytes(const Image& image, std::span<unsigned char> bytes);
 
     private:
+        /**
+         * Encode a linear value in sRGB on 8 bits
+         * @param linear The linear value, clamped to [0,1]
+         * @return The sRGB byte
+        */
+        static unsigned char toSRGBByte(float linear){
+            float value = Color::linearToSRGB(std::clamp(linear, 0.f, 1.f)) * 255.f;
+            return static_cast<unsigned char>(std::min(255u, static_cast<uint32_t>(value + 0.5f)));
+        }
+
+        void allocate(uint32_t width, uint32_t height);
+        std::vector<unsigned char> toRGBBytes() const;
         void checkIndices(uint32_t x, uint32_t y) const;
 };
 
-}
\ No newline at end of file
+}
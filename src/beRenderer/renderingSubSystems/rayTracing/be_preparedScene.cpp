@@ -0,0 +1,493 @@
+#include "be_preparedScene.hpp"
+
+#include "be_components.hpp" // IWYU pragma: keep
+#include "be_errorHandler.hpp"
+#include "be_gameCoordinator.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <type_traits>
+#include <unordered_map>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define BE_PREPARED_SCENE_MMAP
+#endif
+
+namespace be{
+
+PreparedScene::PreparedScene(const std::string& fileName) : _FileName(fileName){
+    map();
+    check();
+}
+
+PreparedScene::~PreparedScene(){
+    #ifdef BE_PREPARED_SCENE_MMAP
+    if(_IsMapped){
+        munmap(const_cast<std::byte*>(_Data), _Size);
+    }
+    #endif
+}
+
+void PreparedScene::map(){
+    #ifdef BE_PREPARED_SCENE_MMAP
+    int file = open(_FileName.c_str(), O_RDONLY);
+    if(file < 0){
+        ErrorHandler::handle(
+            __FILE__, __LINE__,
+            ErrorCode::IO_ERROR,
+            "Cannot open the prepared scene `" + _FileName + "': " + std::strerror(errno) + "!\n"
+        );
+        return;
+    }
+    struct stat status{};
+    if(fstat(file, &status) != 0 || status.st_size < static_cast<off_t>(sizeof(FileHeader))){
+        // too small for a header, check tells why
+        close(file);
+        return;
+    }
+
+    // read only and shared, every process rendering the scene uses the same pages
+    void* data = mmap(nullptr, static_cast<size_t>(status.st_size), PROT_READ, MAP_SHARED, file, 0);
+    int mapError = errno;
+    close(file);
+    if(data == MAP_FAILED){
+        ErrorHandler::handle(
+            __FILE__, __LINE__,
+            ErrorCode::SYSTEM_ERROR,
+            "Cannot map the prepared scene `" + _FileName + "': " + std::strerror(mapError) + "!\n"
+        );
+        return;
+    }
+    _Data = static_cast<const std::byte*>(data);
+    _Size = static_cast<size_t>(status.st_size);
+    _IsMapped = true;
+    #else
+    read();
+    #endif
+}
+
+void PreparedScene::read(){
+    std::ifstream file(_FileName, std::ios::binary | std::ios::ate);
+    if(!file){
+        ErrorHandler::handle(
+            __FILE__, __LINE__,
+            ErrorCode::IO_ERROR,
+            "Cannot open the prepared scene `" + _FileName + "'!\n"
+        );
+        return;
+    }
+    _Size = static_cast<size_t>(file.tellg());
+    file.seekg(0);
+    // new aligns the buffer for any record
+    _Buffer = std::make_unique<std::byte[]>(_Size);
+    if(!file.read(reinterpret_cast<char*>(_Buffer.get()), _Size)){
+        ErrorHandler::handle(
+            __FILE__, __LINE__,
+            ErrorCode::IO_ERROR,
+            "Cannot read the prepared scene `" + _FileName + "'!\n"
+        );
+        return;
+    }
+    _Data = _Buffer.get();
+}
+
+void PreparedScene::check() const {
+    if(_Data == nullptr || _Size < sizeof(FileHeader) || getHeader()._Magic != MAGIC){
+        ErrorHandler::handle(
+            __FILE__, __LINE__,
+            ErrorCode::BAD_VALUE_ERROR,
+            "The file `" + _FileName + "' is not a prepared scene!\n"
+        );
+        return;
+    }
+    const FileHeader& header = getHeader();
+    if(header._Version != VERSION){
+        ErrorHandler::handle(
+            __FILE__, __LINE__,
+            ErrorCode::BAD_VALUE_ERROR,
+            "The prepared scene `" + _FileName + "' was written by another version of the engine, it must be prepared again!\n"
+        );
+        return;
+    }
+
+    // the layout of the records, then every index that the renderer follows without checking
+    const std::array<uint64_t, NB_SECTIONS> recordSizes = {
+        sizeof(TriangleAttributes), sizeof(Node), sizeof(MeshRecord), sizeof(InstanceRecord), sizeof(Node),
+        sizeof(Material), sizeof(MaterialConstants), sizeof(LightRecord), sizeof(char),
+        sizeof(AnalyticPrimitive), sizeof(Node)
+    };
+    bool isValid = header._FileSize == _Size;
+    for(uint32_t section = 0; section<NB_SECTIONS && isValid; section++){
+        const SectionRecord& record = header._Sections[section];
+        isValid = record._RecordSize == recordSizes[section]
+            && record._Offset % SECTION_ALIGNMENT == 0
+            && record._Offset <= _Size
+            && record._Count <= (_Size - record._Offset) / record._RecordSize;
+    }
+    if(isValid){
+        std::span<const char> strings = getSection<char>(STRINGS_SECTION);
+        isValid = getMaterials().size() == getMaterialConstants().size()
+            && (strings.empty() || strings.back() == '\0');
+        for(const MeshRecord& mesh : getMeshes()){
+            isValid = isValid
+                && static_cast<uint64_t>(mesh._FirstTriangle) + mesh._NbTriangles <= getTriangles().size()
+                && static_cast<uint64_t>(mesh._FirstNode) + mesh._NbNodes <= getNodes().size()
+                && (mesh._NbTriangles == 0) == (mesh._NbNodes == 0)
+                && static_cast<uint64_t>(mesh._FirstPrimitive) + mesh._NbPrimitives <= getPrimitives().size()
+                && static_cast<uint64_t>(mesh._FirstPrimitiveNode) + mesh._NbPrimitiveNodes <= getPrimitiveNodes().size()
+                && (mesh._NbPrimitives == 0) == (mesh._NbPrimitiveNodes == 0);
+            // the children and the leaves are relative to the ranges of the mesh
+            isValid = isValid
+                && isValidHierarchy(getNodes().subspan(mesh._FirstNode, mesh._NbNodes), mesh._NbTriangles, false)
+                && isValidHierarchy(getPrimitiveNodes().subspan(mesh._FirstPrimitiveNode, mesh._NbPrimitiveNodes), mesh._NbPrimitives, false);
+        }
+        for(const AnalyticPrimitive& primitive : getPrimitives()){
+            isValid = isValid && primitive._Type <= AnalyticPrimitive::DISK && primitive._Axis < 3;
+        }
+        for(const InstanceRecord& instance : getInstances()){
+            isValid = isValid
+                && instance._Mesh < getMeshes().size()
+                && instance._Material < getMaterials().size();
+            for(uint32_t offset : {instance._BaseColorMap, instance._RoughnessMap, instance._MetallicMap}){
+                isValid = isValid && (offset == NO_STRING || offset < strings.size());
+            }
+        }
+        for(const LightRecord& light : getLights()){
+            isValid = isValid && light._Type <= ORIENTED_LIGHT;
+        }
+        // the leaves of the instances hold the index of their instance
+        isValid = isValid && isValidHierarchy(getInstanceNodes(), getInstances().size(), true);
+    }
+    if(!isValid){
+        ErrorHandler::handle(
+            __FILE__, __LINE__,
+            ErrorCode::BAD_VALUE_ERROR,
+            "The prepared scene `" + _FileName + "' is truncated or corrupted!\n"
+        );
+    }
+}
+
+bool PreparedScene::isValidHierarchy(std::span<const Node> nodes, uint64_t nbItems, bool isOneItemPerLeaf){
+    if(nodes.empty()){
+        return true;
+    }
+    // the traversal of the renderer, which must pop the nodes in their order
+    std::array<uint32_t, BoxHierarchy::MAX_DEPTH> stack;
+    uint32_t stackSize = 0;
+    stack[stackSize++] = 0;
+    uint64_t nbVisited = 0;
+    while(stackSize > 0){
+        uint32_t nodeIndex = stack[--stackSize];
+        if(nodeIndex != nbVisited || nodeIndex >= nodes.size()){
+            return false;
+        }
+        nbVisited++;
+        const Node& node = nodes[nodeIndex];
+        if(node.isLeaf()){
+            bool isInRange = isOneItemPerLeaf
+                ? node._Count == 1 && node._First < nbItems
+                : static_cast<uint64_t>(node._First) + node._Count <= nbItems;
+            if(!isInRange){
+                return false;
+            }
+            continue;
+        }
+        if(stackSize + 2 > stack.size() || node._RightChild <= nodeIndex + 1){
+            return false;
+        }
+        stack[stackSize++] = node._RightChild;
+        stack[stackSize++] = nodeIndex + 1;
+    }
+    return nbVisited == nodes.size();
+}
+
+std::string PreparedScene::getString(uint32_t offset) const {
+    if(offset == NO_STRING){
+        return "";
+    }
+    return std::string(getSection<char>(STRINGS_SECTION).data() + offset);
+}
+
+MaterialTextures PreparedScene::getTextures(const InstanceRecord& instance) const {
+    MaterialTextures textures{};
+    textures._BaseColor = getString(instance._BaseColorMap);
+    textures._Roughness = getString(instance._RoughnessMap);
+    textures._Metallic = getString(instance._MetallicMap);
+    return textures;
+}
+
+ScenePtr PreparedScene::createScene() const {
+    ScenePtr scene = ScenePtr(new Scene());
+    for(const LightRecord& light : getLights()){
+        switch(light._Type){
+            case POINT_LIGHT:{
+                PointLightPtr pointLight = PointLightPtr(new PointLight());
+                pointLight->_Position = light._Position;
+                pointLight->_Color = light._Color;
+                pointLight->_Intensity = light._Intensity;
+                scene->addGamePointLight(pointLight);
+                break;
+            }
+            case DIRECTIONAL_LIGHT:{
+                DirectionalLightPtr directionalLight = DirectionalLightPtr(new DirectionalLight());
+                directionalLight->_Direction = light._Direction;
+                directionalLight->_Color = light._Color;
+                directionalLight->_Intensity = light._Intensity;
+                scene->addGameDirectionalLight(directionalLight);
+                break;
+            }
+            case ORIENTED_LIGHT:{
+                OrientedLightPtr orientedLight = OrientedLightPtr(new OrientedLight());
+                orientedLight->_Position = light._Position;
+                orientedLight->_Direction = light._Direction;
+                orientedLight->_Color = light._Color;
+                orientedLight->_Intensity = light._Intensity;
+                orientedLight->_Angle = light._Angle;
+                orientedLight->_MinSquaredDistance = light._MinSquaredDistance;
+                scene->addGameOrientedLight(orientedLight);
+                break;
+            }
+            default:
+                ErrorHandler::handle(
+                    __FILE__, __LINE__,
+                    ErrorCode::UNKNOWN_VALUE_ERROR,
+                    "The given light type is unknown!\n"
+                );
+                break;
+        }
+    }
+    return scene;
+}
+
+PreparedScene::MatrixRecord PreparedScene::toRecord(const Matrix4x4& matrix){
+    MatrixRecord record{};
+    for(int i=0; i<4; i++){
+        record[i] = matrix[i];
+    }
+    return record;
+}
+
+void PreparedScene::save(ScenePtr scene, const std::string& fileName){
+    std::vector<TriangleAttributes> triangles{};
+    std::vector<Node> nodes{};
+    std::vector<AnalyticPrimitive> primitives{};
+    std::vector<Node> primitiveNodes{};
+    std::vector<MeshRecord> meshes{};
+    std::vector<InstanceRecord> instances{};
+    std::vector<Material> materials{};
+    std::vector<MaterialConstants> materialConstants{};
+    std::vector<LightRecord> lights{};
+    std::vector<char> strings{};
+
+    std::unordered_map<std::string, uint32_t> stringOffsets{};
+    auto addString = [&strings, &stringOffsets](const std::string& string){
+        if(string.empty()){
+            return NO_STRING;
+        }
+        auto [stringIt, isNewString] = stringOffsets.try_emplace(string, strings.size());
+        if(isNewString){
+            strings.insert(strings.end(), string.begin(), string.end());
+            strings.push_back('\0');
+        }
+        return stringIt->second;
+    };
+
+    // the same flattening as the ray tracer, the camera aside
+    std::unordered_map<const Mesh*, uint32_t> meshIDs{};
+    std::unordered_map<const Material*, uint32_t> materialIDs{};
+    for(auto obj : scene->getObjects()){
+        auto mesh = GameCoordinator::getComponent<ComponentModel>(obj)._Model->getMesh();
+        auto [meshIt, isNewMesh] = meshIDs.try_emplace(mesh.get(), meshes.size());
+        if(isNewMesh){
+            std::vector<Triangle> meshTriangles = mesh->getTrianglePrimitives();
+            std::vector<AxisAlignedBoundingBox> bounds{};
+            bounds.reserve(meshTriangles.size());
+            for(const auto& triangle : meshTriangles){
+                bounds.emplace_back(
+                    std::min({triangle._Pos0.x(), triangle._Pos1.x(), triangle._Pos2.x()}),
+                    std::max({triangle._Pos0.x(), triangle._Pos1.x(), triangle._Pos2.x()}),
+                    std::min({triangle._Pos0.y(), triangle._Pos1.y(), triangle._Pos2.y()}),
+                    std::max({triangle._Pos0.y(), triangle._Pos1.y(), triangle._Pos2.y()}),
+                    std::min({triangle._Pos0.z(), triangle._Pos1.z(), triangle._Pos2.z()}),
+                    std::max({triangle._Pos0.z(), triangle._Pos1.z(), triangle._Pos2.z()})
+                );
+            }
+
+            std::vector<Node> meshNodes{};
+            std::vector<uint32_t> order{};
+            BoxHierarchy::build(bounds, MAX_LEAF_SIZE, meshNodes, order);
+
+            const std::vector<AnalyticPrimitive>& meshPrimitives = mesh->getAnalyticPrimitives();
+            std::vector<AxisAlignedBoundingBox> primitiveBounds(meshPrimitives.begin(), meshPrimitives.end());
+            std::vector<Node> meshPrimitiveNodes{};
+            std::vector<uint32_t> primitiveOrder{};
+            BoxHierarchy::build(primitiveBounds, MAX_LEAF_SIZE, meshPrimitiveNodes, primitiveOrder);
+
+            // the triangles and the primitives are stored in the order of the leaves
+            MeshRecord record{};
+            record._FirstTriangle = triangles.size();
+            record._NbTriangles = meshTriangles.size();
+            record._FirstNode = nodes.size();
+            record._NbNodes = meshNodes.size();
+            record._FirstPrimitive = primitives.size();
+            record._NbPrimitives = meshPrimitives.size();
+            record._FirstPrimitiveNode = primitiveNodes.size();
+            record._NbPrimitiveNodes = meshPrimitiveNodes.size();
+            if(!meshNodes.empty() && !meshPrimitiveNodes.empty()){
+                record._Bounds = AxisAlignedBoundingBox::merge(meshNodes.front()._Bounds, meshPrimitiveNodes.front()._Bounds);
+            } else if(!meshNodes.empty()){
+                record._Bounds = meshNodes.front()._Bounds;
+            } else if(!meshPrimitiveNodes.empty()){
+                record._Bounds = meshPrimitiveNodes.front()._Bounds;
+            }
+            for(uint32_t index : order){
+                triangles.push_back(static_cast<const TriangleAttributes&>(meshTriangles[index]));
+            }
+            for(uint32_t index : primitiveOrder){
+                primitives.push_back(meshPrimitives[index]);
+            }
+            nodes.insert(nodes.end(), meshNodes.begin(), meshNodes.end());
+            primitiveNodes.insert(primitiveNodes.end(), meshPrimitiveNodes.begin(), meshPrimitiveNodes.end());
+            meshes.push_back(record);
+        }
+        if(meshes[meshIt->second]._NbTriangles == 0 && meshes[meshIt->second]._NbPrimitives == 0){
+            continue;
+        }
+
+        auto material = GameCoordinator::getComponent<ComponentMaterial>(obj)._Material;
+        auto transform = GameCoordinator::getComponent<ComponentTransform>(obj)._Transform;
+        const MaterialTextures& textures = GameCoordinator::getComponent<ComponentMaterial>(obj)._Textures;
+
+        InstanceRecord instance{};
+        instance._Mesh = meshIt->second;
+        Matrix4x4 model = transform->getModelTransposed();
+        instance._Model = toRecord(model);
+        instance._ModelInv = toRecord(Matrix4x4::inverse(model));
+        instance._Bounds = meshes[instance._Mesh]._Bounds.transform(model);
+        auto [materialIt, isNewMaterial] = materialIDs.try_emplace(material.get(), materials.size());
+        if(isNewMaterial){
+            materials.push_back(material != nullptr ? *material : Material{});
+            materialConstants.push_back(MaterialConstants::fromMaterial(materials.back()));
+        }
+        instance._Material = materialIt->second;
+        instance._ObjectID = obj;
+        instance._IsLight = GameCoordinator::getComponent<ComponentLight>(obj)._IsLight ? 1 : 0;
+        instance._BaseColorMap = addString(textures._BaseColor);
+        instance._RoughnessMap = addString(textures._Roughness);
+        instance._MetallicMap = addString(textures._Metallic);
+        instances.push_back(instance);
+    }
+
+    // the instances are stored in the order of the leaves of the top level hierarchy
+    std::vector<AxisAlignedBoundingBox> instanceBounds{};
+    for(const auto& instance : instances){
+        instanceBounds.push_back(instance._Bounds);
+    }
+    std::vector<Node> instanceNodes{};
+    std::vector<uint32_t> instanceOrder{};
+    BoxHierarchy::build(instanceBounds, 1, instanceNodes, instanceOrder);
+    std::vector<InstanceRecord> sortedInstances{};
+    for(uint32_t index : instanceOrder){
+        sortedInstances.push_back(instances[index]);
+    }
+
+    for(const auto& pointLight : scene->getPointLights()){
+        LightRecord light{};
+        light._Position = pointLight->_Position;
+        light._Color = pointLight->_Color;
+        light._Intensity = pointLight->_Intensity;
+        light._Type = POINT_LIGHT;
+        lights.push_back(light);
+    }
+    for(const auto& directionalLight : scene->getDirectionalLights()){
+        LightRecord light{};
+        light._Direction = directionalLight->_Direction;
+        light._Color = directionalLight->_Color;
+        light._Intensity = directionalLight->_Intensity;
+        light._Type = DIRECTIONAL_LIGHT;
+        lights.push_back(light);
+    }
+    for(const auto& orientedLight : scene->getOrientedLights()){
+        LightRecord light{};
+        light._Position = orientedLight->_Position;
+        light._Direction = orientedLight->_Direction;
+        light._Color = orientedLight->_Color;
+        light._Intensity = orientedLight->_Intensity;
+        light._Angle = orientedLight->_Angle;
+        light._MinSquaredDistance = orientedLight->_MinSquaredDistance;
+        light._Type = ORIENTED_LIGHT;
+        lights.push_back(light);
+    }
+
+    // written aside then renamed, so that the renderers mapping the previous file keep it
+    std::string tmpFile = fileName + ".tmp";
+    std::ofstream file(tmpFile, std::ios::binary);
+    if(!file){
+        ErrorHandler::handle(
+            __FILE__, __LINE__,
+            ErrorCode::IO_ERROR,
+            "Cannot open the file `" + tmpFile + "', to store the prepared scene!\n"
+        );
+        return;
+    }
+
+    // the header is written again once the sections are placed
+    FileHeader header{};
+    file.write(reinterpret_cast<const char*>(&header), sizeof(FileHeader));
+    uint64_t offset = sizeof(FileHeader);
+    auto writeSection = [&file, &header, &offset](Section section, const auto& records){
+        using Record = typename std::decay_t<decltype(records)>::value_type;
+        static_assert(std::is_trivially_copyable_v<Record>, "The records of a prepared scene are mapped as they are");
+        uint64_t padding = (SECTION_ALIGNMENT - offset % SECTION_ALIGNMENT) % SECTION_ALIGNMENT;
+        const std::array<char, SECTION_ALIGNMENT> zeros{};
+        file.write(zeros.data(), padding);
+        offset += padding;
+
+        header._Sections[section] = {offset, records.size(), sizeof(Record)};
+        file.write(reinterpret_cast<const char*>(records.data()), records.size() * sizeof(Record));
+        offset += records.size() * sizeof(Record);
+    };
+    writeSection(TRIANGLES_SECTION, triangles);
+    writeSection(NODES_SECTION, nodes);
+    writeSection(MESHES_SECTION, meshes);
+    writeSection(INSTANCES_SECTION, sortedInstances);
+    writeSection(INSTANCE_NODES_SECTION, instanceNodes);
+    writeSection(MATERIALS_SECTION, materials);
+    writeSection(MATERIAL_CONSTANTS_SECTION, materialConstants);
+    writeSection(LIGHTS_SECTION, lights);
+    writeSection(STRINGS_SECTION, strings);
+    writeSection(PRIMITIVES_SECTION, primitives);
+    writeSection(PRIMITIVE_NODES_SECTION, primitiveNodes);
+    header._FileSize = offset;
+    file.seekp(0);
+    file.write(reinterpret_cast<const char*>(&header), sizeof(FileHeader));
+    file.close();
+    if(!file){
+        ErrorHandler::handle(
+            __FILE__, __LINE__,
+            ErrorCode::IO_ERROR,
+            "Cannot write the prepared scene `" + tmpFile + "'!\n"
+        );
+        return;
+    }
+
+    std::error_code error{};
+    std::filesystem::rename(tmpFile, fileName, error);
+    if(error){
+        ErrorHandler::handle(
+            __FILE__, __LINE__,
+            ErrorCode::IO_ERROR,
+            "Cannot store the prepared scene in `" + fileName + "': " + error.message() + "!\n"
+        );
+        return;
+    }
+}
+
+}
@@ -0,0 +1,208 @@
+#pragma once
+
+#include "be_boundingVolume.hpp"
+#include "be_lights.hpp"
+#include "be_material.hpp"
+#include "be_materialConstants.hpp"
+#include "be_matrix4x4.hpp"
+#include "be_model.hpp"
+#include "be_scene.hpp"
+#include "be_vector4.hpp"
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <string>
+#include <vector>
+
+namespace be{
+
+class PreparedScene;
+using PreparedScenePtr = std::shared_ptr<PreparedScene>;
+
+/**
+ * A scene flattened for the ray tracer, stored in a binary file that is mapped in memory
+ * @note The file is a header followed by arrays of trivially copyable records, the ray tracer
+ * traverses the triangles, the analytic primitives and the hierarchies of the meshes where they are mapped,
+ * nothing is parsed
+ * @note The pages of the file are shared by all the processes that map it (posix only,
+ * the file is read in memory elsewhere)
+ * @note The records have the layout of the machine that wrote the file, it is only read back
+ * by the same build of the engine
+ * @see RayTracer::setPreparedScene
+*/
+class PreparedScene{
+    public:
+        static constexpr uint32_t MAGIC = 0x53504542; // "BEPS"
+        static constexpr uint32_t VERSION = 2;
+        static constexpr uint32_t NO_STRING = UINT32_MAX;
+        static constexpr uint32_t MAX_LEAF_SIZE = 4; // triangles or analytic primitives per leaf of the mesh hierarchies
+
+        // the leaves index the triangles, the analytic primitives or the instances
+        using Node = BoxHierarchy::Node;
+
+        /**
+         * The triangles and the analytic primitives of a model in object space and their hierarchies,
+         * shared by all its instances
+        */
+        struct MeshRecord{
+            AxisAlignedBoundingBox _Bounds{};
+            uint32_t _FirstTriangle = 0;
+            uint32_t _NbTriangles = 0;
+            uint32_t _FirstNode = 0; // the children of the nodes are relative to it
+            uint32_t _NbNodes = 0;
+            uint32_t _FirstPrimitive = 0;
+            uint32_t _NbPrimitives = 0;
+            uint32_t _FirstPrimitiveNode = 0; // the children of the nodes are relative to it
+            uint32_t _NbPrimitiveNodes = 0;
+        };
+
+        // the rows of a matrix, Matrix4x4 itself is not trivially copyable
+        using MatrixRecord = std::array<std::array<float, 4>, 4>;
+
+        /**
+         * An object of the scene, placing a mesh in the world
+        */
+        struct InstanceRecord{
+            MatrixRecord _Model{};    // object to world
+            MatrixRecord _ModelInv{}; // world to object
+            AxisAlignedBoundingBox _Bounds{}; // world space
+            uint32_t _Mesh = 0;
+            uint32_t _Material = 0; // also the material id of its hits
+            uint32_t _ObjectID = UINT32_MAX;
+            uint32_t _IsLight = 0;
+            // offsets of the paths of the maps in the strings, NO_STRING without map
+            uint32_t _BaseColorMap = NO_STRING;
+            uint32_t _RoughnessMap = NO_STRING;
+            uint32_t _MetallicMap = NO_STRING;
+        };
+
+        /**
+         * A point, directional or oriented light
+        */
+        struct LightRecord{
+            Vector4 _Position{};
+            Vector4 _Direction{};
+            Vector4 _Color{};
+            float _Intensity = 0.f;
+            float _Angle = 0.f;
+            float _MinSquaredDistance = 0.f;
+            uint32_t _Type = POINT_LIGHT; // LightType
+        };
+
+    private:
+        enum Section{
+            TRIANGLES_SECTION,
+            NODES_SECTION,
+            MESHES_SECTION,
+            INSTANCES_SECTION,
+            INSTANCE_NODES_SECTION,
+            MATERIALS_SECTION,
+            MATERIAL_CONSTANTS_SECTION,
+            LIGHTS_SECTION,
+            STRINGS_SECTION,
+            PRIMITIVES_SECTION,
+            PRIMITIVE_NODES_SECTION,
+            NB_SECTIONS,
+        };
+
+        // each section starts on a cache line
+        static constexpr uint64_t SECTION_ALIGNMENT = 64;
+
+        struct SectionRecord{
+            uint64_t _Offset = 0;
+            uint64_t _Count = 0;
+            uint64_t _RecordSize = 0; // checked against the records of the reader
+        };
+
+        struct FileHeader{
+            uint32_t _Magic = MAGIC;
+            uint32_t _Version = VERSION;
+            uint64_t _FileSize = 0;
+            std::array<SectionRecord, NB_SECTIONS> _Sections{};
+        };
+
+    private:
+        std::string _FileName = "";
+        const std::byte* _Data = nullptr;
+        size_t _Size = 0;
+        bool _IsMapped = false; // else _Data is owned by _Buffer
+        std::unique_ptr<std::byte[]> _Buffer = nullptr;
+
+    public:
+        /**
+         * Map a prepared scene
+         * @param fileName The file written by save
+        */
+        PreparedScene(const std::string& fileName);
+        ~PreparedScene();
+
+        PreparedScene(const PreparedScene&) = delete;
+        PreparedScene& operator=(const PreparedScene&) = delete;
+
+        /**
+         * Flatten a scene and write it as a prepared scene
+         * @param scene The scene, its objects need a model, a material and a transform
+         * @param fileName The file to write, replaced at once so that running renderers keep their mapping
+         * @note The hierarchies of the meshes are built here, this is the slow part of loading a scene
+        */
+        static void save(ScenePtr scene, const std::string& fileName);
+
+        /**
+         * Create a scene with the lights of the prepared scene
+         * @return A scene without objects, the geometry is read from the prepared scene
+         * @note The light tree of the light cuts is built from these lights by the ray tracer
+        */
+        ScenePtr createScene() const;
+
+        const std::string& getFileName() const {return _FileName;}
+        std::span<const TriangleAttributes> getTriangles() const {return getSection<TriangleAttributes>(TRIANGLES_SECTION);}
+        std::span<const Node> getNodes() const {return getSection<Node>(NODES_SECTION);}
+        std::span<const AnalyticPrimitive> getPrimitives() const {return getSection<AnalyticPrimitive>(PRIMITIVES_SECTION);}
+        std::span<const Node> getPrimitiveNodes() const {return getSection<Node>(PRIMITIVE_NODES_SECTION);}
+        std::span<const MeshRecord> getMeshes() const {return getSection<MeshRecord>(MESHES_SECTION);}
+        std::span<const InstanceRecord> getInstances() const {return getSection<InstanceRecord>(INSTANCES_SECTION);}
+        std::span<const Node> getInstanceNodes() const {return getSection<Node>(INSTANCE_NODES_SECTION);}
+        std::span<const Material> getMaterials() const {return getSection<Material>(MATERIALS_SECTION);}
+        std::span<const MaterialConstants> getMaterialConstants() const {
+            return getSection<MaterialConstants>(MATERIAL_CONSTANTS_SECTION);
+        }
+        std::span<const LightRecord> getLights() const {return getSection<LightRecord>(LIGHTS_SECTION);}
+
+        /**
+         * Getter for the maps of an instance
+         * @param instance The instance
+         * @return The paths of its maps, empty when it has none
+        */
+        MaterialTextures getTextures(const InstanceRecord& instance) const;
+
+    private:
+        const FileHeader& getHeader() const {
+            return *reinterpret_cast<const FileHeader*>(_Data);
+        }
+
+        template<typename Record>
+        std::span<const Record> getSection(Section section) const {
+            const SectionRecord& record = getHeader()._Sections[section];
+            return {reinterpret_cast<const Record*>(_Data + record._Offset), record._Count};
+        }
+
+        static MatrixRecord toRecord(const Matrix4x4& matrix);
+        void map();
+        void read();
+        void check() const;
+
+        /**
+         * Check that a flat hierarchy can be traversed as it is
+         * @param nodes The nodes, in depth first order
+         * @param nbItems The number of primitives or instances the leaves index
+         * @param isOneItemPerLeaf If each leaf must hold exactly one item, as the leaves of the instances
+         * @return true if the nodes form a single tree in depth first order, within the traversal stack, with leaves in range
+        */
+        static bool isValidHierarchy(std::span<const Node> nodes, uint64_t nbItems, bool isOneItemPerLeaf);
+        std::string getString(uint32_t offset) const;
+};
+
+}
@@ -18,7 +18,7 @@ namespace be{
  * @return A ray in world space for raytracing
  * @see RayTracing
 */
-RayPtr Ray::rayAt(float x, float y, 
+Ray Ray::rayAt(float x, float y, 
             const Matrix4x4& viewInv, 
             const Matrix4x4& projInv,
             float width,
@@ -38,17 +38,17 @@ RayPtr Ray::rayAt(float x, float y,
     direction = dirWorldSpace.xyz() - cameraPos;
 
     direction.normalize();
-    return RayPtr(new Ray(cameraPos, direction));
+    return Ray(cameraPos, direction);
 }
 
 /**
  * Generate a ray in the unit sphere
  * @return A ray in world space
 */
-RayPtr Ray::generateRandomRayInUnitSphere(){
+Ray Ray::generateRandomRayInUnitSphere(){
     Vector3 origin = Vector3();
     Vector3 direction = Vector3::normalize(Vector3::random(-1, 1));
-    return RayPtr(new Ray(origin, direction));
+    return Ray(origin, direction);
 }
 
 /**
@@ -57,14 +57,12 @@ RayPtr Ray::generateRandomRayInUnitSphere(){
  * @param planeNormal The normal of the hemisphere plane
  * @return A ray in world space
 */
-RayPtr Ray::generateRandomRayInHemiSphere(const Vector3& sphereCenter, const Vector3& planeNormal){
-    RayPtr ray = Ray::generateRandomRayInUnitSphere();
-    ray->_Origin = sphereCenter;
-    if(Vector3::dot(ray->_Direction, planeNormal) > 0.f){ // same hemisphere
-        return ray;
+Ray Ray::generateRandomRayInHemiSphere(const Vector3& sphereCenter, const Vector3& planeNormal){
+    Vector3 direction = Ray::generateRandomRayInUnitSphere()._Direction;
+    if(Vector3::dot(direction, planeNormal) > 0.f){ // same hemisphere
+        return Ray(sphereCenter, direction);
     }
-    ray->_Direction *= -1.f;
-    return ray;
+    return Ray(sphereCenter, -direction);
 }
 
 /**
@@ -72,7 +70,7 @@ RayPtr Ray::generateRandomRayInHemiSphere(const Vector3& sphereCenter, const Vec
  * @param rayHit The last hit
  * @return A ray in world space
 */
-RayPtr Ray::generateRandomRayInHemiSphere(const RayHit& hit){
+Ray Ray::generateRandomRayInHemiSphere(const RayHit& hit){
     return generateRandomRayInHemiSphere(hit.getWorldPos(), hit.getWorldNorm());
 }
 
@@ -82,16 +80,16 @@ RayPtr Ray::generateRandomRayInHemiSphere(const RayHit& hit){
  * @param planeNormal The normal of the hemisphere plane
  * @return A ray in world space
 */
-RayPtr Ray::generateRandomRayLambertianDistribution(const Vector3& sphereCenter, const Vector3& planeNormal){
+Ray Ray::generateRandomRayLambertianDistribution(const Vector3& sphereCenter, const Vector3& planeNormal){
     Vector3 origin = sphereCenter;
-    Vector3 direction = generateRandomRayInUnitSphere()->_Direction + planeNormal;
+    Vector3 direction = generateRandomRayInUnitSphere()._Direction + planeNormal;
 
     if(direction.isZero()){
         direction = planeNormal;
     }
 
     direction.normalize();
-    return RayPtr(new Ray(origin, direction));
+    return Ray(origin, direction);
 }
 
 /**
@@ -99,22 +97,35 @@ RayPtr Ray::generateRandomRayLambertianDistribution(const Vector3& sphereCenter,
  * @param rayHit The last hit
  * @return A ray in world space
 */
-RayPtr Ray::generateRandomRayLambertianDistribution(const RayHit& hit){
+Ray Ray::generateRandomRayLambertianDistribution(const RayHit& hit){
     return generateRandomRayLambertianDistribution(hit.getWorldPos(), hit.getWorldNorm());
 }
 
 /**
- * Check if the current ray intersects the given triangle
+ * Check if the current ray intersects the given triangle in [_TMin, _TMax]
  * @param trianglePrimitive The triangle to check intersection with
- * @param minDist The minimum distance to consider a Hit (to avoid acnea)
- * @param maxDist The maximum distance to consider a Hit
- * @return An optional Ray hit
+ * @param primitiveID The index of the triangle in its mesh
+ * @return An optional Ray hit, not placed in any instance yet
 */
-RayHitOpt Ray::rayTriangleIntersection(const Triangle& trianglePrimitive, float minDist, float maxDist){
-    Vector3 p0 = trianglePrimitive._WorldPos0;
-    Vector3 p1 = trianglePrimitive._WorldPos1;
-    Vector3 p2 = trianglePrimitive._WorldPos2;
+RayHitOpt Ray::rayTriangleIntersection(const Triangle& trianglePrimitive, uint32_t primitiveID) const{
+    return rayTriangleIntersection(
+        trianglePrimitive._WorldPos0, trianglePrimitive._WorldPos1, trianglePrimitive._WorldPos2,
+        trianglePrimitive, primitiveID
+    );
+}
 
+/**
+ * Check if the current ray intersects the given triangle in [_TMin, _TMax]
+ * @param triangle The triangle to check intersection with, its _Pos* are in the space of the ray
+ * @param primitiveID The index of the triangle in its mesh
+ * @return An optional Ray hit, not placed in any instance yet
+*/
+RayHitOpt Ray::rayTriangleIntersection(const TriangleAttributes& triangle, uint32_t primitiveID) const{
+    return rayTriangleIntersection(triangle._Pos0, triangle._Pos1, triangle._Pos2, triangle, primitiveID);
+}
+
+RayHitOpt Ray::rayTriangleIntersection(const Vector3& p0, const Vector3& p1, const Vector3& p2,
+        const TriangleAttributes& triangle, uint32_t primitiveID) const{
     Vector3 e0 = p1 - p0;
     Vector3 e1 = p2 - p0;
 
@@ -156,12 +167,61 @@ RayHitOpt Ray::rayTriangleIntersection(const Triangle& trianglePrimitive, float
     }
 
     float t = Vector3::dot(e1, r);
-    if(t < minDist || t > maxDist){
+    if(t < _TMin || t > _TMax){
         return RayHit::NO_HIT;
     }
 
     Vector4 res = {b2,b0,b1,t};
-    return RayHit(res, trianglePrimitive, _Direction);
+    return RayHit(res, triangle, primitiveID, _Direction);
+}
+
+/**
+ * Check if the current ray intersects the given analytic primitive in [_TMin, _TMax]
+ * @param primitive The primitive to check intersection with, in the space of the ray
+ * @param primitiveID The index of the primitive in its mesh
+ * @return An optional Ray hit, not placed in any instance yet
+ * @note Only the front of the primitive is hit, a ray leaving a sphere does not hit it
+*/
+RayHitOpt Ray::rayPrimitiveIntersection(const AnalyticPrimitive& primitive, uint32_t primitiveID) const{
+    float t = 0.f;
+    if(primitive._Type == AnalyticPrimitive::SPHERE){
+        // the direction is not normalized in the space of an instance
+        Vector3 centerToOrigin = _Origin - primitive._Center;
+        float a = _Direction.getSquaredNorm();
+        float halfB = Vector3::dot(centerToOrigin, _Direction);
+        float c = centerToOrigin.getSquaredNorm() - primitive._Radius * primitive._Radius;
+        float discriminant = halfB * halfB - a * c;
+        if(discriminant < 0.f || a == 0.f){
+            return RayHit::NO_HIT;
+        }
+        // the nearest root is where the ray enters the sphere
+        t = (-halfB - std::sqrt(discriminant)) / a;
+    } else {
+        // the plane faces the positive side of the axis
+        uint32_t axis = primitive._Axis;
+        if(_Direction[axis] >= 0.f){
+            return RayHit::NO_HIT;
+        }
+        t = (primitive._Center[axis] - _Origin[axis]) * _InvDirection[axis];
+    }
+    if(t < _TMin || t > _TMax){
+        return RayHit::NO_HIT;
+    }
+
+    Vector3 pos = at(t);
+    if(primitive._Type != AnalyticPrimitive::SPHERE){
+        float u = pos[(primitive._Axis + 1) % 3] - primitive._Center[(primitive._Axis + 1) % 3];
+        float v = pos[(primitive._Axis + 2) % 3] - primitive._Center[(primitive._Axis + 2) % 3];
+        bool isInside = primitive._Type == AnalyticPrimitive::QUAD
+            ? std::fabs(u) <= primitive._HalfSize.x() && std::fabs(v) <= primitive._HalfSize.y()
+            : u * u + v * v <= primitive._Radius * primitive._Radius;
+        if(!isInside){
+            return RayHit::NO_HIT;
+        }
+        // exactly on the plane, whatever the rounding of t
+        pos[primitive._Axis] = primitive._Center[primitive._Axis];
+    }
+    return RayHit(Vector4(pos, t), primitive, primitiveID, _Direction);
 }
 
 /**
@@ -170,7 +230,7 @@ RayHitOpt Ray::rayTriangleIntersection(const Triangle& trianglePrimitive, float
  * @param sphereRadius The sphere radius
  * @return true if they intersect
 */
-bool Ray::raySphereIntersection(const Vector3& sphereCenter, float sphereRadius){
+bool Ray::raySphereIntersection(const Vector3& sphereCenter, float sphereRadius) const{
     Vector3 sphereToRay = getOrigin() - sphereCenter;
 
     auto a = getDirection().getSquaredNorm();
@@ -182,7 +242,7 @@ bool Ray::raySphereIntersection(const Vector3& sphereCenter, float sphereRadius)
 }
 
 /**
- * Check if the current ray intersects a box
+ * Check if the current ray intersects a box in [_TMin, _TMax]
  * @param minX The minimum x-coordinate of the box
  * @param maxX The maximum x-coordinate of the box
  * @param minY The minimum y-coordinate of the box
@@ -191,47 +251,23 @@ bool Ray::raySphereIntersection(const Vector3& sphereCenter, float sphereRadius)
  * @param maxZ The maximum z-coordinate of the box
  * @return true if they intersect
 */
-bool Ray::rayBoxIntersection(float minX, float maxX, float minY, float maxY, float minZ, float maxZ){
-    float tMin = 0.0f;
-    float tMax = INFINITY;
-
-    // Check intersection with X-slabs
-    float inverseRayDirX = 1.0f / getDirection().x();
-    float tx1 = (minX - getOrigin().x()) * inverseRayDirX;
-    float tx2 = (maxX - getOrigin().x()) * inverseRayDirX;
-
-    tMin = std::max(tMin, std::min(tx1, tx2));
-    tMax = std::min(tMax, std::max(tx1, tx2));
-
-    // Check for early exit
-    if (tMax < 0.0f || tMin > tMax) {
-        return false;
-    }
-
-    // Check intersection with Y-slabs
-    float inverseRayDirY = 1.0f / getDirection().y();
-    float ty1 = (minY - getOrigin().y()) * inverseRayDirY;
-    float ty2 = (maxY - getOrigin().y()) * inverseRayDirY;
-
-    tMin = std::max(tMin, std::min(ty1, ty2));
-    tMax = std::min(tMax, std::max(ty1, ty2));
-
-    // Check for early exit
-    if (tMax < 0.0f || tMin > tMax) {
-        return false;
+bool Ray::rayBoxIntersection(float minX, float maxX, float minY, float maxY, float minZ, float maxZ) const{
+    const std::array<Vector3, 2> bounds = {Vector3(minX, minY, minZ), Vector3(maxX, maxY, maxZ)};
+    float tMin = _TMin;
+    float tMax = _TMax;
+
+    // the signs give the near and far slabs without any min/max,
+    // the comparisons are written so that a NaN (origin on a slab) keeps the current range
+    for(int axis = 0; axis<3; axis++){
+        float tNear = (bounds[_Sign[axis]][axis] - _Origin[axis]) * _InvDirection[axis];
+        float tFar = (bounds[1 - _Sign[axis]][axis] - _Origin[axis]) * _InvDirection[axis];
+        tMin = tNear > tMin ? tNear : tMin;
+        tMax = tFar < tMax ? tFar : tMax;
+        if(tMin > tMax){
+            return false;
+        }
     }
-
-    // Check intersection with Z-slabs
-    float inverseRayDirZ = 1.0f / getDirection().z();
-    float tz1 = (minZ - getOrigin().z()) * inverseRayDirZ;
-    float tz2 = (maxZ - getOrigin().z()) * inverseRayDirZ;
-
-    tMin = std::max(tMin, std::min(tz1, tz2));
-    tMax = std::min(tMax, std::max(tz1, tz2));
-
-    // Check for intersection
-    return tMax >= 0.0f && tMin <= tMax;
-
+    return true;
 }
 
 }
\ No newline at end of file
@@ -1,32 +1,78 @@
 #pragma once
 
+#include <array>
 #include <cmath>
-#include <memory>
+#include <cstdint>
 #include "be_model.hpp"
 #include "be_vector3.hpp"
 #include "be_rayHit.hpp"
 
 namespace be{
 
-class Ray;
-using RayPtr = std::shared_ptr<Ray>;
-
+/**
+ * A ray, a small value type living on the stack
+ * @note The inverse of the direction and its signs are computed once, for the box tests
+*/
 class Ray{
 
+    public:
+        /**
+         * The default minimum distance to consider a hit (to avoid acnea)
+        */
+        static constexpr float DEFAULT_MIN_DIST = 1e-3f;
+
     private:
         Vector3 _Origin = {};
         Vector3 _Direction = {};
+        Vector3 _InvDirection = {};
+
+        /**
+         * 1 if the direction is negative along the axis, 0 otherwise
+        */
+        std::array<uint8_t, 3> _Sign = {};
 
     public:
-        Ray(const Vector3& origin, const Vector3& direction):
-            _Origin(origin), _Direction(direction){}
+        /**
+         * The valid range of the ray parameter, the traversal shrinks _TMax to the closest hit
+        */
+        float _TMin = DEFAULT_MIN_DIST;
+        float _TMax = INFINITY;
+
+        /**
+         * The ray cone of the texture filtering, an approximation of the ray differentials:
+         * its width at the origin and its spread angle, both in world space
+        */
+        float _ConeWidth = 0.f;
+        float _ConeSpread = 0.f;
+
+    public:
+        Ray(){};
+
+        Ray(const Vector3& origin, const Vector3& direction, float tMin = DEFAULT_MIN_DIST, float tMax = INFINITY):
+            _Origin(origin), _Direction(direction), _TMin(tMin), _TMax(tMax){
+            for(int k=0; k<3; k++){
+                _InvDirection[k] = 1.f / _Direction[k];
+                _Sign[k] = _InvDirection[k] < 0.f ? 1 : 0;
+            }
+        }
 
         Vector3 getOrigin() const {return _Origin;}
         Vector3 getDirection() const {return _Direction;}
+        Vector3 getInvDirection() const {return _InvDirection;}
+        uint8_t getSign(int axis) const {return _Sign[axis];}
 
         Vector3 at(float t) const {
             return _Origin + t*_Direction;
-        } 
+        }
+
+        /**
+         * Getter for the width of the ray cone
+         * @param t The ray parameter
+         * @return The world width of the cone at t
+        */
+        float getConeWidth(float t) const {
+            return _ConeWidth + _ConeSpread * t * _Direction.getNorm();
+        }
 
     public:
         /**
@@ -41,11 +87,11 @@ class Ray{
          * @return A ray in world space for raytracing
          * @see RayTracing
         */
-        static RayPtr rayAt(float x, float y, 
-                        const Matrix4x4& viewInv, 
+        static Ray rayAt(float x, float y,
+                        const Matrix4x4& viewInv,
                         const Matrix4x4& projInv,
                         float width,
-                        float height, 
+                        float height,
                         const Vector3& cameraPos
         );
 
@@ -53,7 +99,7 @@ class Ray{
          * Generate a random ray in the unit sphere
          * @return A ray in world space
         */
-        static RayPtr generateRandomRayInUnitSphere();
+        static Ray generateRandomRayInUnitSphere();
 
         /**
          * Generate a random ray in the hemisphere
@@ -61,14 +107,14 @@ class Ray{
          * @param planeNormal The normal of the hemisphere plane
          * @return A ray in world space
         */
-        static RayPtr generateRandomRayInHemiSphere(const Vector3& sphereCenter, const Vector3& planeNormal);
+        static Ray generateRandomRayInHemiSphere(const Vector3& sphereCenter, const Vector3& planeNormal);
 
         /**
          * Generate a random ray in the hemisphere
          * @param rayHit The last hit
          * @return A ray in world space
         */
-        static RayPtr generateRandomRayInHemiSphere(const RayHit& hit);
+        static Ray generateRandomRayInHemiSphere(const RayHit& hit);
 
         /**
          * Generate a random ray according to Lambertian distribution
@@ -76,24 +122,40 @@ class Ray{
          * @param planeNormal The normal of the hemisphere plane
          * @return A ray in world space
         */
-        static RayPtr generateRandomRayLambertianDistribution(const Vector3& sphereCenter, const Vector3& planeNormal);
+        static Ray generateRandomRayLambertianDistribution(const Vector3& sphereCenter, const Vector3& planeNormal);
 
         /**
          * Generate a random ray according to Lambertian distribution
          * @param rayHit The last hit
          * @return A ray in world space
         */
-        static RayPtr generateRandomRayLambertianDistribution(const RayHit& hit);
+        static Ray generateRandomRayLambertianDistribution(const RayHit& hit);
 
 
         /**
-         * Check if the current ray intersects the given triangle
+         * Check if the current ray intersects the given triangle in [_TMin, _TMax]
          * @param trianglePrimitive The triangle to check intersection with
-         * @param minDist The minimum distance to consider a Hit (to avoid acnea)
-         * @param maxDist The maximum distance to consider a Hit
-         * @return An optional Ray hit
+         * @param primitiveID The index of the triangle in its mesh
+         * @return An optional Ray hit, not placed in any instance yet
         */
-        RayHitOpt rayTriangleIntersection(const Triangle& trianglePrimitive, float minDist = 1e-3, float maxDist = INFINITY);
+        RayHitOpt rayTriangleIntersection(const Triangle& trianglePrimitive, uint32_t primitiveID = 0) const;
+
+        /**
+         * Check if the current ray intersects the given triangle in [_TMin, _TMax]
+         * @param triangle The triangle to check intersection with, its _Pos* are in the space of the ray
+         * @param primitiveID The index of the triangle in its mesh
+         * @return An optional Ray hit, not placed in any instance yet
+        */
+        RayHitOpt rayTriangleIntersection(const TriangleAttributes& triangle, uint32_t primitiveID) const;
+
+        /**
+         * Check if the current ray intersects the given analytic primitive in [_TMin, _TMax]
+         * @param primitive The primitive to check intersection with, in the space of the ray
+         * @param primitiveID The index of the primitive in its mesh
+         * @return An optional Ray hit, not placed in any instance yet
+         * @note Only the front of the primitive is hit, a ray leaving a sphere does not hit it
+        */
+        RayHitOpt rayPrimitiveIntersection(const AnalyticPrimitive& primitive, uint32_t primitiveID) const;
 
         /**
          * Check if the current ray intersects a sphere
@@ -101,10 +163,10 @@ class Ray{
          * @param sphereRadius The sphere radius
          * @return true if they intersect
         */
-        bool raySphereIntersection(const Vector3& sphereCenter, float sphereRadius);
+        bool raySphereIntersection(const Vector3& sphereCenter, float sphereRadius) const;
 
         /**
-         * Check if the current ray intersects a box
+         * Check if the current ray intersects a box in [_TMin, _TMax]
          * @param minX The minimum x-coordinate of the box
          * @param maxX The maximum x-coordinate of the box
          * @param minY The minimum y-coordinate of the box
@@ -113,7 +175,12 @@ class Ray{
          * @param maxZ The maximum z-coordinate of the box
          * @return true if they intersect
         */
-        bool rayBoxIntersection(float minX, float maxX, float minY, float maxY, float minZ, float maxZ);
+        bool rayBoxIntersection(float minX, float maxX, float minY, float maxY, float minZ, float maxZ) const;
+
+    private:
+        RayHitOpt rayTriangleIntersection(const Vector3& p0, const Vector3& p1, const Vector3& p2,
+            const TriangleAttributes& triangle, uint32_t primitiveID
+        ) const;
 };
 
 }
\ No newline at end of file
@@ -5,35 +5,27 @@ namespace be{
 const RayHitOpt RayHit::NO_HIT = std::nullopt;
 
 Vector3 RayHit::getWorldPos() const {
-    Vector3 p0 = _Triangle._WorldPos0;
-    Vector3 p1 = _Triangle._WorldPos1;
-    Vector3 p2 = _Triangle._WorldPos2;
-
-    Vector3 baryCoords = getBarycentricCoords();
-    float b0 = baryCoords[0];
-    float b1 = baryCoords[1];
-    float b2 = baryCoords[2];
-
-    return (b0 * p0) + (b1 * p1) + (b2 * p2);
+    // the attributes are interpolated in object space, then transformed once
+    if(_Instance == nullptr){
+        return getPos();
+    }
+    return (_Instance->_Model * Vector4(getPos(), 1.f)).xyz();
 }
 
 Vector3 RayHit::getViewPos() const {
-    Vector3 p0 = _Triangle._ViewPos0;
-    Vector3 p1 = _Triangle._ViewPos1;
-    Vector3 p2 = _Triangle._ViewPos2;
-
-    Vector3 baryCoords = getBarycentricCoords();
-    float b0 = baryCoords[0];
-    float b1 = baryCoords[1];
-    float b2 = baryCoords[2];
-
-    return (b0 * p0) + (b1 * p1) + (b2 * p2);
+    if(_Instance == nullptr){
+        return getPos();
+    }
+    return (_Instance->_ViewModel * Vector4(getPos(), 1.f)).xyz();
 }
 
 Vector3 RayHit::getPos() const {
-    Vector3 p0 = _Triangle._Pos0;
-    Vector3 p1 = _Triangle._Pos1;
-    Vector3 p2 = _Triangle._Pos2;
+    if(_Primitive != nullptr){
+        return _Representation.xyz();
+    }
+    Vector3 p0 = _Triangle->_Pos0;
+    Vector3 p1 = _Triangle->_Pos1;
+    Vector3 p2 = _Triangle->_Pos2;
 
     Vector3 baryCoords = getBarycentricCoords();
     float b0 = baryCoords[0];
@@ -44,9 +36,12 @@ Vector3 RayHit::getPos() const {
 }
 
 Vector4 RayHit::getCol() const {
-    Vector4 c0 = _Triangle._Col0;
-    Vector4 c1 = _Triangle._Col1;
-    Vector4 c2 = _Triangle._Col2;
+    if(_Primitive != nullptr){
+        return _Primitive->_Col;
+    }
+    Vector4 c0 = _Triangle->_Col0;
+    Vector4 c1 = _Triangle->_Col1;
+    Vector4 c2 = _Triangle->_Col2;
 
     Vector3 baryCoords = getBarycentricCoords();
     float b0 = baryCoords[0];
@@ -57,9 +52,12 @@ Vector4 RayHit::getCol() const {
 }
 
 Vector3 RayHit::getNorm() const {
-    Vector3 n0 = _Triangle._Norm0;
-    Vector3 n1 = _Triangle._Norm1;
-    Vector3 n2 = _Triangle._Norm2;
+    if(_Primitive != nullptr){
+        return _Primitive->getNormal(getPos());
+    }
+    Vector3 n0 = _Triangle->_Norm0;
+    Vector3 n1 = _Triangle->_Norm1;
+    Vector3 n2 = _Triangle->_Norm2;
 
     Vector3 baryCoords = getBarycentricCoords();
     float b0 = baryCoords[0];
@@ -70,41 +68,32 @@ Vector3 RayHit::getNorm() const {
 }
 
 Vector3 RayHit::getWorldNorm() const {
-    Vector3 n0 = Vector3::normalize((_Triangle._Model * Vector4(_Triangle._Norm0, 0.f)).xyz());
-    Vector3 n1 = Vector3::normalize((_Triangle._Model * Vector4(_Triangle._Norm1, 0.f)).xyz());
-    Vector3 n2 = Vector3::normalize((_Triangle._Model * Vector4(_Triangle._Norm2, 0.f)).xyz());
-
-    Vector3 baryCoords = getBarycentricCoords();
-    float b0 = baryCoords[0];
-    float b1 = baryCoords[1];
-    float b2 = baryCoords[2];
-
-    return Vector3::normalize((b0 * n0) + (b1 * n1) + (b2 * n2));
+    if(_Instance == nullptr){
+        return Vector3::normalize(getNorm());
+    }
+    return Vector3::normalize((_Instance->_Model * Vector4(getNorm(), 0.f)).xyz());
 }
 
 Vector3 RayHit::getViewNorm() const {
-    Vector3 n0 = _Triangle._ViewNorm0;
-    Vector3 n1 = _Triangle._ViewNorm1;
-    Vector3 n2 = _Triangle._ViewNorm2;
-
-    Vector3 baryCoords = getBarycentricCoords();
-    float b0 = baryCoords[0];
-    float b1 = baryCoords[1];
-    float b2 = baryCoords[2];
-
-    return Vector3::normalize((b0 * n0) + (b1 * n1) + (b2 * n2));
+    if(_Instance == nullptr){
+        return Vector3::normalize(getNorm());
+    }
+    return Vector3::normalize((_Instance->_NormalMat * Vector4(getNorm(), 0.f)).xyz());
 }
 
 Vector2 RayHit::getTex() const {
-    Vector2 uv0 = _Triangle._Tex0;
-    Vector2 uv1 = _Triangle._Tex1;
-    Vector2 uv2 = _Triangle._Tex2;
+    if(_Primitive != nullptr){
+        return _Primitive->getTex(getPos());
+    }
+    Vector2 uv0 = _Triangle->_Tex0;
+    Vector2 uv1 = _Triangle->_Tex1;
+    Vector2 uv2 = _Triangle->_Tex2;
 
     Vector3 baryCoords = getBarycentricCoords();
     float b0 = baryCoords[0];
     float b1 = baryCoords[1];
     float b2 = baryCoords[2];
-    
+
     return b0 * uv0 + b1 * uv1 + b2 * uv2;
 }
 
@@ -112,5 +101,81 @@ Vector3 RayHit::getDirection() const {
     return _Direction;
 }
 
+float RayHit::getTextureFootprint() const {
+    // width of the ray cone in texture coordinates, from the ratio of the areas of the triangle,
+    // or of the derivatives of the position on an analytic primitive
+    Vector3 edge1{};
+    Vector3 edge2{};
+    float uvArea = 1.f;
+    if(_Primitive != nullptr){
+        _Primitive->getTexDerivatives(getPos(), edge1, edge2);
+    } else {
+        edge1 = _Triangle->_Pos1 - _Triangle->_Pos0;
+        edge2 = _Triangle->_Pos2 - _Triangle->_Pos0;
+        Vector2 uvEdge1 = _Triangle->_Tex1 - _Triangle->_Tex0;
+        Vector2 uvEdge2 = _Triangle->_Tex2 - _Triangle->_Tex0;
+        uvArea = std::fabs(uvEdge1.x() * uvEdge2.y() - uvEdge1.y() * uvEdge2.x());
+    }
+    Vector3 worldCross = Vector3::cross(
+        (_Instance->_Model * Vector4(edge1, 0.f)).xyz(),
+        (_Instance->_Model * Vector4(edge2, 0.f)).xyz()
+    );
+    float worldArea = worldCross.getNorm();
+    if(worldArea <= 0.f){
+        return 0.f;
+    }
+
+    // grazing angles stretch the footprint
+    float cosTheta = std::fabs(Vector3::dot(worldCross / worldArea, Vector3::normalize(_Direction)));
+    return _ConeWidth * std::sqrt(uvArea / worldArea) / std::max(cosTheta, 0.1f);
+}
+
+Vector3 RayHit::getAlbedo() const {
+    Vector3 color = getCol().xyz();
+    if(_Instance == nullptr || _Instance->_TextureCache == nullptr
+        || _Instance->_TextureIDs._BaseColor == TextureCache::NO_TEXTURE){
+        return color;
+    }
+    Vector4 texel = _Instance->_TextureCache->sample(_Instance->_TextureIDs._BaseColor, getTex(), getTextureFootprint());
+    return color * texel.xyz();
+}
+
+float RayHit::getRoughness() const {
+    const MaterialPtr& material = _Instance->_Material;
+    if(_Instance->_TextureCache == nullptr || _Instance->_TextureIDs._Roughness == TextureCache::NO_TEXTURE){
+        return material->_Roughness;
+    }
+    return _Instance->_TextureCache->sample(_Instance->_TextureIDs._Roughness, getTex(), getTextureFootprint()).x();
+}
+
+float RayHit::getMetallic() const {
+    const MaterialPtr& material = _Instance->_Material;
+    if(_Instance->_TextureCache == nullptr || _Instance->_TextureIDs._Metallic == TextureCache::NO_TEXTURE){
+        return material->_Metallic;
+    }
+    return _Instance->_TextureCache->sample(_Instance->_TextureIDs._Metallic, getTex(), getTextureFootprint()).x();
+}
+
+MaterialPtr RayHit::getShadingMaterial(Material& storage) const {
+    const MaterialPtr& material = _Instance->_Material;
+    const TextureCache::MaterialTextureIDs& ids = _Instance->_TextureIDs;
+    if(_Instance->_TextureCache == nullptr
+        || (ids._Roughness == TextureCache::NO_TEXTURE && ids._Metallic == TextureCache::NO_TEXTURE)){
+        return material;
+    }
+    storage = *material;
+    storage._Roughness = getRoughness();
+    storage._Metallic = getMetallic();
+    return MaterialPtr(MaterialPtr(), &storage);
+}
+
+const MaterialConstants& RayHit::getShadingConstants(const MaterialPtr& shadingMaterial, MaterialConstants& storage) const {
+    if(shadingMaterial == _Instance->_Material){
+        return _Instance->_MaterialConstants;
+    }
+    storage = MaterialConstants::fromMaterial(*shadingMaterial);
+    return storage;
+}
 
-}
\ No newline at end of file
+
+}
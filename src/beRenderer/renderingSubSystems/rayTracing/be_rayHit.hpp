@@ -1,47 +1,124 @@
 #pragma once
 
+#include "be_material.hpp"
+#include "be_materialConstants.hpp"
+#include "be_matrix4x4.hpp"
 #include "be_model.hpp"
+#include "be_textureCache.hpp"
+#include "be_vector2.hpp"
 #include "be_vector3.hpp"
 #include "be_vector4.hpp"
 #include <cmath>
+#include <cstdint>
 #include <memory>
 #include <optional>
-#include <vector>
 
 namespace be{
 
-class RayHits;
 class RayHit;
 using RayHitOpt = std::optional<RayHit>;
 
-class RayHit{
-    friend RayHits;
+/**
+ * The data shared by every hit on an instance of a mesh
+ * @note Owned by the ray tracer, a hit only points to it
+*/
+struct RayHitInstance{
+    Matrix4x4 _Model{};     // object to world
+    Matrix4x4 _ViewModel{}; // object to view
+    Matrix4x4 _NormalMat{}; // object normals to view
+    MaterialPtr _Material = nullptr;
+    MaterialConstants _MaterialConstants{}; // copy of the constants of the material, per instance
+    const TextureCache* _TextureCache = nullptr; // null when the material has no texture
+    TextureCache::MaterialTextureIDs _TextureIDs{};
+    uint32_t _ObjectID = UINT32_MAX;
+    uint32_t _MaterialID = UINT32_MAX;
+    bool _IsLight = false;
+};
 
+/**
+ * A compact hit record, the shading attributes are only interpolated when asked for
+ * @note The hit points to the object space triangle or analytic primitive and to its instance,
+ * both must outlive it
+*/
+class RayHit{
     public:
         const static RayHitOpt NO_HIT;
+        static constexpr uint32_t NO_INSTANCE = UINT32_MAX;
 
     private:
         /**
-         * _Representation = [b0, b1, b2, t]
+         * _Representation = [b0, b1, b2, t] on a triangle,
+         * [x, y, z, t] with the object space position on an analytic primitive
         */
         Vector4 _Representation{};
-        Triangle _Triangle = {};
         Vector3 _Direction = {};
+        const TriangleAttributes* _Triangle = nullptr;
+        const AnalyticPrimitive* _Primitive = nullptr; // null on a triangle
+        const RayHitInstance* _Instance = nullptr;
+        uint32_t _PrimitiveID = 0;
+        uint32_t _InstanceID = NO_INSTANCE;
+        float _ConeWidth = 0.f; // world width of the ray cone at the hit
 
     public:
 
-        RayHit(const Vector4& representation, const Triangle& triangle, const Vector3& direction)
-            : _Representation(representation), _Triangle(triangle), _Direction(direction){
+        RayHit(const Vector4& representation, const TriangleAttributes& triangle, uint32_t primitiveID, const Vector3& direction)
+            : _Representation(representation), _Direction(direction), _Triangle(&triangle), _PrimitiveID(primitiveID){
         }
 
+        RayHit(const Vector4& representation, const AnalyticPrimitive& primitive, uint32_t primitiveID, const Vector3& direction)
+            : _Representation(representation), _Direction(direction), _Primitive(&primitive), _PrimitiveID(primitiveID){
+        }
+
+        /**
+         * Getter for the barycentric coordinates of a hit on a triangle
+         * @return The coordinates, meaningless on an analytic primitive
+        */
         Vector3 getBarycentricCoords() const{
             return Vector3(_Representation.x(), _Representation.y(), _Representation.z());
         }
         float getParametricT() const{
-            return _Representation.z();
+            return _Representation.w();
+        }
+
+        uint32_t getPrimitiveID() const {return _PrimitiveID;}
+        uint32_t getInstanceID() const {return _InstanceID;}
+
+        /**
+         * Getter for the hit triangle
+         * @return The triangle in object space
+         * @note Only for the hits on a triangle
+        */
+        const TriangleAttributes& getTriangle() const {return *_Triangle;}
+
+        /**
+         * Getter for the hit analytic primitive
+         * @return The primitive in object space, null on a triangle
+        */
+        const AnalyticPrimitive* getAnalyticPrimitive() const {return _Primitive;}
+
+        /**
+         * Place the hit in an instance, keeping its coordinates
+         * @param instance The instance data
+         * @param instanceID The index of the instance
+         * @param direction The direction of the ray in world space
+         * @param coneWidth The world width of the ray cone at the hit
+         * @return The new hit
+        */
+        RayHit withInstance(const RayHitInstance& instance, uint32_t instanceID, const Vector3& direction, float coneWidth = 0.f) const {
+            RayHit hit = *this;
+            hit._Instance = &instance;
+            hit._InstanceID = instanceID;
+            hit._Direction = direction;
+            hit._ConeWidth = coneWidth;
+            return hit;
         }
 
-        Triangle getTriangle() const {return _Triangle;}
+        float getConeWidth() const {return _ConeWidth;}
+
+        const MaterialPtr& getMaterial() const {return _Instance->_Material;}
+        uint32_t getObjectID() const {return _Instance->_ObjectID;}
+        uint32_t getMaterialID() const {return _Instance->_MaterialID;}
+        bool isLight() const {return _Instance->_IsLight;}
 
 
     public:
@@ -55,38 +132,41 @@ class RayHit{
         Vector2 getTex() const;
         Vector3 getDirection() const;
 
+        /**
+         * Getter for the diffuse color, the vertex color times the base color map
+         * @return The linear color
+        */
+        Vector3 getAlbedo() const;
 
-    public:
-        static bool compareRayHit(const RayHit& hit1, const RayHit& hit2){
-            return hit1._Representation[3] > hit2._Representation[3];
-        }
-
-};
-
-class RayHits{
-    public:
-        std::vector<RayHit> _Hits = {};
-
-    public:
-        RayHits(){
-            std::make_heap(_Hits.begin(), _Hits.end(), RayHit::compareRayHit);
-        };
+        /**
+         * Getter for the roughness, from the roughness map if any
+         * @return The roughness of the surface
+        */
+        float getRoughness() const;
 
-    public:
-        void addHit(const RayHit& hit){
-            _Hits.push_back(hit);
-            std::push_heap(_Hits.begin(), _Hits.end(), RayHit::compareRayHit);
-        }
+        /**
+         * Getter for the metallic factor, from the metallic map if any
+         * @return The metallic factor of the surface
+        */
+        float getMetallic() const;
 
-        uint32_t getNbHits() const {
-            return _Hits.size();
-        }
+        /**
+         * Getter for the material with the values of its maps at the hit
+         * @param storage The material overridden by the maps, when the hit has any
+         * @return The material of the instance, or a non owning pointer to the storage
+        */
+        MaterialPtr getShadingMaterial(Material& storage) const;
 
-        RayHit getClosestHit() {
-            std::pop_heap(_Hits.begin(), _Hits.end(), RayHit::compareRayHit);
-            return _Hits.back();
-        }
+        /**
+         * Getter for the constants of the material at the hit
+         * @param shadingMaterial The material from getShadingMaterial
+         * @param storage The constants of the material overridden by the maps, when the hit has any
+         * @return The constants of the instance, or the storage
+        */
+        const MaterialConstants& getShadingConstants(const MaterialPtr& shadingMaterial, MaterialConstants& storage) const;
 
+    private:
+        float getTextureFootprint() const;
 };
 
-};
\ No newline at end of file
+};
@@ -0,0 +1,125 @@
+#pragma once
+
+#include "be_ray.hpp"
+
+#include <array>
+#include <bit>
+#include <cstdint>
+
+namespace be{
+
+/**
+ * A packet of rays traversed together, the box tests of its lanes run as one simd loop
+ * @note A lane is in use when its bit is set in _Active, the traversal narrows the mask
+ * of the lanes that still overlap a node
+ * @note The rays are also kept whole for the triangle tests and the single ray fallback
+*/
+template<uint32_t N>
+struct RayPacket{
+    static_assert(N > 0 && N <= 32, "A packet mask holds at most 32 lanes");
+    static constexpr uint32_t SIZE = N;
+    static constexpr uint32_t FULL_MASK = N == 32 ? UINT32_MAX : (1u << N) - 1;
+
+    std::array<Ray, N> _Rays{};
+    alignas(32) std::array<float, N> _OriginX{};
+    alignas(32) std::array<float, N> _OriginY{};
+    alignas(32) std::array<float, N> _OriginZ{};
+    alignas(32) std::array<float, N> _InvDirectionX{};
+    alignas(32) std::array<float, N> _InvDirectionY{};
+    alignas(32) std::array<float, N> _InvDirectionZ{};
+    alignas(32) std::array<float, N> _TMin{};
+    alignas(32) std::array<float, N> _TMax{};
+    uint32_t _Active = 0;
+
+    /**
+     * Put a ray in a lane
+     * @param lane The lane
+     * @param ray The ray
+    */
+    void set(uint32_t lane, const Ray& ray){
+        _Rays[lane] = ray;
+        Vector3 origin = ray.getOrigin();
+        Vector3 invDirection = ray.getInvDirection();
+        _OriginX[lane] = origin.x();
+        _OriginY[lane] = origin.y();
+        _OriginZ[lane] = origin.z();
+        _InvDirectionX[lane] = invDirection.x();
+        _InvDirectionY[lane] = invDirection.y();
+        _InvDirectionZ[lane] = invDirection.z();
+        _TMin[lane] = ray._TMin;
+        _TMax[lane] = ray._TMax;
+        _Active |= 1u << lane;
+    }
+
+    /**
+     * Shrink the range of a lane, after a hit
+     * @param lane The lane
+     * @param tMax The new end of the range
+    */
+    void setTMax(uint32_t lane, float tMax){
+        _TMax[lane] = tMax;
+        _Rays[lane]._TMax = tMax;
+    }
+
+    /**
+     * Check which lanes intersect a box in their [_TMin, _TMax]
+     * @param minX The minimum x-coordinate of the box
+     * @param maxX The maximum x-coordinate of the box
+     * @param minY The minimum y-coordinate of the box
+     * @param maxY The maximum y-coordinate of the box
+     * @param minZ The minimum z-coordinate of the box
+     * @param maxZ The maximum z-coordinate of the box
+     * @param mask The lanes to test
+     * @return The lanes of the mask that intersect the box
+     * @note Same slab test as Ray::rayBoxIntersection, a NaN keeps the current range
+    */
+    uint32_t intersectBox(float minX, float maxX, float minY, float maxY, float minZ, float maxZ, uint32_t mask) const {
+        alignas(32) std::array<uint32_t, N> isHit{};
+
+        #pragma omp simd
+        for(uint32_t lane = 0; lane<N; lane++){
+            float tMin = _TMin[lane];
+            float tMax = _TMax[lane];
+
+            float invX = _InvDirectionX[lane];
+            float nearX = ((invX < 0.f ? maxX : minX) - _OriginX[lane]) * invX;
+            float farX = ((invX < 0.f ? minX : maxX) - _OriginX[lane]) * invX;
+            tMin = nearX > tMin ? nearX : tMin;
+            tMax = farX < tMax ? farX : tMax;
+
+            float invY = _InvDirectionY[lane];
+            float nearY = ((invY < 0.f ? maxY : minY) - _OriginY[lane]) * invY;
+            float farY = ((invY < 0.f ? minY : maxY) - _OriginY[lane]) * invY;
+            tMin = nearY > tMin ? nearY : tMin;
+            tMax = farY < tMax ? farY : tMax;
+
+            float invZ = _InvDirectionZ[lane];
+            float nearZ = ((invZ < 0.f ? maxZ : minZ) - _OriginZ[lane]) * invZ;
+            float farZ = ((invZ < 0.f ? minZ : maxZ) - _OriginZ[lane]) * invZ;
+            tMin = nearZ > tMin ? nearZ : tMin;
+            tMax = farZ < tMax ? farZ : tMax;
+
+            isHit[lane] = tMin <= tMax ? 1u : 0u;
+        }
+
+        uint32_t hitMask = 0;
+        for(uint32_t lane = 0; lane<N; lane++){
+            hitMask |= isHit[lane] << lane;
+        }
+        return hitMask & mask;
+    }
+
+    /**
+     * Tells if too few lanes are left for a packet to pay off
+     * @param mask The active lanes
+     * @return True if the lanes should go on one by one
+    */
+    static bool isIncoherent(uint32_t mask){
+        return static_cast<uint32_t>(std::popcount(mask)) <= N / 4;
+    }
+};
+
+using RayPacket4 = RayPacket<4>;
+using RayPacket8 = RayPacket<8>;
+
+}
@@ -1,6 +1,12 @@
 #pragma once
 
+#include "be_aovBuffers.hpp" // IWYU pragma: keep
+#include "be_cameraRayGenerator.hpp" // IWYU pragma: keep
+#include "be_denoiser.hpp" // IWYU pragma: keep
 #include "be_image.hpp" // IWYU pragma: keep
+#include "be_preparedScene.hpp" // IWYU pragma: keep
 #include "be_ray.hpp" // IWYU pragma: keep
 #include "be_rayHit.hpp" // IWYU pragma: keep
-#include "be_raytracer.hpp" // IWYU pragma: keep
\ No newline at end of file
+#include "be_raytracer.hpp" // IWYU pragma: keep
+#include "be_textureCache.hpp" // IWYU pragma: keep
+#include "be_tileWorkers.hpp" // IWYU pragma: keep
\ No newline at end of file
@@ -8,27 +8,47 @@
 #include "be_trigonometry.hpp"
 #include "be_utilityFunctions.hpp"
 
+#include <algorithm>
+#include <bit>
+#include <cmath>
 #include <omp.h>
+#include <unordered_map>
+#include <utility>
 
 namespace be{
 
-RayPtr RayTracer::sampleNewRay(const RayHit& rayHit) const {
+template<RayTracer::SamplingDistribution SAMPLING>
+Ray RayTracer::sampleNewRay(const RayHit& rayHit) const {
+    Ray newRay{};
+    if constexpr(SAMPLING == HEMISPHERE_SAMPLING){
+        newRay = Ray::generateRandomRayInHemiSphere(rayHit);
+    } else {
+        newRay = Ray::generateRandomRayLambertianDistribution(rayHit);
+    }
+    // the cone keeps its width at the hit, and widens as a diffuse lobe
+    newRay._ConeWidth = rayHit.getConeWidth();
+    newRay._ConeSpread = BOUNCE_CONE_SPREAD;
+    return newRay;
+}
+
+Ray RayTracer::sampleNewRay(const RayHit& rayHit) const {
     switch(_SamplingDistribution){
         case HEMISPHERE_SAMPLING:
-            return Ray::generateRandomRayInHemiSphere(rayHit);
+            return sampleNewRay<HEMISPHERE_SAMPLING>(rayHit);
         case LAMBERTIAN_SAMPLING:
-            return Ray::generateRandomRayLambertianDistribution(rayHit); 
+            return sampleNewRay<LAMBERTIAN_SAMPLING>(rayHit);
+        default:
+            ErrorHandler::handle(
+                __FILE__, __LINE__,
+                ErrorCode::UNKNOWN_VALUE_ERROR,
+                "The given sample distribution method is unkown!\n"
+            );
+            return Ray{};
     }
-    ErrorHandler::handle(
-        __FILE__, __LINE__,
-        ErrorCode::UNKNOWN_VALUE_ERROR,
-        "The given sample distribution method is unkown!\n"
-    );
-    return nullptr;
 }
 
 Vector3 RayTracer::colorBRDF(const RayHit& rayHit) const{
-    return rayHit.getCol().xyz();
+    return rayHit.getAlbedo();
 }
 
 Vector3 RayTracer::normalBRDF(const RayHit& rayHit) const{
@@ -40,32 +60,36 @@ Vector3 RayTracer::normalBRDF(const RayHit& rayHit) const{
     return color;
 }
 
-bool RayTracer::isInShadow(RayPtr shadowRay, float distToLight) const {
-    RayHits shadowHits = getHits(shadowRay);
-    if(shadowHits.getNbHits() == 0){
-        return false;
+bool RayTracer::isInShadow(const Ray& shadowRay, float distToLight) const {
+    _ThreadCounters->getThreadCounters()._ShadowRays++;
+    // check if the shadow ray hits any object before reaching the light source,
+    // the direction is normalized so the ray parameter is the distance
+    Ray ray = shadowRay;
+    ray._TMax = std::min(ray._TMax, distToLight);
+    return traceRay(ray, true).has_value();
+}
+
+Vector3 RayTracer::getVisibleRadiance(const Vector3& radiance, const Ray& shadowRay, float distToLight, Ray* deferredShadowRay) const {
+    if(radiance.isZero()){
+        return Color::BLACK;
     }
-    // check if the shadow ray hits any object before reaching the light source
-    for(auto hit: shadowHits._Hits){
-        if(hit.getTriangle()._IsLight){
-            continue;
-        }
-        float hitDist = (hit.getWorldPos() - shadowRay->getOrigin()).getNorm();
-        if(hitDist < distToLight) {
-            return true;
-        }
+    if(deferredShadowRay != nullptr){
+        *deferredShadowRay = shadowRay;
+        deferredShadowRay->_TMax = std::min(shadowRay._TMax, distToLight);
+        return radiance;
     }
-    return false;
+    return isInShadow(shadowRay, distToLight) ? Color::BLACK : radiance;
 }
 
 
 Vector3 RayTracer::disneyBRDF(const RayHit& rayHit) const{
-    return disneyBRDF(rayHit, _Scene->getPointLights(), _Scene->getDirectionalLights());
+    return disneyBRDF(rayHit, _Scene->getPointLights(), _Scene->getDirectionalLights(), _Scene->getOrientedLights());
 }
 
 Vector3 RayTracer::disneyBRDF(const RayHit& rayHit, 
             const std::vector<PointLightPtr>& pointLights,
-            const std::vector<DirectionalLightPtr>& directionalLights 
+            const std::vector<DirectionalLightPtr>& directionalLights,
+            const std::vector<OrientedLightPtr>& orientedLights
         ) const{
     Vector3 color = Color::BLACK;
     // point lights
@@ -76,25 +100,33 @@ Vector3 RayTracer::disneyBRDF(const RayHit& rayHit,
     for(const auto& directionalLight : directionalLights){
         color += disneyBRDF(rayHit, directionalLight);
     }
+    // oriented lights
+    for(const auto& orientedLight : orientedLights){
+        color += disneyBRDF(rayHit, orientedLight);
+    }
     return color;
 }
 
-Vector3 RayTracer::disneyBRDF(const RayHit& rayHit, PointLightPtr light) const{
+Vector3 RayTracer::disneyBRDF(const RayHit& rayHit, PointLightPtr light, Ray* deferredShadowRay) const{
     Vector3 hitWorldPos = rayHit.getWorldPos();
 
     Vector3 wo = Vector3::normalize(light->_Position.xyz() - hitWorldPos);
     Vector3 wi = Vector3::normalize(-rayHit.getDirection());
-    MaterialPtr material = rayHit.getTriangle()._Material;
+    Material textured{};
+    MaterialPtr material = rayHit.getShadingMaterial(textured);
+    MaterialConstants texturedConstants{};
+    const MaterialConstants& constants = rayHit.getShadingConstants(material, texturedConstants);
 
     Vector3 hitNormal = rayHit.getWorldNorm();
-    Vector3 surfaceColor = rayHit.getCol().xyz();
+    Vector3 surfaceColor = rayHit.getAlbedo();
 
     Vector3 materialReflectance = Disney::BRDF(
         wi, wo,
         hitNormal, 
         surfaceColor, 
         material,
-        light
+        constants,
+        light->getIntensity()
     );
 
     Vector3 lightRadiance = Disney::getAttenuation(light, hitWorldPos);
@@ -102,29 +134,66 @@ Vector3 RayTracer::disneyBRDF(const RayHit& rayHit, PointLightPtr light) const{
 
     // cast shadow ray
     Vector3 lightDir = Vector3::normalize((light->_Position.xyz() - rayHit.getWorldPos()));
-    RayPtr shadowRay = RayPtr(new Ray(rayHit.getWorldPos(), lightDir));
+    Ray shadowRay(rayHit.getWorldPos(), lightDir);
     float distToLight = (light->_Position.xyz() - rayHit.getWorldPos()).getNorm();
-    if (!isInShadow(shadowRay, distToLight)){
-        return lightRadiance * materialReflectance * wiDotN;
+    return getVisibleRadiance(lightRadiance * materialReflectance * wiDotN, shadowRay, distToLight, deferredShadowRay);
+}
+
+
+Vector3 RayTracer::disneyBRDF(const RayHit& rayHit, OrientedLightPtr light, Ray* deferredShadowRay) const{
+    Vector3 hitWorldPos = rayHit.getWorldPos();
+
+    Vector3 wo = Vector3::normalize(light->_Position.xyz() - hitWorldPos);
+    Vector3 wi = Vector3::normalize(-rayHit.getDirection());
+    Vector3 lightRadiance = Disney::getAttenuation(light, hitWorldPos);
+    if(lightRadiance.isZero()){
+        return Color::BLACK;
     }
-    return Color::BLACK;
+
+    Material textured{};
+    MaterialPtr material = rayHit.getShadingMaterial(textured);
+    MaterialConstants texturedConstants{};
+    const MaterialConstants& constants = rayHit.getShadingConstants(material, texturedConstants);
+
+    Vector3 hitNormal = rayHit.getWorldNorm();
+    Vector3 surfaceColor = rayHit.getAlbedo();
+
+    Vector3 materialReflectance = Disney::BRDF(
+        wi, wo,
+        hitNormal, 
+        surfaceColor, 
+        material,
+        constants,
+        light->getIntensity()
+    );
+
+    float wiDotN = std::max(0.f, Vector3::dot(wo, hitNormal));
+
+    // cast shadow ray
+    Ray shadowRay(hitWorldPos, wo);
+    float distToLight = (light->_Position.xyz() - hitWorldPos).getNorm();
+    return getVisibleRadiance(lightRadiance * materialReflectance * wiDotN, shadowRay, distToLight, deferredShadowRay);
 }
 
 
-Vector3 RayTracer::disneyBRDF(const RayHit& rayHit, DirectionalLightPtr light) const{
+Vector3 RayTracer::disneyBRDF(const RayHit& rayHit, DirectionalLightPtr light, Ray* deferredShadowRay) const{
     Vector3 wo = -light->_Direction.xyz();
     Vector3 wi = -rayHit.getDirection();
-    MaterialPtr material = rayHit.getTriangle()._Material;
+    Material textured{};
+    MaterialPtr material = rayHit.getShadingMaterial(textured);
+    MaterialConstants texturedConstants{};
+    const MaterialConstants& constants = rayHit.getShadingConstants(material, texturedConstants);
 
     Vector3 hitNormal = rayHit.getWorldNorm();
-    Vector3 surfaceColor = rayHit.getCol().xyz();
+    Vector3 surfaceColor = rayHit.getAlbedo();
 
    Vector3 materialReflectance = Disney::BRDF(
         wi, wo,
         hitNormal, 
         surfaceColor, 
         material,
-        light
+        constants,
+        light->getIntensity()
     );
 
     Vector3 lightRadiance = Disney::getAttenuation(light);
@@ -132,21 +201,19 @@ Vector3 RayTracer::disneyBRDF(const RayHit& rayHit, DirectionalLightPtr light) c
 
     // cast shadow ray
     Vector3 lightDir = Vector3::normalize(light->_Direction.xyz());
-    RayPtr shadowRay = RayPtr(new Ray(rayHit.getWorldPos(), -lightDir));
-    if (!isInShadow(shadowRay)){
-        return lightRadiance * materialReflectance * wiDotN;
-    }
-    return Color::BLACK;
+    Ray shadowRay(rayHit.getWorldPos(), -lightDir);
+    return getVisibleRadiance(lightRadiance * materialReflectance * wiDotN, shadowRay, INFINITY, deferredShadowRay);
 }
 
 
 Vector3 RayTracer::ggxBRDF(const RayHit& rayHit) const{
-    return ggxBRDF(rayHit, _Scene->getPointLights(), _Scene->getDirectionalLights());
+    return ggxBRDF(rayHit, _Scene->getPointLights(), _Scene->getDirectionalLights(), _Scene->getOrientedLights());
 }
 
 Vector3 RayTracer::ggxBRDF(const RayHit& rayHit, 
             const std::vector<PointLightPtr>& pointLights,
-            const std::vector<DirectionalLightPtr>& directionalLights 
+            const std::vector<DirectionalLightPtr>& directionalLights,
+            const std::vector<OrientedLightPtr>& orientedLights
         ) const{
     Vector3 color = Color::BLACK;
     // point lights
@@ -157,25 +224,28 @@ Vector3 RayTracer::ggxBRDF(const RayHit& rayHit,
     for(const auto& directionalLight : directionalLights){
         color += ggxBRDF(rayHit, directionalLight);
     }
+    // oriented lights
+    for(const auto& orientedLight : orientedLights){
+        color += ggxBRDF(rayHit, orientedLight);
+    }
     return color;
 }
 
-Vector3 RayTracer::ggxBRDF(const RayHit& rayHit, PointLightPtr light) const{
+Vector3 RayTracer::ggxBRDF(const RayHit& rayHit, PointLightPtr light, Ray* deferredShadowRay) const{
     Vector3 hitWorldPos = rayHit.getWorldPos();
 
     Vector3 wi = Vector3::normalize(light->_Position.xyz() - hitWorldPos);
     Vector3 wo = Vector3::normalize(-rayHit.getDirection());
-    MaterialPtr material = rayHit.getTriangle()._Material;
 
     Vector3 hitNormal = rayHit.getWorldNorm();
-    Vector3 surfaceColor = rayHit.getCol().xyz();
+    Vector3 surfaceColor = rayHit.getAlbedo();
 
     Vector3 materialReflectance = GGX::BRDF(
         wi, wo,
         hitNormal, 
         surfaceColor, 
-        material->_Roughness, 
-        material->_Metallic
+        rayHit.getRoughness(), 
+        rayHit.getMetallic()
     );
 
     Vector3 lightRadiance = GGX::getAttenuation(light, hitWorldPos);
@@ -183,29 +253,56 @@ Vector3 RayTracer::ggxBRDF(const RayHit& rayHit, PointLightPtr light) const{
 
     // cast shadow ray
     Vector3 lightDir = Vector3::normalize((light->_Position.xyz() - rayHit.getWorldPos()));
-    RayPtr shadowRay = RayPtr(new Ray(rayHit.getWorldPos(), lightDir));
+    Ray shadowRay(rayHit.getWorldPos(), lightDir);
     float distToLight = (light->_Position.xyz() - rayHit.getWorldPos()).getNorm();
-    if (!isInShadow(shadowRay, distToLight)){
-        return lightRadiance * materialReflectance * wiDotN;
+    return getVisibleRadiance(lightRadiance * materialReflectance * wiDotN, shadowRay, distToLight, deferredShadowRay);
+}
+
+
+Vector3 RayTracer::ggxBRDF(const RayHit& rayHit, OrientedLightPtr light, Ray* deferredShadowRay) const{
+    Vector3 hitWorldPos = rayHit.getWorldPos();
+
+    Vector3 wi = Vector3::normalize(light->_Position.xyz() - hitWorldPos);
+    Vector3 wo = Vector3::normalize(-rayHit.getDirection());
+
+    Vector3 lightRadiance = GGX::getAttenuation(light, hitWorldPos);
+    if(lightRadiance.isZero()){
+        return Color::BLACK;
     }
-    return Color::BLACK;
+
+    Vector3 hitNormal = rayHit.getWorldNorm();
+    Vector3 surfaceColor = rayHit.getAlbedo();
+
+    Vector3 materialReflectance = GGX::BRDF(
+        wi, wo,
+        hitNormal, 
+        surfaceColor, 
+        rayHit.getRoughness(), 
+        rayHit.getMetallic()
+    );
+
+    float wiDotN = std::max(0.f, Vector3::dot(wi, hitNormal));
+
+    // cast shadow ray
+    Ray shadowRay(hitWorldPos, wi);
+    float distToLight = (light->_Position.xyz() - hitWorldPos).getNorm();
+    return getVisibleRadiance(lightRadiance * materialReflectance * wiDotN, shadowRay, distToLight, deferredShadowRay);
 }
 
 
-Vector3 RayTracer::ggxBRDF(const RayHit& rayHit, DirectionalLightPtr light) const{
+Vector3 RayTracer::ggxBRDF(const RayHit& rayHit, DirectionalLightPtr light, Ray* deferredShadowRay) const{
     Vector3 wi = -light->_Direction.xyz();
     Vector3 wo = -rayHit.getDirection();
-    MaterialPtr material = rayHit.getTriangle()._Material;
 
     Vector3 hitNormal = rayHit.getWorldNorm();
-    Vector3 surfaceColor = rayHit.getCol().xyz();
+    Vector3 surfaceColor = rayHit.getAlbedo();
 
     Vector3 materialReflectance = GGX::BRDF(
         wi, wo,
         hitNormal, 
         surfaceColor, 
-        material->_Roughness, 
-        material->_Metallic
+        rayHit.getRoughness(), 
+        rayHit.getMetallic()
     );
 
     Vector3 lightRadiance = GGX::getAttenuation(light);
@@ -213,41 +310,48 @@ Vector3 RayTracer::ggxBRDF(const RayHit& rayHit, DirectionalLightPtr light) cons
 
     // cast shadow ray
     Vector3 lightDir = Vector3::normalize(light->_Direction.xyz());
-    RayPtr shadowRay = RayPtr(new Ray(rayHit.getWorldPos(), -lightDir));
-    if (!isInShadow(shadowRay)){
-        return lightRadiance * materialReflectance * wiDotN;
-    }
-    return Color::BLACK;
+    Ray shadowRay(rayHit.getWorldPos(), -lightDir);
+    return getVisibleRadiance(lightRadiance * materialReflectance * wiDotN, shadowRay, INFINITY, deferredShadowRay);
 }
 
 
 
-Vector3 RayTracer::lambertBRDF(const RayHit& rayHit, PointLightPtr light) const{
+Vector3 RayTracer::lambertBRDF(const RayHit& rayHit, PointLightPtr light, Ray* deferredShadowRay) const{
     Vector3 lightDir = Vector3::normalize((light->_Position.xyz() - rayHit.getWorldPos()));
     float diffuseFactor = std::max(0.f, Vector3::dot(rayHit.getWorldNorm(), lightDir)) / PI;
     // cast shadow ray
-    RayPtr shadowRay = RayPtr(new Ray(rayHit.getWorldPos(), lightDir));
+    Ray shadowRay(rayHit.getWorldPos(), lightDir);
     float distToLight = (light->_Position.xyz() - rayHit.getWorldPos()).getNorm();
-    if (!isInShadow(shadowRay, distToLight)){
-        return (diffuseFactor * light->_Intensity) * (rayHit.getCol().xyz() * light->_Color.xyz());
+    return getVisibleRadiance((diffuseFactor * light->_Intensity) * (rayHit.getAlbedo() * light->_Color.xyz()), shadowRay, distToLight, deferredShadowRay);
+}
+
+Vector3 RayTracer::lambertBRDF(const RayHit& rayHit, OrientedLightPtr light, Ray* deferredShadowRay) const{
+    Vector3 hitWorldPos = rayHit.getWorldPos();
+    // same emission and clamped falloff as the other brdfs
+    Vector3 lightRadiance = GGX::getAttenuation(light, hitWorldPos);
+    if(lightRadiance.isZero()){
+        return Color::BLACK;
     }
-    return Color::BLACK;
+    Vector3 lightDir = Vector3::normalize((light->_Position.xyz() - hitWorldPos));
+    float diffuseFactor = std::max(0.f, Vector3::dot(rayHit.getWorldNorm(), lightDir)) / PI;
+    // cast shadow ray
+    Ray shadowRay(hitWorldPos, lightDir);
+    float distToLight = (light->_Position.xyz() - hitWorldPos).getNorm();
+    return getVisibleRadiance(diffuseFactor * (rayHit.getAlbedo() * lightRadiance), shadowRay, distToLight, deferredShadowRay);
 }
 
-Vector3 RayTracer::lambertBRDF(const RayHit& rayHit, DirectionalLightPtr light) const{
+Vector3 RayTracer::lambertBRDF(const RayHit& rayHit, DirectionalLightPtr light, Ray* deferredShadowRay) const{
     Vector3 lightDir = Vector3::normalize(light->_Direction.xyz());
     float diffuseFactor = std::max(0.f, Vector3::dot(rayHit.getWorldNorm(), lightDir));
     // cast shadow ray
-    RayPtr shadowRay = RayPtr(new Ray(rayHit.getWorldPos(), -lightDir));
-    if (!isInShadow(shadowRay)){
-        return (diffuseFactor * light->_Intensity) * (rayHit.getCol().xyz() * light->_Color.xyz());
-    }
-    return Color::BLACK;
+    Ray shadowRay(rayHit.getWorldPos(), -lightDir);
+    return getVisibleRadiance((diffuseFactor * light->_Intensity) * (rayHit.getAlbedo() * light->_Color.xyz()), shadowRay, INFINITY, deferredShadowRay);
 }
 
 Vector3 RayTracer::lambertBRDF(const RayHit& rayHit, 
         const std::vector<PointLightPtr>& pointLights,
-        const std::vector<DirectionalLightPtr>& directionalLights 
+        const std::vector<DirectionalLightPtr>& directionalLights,
+        const std::vector<OrientedLightPtr>& orientedLights
     ) const{
     Vector3 color = Color::BLACK;
     // point lights
@@ -258,12 +362,16 @@ Vector3 RayTracer::lambertBRDF(const RayHit& rayHit,
     for(const auto& directionalLight : directionalLights){
         color += lambertBRDF(rayHit, directionalLight);
     }
+    // oriented lights
+    for(const auto& orientedLight : orientedLights){
+        color += lambertBRDF(rayHit, orientedLight);
+    }
     return color;
 }
 
 
 Vector3 RayTracer::lambertBRDF(const RayHit& rayHit) const{
-    return lambertBRDF(rayHit, _Scene->getPointLights(), _Scene->getDirectionalLights());
+    return lambertBRDF(rayHit, _Scene->getPointLights(), _Scene->getDirectionalLights(), _Scene->getOrientedLights());
 }
 
 // Vector3 RayTracer::getErrorBoundLambertBRDF(const RayHit& rayHit, LightCutsTree::LightNodePtr curNode) const{
@@ -273,13 +381,13 @@ Vector3 RayTracer::lambertBRDF(const RayHit& rayHit) const{
 //     // direction from the center of the AABB to the hit
 //     Vector3 lightDir = (curNode->_AABB.getClosestPoint(worlPosHit) - worlPosHit);
 //     if(lightDir.getSquaredNorm() < EPSILON){
-//         return curNode->_Representative->getColor() * rayHit.getCol().xyz();
+//         return curNode->_Representative->getColor() * rayHit.getAlbedo();
 //     }
 //     float diffuseFactor = std::max(0.f, Vector3::dot(rayHit.getWorldNorm(), lightDir)) / PI;
 //     // cast shadow ray
-//     RayPtr shadowRay = RayPtr(new Ray(worlPosHit, lightDir));
+//     Ray shadowRay(worlPosHit, lightDir);
 //     if (!isInShadow(shadowRay, distToLight)){
-//         return diffuseFactor * (rayHit.getCol().xyz() * curNode->_Representative->getColor());
+//         return diffuseFactor * (rayHit.getAlbedo() * curNode->_Representative->getColor());
 //     }
 //     return Color::BLACK;
 // }
@@ -324,17 +432,121 @@ Vector3 RayTracer::lambertBRDF(const RayHit& rayHit) const{
 // }
 
 
-Vector3 RayTracer::getClusterEstimate(const RayHit& rayHit, LightCutsTree::LightNodePtr cluster) const {
-    if(rayHit.getTriangle()._IsLight){
-        return colorBRDF(rayHit);
+void RayTracer::getOrthonormalBasis(const Vector3& normal, Vector3& tangent, Vector3& bitangent){
+    // branchless orthonormal basis
+    // see https://graphics.pixar.com/library/OrthonormalB/paper.pdf
+    float sign = std::copysign(1.f, normal.z());
+    float a = -1.f / (sign + normal.z());
+    float b = normal.x() * normal.y() * a;
+    tangent = Vector3(1.f + sign * normal.x() * normal.x() * a, sign * b, -sign * normal.x());
+    bitangent = Vector3(b, sign + normal.y() * normal.y() * a, -normal.y());
+}
+
+RayTracer::LightCutsShadingPoint::LightCutsShadingPoint(const RayHit& rayHit){
+    _Pos = rayHit.getWorldPos();
+    _Normal = rayHit.getWorldNorm();
+    _Albedo = rayHit.getAlbedo();
+    getOrthonormalBasis(_Normal, _Tangent, _Bitangent);
+}
+
+void RayTracer::GatherTree::addGatherPoint(const RayHit& rayHit, float weight){
+    _Hits.push_back(rayHit);
+    _Points.emplace_back(rayHit);
+    _Weights.push_back(weight);
+}
+
+void RayTracer::GatherTree::build(){
+    _Nodes.clear();
+    if(_Points.empty()){
+        return;
+    }
+    _Nodes.reserve(2*_Points.size() - 1);
+    std::vector<uint32_t> points(_Points.size());
+    for(uint32_t i=0; i<points.size(); i++){
+        points[i] = i;
+    }
+    addNode(points, 0, points.size());
+}
+
+uint32_t RayTracer::GatherTree::addNode(std::vector<uint32_t>& points, uint32_t begin, uint32_t end){
+    uint32_t index = _Nodes.size();
+    _Nodes.emplace_back();
+
+    // bounds of the positions, normals, albedos and weights
+    Vector3 minPos = _Points[points[begin]]._Pos;
+    Vector3 maxPos = minPos;
+    Vector3 maxAlbedo = Vector3::zeros();
+    Vector3 normalSum = Vector3::zeros();
+    float weight = 0.f;
+    for(uint32_t i=begin; i<end; i++){
+        const LightCutsShadingPoint& point = _Points[points[i]];
+        for(int k=0; k<3; k++){
+            minPos[k] = std::min(minPos[k], point._Pos[k]);
+            maxPos[k] = std::max(maxPos[k], point._Pos[k]);
+            maxAlbedo[k] = std::max(maxAlbedo[k], point._Albedo[k]);
+        }
+        normalSum += point._Normal;
+        weight += _Weights[points[i]];
+    }
+
+    GatherNode node{};
+    node._Center = 0.5f * (minPos + maxPos);
+    node._HalfExtent = 0.5f * (maxPos - minPos);
+    node._MaxAlbedo = maxAlbedo;
+    node._Weight = weight;
+    if(normalSum.getSquaredNorm() < EPSILON){
+        // normals in every directions
+        node._NormalAxis = Vector3(0.f, 0.f, 1.f);
+        node._NormalCosHalfAngle = -1.f;
+        node._NormalSinHalfAngle = 0.f;
+    } else {
+        node._NormalAxis = Vector3::normalize(normalSum);
+        float cosHalfAngle = 1.f;
+        for(uint32_t i=begin; i<end; i++){
+            cosHalfAngle = std::min(cosHalfAngle, Vector3::dot(node._NormalAxis, _Points[points[i]]._Normal));
+        }
+        node._NormalCosHalfAngle = cosHalfAngle;
+        node._NormalSinHalfAngle = std::sqrt(std::max(0.f, 1.f - cosHalfAngle*cosHalfAngle));
+    }
+    getOrthonormalBasis(node._NormalAxis, node._NormalTangent, node._NormalBitangent);
+
+    if(end - begin == 1){
+        node._Representative = points[begin];
+        _Nodes[index] = node;
+        return index;
+    }
+
+    // median split along the longest axis
+    uint32_t axis = 0;
+    if(node._HalfExtent[1] > node._HalfExtent[axis]){
+        axis = 1;
+    }
+    if(node._HalfExtent[2] > node._HalfExtent[axis]){
+        axis = 2;
     }
-    switch(cluster->_Type){
+    uint32_t middle = begin + (end - begin) / 2;
+    std::nth_element(points.begin() + begin, points.begin() + middle, points.begin() + end,
+        [&](uint32_t p1, uint32_t p2){
+            return _Points[p1]._Pos[axis] < _Points[p2]._Pos[axis];
+        }
+    );
+
+    uint32_t leftChild = addNode(points, begin, middle);
+    node._RightChild = addNode(points, middle, end);
+    // the left child always shares the representative of its parent
+    node._Representative = _Nodes[leftChild]._Representative;
+    _Nodes[index] = node;
+    return index;
+}
+
+Vector3 RayTracer::getClusterEstimate(const RayHit& rayHit, uint32_t cluster) const {
+    const LightCutsTree::FlatTree& tree = _LightTree->getFlatTree();
+    uint32_t representative = tree._Representative[cluster];
+    float visibility = 1.f; // already in the BRDF shadow ray
+    float intensity = tree._TotalIntensity[cluster];
+    switch(tree._Type[cluster]){
         case POINT_LIGHT:{
-            PointLightPtr pointLight = std::dynamic_pointer_cast<PointLight>(cluster->_Representative);
-            float visibility = 1.f; // already in Lambert shadow ray
-            float geometric = 1.f; 
-            // float geometric = cluster->getGeometric(rayHit.getWorldPos());
-            float intensity = cluster->_TotalIntensity;
+            const PointLightPtr& pointLight = tree._PointLights[representative];
             Vector3 material{};
             switch(_BRDF){
                 case LAMBERT_BRDF:
@@ -345,18 +557,14 @@ Vector3 RayTracer::getClusterEstimate(const RayHit& rayHit, LightCutsTree::Light
                     break;
                 case DISNEY_BRDF:
                     material = disneyBRDF(rayHit, pointLight) / pointLight->getIntensity();
+                    break;
                 default:
                     break;
             } 
-            // cluster->_BRDF = material * intensity;
-            return material*geometric*visibility*intensity; 
+            return material*visibility*intensity; 
         }
         case DIRECTIONAL_LIGHT:{
-            DirectionalLightPtr directionalLight = std::dynamic_pointer_cast<DirectionalLight>(cluster->_Representative);
-            float visibility = 1.f; // already in Lambert shadow ray
-            float geometric = 1.f; 
-            // float geometric = cluster->getGeometric(rayHit.getWorldPos());
-            float intensity = cluster->_TotalIntensity;
+            const DirectionalLightPtr& directionalLight = tree._DirectionalLights[representative];
             Vector3 material{};
             switch(_BRDF){
                 case LAMBERT_BRDF:
@@ -371,160 +579,431 @@ Vector3 RayTracer::getClusterEstimate(const RayHit& rayHit, LightCutsTree::Light
                 default:
                     break;
             } 
-            return material*geometric*visibility*intensity; 
+            return material*visibility*intensity; 
+        }
+        case ORIENTED_LIGHT:{
+            const OrientedLightPtr& orientedLight = tree._OrientedLights[representative];
+            Vector3 material{};
+            switch(_BRDF){
+                case LAMBERT_BRDF:
+                    material = lambertBRDF(rayHit, orientedLight) / orientedLight->getIntensity();
+                    break;
+                case GGX_BRDF:
+                    material = ggxBRDF(rayHit, orientedLight) / orientedLight->getIntensity();
+                    break;
+                case DISNEY_BRDF:
+                    material = disneyBRDF(rayHit, orientedLight) / orientedLight->getIntensity();
+                    break;
+                default:
+                    break;
+            } 
+            return material*visibility*intensity; 
         }
         default:
             return Vector3{};
     }
 }
 
-Vector3 RayTracer::getClusterError(const RayHit& rayHit, LightCutsTree::LightNodePtr cluster) const {
-    if(rayHit.getTriangle()._IsLight){
-        return colorBRDF(rayHit);
+Vector3 RayTracer::getClusterError(const LightCutsShadingPoint& point, uint32_t cluster) const {
+    const LightCutsTree::FlatTree& tree = _LightTree->getFlatTree();
+    float visibility = 1.f; // all lights are potentially visible
+    float orientation = tree.getOrientationBound(cluster, point._Pos);
+    if(orientation == 0.f){
+        return Vector3::zeros();
     }
-    
-    float visibility = cluster->getVisibility();
-    float geometric = cluster->getGeometricBound(rayHit.getWorldPos());
-    float intensity = cluster->_TotalIntensity;
+    float d2 = tree.getSquaredDistance(cluster, point._Pos);
+    float geometric = Maths::isZero(d2) ? 1.f : 1.f / d2;
+    float intensity = tree._TotalIntensity[cluster];
     // material upper bound
     Vector3 material{};
     // diffuse
-    Vector3 diffuseBound = cluster->_TotalColor * rayHit.getCol().xyz();
+    Vector3 diffuseBound = tree._TotalColor[cluster] * point._Albedo;
     // cosine upper bound
-    float theta = std::acos(
-        be::Vector3::dot(rayHit.getWorldNorm(), {0.f, 0.f, 1.f})
+    float cosBound = tree.getCosineBound(cluster, point._Pos, point._Tangent, point._Bitangent, point._Normal);
+    // attenuation
+    float attenuation = 1.f / std::max(1.f, d2);
+
+    switch(_BRDF){
+        case LAMBERT_BRDF:
+            material = diffuseBound*cosBound;
+            break;
+        case GGX_BRDF:
+            material = attenuation*diffuseBound*cosBound;
+            break;
+        // TODO: better bound for disney brdf
+        case DISNEY_BRDF:
+            material = attenuation*diffuseBound*cosBound;
+            break;
+        default:
+            break;
+    }
+
+    return material*geometric*visibility*orientation*intensity; 
+}
+
+Vector3 RayTracer::getProductClusterError(const GatherTree& gatherTree, uint32_t gatherCluster, uint32_t lightCluster) const {
+    const LightCutsTree::FlatTree& tree = _LightTree->getFlatTree();
+    const GatherTree::GatherNode& gather = gatherTree._Nodes[gatherCluster];
+    float visibility = 1.f; // all lights are potentially visible
+    float orientation = tree.getOrientationBound(lightCluster, gather._Center, gather._HalfExtent.getNorm());
+    if(orientation == 0.f){
+        return Vector3::zeros();
+    }
+    float d2 = tree.getSquaredDistance(lightCluster, gather._Center, gather._HalfExtent);
+    float geometric = Maths::isZero(d2) ? 1.f : 1.f / d2;
+    float intensity = tree._TotalIntensity[lightCluster] * gather._Weight;
+    // material upper bound
+    Vector3 material{};
+    // diffuse
+    Vector3 diffuseBound = tree._TotalColor[lightCluster] * gather._MaxAlbedo;
+    // cosine upper bound between the boxes, widened by the cone of normals
+    float cosBound = tree.getCosineBound(lightCluster, gather._Center, gather._HalfExtent, 
+        gather._NormalTangent, gather._NormalBitangent, gather._NormalAxis
     );
-    AxisAlignedBoundingBox rotatedAABB = cluster->_AABB.rotate(theta);
-    float cosBound = 1.f;
-    float maxZ = rotatedAABB._MaxZ;
-    float maxZ2 = maxZ*maxZ;
-    if(maxZ >= 0){
-        float minX2 = std::min(rotatedAABB._MinX*rotatedAABB._MinX, rotatedAABB._MaxX*rotatedAABB._MaxX);
-        float minY2 = std::min(rotatedAABB._MinY*rotatedAABB._MinY, rotatedAABB._MaxY*rotatedAABB._MaxY);
-        cosBound = maxZ / std::sqrt(minX2 + minY2 + maxZ2);
+    if(cosBound >= gather._NormalCosHalfAngle){
+        cosBound = 1.f;
     } else {
-        float maxX2 = std::max(rotatedAABB._MinX*rotatedAABB._MinX, rotatedAABB._MaxX*rotatedAABB._MaxX);
-        float maxY2 = std::max(rotatedAABB._MinY*rotatedAABB._MinY, rotatedAABB._MaxY*rotatedAABB._MaxY);
-        cosBound = maxZ / std::sqrt(maxX2 + maxY2 + maxZ2);
+        // cos(boxAngle - normalAngle)
+        float sinBound = std::sqrt(std::max(0.f, 1.f - cosBound*cosBound));
+        cosBound = std::min(1.f, cosBound*gather._NormalCosHalfAngle + sinBound*gather._NormalSinHalfAngle);
     }
     // attenuation
-    float dlen2 = cluster->_AABB.getDistance(rayHit.getWorldPos());
-    dlen2 *= dlen2;
-    if (dlen2 < 1) dlen2 = 1;
-    float attenuation = 1.f/dlen2;
+    float attenuation = 1.f / std::max(1.f, d2);
 
     switch(_BRDF){
         case LAMBERT_BRDF:
-            material = diffuseBound*std::max(0.f, cosBound);
+            material = diffuseBound*cosBound;
             break;
         case GGX_BRDF:
-            material = attenuation*diffuseBound*std::max(0.f, cosBound);
+            material = attenuation*diffuseBound*cosBound;
             break;
         // TODO: better bound for disney brdf
         case DISNEY_BRDF:
-            material = attenuation*diffuseBound*std::max(0.f, cosBound);
+            material = attenuation*diffuseBound*cosBound;
             break;
         default:
             break;
     }
 
-    return material*geometric*visibility*intensity; 
+    return material*geometric*visibility*orientation*intensity; 
 }
 
-Vector3 RayTracer::shadeLightCuts(RayHits& hits, uint32_t depth) const {
-    if(hits.getNbHits() == 0){
-        return _BackgroundColor;
+RayTracer::ProductCutHeap RayTracer::createProductCutHeap(const GatherTree& gatherTree, uint32_t gatherCluster, uint32_t lightCluster, 
+        const Vector3& clusterEstimate) const {
+    const LightCutsTree::FlatTree& tree = _LightTree->getFlatTree();
+    ProductCutHeap cut{};
+    cut._GatherCluster = gatherCluster;
+    cut._LightCluster = lightCluster;
+    cut._ClusterEstimate = {clusterEstimate.r(), clusterEstimate.g(), clusterEstimate.b()};
+    if(gatherTree.isLeaf(gatherCluster) && tree.isLeaf(lightCluster)){
+        cut._Error = 0.f;
+    } else {
+        cut._Error = getCutHeapError(false, getProductClusterError(gatherTree, gatherCluster, lightCluster), clusterEstimate);
+    }
+    return cut;
+}
+
+RayTracer::CutHeap RayTracer::createCutHeap(const LightCutsShadingPoint& point, uint32_t cluster, const Vector3& clusterEstimate) const {
+    const LightCutsTree::FlatTree& tree = _LightTree->getFlatTree();
+    CutHeap cut{};
+    cut._Cluster = cluster;
+    cut._ClusterEstimate = {clusterEstimate.r(), clusterEstimate.g(), clusterEstimate.b()};
+    if(tree.isLeaf(cluster)){
+        cut._Error = 0.f;
+    } else {
+        cut._Error = getCutHeapError(false, getClusterError(point, cluster), clusterEstimate);
     }
+    return cut;
+}
 
-    if(depth > _MaxBounces){
-        return Color::WHITE;
+uint32_t RayTracer::seedLightCut(const RayHit& rayHit, const LightCutsShadingPoint& point, 
+        const LightCutsSeed& seed, CutHeap* cutHeap) const {
+    const LightCutsTree::FlatTree& tree = _LightTree->getFlatTree();
+    // evaluate the previous cut at the new point
+    uint32_t cutSize = 0;
+    for(uint32_t i=0; i<seed._Size; i++){
+        uint32_t cluster = seed._Clusters[i];
+        cutHeap[cutSize++] = createCutHeap(point, cluster, getClusterEstimate(rayHit, cluster));
     }
-    
-    RayHit closestHit = hits.getClosestHit();
 
-    Vector3 color = Vector3::zeros();
-            
-    // init cut == root
-    CutHeap rootCut = {};
-    LightCutsTree::LightNodePtr root = _Scene->getLightTreeRoot();
-    rootCut._Cluster = root;
-    rootCut._ClusterEstimate = getClusterEstimate(closestHit, root);
-    rootCut._ClusterError = getClusterError(closestHit, root);
-    // setError(closestHit, root);
-
-    std::vector<CutHeap> cutHeap = {};
-    std::make_heap(cutHeap.begin(), cutHeap.end(), cutHeapComparator);
-    cutHeap.push_back(rootCut);
-    std::push_heap(cutHeap.begin(), cutHeap.end(), cutHeapComparator);
-    
-    while(getCutHeapError(cutHeap.front()) > _LightcutsErrorThreshold 
-            && cutHeap.size() < _LightcutsMaxClusters
-        ){
-        // get worst cluster
-        auto worstCut = cutHeap.front();
-        std::pop_heap(cutHeap.begin(), cutHeap.end(), cutHeapComparator);
-        cutHeap.pop_back();
+    // coarsen, merge two siblings if their parent is precise enough
+    // the pending clusters are ordered by parent and a parent comes before its children in the flat tree,
+    // so siblings are popped one after the other and each pair is evaluated once, bottom-up
+    auto parentComparator = [&tree](const CutHeap& a, const CutHeap& b){
+        return tree._Parent[a._Cluster] < tree._Parent[b._Cluster];
+    };
+    uint32_t pendingSize = cutSize;
+    std::make_heap(cutHeap, cutHeap + pendingSize, parentComparator);
+    while(pendingSize > 0){
+        std::pop_heap(cutHeap, cutHeap + pendingSize, parentComparator);
+        uint32_t parent = tree._Parent[cutHeap[--pendingSize]._Cluster];
+        if(parent == LightCutsTree::FlatTree::NO_NODE || pendingSize == 0 || tree._Parent[cutHeap[0]._Cluster] != parent){
+            continue; // no sibling in the cut, the cluster stays
+        }
+        std::pop_heap(cutHeap, cutHeap + pendingSize, parentComparator);
+        pendingSize--;
+        // the parent estimate is the rescaled estimate of the child sharing its representative
+        uint32_t sameChild = tree._IsLeftChildSame[parent] ? tree._LeftChild[parent] : tree._RightChild[parent];
+        const CutHeap& sameCut = cutHeap[pendingSize]._Cluster == sameChild ? cutHeap[pendingSize] : cutHeap[pendingSize+1];
+        Vector3 parentEstimate = sameCut.getEstimate() * (tree._TotalIntensity[parent] / tree._TotalIntensity[sameChild]);
+        CutHeap parentCut = createCutHeap(point, parent, parentEstimate);
+        if(parentCut._Error > _LightcutsErrorThreshold){
+            continue; // both siblings stay
+        }
+        cutHeap[pendingSize] = parentCut;
+        cutHeap[pendingSize+1] = cutHeap[--cutSize];
+        std::push_heap(cutHeap, cutHeap + ++pendingSize, parentComparator);
+    }
+    return cutSize;
+}
+
+Vector3 RayTracer::getLightCutsRadiance(const RayHit& rayHit, LightCutsSeed* seed) const {
+    const LightCutsTree::FlatTree& tree = _LightTree->getFlatTree();
+    LightCutsShadingPoint point(rayHit);
+    uint32_t maxCutSize = std::min(_LightcutsMaxClusters, LIGHTCUTS_MAX_CUT_SIZE);
+
+    // init cut == root, or the cut of the previous pixel
+    std::array<CutHeap, LIGHTCUTS_MAX_CUT_SIZE> cutHeap;
+    uint32_t cutSize = 0;
+    if(seed != nullptr && seed->_Size > 0){
+        cutSize = seedLightCut(rayHit, point, *seed, cutHeap.data());
+        std::make_heap(cutHeap.begin(), cutHeap.begin() + cutSize, cutHeapComparator);
+    } else {
+        cutHeap[cutSize++] = createCutHeap(point, 0, getClusterEstimate(rayHit, 0));
+    }
 
-        auto worstCluster = worstCut._Cluster;
-        CutHeap leftCut{};
-        CutHeap rightCut{};
+    while(cutSize < maxCutSize && cutHeap[0]._Error > _LightcutsErrorThreshold){
+        // get worst cluster
+        std::pop_heap(cutHeap.begin(), cutHeap.begin() + cutSize, cutHeapComparator);
+        CutHeap worstCut = cutHeap[--cutSize];
+        uint32_t worstCluster = worstCut._Cluster;
         // get its two children
-        leftCut._Cluster = worstCluster->_LeftChild;
-        rightCut._Cluster = worstCluster->_RightChild;
-        // estimate their clusters
-        if(worstCluster->_IsLeftChildSame){
-            leftCut._ClusterEstimate = worstCut._ClusterEstimate * (leftCut._Cluster->_TotalIntensity / worstCluster->_TotalIntensity);
-            rightCut._ClusterEstimate = getClusterEstimate(closestHit, rightCut._Cluster);
+        uint32_t leftCluster = tree._LeftChild[worstCluster];
+        uint32_t rightCluster = tree._RightChild[worstCluster];
+        // estimate their clusters, the one sharing the representative is rescaled
+        Vector3 leftEstimate{};
+        Vector3 rightEstimate{};
+        if(tree._IsLeftChildSame[worstCluster]){
+            leftEstimate = worstCut.getEstimate() * (tree._TotalIntensity[leftCluster] / tree._TotalIntensity[worstCluster]);
+            rightEstimate = getClusterEstimate(rayHit, rightCluster);
         } else {
-            leftCut._ClusterEstimate = getClusterEstimate(closestHit, leftCut._Cluster);
-            rightCut._ClusterEstimate = worstCut._ClusterEstimate * (rightCut._Cluster->_TotalIntensity / worstCluster->_TotalIntensity);
+            leftEstimate = getClusterEstimate(rayHit, leftCluster);
+            rightEstimate = worstCut.getEstimate() * (tree._TotalIntensity[rightCluster] / tree._TotalIntensity[worstCluster]);
         }
-        // get their error
-        leftCut._ClusterError = getClusterError(closestHit, leftCut._Cluster);
-        rightCut._ClusterError = getClusterError(closestHit, rightCut._Cluster);
-
-        // setError(closestHit, leftChild);
-        // setError(closestHit, rightChild);
-
         // add them to heap
-        cutHeap.push_back(leftCut);
-        cutHeap.push_back(rightCut);
-        std::push_heap(cutHeap.begin(), cutHeap.end(), cutHeapComparator);
+        cutHeap[cutSize++] = createCutHeap(point, leftCluster, leftEstimate);
+        std::push_heap(cutHeap.begin(), cutHeap.begin() + cutSize, cutHeapComparator);
+        cutHeap[cutSize++] = createCutHeap(point, rightCluster, rightEstimate);
+        std::push_heap(cutHeap.begin(), cutHeap.begin() + cutSize, cutHeapComparator);
     }
+
     // return sum of estimates
-    // fprintf(stdout, "cut size: %zu / %zu\n", cutHeap.size(), _Scene->getPointLights().size());
-    for(auto cluster : cutHeap){
-        // fprintf(stdout, "cur cluster: %s\n", cluster->toString().c_str());
-        color += cluster._ClusterEstimate;
-        // color += cluster->_BRDF;
+    Vector3 color = Vector3::zeros();
+    for(uint32_t i=0; i<cutSize; i++){
+        color += cutHeap[i].getEstimate();
     }
 
-    if(depth == _MaxBounces){
-        return color;
+    _ThreadCounters->getThreadCounters().addLightCut(cutSize);
+
+    // keep the finished cut for the next pixel
+    if(seed != nullptr){
+        for(uint32_t i=0; i<cutSize; i++){
+            seed->_Clusters[i] = cutHeap[i]._Cluster;
+        }
+        seed->_Size = cutSize;
     }
+    return color;
+}
 
-    // path tracing
-    Vector3 bounceColor = Vector3::zeros();
-    for(uint32_t curSubSample=0; curSubSample<_SamplesPerBounces; curSubSample++){
-        RayPtr newRay = sampleNewRay(closestHit);    
-        RayHits bouncedHits = getHits(newRay);
+std::vector<OrientedLightPtr> RayTracer::generateVirtualPointLights() const {
+    std::vector<OrientedLightPtr> virtualPointLights{};
+    std::vector<PointLightPtr> pointLights = _Scene->getPointLights();
+    std::vector<DirectionalLightPtr> directionalLights = _Scene->getDirectionalLights();
+    std::vector<OrientedLightPtr> orientedLights = _Scene->getOrientedLights();
+    size_t nbLights = pointLights.size() + directionalLights.size() + orientedLights.size();
+    if(nbLights == 0 || _InstanceTree._Nodes.empty() || _VirtualPointLightsPaths == 0){
+        return virtualPointLights;
+    }
+    uint32_t pathsPerLight = std::max(1u, static_cast<uint32_t>(_VirtualPointLightsPaths / nbLights));
+
+    // bounding sphere of the scene, for the paths of directional lights
+    const AxisAlignedBoundingBox& sceneBounds = _InstanceTree._Nodes[0]._Bounds;
+    Vector3 sceneCenter = sceneBounds.getCenter();
+    float sceneRadius = std::max(0.5f * sceneBounds.getDiagonalLength(), 1e-3f);
+
+    // emit the light paths, each one carries an equal part of the light flux
+    std::vector<std::pair<Ray, Vector3>> lightPaths{};
+    lightPaths.reserve(pathsPerLight * nbLights);
+    for(const auto& light : pointLights){
+        Vector3 flux = (4.f * PI * light->_Intensity / pathsPerLight) * light->_Color.xyz();
+        for(uint32_t k=0; k<pathsPerLight; k++){
+            Vector3 direction = Ray::generateRandomRayInUnitSphere().getDirection();
+            lightPaths.push_back({Ray(light->_Position.xyz(), direction), flux});
+        }
+    }
+    for(const auto& light : orientedLights){
+        Vector3 flux = (4.f * PI * light->_Intensity / pathsPerLight) * light->_Color.xyz();
+        for(uint32_t k=0; k<pathsPerLight; k++){
+            Vector3 direction = Ray::generateRandomRayInUnitSphere().getDirection();
+            if(light->getEmission(direction) > 0.f){
+                lightPaths.push_back({Ray(light->_Position.xyz(), direction), flux});
+            }
+        }
+    }
+    for(const auto& light : directionalLights){
+        // rays through a disk facing the light, covering the whole scene, sampled uniformly with a polar map
+        Vector3 direction = Vector3::normalize(light->_Direction.xyz());
+        Vector3 tangent{};
+        Vector3 bitangent{};
+        getOrthonormalBasis(direction, tangent, bitangent);
+        Vector3 flux = (PI * sceneRadius * sceneRadius * light->_Intensity / pathsPerLight) * light->_Color.xyz();
+        for(uint32_t k=0; k<pathsPerLight; k++){
+            float radius = std::sqrt(Maths::random_float(0.f, 1.f));
+            float angle = 2.f * PI * Maths::random_float(0.f, 1.f);
+            Vector3 offset = radius * (std::cos(angle) * tangent + std::sin(angle) * bitangent);
+            Vector3 origin = sceneCenter + sceneRadius * (offset - 2.f * direction);
+            lightPaths.push_back({Ray(origin, direction), flux});
+        }
+    }
+
+    // deposit a virtual point light at each diffuse bounce
+    float minSquaredDistance = _VirtualPointLightsMinDistance * _VirtualPointLightsMinDistance;
+    RayTracingCounters& counters = _ThreadCounters->getThreadCounters();
+    for(auto& [ray, flux] : lightPaths){
+        for(uint32_t depth=0; depth<_VirtualPointLightsMaxDepth; depth++){
+            counters._LightPathRays++;
+            RayHitOpt hit = getClosestHit(ray);
+            if(!hit.has_value()){
+                break;
+            }
+            const RayHit& closestHit = hit.value();
+            if(closestHit.isLight()){
+                break;
+            }
+            float diffuse = closestHit.getMaterial() == nullptr ? 1.f : 1.f - closestHit.getMetallic();
+            flux *= diffuse * closestHit.getAlbedo();
+            float maxFlux = std::max(flux.r(), std::max(flux.g(), flux.b()));
+            if(maxFlux <= 0.f){
+                break;
+            }
+
+            Vector3 normal = closestHit.getWorldNorm();
+            if(Vector3::dot(normal, ray.getDirection()) > 0.f){
+                normal = -normal;
+            }
+            // the reflected flux is emitted in a cosine lobe over the hemisphere of the surface, I = flux * cos / pi
+            OrientedLightPtr virtualPointLight = OrientedLightPtr(new OrientedLight());
+            virtualPointLight->_Position = Vector4(closestHit.getWorldPos(), 1.f);
+            virtualPointLight->_Direction = Vector4(normal, 0.f);
+            virtualPointLight->_Color = Vector4(flux / maxFlux, 1.f);
+            virtualPointLight->_Intensity = maxFlux / PI;
+            virtualPointLight->_Angle = PI;
+            virtualPointLight->_IsCosineLobe = true;
+            virtualPointLight->_MinSquaredDistance = minSquaredDistance;
+            virtualPointLights.push_back(virtualPointLight);
+
+            // cosine sampling cancels the lambertian brdf
+            ray = Ray::generateRandomRayLambertianDistribution(closestHit);
+        }
+    }
+    return virtualPointLights;
+}
 
-        if(bouncedHits.getNbHits() > 0){
-            bounceColor += _ShadingFactor * shadeLightCuts(bouncedHits, depth+1);
+Vector3 RayTracer::getMultidimensionalLightCutsRadiance(const GatherTree& gatherTree) const {
+    const LightCutsTree::FlatTree& tree = _LightTree->getFlatTree();
+    uint32_t maxCutSize = std::min(_LightcutsMaxProductClusters, LIGHTCUTS_MAX_PRODUCT_CUT_SIZE);
+
+    // init cut == (gather root, light root)
+    std::array<ProductCutHeap, LIGHTCUTS_MAX_PRODUCT_CUT_SIZE> cutHeap;
+    uint32_t cutSize = 0;
+    const GatherTree::GatherNode& root = gatherTree._Nodes[0];
+    Vector3 rootEstimate = root._Weight * getClusterEstimate(gatherTree._Hits[root._Representative], 0);
+    cutHeap[cutSize++] = createProductCutHeap(gatherTree, 0, 0, rootEstimate);
+
+    while(cutSize < maxCutSize && cutHeap[0]._Error > _LightcutsErrorThreshold){
+        // get worst pair of clusters
+        std::pop_heap(cutHeap.begin(), cutHeap.begin() + cutSize, productCutHeapComparator);
+        ProductCutHeap worstCut = cutHeap[--cutSize];
+        uint32_t gatherCluster = worstCut._GatherCluster;
+        uint32_t lightCluster = worstCut._LightCluster;
+        const GatherTree::GatherNode& gather = gatherTree._Nodes[gatherCluster];
+
+        // split the largest of the two clusters
+        bool splitGather = tree.isLeaf(lightCluster) 
+            || (!gatherTree.isLeaf(gatherCluster) 
+                && gather._HalfExtent.getSquaredNorm() > tree._HalfExtent[lightCluster].getSquaredNorm());
+
+        ProductCutHeap leftCut{};
+        ProductCutHeap rightCut{};
+        if(splitGather){
+            // the left gather child shares the representative, its estimate is rescaled
+            uint32_t leftCluster = gatherCluster + 1;
+            uint32_t rightCluster = gather._RightChild;
+            const GatherTree::GatherNode& right = gatherTree._Nodes[rightCluster];
+            Vector3 leftEstimate = worstCut.getEstimate() * (gatherTree._Nodes[leftCluster]._Weight / gather._Weight);
+            Vector3 rightEstimate = right._Weight * getClusterEstimate(gatherTree._Hits[right._Representative], lightCluster);
+            leftCut = createProductCutHeap(gatherTree, leftCluster, lightCluster, leftEstimate);
+            rightCut = createProductCutHeap(gatherTree, rightCluster, lightCluster, rightEstimate);
         } else {
-            bounceColor += _BackgroundColor;
+            // the light child sharing the representative is rescaled
+            const RayHit& rayHit = gatherTree._Hits[gather._Representative];
+            uint32_t leftCluster = tree._LeftChild[lightCluster];
+            uint32_t rightCluster = tree._RightChild[lightCluster];
+            Vector3 leftEstimate{};
+            Vector3 rightEstimate{};
+            if(tree._IsLeftChildSame[lightCluster]){
+                leftEstimate = worstCut.getEstimate() * (tree._TotalIntensity[leftCluster] / tree._TotalIntensity[lightCluster]);
+                rightEstimate = gather._Weight * getClusterEstimate(rayHit, rightCluster);
+            } else {
+                leftEstimate = gather._Weight * getClusterEstimate(rayHit, leftCluster);
+                rightEstimate = worstCut.getEstimate() * (tree._TotalIntensity[rightCluster] / tree._TotalIntensity[lightCluster]);
+            }
+            leftCut = createProductCutHeap(gatherTree, gatherCluster, leftCluster, leftEstimate);
+            rightCut = createProductCutHeap(gatherTree, gatherCluster, rightCluster, rightEstimate);
         }
+
+        // add them to heap
+        cutHeap[cutSize++] = leftCut;
+        std::push_heap(cutHeap.begin(), cutHeap.begin() + cutSize, productCutHeapComparator);
+        cutHeap[cutSize++] = rightCut;
+        std::push_heap(cutHeap.begin(), cutHeap.begin() + cutSize, productCutHeapComparator);
     }
-    color += bounceColor / _SamplesPerBounces;
 
+    // return sum of estimates
+    Vector3 color = Vector3::zeros();
+    for(uint32_t i=0; i<cutSize; i++){
+        color += cutHeap[i].getEstimate();
+    }
+    _ThreadCounters->getThreadCounters().addLightCut(cutSize);
     return color;
 }
 
+Vector3 RayTracer::shadeGatherPoint(const RayHitOpt& hit, GatherTree& gatherTree) const {
+    if(!hit.has_value()){
+        return _BackgroundColor;
+    }
+
+    const RayHit& closestHit = hit.value();
+
+    // direct lighting is deferred to the multidimensional cut of the pixel
+    Vector3 color = Vector3::zeros();
+    if(closestHit.isLight()){
+        color += colorBRDF(closestHit);
+    } else {
+        gatherTree.addGatherPoint(closestHit);
+    }
 
+    // indirect lighting is already carried by the virtual point lights
+    if(_MaxBounces == 0 || _UseVirtualPointLights){
+        return color;
+    }
 
+    color += shadeLightCutsBounces(closestHit, 0);
+    return color;
+}
 
-Vector3 RayTracer::shade(RayHits& hits, uint32_t depth) const {
-    if(hits.getNbHits() == 0){
+Vector3 RayTracer::shadeLightCuts(const RayHitOpt& hit, uint32_t depth, LightCutsSeed* seed) const {
+    if(!hit.has_value()){
         return _BackgroundColor;
     }
 
@@ -532,151 +1011,1353 @@ Vector3 RayTracer::shade(RayHits& hits, uint32_t depth) const {
         return Color::WHITE;
     }
     
-    RayHit closestHit = hits.getClosestHit();
+    const RayHit& closestHit = hit.value();
 
     Vector3 color = Vector3::zeros();
-    if(closestHit.getTriangle()._IsLight){
+    if(closestHit.isLight()){
         color += colorBRDF(closestHit);
     } else {
-        switch(_BRDF){
-            case COLOR_BRDF:
-                color += colorBRDF(closestHit);
-                break;
-            case NORMAL_BRDF:
-                color += normalBRDF(closestHit);
-                break;
-            case LAMBERT_BRDF:
-                color += lambertBRDF(closestHit);
-                break;
-            case GGX_BRDF:
-                color += ggxBRDF(closestHit);
-                break;
-            case DISNEY_BRDF:
-                color += disneyBRDF(closestHit);
-                break;
-        }
+        color += getLightCutsRadiance(closestHit, seed);
     }
 
-    if(depth == _MaxBounces){
+    // indirect lighting is already carried by the virtual point lights
+    if(depth == _MaxBounces || _UseVirtualPointLights){
         return color;
     }
 
+    color += shadeLightCutsBounces(closestHit, depth);
+    return color;
+}
+
+Vector3 RayTracer::shadeLightCutsBounces(const RayHit& closestHit, uint32_t depth) const {
     // path tracing
     Vector3 bounceColor = Vector3::zeros();
     for(uint32_t curSubSample=0; curSubSample<_SamplesPerBounces; curSubSample++){
-        RayPtr newRay = sampleNewRay(closestHit);    
-        RayHits bouncedHits = getHits(newRay);
+        Ray newRay = sampleNewRay(closestHit);
+        _ThreadCounters->getThreadCounters()._BounceRays++;
+        RayHitOpt bouncedHit = getClosestHit(newRay);
 
-        if(bouncedHits.getNbHits() > 0){
-            bounceColor += _ShadingFactor * shade(bouncedHits, depth+1);
+        if(bouncedHit.has_value()){
+            bounceColor += _ShadingFactor * shadeLightCuts(bouncedHit, depth+1);
         } else {
             bounceColor += _BackgroundColor;
         }
     }
-    color += bounceColor / _SamplesPerBounces;
-
-    return color;
+    return bounceColor / _SamplesPerBounces;
 }
 
-std::vector<Triangle> RayTracer::getTriangles(){
-    std::vector<Triangle> allTriangles = {};
-    fprintf(stdout, "There are %zu objects in the scene!\n", _Scene->getObjects().size());
-
-    _BSH.clear();
-    _BVH.clear();
-
-    for(auto obj : _Scene->getObjects()){
-        
-        auto model = GameCoordinator::getComponent<ComponentModel>(obj)._Model;
-        auto triangles = model->getTrianglePrimitives();
-        fprintf(stdout, "\tThere are %zu triangles in the object `%d'\n", triangles.size(), obj);
-
-        auto material = GameCoordinator::getComponent<ComponentMaterial>(obj)._Material;
-        auto transform = GameCoordinator::getComponent<ComponentTransform>(obj)._Transform;
-        bool isLight = GameCoordinator::getComponent<ComponentLight>(obj)._IsLight;
-        Matrix4x4 modelMatrix = transform->getModelTransposed();
-        Matrix4x4 viewMatrix = Matrix4x4::transpose(_Frame._Camera->getView());
-        Matrix4x4 normalMat = Matrix4x4::transpose(Matrix4x4::inverse(viewMatrix*transform->getModel()));
-
-        for(size_t k = 0; k<triangles.size(); k++){
-            auto& triangle = triangles[k];
 
-            triangle._WorldPos0 = (modelMatrix * Vector4(triangle._Pos0, 1.f)).xyz();
-            triangle._WorldPos1 = (modelMatrix * Vector4(triangle._Pos1, 1.f)).xyz();
-            triangle._WorldPos2 = (modelMatrix * Vector4(triangle._Pos2, 1.f)).xyz();
 
-            triangle._ViewPos0 = (viewMatrix * Vector4(triangle._Pos0, 1.f)).xyz();
-            triangle._ViewPos1 = (viewMatrix * Vector4(triangle._Pos1, 1.f)).xyz();
-            triangle._ViewPos2 = (viewMatrix * Vector4(triangle._Pos2, 1.f)).xyz();
 
-            triangle._ViewNorm0 = (normalMat * Vector4(triangle._Norm0, 0.f)).xyz();
-            triangle._ViewNorm1 = (normalMat * Vector4(triangle._Norm1, 0.f)).xyz();
-            triangle._ViewNorm2 = (normalMat * Vector4(triangle._Norm2, 0.f)).xyz();
-
-            triangle._Material = material;
-            triangle._Model = modelMatrix;
-            triangle._NormalMat = normalMat;
-
-            triangle._IsLight = isLight;
+template<RayTracer::BRDFModel BRDF, RayTracer::BoundingVolumeMethod METHOD>
+Vector3 RayTracer::getDirectLight(const RayHit& rayHit) const {
+    Vector3 color = Color::BLACK;
+    // the shadow rays are traced here, with the traversal of the run
+    auto addLight = [&](const auto& light){
+        Ray shadowRay{};
+        Vector3 radiance = shadeDirect<BRDF>(rayHit, light, &shadowRay);
+        if(radiance.isZero()){
+            return;
         }
-
-        addObjectToAccelerationStructures(triangles);
-        allTriangles.insert(allTriangles.end(), triangles.begin(), triangles.end());
+        _ThreadCounters->getThreadCounters()._ShadowRays++;
+        if(!traceRay<METHOD>(shadowRay, true).has_value()){
+            color += radiance;
+        }
+    };
+    // point lights
+    for(const auto& pointLight : _Scene->getPointLights()){
+        addLight(pointLight);
+    }
+    // directional lights
+    for(const auto& directionalLight : _Scene->getDirectionalLights()){
+        addLight(directionalLight);
     }
-    return allTriangles;
+    // oriented lights
+    for(const auto& orientedLight : _Scene->getOrientedLights()){
+        addLight(orientedLight);
+    }
+    return color;
 }
 
+template<RayTracer::BRDFModel BRDF, RayTracer::SamplingDistribution SAMPLING, RayTracer::BoundingVolumeMethod METHOD>
+Vector3 RayTracer::shade(const RayHitOpt& hit, uint32_t depth) const {
+    if(!hit.has_value()){
+        return _BackgroundColor;
+    }
 
-RayHits RayTracer::getHitsBSH(RayPtr curRay) const{
-    RayHits hits{};
-    for(auto& bsh: _BSH){
-        bsh->getIntersections(curRay, _Frame._Camera->getPosition(), hits);
+    if(depth > _MaxBounces){
+        return Color::WHITE;
+    }
+    
+    const RayHit& closestHit = hit.value();
+
+    Vector3 color = Vector3::zeros();
+    if(closestHit.isLight()){
+        color += colorBRDF(closestHit);
+    } else if constexpr(BRDF == COLOR_BRDF){
+        color += colorBRDF(closestHit);
+    } else if constexpr(BRDF == NORMAL_BRDF){
+        color += normalBRDF(closestHit);
+    } else {
+        color += getDirectLight<BRDF, METHOD>(closestHit);
     }
-    return hits;
-}
 
-RayHits RayTracer::getHitsBVH(RayPtr curRay) const{
-    RayHits hits{};
-    for(auto& bvh: _BVH){
-        bvh->getIntersections(curRay, _Frame._Camera->getPosition(), hits);
+    if(depth == _MaxBounces){
+        return color;
     }
-    return hits;
-}
 
-RayHits RayTracer::getHitsNaive(RayPtr curRay) const {
-    RayHits hits{};
-    for(auto& triangle : _Primitives){
-        RayHitOpt hit = curRay->rayTriangleIntersection(triangle);
-        if(hit.has_value()){
-            hits.addHit(hit.value());
+    // path tracing
+    Vector3 bounceColor = Vector3::zeros();
+    for(uint32_t curSubSample=0; curSubSample<_SamplesPerBounces; curSubSample++){
+        Ray newRay = sampleNewRay<SAMPLING>(closestHit);
+        _ThreadCounters->getThreadCounters()._BounceRays++;
+        RayHitOpt bouncedHit = getClosestHit<METHOD>(newRay);
+
+        if(bouncedHit.has_value()){
+            bounceColor += _ShadingFactor * shade<BRDF, SAMPLING, METHOD>(bouncedHit, depth+1);
+        } else {
+            bounceColor += _BackgroundColor;
         }
     }
-    return hits;
-}    
+    color += bounceColor / _SamplesPerBounces;
+
+    return color;
+}
 
-RayHits RayTracer::getHits(RayPtr curRay) const {
+template<RayTracer::BRDFModel BRDF, RayTracer::SamplingDistribution SAMPLING>
+RayTracer::ShadeFunction RayTracer::getShadeFunction() const {
     switch(_BoundingVolumeMethod){
         case NAIVE_METHOD:
-            return getHitsNaive(curRay);
+            return &RayTracer::shade<BRDF, SAMPLING, NAIVE_METHOD>;
         case BVH_METHOD:
-            return getHitsBVH(curRay);
+            return &RayTracer::shade<BRDF, SAMPLING, BVH_METHOD>;
         case BSH_METHOD:
-            return getHitsBSH(curRay);
+            return &RayTracer::shade<BRDF, SAMPLING, BSH_METHOD>;
+        default:
+            ErrorHandler::handle(
+                __FILE__, __LINE__,
+                ErrorCode::UNKNOWN_VALUE_ERROR,
+                "The given bounding volume method is unkown!\n"
+            );
+            return nullptr;
+    }
+}
+
+template<RayTracer::BRDFModel BRDF>
+RayTracer::ShadeFunction RayTracer::getShadeFunction() const {
+    switch(_SamplingDistribution){
+        case HEMISPHERE_SAMPLING:
+            return getShadeFunction<BRDF, HEMISPHERE_SAMPLING>();
+        case LAMBERTIAN_SAMPLING:
+            return getShadeFunction<BRDF, LAMBERTIAN_SAMPLING>();
+        default:
+            ErrorHandler::handle(
+                __FILE__, __LINE__,
+                ErrorCode::UNKNOWN_VALUE_ERROR,
+                "The given sample distribution method is unkown!\n"
+            );
+            return nullptr;
+    }
+}
+
+RayTracer::ShadeFunction RayTracer::getShadeFunction() const {
+    switch(_BRDF){
+        case COLOR_BRDF:
+            return getShadeFunction<COLOR_BRDF>();
+        case NORMAL_BRDF:
+            return getShadeFunction<NORMAL_BRDF>();
+        case LAMBERT_BRDF:
+            return getShadeFunction<LAMBERT_BRDF>();
+        case GGX_BRDF:
+            return getShadeFunction<GGX_BRDF>();
+        case DISNEY_BRDF:
+            return getShadeFunction<DISNEY_BRDF>();
+        default:
+            ErrorHandler::handle(
+                __FILE__, __LINE__,
+                ErrorCode::UNKNOWN_VALUE_ERROR,
+                "The given BRDF model is unkown!\n"
+            );
+            return nullptr;
+    }
+}
+
+void RayTracer::buildInstances(){
+    fprintf(stdout, "There are %zu objects in the scene!\n", _Scene->getObjects().size());
+
+    _Meshes.clear();
+    _Instances.clear();
+    _ViewMatrix = Matrix4x4::transpose(_Frame._Camera->getView());
+
+    std::unordered_map<const Mesh*, uint32_t> meshIDs{};
+    std::unordered_map<const Material*, uint32_t> materialIDs{};
+    std::vector<MaterialConstants> materialConstants{};
+    for(auto obj : _Scene->getObjects()){
+        auto mesh = GameCoordinator::getComponent<ComponentModel>(obj)._Model->getMesh();
+        auto [meshIt, isNewMesh] = meshIDs.try_emplace(mesh.get(), _Meshes.size());
+        if(isNewMesh){
+            // the acceleration structures are built once per mesh, in object space
+            InstancedMesh instancedMesh{};
+            instancedMesh._Triangles = mesh->getTrianglePrimitives();
+            for(auto& triangle : instancedMesh._Triangles){
+                triangle._WorldPos0 = triangle._Pos0;
+                triangle._WorldPos1 = triangle._Pos1;
+                triangle._WorldPos2 = triangle._Pos2;
+            }
+            instancedMesh._Primitives = mesh->getAnalyticPrimitives();
+            fprintf(stdout, "\tThere are %zu triangles and %zu analytic primitives in the mesh `%zu'\n",
+                instancedMesh._Triangles.size(), instancedMesh._Primitives.size(), _Meshes.size()
+            );
+
+            auto buildStart = std::chrono::steady_clock::now();
+            addMeshToAccelerationStructures(instancedMesh);
+            _Stats._AccelerationStructuresTime += getMillisecondsSince(buildStart);
+            _Meshes.push_back(std::move(instancedMesh));
+        }
+        if(_Meshes[meshIt->second]._Triangles.empty() && _Meshes[meshIt->second]._Primitives.empty()){
+            continue;
+        }
+
+        auto material = GameCoordinator::getComponent<ComponentMaterial>(obj)._Material;
+        auto transform = GameCoordinator::getComponent<ComponentTransform>(obj)._Transform;
+
+        Instance instance{};
+        instance._Mesh = meshIt->second;
+        instance._Model = transform->getModelTransposed();
+        instance._ModelInv = Matrix4x4::inverse(instance._Model);
+        instance._ViewModel = _ViewMatrix * instance._Model;
+        instance._NormalMat = Matrix4x4::transpose(Matrix4x4::inverse(_ViewMatrix*transform->getModel()));
+        instance._Material = material;
+        const MaterialTextures& textures = GameCoordinator::getComponent<ComponentMaterial>(obj)._Textures;
+        if(!textures.isEmpty()){
+            if(_TextureCache == nullptr){
+                _TextureCache = std::make_shared<TextureCache>();
+            }
+            instance._TextureCache = _TextureCache.get();
+            instance._TextureIDs = _TextureCache->load(textures);
+        }
+        instance._ObjectID = obj;
+        auto [materialIt, isNewMaterial] = materialIDs.try_emplace(material.get(), materialIDs.size());
+        if(isNewMaterial){
+            // the derived constants of each material are built once per run
+            materialConstants.push_back(material != nullptr ? MaterialConstants::fromMaterial(*material) : MaterialConstants{});
+        }
+        instance._MaterialID = materialIt->second;
+        instance._MaterialConstants = materialConstants[instance._MaterialID];
+        instance._IsLight = GameCoordinator::getComponent<ComponentLight>(obj)._IsLight;
+
+        // world box of the transformed corners of the object box
+        instance._Bounds = _Meshes[instance._Mesh]._Bounds.transform(instance._Model);
+        _Instances.push_back(instance);
     }
-    ErrorHandler::handle(
-        __FILE__, __LINE__,
-        ErrorCode::UNKNOWN_VALUE_ERROR,
-        "The given bounding volume method is unkown!\n"
+    fprintf(stdout, "\tThere are %zu instances of %zu meshes\n", _Instances.size(), _Meshes.size());
+
+    auto buildStart = std::chrono::steady_clock::now();
+    _InstanceTree.build(_Instances);
+    _Stats._AccelerationStructuresTime += getMillisecondsSince(buildStart);
+}
+
+void RayTracer::buildPreparedInstances(){
+    const PreparedScene& preparedScene = *_PreparedScene;
+    fprintf(stdout, "There are %zu objects in the prepared scene `%s'!\n",
+        preparedScene.getInstances().size(), preparedScene.getFileName().c_str()
     );
-    return {};
+
+    _Meshes.clear();
+    _Instances.clear();
+    _ViewMatrix = Matrix4x4::transpose(_Frame._Camera->getView());
+
+    // the triangles and the hierarchies are traversed where they are mapped
+    std::span<const TriangleAttributes> triangles = preparedScene.getTriangles();
+    std::span<const PreparedScene::Node> nodes = preparedScene.getNodes();
+    std::span<const AnalyticPrimitive> primitives = preparedScene.getPrimitives();
+    std::span<const PreparedScene::Node> primitiveNodes = preparedScene.getPrimitiveNodes();
+    for(const auto& record : preparedScene.getMeshes()){
+        InstancedMesh mesh{};
+        mesh._PreparedTriangles = triangles.subspan(record._FirstTriangle, record._NbTriangles);
+        mesh._PreparedNodes = nodes.subspan(record._FirstNode, record._NbNodes);
+        mesh._PreparedPrimitives = primitives.subspan(record._FirstPrimitive, record._NbPrimitives);
+        mesh._PreparedPrimitiveNodes = primitiveNodes.subspan(record._FirstPrimitiveNode, record._NbPrimitiveNodes);
+        mesh._Bounds = record._Bounds;
+        _Meshes.push_back(std::move(mesh));
+    }
+
+    // the instances hold the view dependent matrices, they are rebuilt for each run
+    std::vector<MaterialPtr> materials{};
+    for(const Material& material : preparedScene.getMaterials()){
+        materials.push_back(std::make_shared<Material>(material));
+    }
+    std::span<const MaterialConstants> materialConstants = preparedScene.getMaterialConstants();
+    for(const auto& record : preparedScene.getInstances()){
+        Instance instance{};
+        instance._Mesh = record._Mesh;
+        instance._Model = Matrix4x4(record._Model);
+        instance._ModelInv = Matrix4x4(record._ModelInv);
+        instance._ViewModel = _ViewMatrix * instance._Model;
+        instance._NormalMat = Matrix4x4::transpose(Matrix4x4::inverse(_ViewMatrix*Matrix4x4::transpose(instance._Model)));
+        instance._Material = materials[record._Material];
+        MaterialTextures textures = preparedScene.getTextures(record);
+        if(!textures.isEmpty()){
+            if(_TextureCache == nullptr){
+                _TextureCache = std::make_shared<TextureCache>();
+            }
+            instance._TextureCache = _TextureCache.get();
+            instance._TextureIDs = _TextureCache->load(textures);
+        }
+        instance._ObjectID = record._ObjectID;
+        instance._MaterialID = record._Material;
+        instance._MaterialConstants = materialConstants[record._Material];
+        instance._IsLight = record._IsLight != 0;
+        instance._Bounds = record._Bounds;
+        _Instances.push_back(instance);
+    }
+    fprintf(stdout, "\tThere are %zu instances of %zu meshes\n", _Instances.size(), _Meshes.size());
+
+    // the instances are stored in the order of the leaves of the top level structure
+    _InstanceTree._Nodes.clear();
+    for(const auto& node : preparedScene.getInstanceNodes()){
+        InstanceTree::InstanceNode instanceNode{};
+        instanceNode._Bounds = node._Bounds;
+        instanceNode._Instance = node.isLeaf() ? node._First : InstanceTree::NO_NODE;
+        instanceNode._RightChild = node._RightChild;
+        _InstanceTree._Nodes.push_back(instanceNode);
+    }
+}
+
+void RayTracer::InstanceTree::build(const std::vector<Instance>& instances){
+    _Nodes.clear();
+    if(instances.empty()){
+        return;
+    }
+    _Nodes.reserve(2 * instances.size() - 1);
+    std::vector<uint32_t> indices(instances.size());
+    for(uint32_t i=0; i<indices.size(); i++){
+        indices[i] = i;
+    }
+    addNode(instances, indices, 0, indices.size());
 }
 
-void RayTracer::addObjectToAccelerationStructures(const std::vector<Triangle>& triangles){
-    _BSH.push_back(BSHPtr(new BSH(triangles)));
-    _BVH.push_back(BVHPtr(new BVH(triangles)));
+uint32_t RayTracer::InstanceTree::addNode(const std::vector<Instance>& instances, std::vector<uint32_t>& indices, uint32_t begin, uint32_t end){
+    uint32_t nodeIndex = _Nodes.size();
+    _Nodes.push_back({});
+
+    AxisAlignedBoundingBox bounds = instances[indices[begin]]._Bounds;
+    for(uint32_t i = begin+1; i<end; i++){
+        bounds = AxisAlignedBoundingBox::merge(bounds, instances[indices[i]]._Bounds);
+    }
+    _Nodes[nodeIndex]._Bounds = bounds;
+
+    if(end - begin == 1){
+        _Nodes[nodeIndex]._Instance = indices[begin];
+        return nodeIndex;
+    }
+
+    // median split of the centers along the dominant axis, keeps the depth logarithmic
+    int axis = static_cast<int>(bounds.getDominantAxis());
+    uint32_t middle = begin + (end - begin) / 2;
+    std::nth_element(indices.begin() + begin, indices.begin() + middle, indices.begin() + end,
+        [&instances, axis](uint32_t i1, uint32_t i2){
+            return instances[i1]._Bounds.getCenter()[axis] < instances[i2]._Bounds.getCenter()[axis];
+        }
+    );
+
+    addNode(instances, indices, begin, middle);
+    uint32_t rightChild = addNode(instances, indices, middle, end);
+    _Nodes[nodeIndex]._RightChild = rightChild;
+    return nodeIndex;
 }
 
+template<RayTracer::BoundingVolumeMethod METHOD>
+void RayTracer::getInstanceHit(uint32_t instanceIndex, Ray& curRay, RayHitOpt& closestHit, RayTracingCounters& counters) const{
+    const Instance& instance = _Instances[instanceIndex];
+    const InstancedMesh& mesh = _Meshes[instance._Mesh];
+
+    // the direction is not normalized, so that t is the same in both spaces
+    Ray objectRay(
+        (instance._ModelInv * Vector4(curRay.getOrigin(), 1.f)).xyz(),
+        (instance._ModelInv * Vector4(curRay.getDirection(), 0.f)).xyz(),
+        curRay._TMin,
+        curRay._TMax
+    );
+
+    RayHitOpt objectHit = RayHit::NO_HIT;
+    if(!mesh._PreparedNodes.empty()){
+        // the prepared scenes only store flat hierarchies, whatever the method
+        BoxHierarchy::getIntersections<TriangleAttributes>(mesh._PreparedNodes, mesh._PreparedTriangles, objectRay, objectHit, counters);
+    } else if(!mesh._Triangles.empty()){
+        if constexpr(METHOD == NAIVE_METHOD){
+            counters._TriangleTests += mesh._Triangles.size();
+            for(uint32_t k = 0; k<mesh._Triangles.size(); k++){
+                RayHitOpt hit = objectRay.rayTriangleIntersection(mesh._Triangles[k], k);
+                if(hit.has_value()){
+                    objectRay._TMax = hit->getParametricT();
+                    objectHit = hit;
+                }
+            }
+        } else if constexpr(METHOD == BVH_METHOD){
+            mesh._BVH->getIntersections(objectRay, objectHit, counters);
+        } else {
+            mesh._BSH->getIntersections(objectRay, objectHit, counters);
+        }
+    }
+    // the primitives are only tested up to the closest triangle hit
+    if(!mesh._PrimitiveNodes.empty()){
+        BoxHierarchy::getIntersections<AnalyticPrimitive>(mesh._PrimitiveNodes, mesh._Primitives, objectRay, objectHit, counters);
+    } else if(!mesh._PreparedPrimitiveNodes.empty()){
+        BoxHierarchy::getIntersections<AnalyticPrimitive>(mesh._PreparedPrimitiveNodes, mesh._PreparedPrimitives, objectRay, objectHit, counters);
+    }
 
+    // only the closest hit is kept, its attributes are fetched in world space when shading
+    if(objectHit.has_value()){
+        curRay._TMax = objectRay._TMax;
+        closestHit = objectHit->withInstance(instance, instanceIndex, curRay.getDirection(), curRay.getConeWidth(objectRay._TMax));
+    }
+}
+
+void RayTracer::getInstanceHit(uint32_t instanceIndex, Ray& curRay, RayHitOpt& closestHit, RayTracingCounters& counters) const{
+    switch(_BoundingVolumeMethod){
+        case NAIVE_METHOD:
+            getInstanceHit<NAIVE_METHOD>(instanceIndex, curRay, closestHit, counters);
+            break;
+        case BVH_METHOD:
+            getInstanceHit<BVH_METHOD>(instanceIndex, curRay, closestHit, counters);
+            break;
+        case BSH_METHOD:
+            getInstanceHit<BSH_METHOD>(instanceIndex, curRay, closestHit, counters);
+            break;
+        default:
+            ErrorHandler::handle(
+                __FILE__, __LINE__,
+                ErrorCode::UNKNOWN_VALUE_ERROR,
+                "The given bounding volume method is unkown!\n"
+            );
+            return;
+    }
+}
+
+template<RayTracer::BoundingVolumeMethod METHOD>
+RayHitOpt RayTracer::traceRay(Ray& curRay, bool isShadowRay) const {
+    RayHitOpt closestHit = RayHit::NO_HIT;
+    RayTracingCounters& counters = _ThreadCounters->getThreadCounters();
+    counters._TracedRays++;
+    if(_InstanceTree._Nodes.empty()){
+        return closestHit;
+    }
+
+    std::array<uint32_t, InstanceTree::MAX_DEPTH> stack;
+    uint32_t stackSize = 0;
+    stack[stackSize++] = 0;
+    while(stackSize > 0){
+        uint32_t nodeIndex = stack[--stackSize];
+        const auto& node = _InstanceTree._Nodes[nodeIndex];
+        counters._NodeVisits++;
+        const AxisAlignedBoundingBox& bounds = node._Bounds;
+        // the range of the ray is shrunk by every hit, farther instances are culled here
+        if(!curRay.rayBoxIntersection(bounds._MinX, bounds._MaxX, bounds._MinY, bounds._MaxY, bounds._MinZ, bounds._MaxZ)){
+            continue;
+        }
+        if(_InstanceTree.isLeaf(nodeIndex)){
+            // lights do not cast shadows
+            if(isShadowRay && _Instances[node._Instance]._IsLight){
+                continue;
+            }
+            getInstanceHit<METHOD>(node._Instance, curRay, closestHit, counters);
+            // any occluder is enough for a shadow ray
+            if(isShadowRay && closestHit.has_value()){
+                break;
+            }
+        } else {
+            stack[stackSize++] = node._RightChild;
+            stack[stackSize++] = nodeIndex + 1;
+        }
+    }
+
+    if(closestHit.has_value()){
+        counters._Hits++;
+    }
+    return closestHit;
+}
+
+RayHitOpt RayTracer::traceRay(Ray& curRay, bool isShadowRay) const {
+    switch(_BoundingVolumeMethod){
+        case NAIVE_METHOD:
+            return traceRay<NAIVE_METHOD>(curRay, isShadowRay);
+        case BVH_METHOD:
+            return traceRay<BVH_METHOD>(curRay, isShadowRay);
+        case BSH_METHOD:
+            return traceRay<BSH_METHOD>(curRay, isShadowRay);
+        default:
+            ErrorHandler::handle(
+                __FILE__, __LINE__,
+                ErrorCode::UNKNOWN_VALUE_ERROR,
+                "The given bounding volume method is unkown!\n"
+            );
+            return RayHit::NO_HIT;
+    }
+}
+
+template<RayTracer::BoundingVolumeMethod METHOD>
+RayHitOpt RayTracer::getClosestHit(const Ray& curRay) const {
+    Ray ray = curRay;
+    return traceRay<METHOD>(ray, false);
+}
+
+RayHitOpt RayTracer::getClosestHit(const Ray& curRay) const {
+    Ray ray = curRay;
+    return traceRay(ray, false);
+}
+
+void RayTracer::addMeshToAccelerationStructures(InstancedMesh& mesh){
+    if(!mesh._Primitives.empty()){
+        // the primitives are reordered as the leaves of their hierarchy
+        std::vector<AxisAlignedBoundingBox> bounds(mesh._Primitives.begin(), mesh._Primitives.end());
+        std::vector<uint32_t> order{};
+        BoxHierarchy::build(bounds, PreparedScene::MAX_LEAF_SIZE, mesh._PrimitiveNodes, order);
+        std::vector<AnalyticPrimitive> primitives{};
+        primitives.reserve(order.size());
+        for(uint32_t index : order){
+            primitives.push_back(mesh._Primitives[index]);
+        }
+        mesh._Primitives = std::move(primitives);
+        mesh._Bounds = mesh._PrimitiveNodes.front()._Bounds;
+    }
+    if(mesh._Triangles.empty()){
+        return;
+    }
+    mesh._BSH = BSHPtr(new BSH(mesh._Triangles));
+    mesh._BVH = BVHPtr(new BVH(mesh._Triangles));
+    AxisAlignedBoundingBox bounds(mesh._Triangles);
+    mesh._Bounds = mesh._Primitives.empty() ? bounds : AxisAlignedBoundingBox::merge(bounds, mesh._Bounds);
+}
+
+
+
+template<uint32_t N>
+void RayTracer::getInstanceHits(uint32_t instanceIndex, RayPacket<N>& packet, std::array<RayHitOpt, N>& closestHits, uint32_t mask,
+        RayTracingCounters& counters) const{
+    const Instance& instance = _Instances[instanceIndex];
+    const InstancedMesh& mesh = _Meshes[instance._Mesh];
+    if(_BoundingVolumeMethod != BVH_METHOD || mesh._BVH == nullptr || mesh.hasPrimitives() || RayPacket<N>::isIncoherent(mask)){
+        for(; mask != 0; mask &= mask - 1){
+            uint32_t lane = std::countr_zero(mask);
+            getInstanceHit(instanceIndex, packet._Rays[lane], closestHits[lane], counters);
+            packet.setTMax(lane, packet._Rays[lane]._TMax);
+        }
+        return;
+    }
+
+    // the directions are not normalized, so that t is the same in both spaces
+    RayPacket<N> objectPacket{};
+    for(uint32_t lanes = mask; lanes != 0; lanes &= lanes - 1){
+        uint32_t lane = std::countr_zero(lanes);
+        const Ray& ray = packet._Rays[lane];
+        objectPacket.set(lane, Ray(
+            (instance._ModelInv * Vector4(ray.getOrigin(), 1.f)).xyz(),
+            (instance._ModelInv * Vector4(ray.getDirection(), 0.f)).xyz(),
+            ray._TMin,
+            ray._TMax
+        ));
+    }
+
+    std::array<RayHitOpt, N> objectHits{};
+    mesh._BVH->getIntersections<N>(objectPacket, objectHits, counters);
+
+    for(uint32_t lanes = mask; lanes != 0; lanes &= lanes - 1){
+        uint32_t lane = std::countr_zero(lanes);
+        if(objectHits[lane].has_value()){
+            const Ray& ray = packet._Rays[lane];
+            float t = objectPacket._TMax[lane];
+            closestHits[lane] = objectHits[lane]->withInstance(instance, instanceIndex, ray.getDirection(), ray.getConeWidth(t));
+            packet.setTMax(lane, t);
+        }
+    }
+}
+
+template<uint32_t N>
+void RayTracer::traceRayPacket(RayPacket<N>& packet, std::array<RayHitOpt, N>& closestHits, bool isShadowRay) const{
+    RayTracingCounters& counters = _ThreadCounters->getThreadCounters();
+    counters._TracedRays += std::popcount(packet._Active);
+    if(_InstanceTree._Nodes.empty()){
+        return;
+    }
+
+    // each entry keeps the lanes that overlap its parent
+    std::array<std::pair<uint32_t, uint32_t>, InstanceTree::MAX_DEPTH> stack;
+    uint32_t stackSize = 0;
+    stack[stackSize++] = {0, packet._Active};
+    while(stackSize > 0){
+        auto [nodeIndex, mask] = stack[--stackSize];
+        const auto& node = _InstanceTree._Nodes[nodeIndex];
+        counters._NodeVisits++;
+        const AxisAlignedBoundingBox& bounds = node._Bounds;
+        // the lanes of the occluded shadow rays are already off
+        mask = packet.intersectBox(bounds._MinX, bounds._MaxX, bounds._MinY, bounds._MaxY, bounds._MinZ, bounds._MaxZ,
+            mask & packet._Active
+        );
+        if(mask == 0){
+            continue;
+        }
+        if(_InstanceTree.isLeaf(nodeIndex)){
+            // lights do not cast shadows
+            if(isShadowRay && _Instances[node._Instance]._IsLight){
+                continue;
+            }
+            getInstanceHits<N>(node._Instance, packet, closestHits, mask, counters);
+            // any occluder is enough for a shadow ray
+            if(isShadowRay){
+                for(uint32_t lanes = mask; lanes != 0; lanes &= lanes - 1){
+                    uint32_t lane = std::countr_zero(lanes);
+                    if(closestHits[lane].has_value()){
+                        packet._Active &= ~(1u << lane);
+                    }
+                }
+                if(packet._Active == 0){
+                    break;
+                }
+            }
+        } else {
+            stack[stackSize++] = {node._RightChild, mask};
+            stack[stackSize++] = {nodeIndex + 1, mask};
+        }
+    }
+
+    for(const auto& hit : closestHits){
+        if(hit.has_value()){
+            counters._Hits++;
+        }
+    }
+}
+
+template<uint32_t N>
+void RayTracer::traceRayPackets(std::span<const Ray> rays, std::span<RayHitOpt> hits, bool isShadowRay) const{
+    for(size_t first = 0; first<rays.size(); first += N){
+        uint32_t size = static_cast<uint32_t>(std::min<size_t>(N, rays.size() - first));
+        RayPacket<N> packet{};
+        for(uint32_t lane = 0; lane<size; lane++){
+            packet.set(lane, rays[first + lane]);
+        }
+        std::array<RayHitOpt, N> packetHits{};
+        traceRayPacket<N>(packet, packetHits, isShadowRay);
+        std::copy(packetHits.begin(), packetHits.begin() + size, hits.begin() + first);
+    }
+}
+
+void RayTracer::traceRays(std::span<const Ray> rays, std::span<RayHitOpt> hits, bool isShadowRay) const{
+    if(isShadowRay){
+        _ThreadCounters->getThreadCounters()._ShadowRays += rays.size();
+    }
+    switch(_PacketSize){
+        case 4:
+            traceRayPackets<4>(rays, hits, isShadowRay);
+            break;
+        case 8:
+            traceRayPackets<8>(rays, hits, isShadowRay);
+            break;
+        default:
+            for(size_t k = 0; k<rays.size(); k++){
+                Ray ray = rays[k];
+                hits[k] = traceRay(ray, isShadowRay);
+            }
+            break;
+    }
+}
+
+void RayTracer::traceCameraRays(const SampleDirections& directions, std::span<RayHitOpt> hits) const{
+    std::vector<Ray> rays(directions._X.size());
+    for(size_t k = 0; k<rays.size(); k++){
+        rays[k] = Ray(_CameraRays.getOrigin(), Vector3(directions._X[k], directions._Y[k], directions._Z[k]));
+        rays[k]._ConeSpread = _CameraRays.getPixelSpreadAngle();
+    }
+    _ThreadCounters->getThreadCounters()._PrimaryRays += rays.size();
+    traceRays(rays, hits, false);
+}
+
+void RayTracer::renderPixel(uint32_t i, uint32_t j, std::span<const RayHitOpt> hits, LightCutsSeed* seed){
+    Maths::seedRandom(Maths::hashSeed(_Seed, static_cast<uint64_t>(j) * _Image->getWidth() + i));
+    Vector3 color = Vector3::zeros();
+    int nbHits = 0;
+    // the direct lighting of every sample is gathered in a single cut
+    bool multidimensional = _UseLightCuts && _LightcutsMultidimensional;
+    GatherTree gatherTree{};
+    // output variables, from the first hit of each sample
+    PixelAOVs aovs{};
+
+    // subpixel sampling, the camera rays are already traced
+    for(const RayHitOpt& hit : hits){
+        if(hit.has_value()){
+            nbHits++;
+        }
+        if(_AOVs != nullptr){
+            aovs.add(hit);
+        }
+        if(multidimensional){
+            color += shadeGatherPoint(hit, gatherTree);
+        } else if(_UseLightCuts){
+            color += shadeLightCuts(hit, 0, seed);
+        } else {
+            color += (this->*_Shade)(hit, 0);
+        }
+    }
+
+    if(multidimensional && !gatherTree._Hits.empty()){
+        gatherTree.build();
+        color += getMultidimensionalLightCutsRadiance(gatherTree);
+    }
+    
+    if(nbHits > 0){
+        color /= _SamplesPerPixels;
+        _Image->setUnchecked(i, j, color);
+    }
+
+    if(_AOVs != nullptr){
+        aovs.write(*_AOVs, i, j);
+    }
+}
+
+void RayTracer::PixelAOVs::add(const RayHitOpt& hit){
+    _NbSamples++;
+    if(!hit.has_value()){
+        return;
+    }
+    const RayHit& closestHit = hit.value();
+    _Albedo += closestHit.getAlbedo();
+    _Normal += closestHit.getWorldNorm();
+    _Depth += closestHit.getParametricT();
+    if(_NbSamplesHit == 0){
+        _ObjectID = closestHit.getObjectID();
+        _MaterialID = closestHit.getMaterialID();
+    }
+    _NbSamplesHit++;
+}
+
+void RayTracer::PixelAOVs::write(AOVBuffers& aovs, uint32_t i, uint32_t j) const {
+    size_t index = static_cast<size_t>(j) * aovs.getWidth() + i;
+    aovs._SampleCount[index] = _NbSamples;
+    aovs._HitCount[index] = _NbSamplesHit;
+    if(_NbSamplesHit > 0){
+        aovs._Albedo->setUnchecked(i, j, _Albedo / _NbSamplesHit);
+        aovs._Normal->setUnchecked(i, j, _Normal / _NbSamplesHit);
+        aovs._Depth[index] = _Depth / _NbSamplesHit;
+        aovs._ObjectID[index] = _ObjectID;
+        aovs._MaterialID[index] = _MaterialID;
+    }
+}
+
+void RayTracer::renderTile(uint32_t minI, uint32_t minJ, uint32_t maxI, uint32_t maxJ){
+    uint32_t height = _Image->getHeight();
+    size_t nbSamples = _SampleOffsetsI.size();
+
+    // primary rays of the whole tile at once
+    size_t tileSamples = static_cast<size_t>(maxI - minI) * (maxJ - minJ) * nbSamples;
+    std::vector<float> directionX(tileSamples);
+    std::vector<float> directionY(tileSamples);
+    std::vector<float> directionZ(tileSamples);
+    _CameraRays.generateTile(minI, minJ, maxI, maxJ, height,
+        _SampleOffsetsI, _SampleOffsetsJ, directionX, directionY, directionZ
+    );
+
+    std::vector<RayHitOpt> hits(tileSamples);
+    traceCameraRays({directionX, directionY, directionZ}, hits);
+
+    // snake order so that consecutive pixels are always neighbours,
+    // the cuts are only carried over when asked, as in the other render paths
+    LightCutsSeed seed{};
+    LightCutsSeed* pixelSeed = _UseLightCuts && _LightcutsReuseCuts ? &seed : nullptr;
+    for(uint32_t j = minJ; j<maxJ; j++){
+        bool leftToRight = (j - minJ) % 2 == 0;
+        for(uint32_t k = minI; k<maxI; k++){
+            uint32_t i = leftToRight ? k : maxI - 1 - (k - minI);
+            size_t offset = (static_cast<size_t>(j - minJ) * (maxI - minI) + (i - minI)) * nbSamples;
+            renderPixel(i, j, std::span<const RayHitOpt>(hits).subspan(offset, nbSamples), pixelSeed);
+        }
+    }
+}
+
+std::vector<TileMessage> RayTracer::getTiles() const {
+    uint32_t width = _Image->getWidth();
+    uint32_t height = _Image->getHeight();
+    uint32_t tileSize = std::max(1u, _TileSize);
+    uint32_t nbTilesX = (width + tileSize - 1) / tileSize;
+    uint32_t nbTilesY = (height + tileSize - 1) / tileSize;
+
+    std::vector<TileMessage> tiles{};
+    tiles.reserve(nbTilesX * nbTilesY);
+    for(uint32_t tile = 0; tile<nbTilesX * nbTilesY; tile++){
+        uint32_t minI = (tile % nbTilesX) * tileSize;
+        uint32_t minJ = (tile / nbTilesX) * tileSize;
+        tiles.push_back({
+            tile,
+            minI, minJ,
+            std::min(width, minI + tileSize), std::min(height, minJ + tileSize)
+        });
+    }
+    return tiles;
+}
+
+void RayTracer::renderTiles(){
+    std::vector<TileMessage> tiles = getTiles();
+    uint32_t nbTiles = tiles.size();
+
+    # pragma omp parallel for schedule(dynamic)
+    for(uint32_t tile = 0; tile<nbTiles; tile++){
+        #ifndef _OPENMP
+        float progress = tile / (nbTiles+1.f);
+        displayProgressBar(progress);
+        #else
+        displayProgressBarOpenMP((nbTiles+1.f));
+        #endif
+
+        renderTile(tiles[tile]._MinI, tiles[tile]._MinJ, tiles[tile]._MaxI, tiles[tile]._MaxJ);
+    }
+}
+
+void RayTracer::renderTilesInWorkers(){
+    // the output variables of a pixel follow its color, for the denoiser of the coordinator
+    std::vector<TileMessage> tiles = getTiles();
+    if(_AOVs != nullptr){
+        for(auto& tile : tiles){
+            tile._NbFloatsPerPixel = Image::CHANNELS + AOVBuffers::PACKED_FLOATS;
+        }
+    }
+
+    // a worker renders in its own copy of the image, then sends the packed pixels of the tile
+    auto renderTileInWorker = [this](const TileMessage& tile, std::span<float> pixels){
+        renderTile(tile._MinI, tile._MinJ, tile._MaxI, tile._MaxJ);
+        auto out = pixels.begin();
+        for(uint32_t j = tile._MinJ; j<tile._MaxJ; j++){
+            std::span<const float> row = std::as_const(*_Image).getRow(j);
+            for(uint32_t i = tile._MinI; i<tile._MaxI; i++){
+                out = std::copy_n(row.begin() + i * Image::CHANNELS, Image::CHANNELS, out);
+                if(_AOVs != nullptr){
+                    _AOVs->pack(i, j, std::span<float>(out, AOVBuffers::PACKED_FLOATS));
+                    out += AOVBuffers::PACKED_FLOATS;
+                }
+            }
+        }
+    };
+    auto storeTile = [this](const TileMessage& tile, std::span<const float> pixels){
+        auto in = pixels.begin();
+        for(uint32_t j = tile._MinJ; j<tile._MaxJ; j++){
+            std::span<float> row = _Image->getRow(j);
+            for(uint32_t i = tile._MinI; i<tile._MaxI; i++){
+                std::copy_n(in, Image::CHANNELS, row.begin() + i * Image::CHANNELS);
+                in += Image::CHANNELS;
+                if(_AOVs != nullptr){
+                    _AOVs->unpack(i, j, std::span<const float>(in, AOVBuffers::PACKED_FLOATS));
+                    in += AOVBuffers::PACKED_FLOATS;
+                }
+            }
+        }
+    };
+
+    fprintf(stdout, "Using %u worker processes\n", _NbWorkerProcesses);
+    _WorkerCounters = TileWorkers::render(_NbWorkerProcesses, tiles, renderTileInWorker, storeTile, *_ThreadCounters);
+}
+
+void RayTracer::PathQueue::resize(size_t size){
+    _Pixel.resize(size);
+    _OriginX.resize(size);
+    _OriginY.resize(size);
+    _OriginZ.resize(size);
+    _DirectionX.resize(size);
+    _DirectionY.resize(size);
+    _DirectionZ.resize(size);
+    _ConeWidth.resize(size);
+    _ConeSpread.resize(size);
+    _Weight.resize(size);
+}
+
+void RayTracer::PathQueue::set(size_t index, uint32_t pixel, const Ray& ray, float weight){
+    Vector3 origin = ray.getOrigin();
+    Vector3 direction = ray.getDirection();
+    _Pixel[index] = pixel;
+    _OriginX[index] = origin.x();
+    _OriginY[index] = origin.y();
+    _OriginZ[index] = origin.z();
+    _DirectionX[index] = direction.x();
+    _DirectionY[index] = direction.y();
+    _DirectionZ[index] = direction.z();
+    _ConeWidth[index] = ray._ConeWidth;
+    _ConeSpread[index] = ray._ConeSpread;
+    _Weight[index] = weight;
+}
+
+Ray RayTracer::PathQueue::getRay(size_t index) const {
+    Ray ray(
+        Vector3(_OriginX[index], _OriginY[index], _OriginZ[index]),
+        Vector3(_DirectionX[index], _DirectionY[index], _DirectionZ[index])
+    );
+    ray._ConeWidth = _ConeWidth[index];
+    ray._ConeSpread = _ConeSpread[index];
+    return ray;
+}
+
+void RayTracer::ShadowQueue::resize(size_t size){
+    _Pixel.resize(size);
+    _OriginX.resize(size);
+    _OriginY.resize(size);
+    _OriginZ.resize(size);
+    _DirectionX.resize(size);
+    _DirectionY.resize(size);
+    _DirectionZ.resize(size);
+    _TMax.resize(size);
+    _RadianceR.resize(size);
+    _RadianceG.resize(size);
+    _RadianceB.resize(size);
+}
+
+void RayTracer::ShadowQueue::set(size_t index, uint32_t pixel, const Ray& ray, const Vector3& radiance){
+    Vector3 origin = ray.getOrigin();
+    Vector3 direction = ray.getDirection();
+    _Pixel[index] = pixel;
+    _OriginX[index] = origin.x();
+    _OriginY[index] = origin.y();
+    _OriginZ[index] = origin.z();
+    _DirectionX[index] = direction.x();
+    _DirectionY[index] = direction.y();
+    _DirectionZ[index] = direction.z();
+    _TMax[index] = ray._TMax;
+    _RadianceR[index] = radiance.r();
+    _RadianceG[index] = radiance.g();
+    _RadianceB[index] = radiance.b();
+}
+
+Ray RayTracer::ShadowQueue::getRay(size_t index) const {
+    return Ray(
+        Vector3(_OriginX[index], _OriginY[index], _OriginZ[index]),
+        Vector3(_DirectionX[index], _DirectionY[index], _DirectionZ[index]),
+        Ray::DEFAULT_MIN_DIST,
+        _TMax[index]
+    );
+}
+
+template<RayTracer::BRDFModel BRDF, typename LightPtr>
+Vector3 RayTracer::shadeDirect(const RayHit& rayHit, const LightPtr& light, Ray* deferredShadowRay) const {
+    if constexpr(BRDF == LAMBERT_BRDF){
+        return lambertBRDF(rayHit, light, deferredShadowRay);
+    } else if constexpr(BRDF == GGX_BRDF){
+        return ggxBRDF(rayHit, light, deferredShadowRay);
+    } else if constexpr(BRDF == DISNEY_BRDF){
+        return disneyBRDF(rayHit, light, deferredShadowRay);
+    } else {
+        return Color::BLACK;
+    }
+}
+
+template<typename LightPtr>
+Vector3 RayTracer::shadeDirect(const RayHit& rayHit, const LightPtr& light, Ray* deferredShadowRay) const {
+    switch(_BRDF){
+        case LAMBERT_BRDF:
+            return shadeDirect<LAMBERT_BRDF>(rayHit, light, deferredShadowRay);
+        case GGX_BRDF:
+            return shadeDirect<GGX_BRDF>(rayHit, light, deferredShadowRay);
+        case DISNEY_BRDF:
+            return shadeDirect<DISNEY_BRDF>(rayHit, light, deferredShadowRay);
+        default:
+            return Color::BLACK;
+    }
+}
+
+Vector3 RayTracer::getIncidentLight(const RayHit& rayHit, PointLightPtr light, Vector3& toLight, Ray& shadowRay) const {
+    Vector3 hitWorldPos = rayHit.getWorldPos();
+    toLight = Vector3::normalize(light->_Position.xyz() - hitWorldPos);
+    shadowRay = Ray(hitWorldPos, toLight);
+    shadowRay._TMax = std::min(shadowRay._TMax, (light->_Position.xyz() - hitWorldPos).getNorm());
+    return GGX::getAttenuation(light, hitWorldPos);
+}
+
+Vector3 RayTracer::getIncidentLight(const RayHit& rayHit, DirectionalLightPtr light, Vector3& toLight, Ray& shadowRay) const {
+    toLight = -light->_Direction.xyz();
+    shadowRay = Ray(rayHit.getWorldPos(), -Vector3::normalize(light->_Direction.xyz()));
+    return GGX::getAttenuation(light);
+}
+
+Vector3 RayTracer::getIncidentLight(const RayHit& rayHit, OrientedLightPtr light, Vector3& toLight, Ray& shadowRay) const {
+    Vector3 hitWorldPos = rayHit.getWorldPos();
+    toLight = Vector3::normalize(light->_Position.xyz() - hitWorldPos);
+    shadowRay = Ray(hitWorldPos, toLight);
+    shadowRay._TMax = std::min(shadowRay._TMax, (light->_Position.xyz() - hitWorldPos).getNorm());
+    return GGX::getAttenuation(light, hitWorldPos);
+}
+
+template<typename LightPtr>
+Vector3 RayTracer::setBRDFInputs(const RayHit& rayHit, const LightPtr& light, BRDFBatch& batch, size_t index, Ray& shadowRay) const {
+    Vector3 toLight{};
+    Vector3 lightRadiance = getIncidentLight(rayHit, light, toLight, shadowRay);
+    Vector3 hitNormal = rayHit.getWorldNorm();
+    float wiDotN = std::max(0.f, Vector3::dot(toLight, hitNormal));
+    if(lightRadiance.isZero() || wiDotN == 0.f){
+        return Color::BLACK;
+    }
+
+    Vector3 toCamera = Vector3::normalize(-rayHit.getDirection());
+    Material textured{};
+    MaterialPtr material = rayHit.getShadingMaterial(textured);
+    MaterialConstants texturedConstants{};
+    const MaterialConstants& constants = rayHit.getShadingConstants(material, texturedConstants);
+    // GGX takes the light direction first, Disney the camera direction, as in ggxBRDF and disneyBRDF
+    if(_BRDF == GGX_BRDF){
+        batch.set(index, toLight, toCamera, hitNormal, rayHit.getAlbedo(), *material, constants, light->getIntensity());
+    } else {
+        batch.set(index, toCamera, toLight, hitNormal, rayHit.getAlbedo(), *material, constants, light->getIntensity());
+    }
+    return lightRadiance * wiDotN;
+}
+
+template<typename Queue>
+void RayTracer::getRayOrder(const Queue& queue, std::vector<uint32_t>& order) const {
+    size_t size = queue.size();
+    order.resize(size);
+    if(!_ReorderRays || _InstanceTree._Nodes.empty()){
+        for(uint32_t k = 0; k<size; k++){
+            order[k] = k;
+        }
+        return;
+    }
+
+    // rays with the same direction octant and close origins visit the same nodes,
+    // the key is the octant followed by the morton code of the origin in the scene box
+    static constexpr uint32_t MORTON_BITS = 9; // per axis
+    const AxisAlignedBoundingBox& bounds = _InstanceTree._Nodes[0]._Bounds;
+    const float minX = bounds._MinX, minY = bounds._MinY, minZ = bounds._MinZ;
+    const float cells = static_cast<float>((1u << MORTON_BITS) - 1);
+    const float scaleX = cells / std::max(bounds._MaxX - bounds._MinX, 1e-6f);
+    const float scaleY = cells / std::max(bounds._MaxY - bounds._MinY, 1e-6f);
+    const float scaleZ = cells / std::max(bounds._MaxZ - bounds._MinZ, 1e-6f);
+    // spread the bits of a cell coordinate, two zeros between each bit
+    auto spreadBits = [](uint32_t x){
+        x &= 0x3ff;
+        x = (x | (x << 16)) & 0x030000ff;
+        x = (x | (x << 8)) & 0x0300f00f;
+        x = (x | (x << 4)) & 0x030c30c3;
+        x = (x | (x << 2)) & 0x09249249;
+        return x;
+    };
+
+    // the index of the ray fills the low bits, sorting the keys sorts the indices
+    std::vector<uint64_t> keys(size);
+    # pragma omp parallel for schedule(static)
+    for(size_t k = 0; k<size; k++){
+        uint32_t cellX = static_cast<uint32_t>(std::clamp((queue._OriginX[k] - minX) * scaleX, 0.f, cells));
+        uint32_t cellY = static_cast<uint32_t>(std::clamp((queue._OriginY[k] - minY) * scaleY, 0.f, cells));
+        uint32_t cellZ = static_cast<uint32_t>(std::clamp((queue._OriginZ[k] - minZ) * scaleZ, 0.f, cells));
+        uint32_t octant = (queue._DirectionX[k] < 0.f ? 1u : 0u)
+            | (queue._DirectionY[k] < 0.f ? 2u : 0u)
+            | (queue._DirectionZ[k] < 0.f ? 4u : 0u);
+        uint64_t key = (static_cast<uint64_t>(octant) << (3 * MORTON_BITS))
+            | (spreadBits(cellX) << 2) | (spreadBits(cellY) << 1) | spreadBits(cellZ);
+        keys[k] = (key << 32) | k;
+    }
+    std::sort(keys.begin(), keys.end());
+    for(size_t k = 0; k<size; k++){
+        order[k] = static_cast<uint32_t>(keys[k]);
+    }
+}
+
+void RayTracer::renderWave(std::span<const TileMessage> tiles){
+    uint32_t height = _Image->getHeight();
+    size_t nbSamples = _SampleOffsetsI.size();
+    const auto& pointLights = _Scene->getPointLights();
+    const auto& directionalLights = _Scene->getDirectionalLights();
+    const auto& orientedLights = _Scene->getOrientedLights();
+    size_t nbLights = pointLights.size() + directionalLights.size() + orientedLights.size();
+    bool useLights = _BRDF == LAMBERT_BRDF || _BRDF == GGX_BRDF || _BRDF == DISNEY_BRDF;
+    bool useBRDFBatch = _BRDF == GGX_BRDF || _BRDF == DISNEY_BRDF;
+
+    // the pixels of the wave, tile after tile, row major inside a tile
+    std::vector<size_t> firstPixels(tiles.size());
+    std::vector<uint32_t> pixelI{};
+    std::vector<uint32_t> pixelJ{};
+    for(size_t tile = 0; tile<tiles.size(); tile++){
+        firstPixels[tile] = pixelI.size();
+        for(uint32_t j = tiles[tile]._MinJ; j<tiles[tile]._MaxJ; j++){
+            for(uint32_t i = tiles[tile]._MinI; i<tiles[tile]._MaxI; i++){
+                pixelI.push_back(i);
+                pixelJ.push_back(j);
+            }
+        }
+    }
+    size_t nbPixels = pixelI.size();
+
+    // generate: the camera samples, those of a pixel are contiguous
+    PathQueue paths{};
+    paths.resize(nbPixels * nbSamples);
+    # pragma omp parallel for schedule(dynamic)
+    for(size_t tile = 0; tile<tiles.size(); tile++){
+        const TileMessage& curTile = tiles[tile];
+        size_t tileSamples = static_cast<size_t>(curTile._MaxI - curTile._MinI) * (curTile._MaxJ - curTile._MinJ) * nbSamples;
+        std::vector<float> directionX(tileSamples);
+        std::vector<float> directionY(tileSamples);
+        std::vector<float> directionZ(tileSamples);
+        _CameraRays.generateTile(curTile._MinI, curTile._MinJ, curTile._MaxI, curTile._MaxJ, height,
+            _SampleOffsetsI, _SampleOffsetsJ, directionX, directionY, directionZ
+        );
+        size_t firstSample = firstPixels[tile] * nbSamples;
+        for(size_t k = 0; k<tileSamples; k++){
+            Ray ray(_CameraRays.getOrigin(), Vector3(directionX[k], directionY[k], directionZ[k]));
+            ray._ConeSpread = _CameraRays.getPixelSpreadAngle();
+            paths.set(firstSample + k, firstPixels[tile] + k / nbSamples, ray, 1.f);
+        }
+    }
+
+    std::vector<Vector3> colors(nbPixels, Vector3::zeros());
+    std::vector<uint8_t> isPixelHit(nbPixels, 0);
+    std::vector<size_t> firstPathOfPixel(nbPixels, 0);
+    std::vector<RayHitOpt> hits{};
+    std::vector<uint32_t> order{};
+    std::vector<Vector3> contributions{};
+    std::vector<uint8_t> isVisible{};
+    std::vector<uint32_t> shadowOrder{};
+    ShadowQueue shadows{};
+    BRDFBatch brdfInputs{};
+    PathQueue bounces{};
+    for(uint32_t depth = 0; paths.size() > 0; depth++){
+        size_t nbPaths = paths.size();
+
+        // extend: the closest hit of every path, the camera samples are in pixel order
+        // and go in packets, the bounces are traced in coherent order
+        hits.assign(nbPaths, RayHit::NO_HIT);
+        if(depth == 0){
+            size_t nbBlocks = (nbPaths + WAVEFRONT_BLOCK_SIZE - 1) / WAVEFRONT_BLOCK_SIZE;
+            # pragma omp parallel for schedule(dynamic)
+            for(size_t block = 0; block<nbBlocks; block++){
+                size_t first = block * WAVEFRONT_BLOCK_SIZE;
+                size_t size = std::min(WAVEFRONT_BLOCK_SIZE, nbPaths - first);
+                std::array<Ray, WAVEFRONT_BLOCK_SIZE> rays;
+                for(size_t k = 0; k<size; k++){
+                    rays[k] = paths.getRay(first + k);
+                }
+                _ThreadCounters->getThreadCounters()._PrimaryRays += size;
+                traceRays(std::span<const Ray>(rays).first(size), std::span<RayHitOpt>(hits).subspan(first, size), false);
+            }
+        } else {
+            getRayOrder(paths, order);
+            # pragma omp parallel for schedule(dynamic, 256)
+            for(size_t n = 0; n<nbPaths; n++){
+                uint32_t k = order[n];
+                _ThreadCounters->getThreadCounters()._BounceRays++;
+                hits[k] = getClosestHit(paths.getRay(k));
+            }
+        }
+
+        if(depth == 0){
+            # pragma omp parallel for
+            for(size_t pixel = 0; pixel<nbPixels; pixel++){
+                PixelAOVs aovs{};
+                for(size_t sample = 0; sample<nbSamples; sample++){
+                    const RayHitOpt& hit = hits[pixel * nbSamples + sample];
+                    isPixelHit[pixel] |= hit.has_value();
+                    aovs.add(hit);
+                }
+                if(_AOVs != nullptr){
+                    aovs.write(*_AOVs, pixelI[pixel], pixelJ[pixel]);
+                }
+            }
+        }
+
+        // the hits of a material are shaded together, the misses first
+        order.resize(nbPaths);
+        for(uint32_t k = 0; k<nbPaths; k++){
+            order[k] = k;
+        }
+        std::stable_sort(order.begin(), order.end(), [&hits](uint32_t k1, uint32_t k2){
+            uint64_t key1 = hits[k1].has_value() ? hits[k1]->getMaterialID() + 1ull : 0ull;
+            uint64_t key2 = hits[k2].has_value() ? hits[k2]->getMaterialID() + 1ull : 0ull;
+            return key1 < key2;
+        });
+
+        // the paths of a pixel stay contiguous from depth to depth, each one draws its random
+        // numbers from the pixel, the depth and its rank in the pixel
+        for(size_t k = nbPaths; k-- > 0;){
+            firstPathOfPixel[paths._Pixel[k]] = k;
+        }
+
+        // shade: the emitted and background radiance, the shadow rays of the direct lighting
+        // and the bounces, in fixed slots; the unused slots keep a zero weight
+        size_t nbShadowSlots = useLights ? nbLights : 0;
+        size_t nbBounceSlots = depth < _MaxBounces ? _SamplesPerBounces : 0;
+        contributions.assign(nbPaths, Vector3::zeros());
+        shadows.resize(nbPaths * nbShadowSlots);
+        brdfInputs.resize(useBRDFBatch ? shadows.size() : 0);
+        bounces.resize(nbPaths * nbBounceSlots);
+        # pragma omp parallel for schedule(static)
+        for(size_t n = 0; n<nbPaths; n++){
+            uint32_t k = order[n];
+            uint32_t pixel = paths._Pixel[k];
+            uint64_t pixelSeed = Maths::hashSeed(_Seed, static_cast<uint64_t>(pixelJ[pixel]) * _Image->getWidth() + pixelI[pixel]);
+            Maths::seedRandom(Maths::hashSeed(Maths::hashSeed(pixelSeed, depth), k - firstPathOfPixel[pixel]));
+            size_t shadowSlot = k * nbShadowSlots;
+            size_t bounceSlot = k * nbBounceSlots;
+            if(!hits[k].has_value()){
+                contributions[k] = paths._Weight[k] * _BackgroundColor;
+                for(size_t slot = 0; slot<nbShadowSlots; slot++){
+                    shadows.set(shadowSlot + slot, pixel, Ray(), Vector3::zeros());
+                }
+                for(size_t slot = 0; slot<nbBounceSlots; slot++){
+                    bounces.set(bounceSlot + slot, pixel, Ray(), 0.f);
+                }
+                continue;
+            }
+
+            const RayHit& hit = hits[k].value();
+            // the radiance of a bounce is scaled, as in shade
+            float weight = depth > 0 ? _ShadingFactor * paths._Weight[k] : paths._Weight[k];
+            if(hit.isLight() || _BRDF == COLOR_BRDF){
+                contributions[k] = weight * colorBRDF(hit);
+            } else if(_BRDF == NORMAL_BRDF){
+                contributions[k] = weight * normalBRDF(hit);
+            }
+            if(nbShadowSlots > 0){
+                auto addShadowRay = [&](const auto& light){
+                    size_t slot = shadowSlot++;
+                    Ray shadowRay{};
+                    Vector3 radiance = Color::BLACK;
+                    if(!hit.isLight()){
+                        radiance = useBRDFBatch
+                            ? setBRDFInputs(hit, light, brdfInputs, slot, shadowRay)
+                            : shadeDirect(hit, light, &shadowRay);
+                    }
+                    shadows.set(slot, pixel, shadowRay, weight * radiance);
+                };
+                for(const auto& light : pointLights){
+                    addShadowRay(light);
+                }
+                for(const auto& light : directionalLights){
+                    addShadowRay(light);
+                }
+                for(const auto& light : orientedLights){
+                    addShadowRay(light);
+                }
+            }
+            for(size_t slot = 0; slot<nbBounceSlots; slot++){
+                bounces.set(bounceSlot + slot, pixel, sampleNewRay(hit), weight / _SamplesPerBounces);
+            }
+        }
+
+        // the BRDFs of the direct lighting, in simd batches; the slots without radiance
+        // were not set and stay dark
+        if(useBRDFBatch){
+            size_t nbBRDFBlocks = (shadows.size() + WAVEFRONT_BLOCK_SIZE - 1) / WAVEFRONT_BLOCK_SIZE;
+            # pragma omp parallel for schedule(static)
+            for(size_t block = 0; block<nbBRDFBlocks; block++){
+                size_t first = block * WAVEFRONT_BLOCK_SIZE;
+                size_t last = std::min(first + WAVEFRONT_BLOCK_SIZE, shadows.size());
+                if(_BRDF == GGX_BRDF){
+                    GGX::BRDF(brdfInputs, first, last);
+                } else {
+                    Disney::BRDF(brdfInputs, first, last);
+                }
+                for(size_t k = first; k<last; k++){
+                    if(shadows._RadianceR[k] != 0.f || shadows._RadianceG[k] != 0.f || shadows._RadianceB[k] != 0.f){
+                        shadows._RadianceR[k] *= brdfInputs._ReflectanceR[k];
+                        shadows._RadianceG[k] *= brdfInputs._ReflectanceG[k];
+                        shadows._RadianceB[k] *= brdfInputs._ReflectanceB[k];
+                    }
+                }
+            }
+        }
+
+        // shadow: the occlusion of the lights, grouped by light and in coherent order,
+        // so that the packets go toward a shared light
+        getRayOrder(shadows, order);
+        std::vector<uint32_t> lightFirst(nbShadowSlots + 1, 0);
+        for(uint32_t k : order){
+            if(shadows._RadianceR[k] != 0.f || shadows._RadianceG[k] != 0.f || shadows._RadianceB[k] != 0.f){
+                lightFirst[k % nbShadowSlots + 1]++;
+            }
+        }
+        for(size_t light = 0; light<nbShadowSlots; light++){
+            lightFirst[light + 1] += lightFirst[light];
+        }
+        shadowOrder.resize(nbShadowSlots > 0 ? lightFirst[nbShadowSlots] : 0);
+        for(uint32_t k : order){
+            if(shadows._RadianceR[k] != 0.f || shadows._RadianceG[k] != 0.f || shadows._RadianceB[k] != 0.f){
+                shadowOrder[lightFirst[k % nbShadowSlots]++] = k;
+            }
+        }
+
+        isVisible.assign(shadows.size(), 0);
+        size_t nbShadowBlocks = (shadowOrder.size() + WAVEFRONT_BLOCK_SIZE - 1) / WAVEFRONT_BLOCK_SIZE;
+        # pragma omp parallel for schedule(dynamic)
+        for(size_t block = 0; block<nbShadowBlocks; block++){
+            size_t first = block * WAVEFRONT_BLOCK_SIZE;
+            size_t size = std::min(WAVEFRONT_BLOCK_SIZE, shadowOrder.size() - first);
+            std::array<Ray, WAVEFRONT_BLOCK_SIZE> rays;
+            std::array<RayHitOpt, WAVEFRONT_BLOCK_SIZE> occluders;
+            // a packet never mixes two lights
+            size_t runFirst = 0;
+            for(size_t k = 0; k<size; k++){
+                rays[k] = shadows.getRay(shadowOrder[first + k]);
+                bool isRunEnd = k + 1 == size
+                    || shadowOrder[first + k + 1] % nbShadowSlots != shadowOrder[first + k] % nbShadowSlots;
+                if(isRunEnd){
+                    traceRays(
+                        std::span<const Ray>(rays).subspan(runFirst, k + 1 - runFirst),
+                        std::span<RayHitOpt>(occluders).subspan(runFirst, k + 1 - runFirst),
+                        true
+                    );
+                    runFirst = k + 1;
+                }
+            }
+            for(size_t k = 0; k<size; k++){
+                isVisible[shadowOrder[first + k]] = !occluders[k].has_value();
+            }
+        }
+
+        // the samples of a pixel are spread over the queues, they are summed in order
+        for(size_t k = 0; k<nbPaths; k++){
+            colors[paths._Pixel[k]] += contributions[k];
+        }
+        for(size_t k = 0; k<shadows.size(); k++){
+            if(isVisible[k]){
+                colors[shadows._Pixel[k]] += Vector3(shadows._RadianceR[k], shadows._RadianceG[k], shadows._RadianceB[k]);
+            }
+        }
+
+        // the bounces are the paths of the next depth
+        size_t nbNextPaths = 0;
+        for(size_t k = 0; k<bounces.size(); k++){
+            nbNextPaths += bounces._Weight[k] != 0.f;
+        }
+        paths.resize(nbNextPaths);
+        size_t next = 0;
+        for(size_t k = 0; k<bounces.size(); k++){
+            if(bounces._Weight[k] != 0.f){
+                paths.set(next++, bounces._Pixel[k], bounces.getRay(k), bounces._Weight[k]);
+            }
+        }
+    }
+
+    for(size_t pixel = 0; pixel<nbPixels; pixel++){
+        if(isPixelHit[pixel]){
+            _Image->setUnchecked(pixelI[pixel], pixelJ[pixel], colors[pixel] / _SamplesPerPixels);
+        }
+    }
+}
+
+void RayTracer::renderWavefront(){
+    std::vector<TileMessage> tiles = getTiles();
+
+    // the bounces multiply the paths at each depth, the camera samples of a wave keep the
+    // largest queue around _WavefrontSize states
+    double pathsPerSample = std::pow(static_cast<double>(std::max(1u, _SamplesPerBounces)), _MaxBounces);
+    double samplesPerWave = std::max(1.0, _WavefrontSize / pathsPerSample);
+    size_t nbSamples = _SampleOffsetsI.size();
+
+    size_t firstTile = 0;
+    while(firstTile < tiles.size()){
+        size_t lastTile = firstTile;
+        double waveSamples = 0.0;
+        while(lastTile < tiles.size() && (lastTile == firstTile || waveSamples < samplesPerWave)){
+            const TileMessage& tile = tiles[lastTile];
+            waveSamples += static_cast<double>(tile._MaxI - tile._MinI) * (tile._MaxJ - tile._MinJ) * nbSamples;
+            lastTile++;
+        }
+        renderWave(std::span<const TileMessage>(tiles).subspan(firstTile, lastTile - firstTile));
+        firstTile = lastTile;
+        displayProgressBar(static_cast<float>(firstTile) / tiles.size());
+    }
+}
 
 void RayTracer::run(FrameInfo frame, Vector3 backgroundColor){
     if(!_IsRunning){
@@ -693,20 +2374,54 @@ void RayTracer::run(FrameInfo frame, Vector3 backgroundColor){
         fprintf(stdout, "Start ray tracing at `%dx%d' resolution...\n", width, height);
         fprintf(stdout, "Using OpenMP, max_threads = %d\n", omp_get_max_threads());
         timer.start();
+        auto runStart = std::chrono::steady_clock::now();
+        _Stats = {};
+        _ThreadCounters->reset();
+        // the virtual point lights and the light tree are drawn from the seed too
+        Maths::seedRandom(_Seed);
         _BackgroundColor = backgroundColor;
         _Image->clear(_BackgroundColor);
+        if(_WriteAOVs || _Denoise){
+            if(_AOVs == nullptr || _AOVs->getWidth() != width || _AOVs->getHeight() != height){
+                _AOVs = std::make_shared<AOVBuffers>(width, height);
+            } else {
+                _AOVs->clear();
+            }
+        } else {
+            _AOVs = nullptr;
+        }
 
         fprintf(stdout, "Start building BVH...\n");
-        _Primitives = getTriangles();
+        auto phaseStart = std::chrono::steady_clock::now();
+        if(_PreparedScene != nullptr){
+            buildPreparedInstances();
+        } else {
+            buildInstances();
+        }
+        _Stats._SceneFlatteningTime = getMillisecondsSince(phaseStart) - _Stats._AccelerationStructuresTime;
         fprintf(stdout, "Done\n");
 
         fprintf(stdout, "There are %zu lights in the scene\n", 
             _Scene->getDirectionalLights().size()
             + _Scene->getPointLights().size()
+            + _Scene->getOrientedLights().size()
         );
         if(_UseLightCuts){
             fprintf(stdout, "Start building LightTree...\n");
-            _Scene->buildTree();
+            phaseStart = std::chrono::steady_clock::now();
+            if(_UseVirtualPointLights){
+                std::vector<OrientedLightPtr> orientedLights = _Scene->getOrientedLights();
+                std::vector<OrientedLightPtr> virtualPointLights = generateVirtualPointLights();
+                fprintf(stdout, "\tThere are %zu virtual point lights\n", virtualPointLights.size());
+                orientedLights.insert(orientedLights.end(), virtualPointLights.begin(), virtualPointLights.end());
+                _LightTree = LightCutsTreePtr(new LightCutsTree(
+                    _Scene->getPointLights(), _Scene->getDirectionalLights(), orientedLights
+                ));
+            } else {
+                _Scene->buildTree();
+                _LightTree = _Scene->getLightTree();
+            }
+            _Stats._LightTreeTime = getMillisecondsSince(phaseStart);
             fprintf(stdout, "Done\n");
         }
 
@@ -715,53 +2430,98 @@ void RayTracer::run(FrameInfo frame, Vector3 backgroundColor){
         if(_SamplesPerPixels > 1){
             step = 1.f / (_SamplesPerPixels >> 1); // more samples to make weird effects diseaper
         }
+        _SampleOffsetsI.clear();
+        _SampleOffsetsJ.clear();
+        for(float deltaI=0; deltaI<1; deltaI+=step){
+            for(float deltaJ=0; deltaJ<1; deltaJ+=step){
+                _SampleOffsetsI.push_back(deltaI);
+                _SampleOffsetsJ.push_back(deltaJ);
+            }
+        }
+        size_t nbSamples = _SampleOffsetsI.size();
+        _CameraRays = CameraRayGenerator(
+            viewInv, projInv,
+            camera->getWidth(), camera->getHeight(),
+            camera->getPosition()
+        );
 
 
-        # pragma omp parallel for
-        for(uint32_t j = 0.f; j<height; j++){
-            #ifndef _OPENMP
-            float progress = j / (height+1.f);
-            displayProgressBar(progress);
-            #else
-            displayProgressBarOpenMP((height+1.f));
-            #endif
-
+        phaseStart = std::chrono::steady_clock::now();
+        _WorkerCounters = {};
+        _Shade = getShadeFunction();
+        if(_UseWavefront && _UseLightCuts){
+            ErrorHandler::handle(
+                __FILE__, __LINE__,
+                ErrorCode::BAD_VALUE_ERROR,
+                "The wavefront mode does not support light cuts, the paths are traced one by one!\n",
+                ErrorLevel::WARNING
+            );
+        }
+        if(_UseWavefront && _NbWorkerProcesses > 0){
+            ErrorHandler::handle(
+                __FILE__, __LINE__,
+                ErrorCode::BAD_VALUE_ERROR,
+                "The worker processes do not support the wavefront mode, they render their tiles path by path!\n",
+                ErrorLevel::WARNING
+            );
+        }
+        if(_NbWorkerProcesses > 0){
+            renderTilesInWorkers();
+        } else if(_UseWavefront && !_UseLightCuts){
+            renderWavefront();
+        } else if(_UseLightCuts && _LightcutsReuseCuts){
+            renderTiles();
+        } else {
             # pragma omp parallel for
-            for(uint32_t i = 0.f; i<width; i++){
-                Vector3 color = Vector3::zeros();
-                int nbHits = 0;
-
-                // subpixel sampling
-                for(float deltaI=0; deltaI<1; deltaI+=step){
-                    for(float deltaJ=0; deltaJ<1; deltaJ+=step){
-                        float u = (i+deltaI);
-                        float v = height - (j+deltaJ);
-
-                        RayPtr curRay = Ray::rayAt(
-                            u, v, 
-                            viewInv, projInv, 
-                            camera->getWidth(), camera->getHeight(), 
-                            camera->getPosition()
-                        );
-
-                        RayHits hits = getHits(curRay);
-                        nbHits += hits.getNbHits();
-                        if(_UseLightCuts){
-                            color += shadeLightCuts(hits);
-                        } else {
-                            color += shade(hits);
-                        }
-                    }
-                }
-                
-                if(nbHits > 0){
-                    color /= _SamplesPerPixels;
-                    _Image->set(i, j, color, Color::SRGB);
+            for(uint32_t j = 0.f; j<height; j++){
+                #ifndef _OPENMP
+                float progress = j / (height+1.f);
+                displayProgressBar(progress);
+                #else
+                displayProgressBarOpenMP((height+1.f));
+                #endif
+
+                // primary rays of the whole row at once
+                std::vector<float> directionX(width * nbSamples);
+                std::vector<float> directionY(width * nbSamples);
+                std::vector<float> directionZ(width * nbSamples);
+                _CameraRays.generateTile(0, j, width, j+1, height,
+                    _SampleOffsetsI, _SampleOffsetsJ, directionX, directionY, directionZ
+                );
+
+                std::vector<RayHitOpt> hits(width * nbSamples);
+                traceCameraRays({directionX, directionY, directionZ}, hits);
+
+                # pragma omp parallel for
+                for(uint32_t i = 0.f; i<width; i++){
+                    renderPixel(i, j, std::span<const RayHitOpt>(hits).subspan(i * nbSamples, nbSamples));
                 }
             }
         }
 
+        _Stats._RenderTime = getMillisecondsSince(phaseStart);
+
+        if(_Denoise){
+            fprintf(stdout, "\nStart denoising...\n");
+            phaseStart = std::chrono::steady_clock::now();
+            _Denoiser.denoise(*_Image, *_AOVs->_Albedo, *_AOVs->_Normal, _AOVs->_Depth);
+            _Stats._DenoiseTime = getMillisecondsSince(phaseStart);
+            fprintf(stdout, "Done\n");
+        }
+
         fprintf(stdout, "\nRay tracing executed in `%s'\n", Timer::format(timer.getTicks()).c_str());
+        _Stats._Counters = _ThreadCounters->merge();
+        _Stats._Counters.merge(_WorkerCounters);
+        _Stats._TotalTime = getMillisecondsSince(runStart);
+        if(!_StatsFileName.empty()){
+            _Stats.saveJSON(_StatsFileName);
+        }
+
+        // the image is encoded and written while the caller goes on
+        if(!_OutputFileName.empty()){
+            waitForOutput();
+            _OutputWriting = Image::saveAsync(*_Image, _OutputFileName, _OutputFileFormat);
+        }
         _IsRunning = false;
     }
 }
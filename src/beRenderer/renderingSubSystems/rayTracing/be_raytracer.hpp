@@ -1,13 +1,29 @@
 #pragma once
 
+#include <array>
+#include <chrono>
+#include <exception>
+#include <future>
 #include <memory>
+#include <span>
+#include <vector>
+#include "be_aovBuffers.hpp"
 #include "be_boundingVolume.hpp"
+#include "be_brdfBatch.hpp"
+#include "be_cameraRayGenerator.hpp"
+#include "be_denoiser.hpp"
+#include "be_errorHandler.hpp"
 #include "be_frameInfo.hpp"
 #include "be_image.hpp"
 #include "be_model.hpp"
+#include "be_preparedScene.hpp"
 #include "be_ray.hpp"
+#include "be_rayPacket.hpp"
 #include "be_rayHit.hpp"
+#include "be_rayTracingStats.hpp"
 #include "be_scene.hpp"
+#include "be_textureCache.hpp"
+#include "be_tileWorkers.hpp"
 
 namespace be{
 
@@ -39,11 +55,19 @@ class RayTracer{
         Vector3 _BackgroundColor = Color::WHITE;
         ImagePtr _Image = nullptr;
         ScenePtr _Scene = nullptr;
+        PreparedScenePtr _PreparedScene = nullptr;
         bool _IsRunning = false;
         FrameInfo _Frame;
-        std::vector<Triangle> _Primitives = {};
-        std::vector<BSHPtr> _BSH = {};
-        std::vector<BVHPtr> _BVH = {};
+        Matrix4x4 _ViewMatrix{};
+        CameraRayGenerator _CameraRays{};
+        std::vector<float> _SampleOffsetsI = {}; // subpixel offsets of the samples of every pixel
+        std::vector<float> _SampleOffsetsJ = {};
+        LightCutsTreePtr _LightTree = nullptr;
+        std::future<void> _OutputWriting{};
+        AOVBuffersPtr _AOVs = nullptr;
+        RayTracingStats _Stats{};
+        RayTracingCounterRegistryPtr _ThreadCounters = std::make_shared<RayTracingCounterRegistry>(); // written from the const traversals
+        RayTracingCounters _WorkerCounters{};
 
     private:
         // raytracing parameters
@@ -61,6 +85,27 @@ class RayTracer{
         float _LightcutsErrorThreshold = 0.02f; // 2%
         float _LightcutsMinIntensity = 1e-6;
         uint32_t _LightcutsMaxClusters = 100;
+        bool _LightcutsReuseCuts = false; // seed each pixel's cut with the cut of the previous pixel in its tile
+        bool _LightcutsMultidimensional = false; // refine one cut for all the samples of a pixel
+        uint32_t _LightcutsMaxProductClusters = 1000;
+        bool _UseVirtualPointLights = false; // indirect lighting from virtual point lights instead of bounce rays
+        uint32_t _VirtualPointLightsPaths = 1024;
+        uint32_t _VirtualPointLightsMaxDepth = 2;
+        float _VirtualPointLightsMinDistance = 0.1f; // clamping of the falloff of virtual point lights
+        uint32_t _TileSize = 16;
+        uint32_t _Seed = 0; // each pixel draws its random numbers from it, the image does not depend on the threads
+        bool _UseWavefront = false; // shade batches of path states stage by stage instead of one path per thread (not with light cuts)
+        uint32_t _WavefrontSize = 1 << 18; // camera samples per wave, bounds the memory of the queues
+        uint32_t _PacketSize = 4; // width of the packets of the camera rays and of the wavefront shadow rays: 4, 8, or 1 for single rays
+        bool _ReorderRays = true; // trace the bounce and shadow rays of a wave sorted by direction octant and origin (wavefront only)
+        uint32_t _NbWorkerProcesses = 0; // render the tiles in forked worker processes instead of threads when not 0 (posix only)
+        std::string _OutputFileName = ""; // written from a background thread at the end of run when not empty
+        Image::FileFormat _OutputFileFormat = Image::PFM;
+        bool _WriteAOVs = false; // the denoiser writes them anyway as its guides
+        bool _Denoise = false;
+        Denoiser _Denoiser{};
+        std::string _StatsFileName = ""; // json dump of the statistics at the end of run when not empty
+        TextureCachePtr _TextureCache = nullptr; // created with the first textured material, can be set beforehand to change its budget
 
 
     public:
@@ -68,18 +113,67 @@ class RayTracer{
             : _Scene(scene){
             setResolution(width, height);
         }
+
+        ~RayTracer(){
+            // a destructor must not throw, the failure of the last write is only reported
+            try{
+                waitForOutput();
+            } catch(const std::exception& e){
+                ErrorHandler::handle(
+                    __FILE__, __LINE__,
+                    ErrorCode::IO_ERROR,
+                    "Can't write the output file `" + _OutputFileName + "':\n\t" + e.what() + "\n",
+                    ErrorLevel::WARNING
+                );
+            }
+        }
         
         void run(FrameInfo frame, Vector3 backgroundColor = {});
 
+        /**
+         * Wait for the output file of the last run to be written
+         * @note Rethrows the exceptions of the writing
+        */
+        void waitForOutput(){
+            if(_OutputWriting.valid()){
+                _OutputWriting.get();
+            }
+        }
+
     public:
         ImagePtr getImage() const { 
             return _Image;
         }
+
+        /**
+         * Getter for the output variables of the last run
+         * @return The buffers, null if neither _WriteAOVs nor _Denoise were set
+        */
+        AOVBuffersPtr getAOVs() const {
+            return _AOVs;
+        }
+
+        /**
+         * Getter for the statistics of the last run
+         * @return The merged counters and the timings
+        */
+        const RayTracingStats& getStats() const {
+            return _Stats;
+        }
         
         void setScene(ScenePtr scene){
             _Scene = scene;
         }
 
+        /**
+         * Render a prepared scene instead of the objects of the scene
+         * @param preparedScene The mapped scene, null to go back to the objects of the scene
+         * @note The scene still provides the lights, see PreparedScene::createScene
+        */
+        void setPreparedScene(PreparedScenePtr preparedScene){
+            _PreparedScene = preparedScene;
+        }
+
         void setResolution(uint32_t width, uint32_t height){
             _Image = std::make_shared<Image>(width, height);
         }
@@ -87,76 +181,367 @@ class RayTracer{
         void enableNormalBRDF(){_BRDF = NORMAL_BRDF;}
         void enableLambertBRDF(){_BRDF = LAMBERT_BRDF;}
         void enableGgxBRDF(){_BRDF = GGX_BRDF;}
+        void enableDisneyBRDF(){_BRDF = DISNEY_BRDF;}
+        void setBRDF(BRDFModel brdf){_BRDF = brdf;}
+        void setBoundingVolumeMethod(BoundingVolumeMethod method){_BoundingVolumeMethod = method;}
 
     
     private:
-        std::vector<Triangle> getTriangles();
-        Vector3 shade(RayHits& hits, uint32_t depth = 0) const;
-        Vector3 shadeLightCuts(RayHits& hits, uint32_t depth = 0) const;
+        struct LightCutsSeed;
+        struct GatherTree;
+
+        static double getMillisecondsSince(std::chrono::steady_clock::time_point start){
+            return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        }
+
+        void buildInstances();
+        void buildPreparedInstances();
+        // the primary ray directions of the samples of a pixel
+        struct SampleDirections{
+            std::span<const float> _X;
+            std::span<const float> _Y;
+            std::span<const float> _Z;
+        };
+
+        // the output variables of a pixel, accumulated over its camera samples
+        struct PixelAOVs{
+            Vector3 _Albedo = Vector3::zeros();
+            Vector3 _Normal = Vector3::zeros();
+            float _Depth = 0.f;
+            uint32_t _ObjectID = AOVBuffers::NO_ID;
+            uint32_t _MaterialID = AOVBuffers::NO_ID;
+            uint32_t _NbSamples = 0;
+            uint32_t _NbSamplesHit = 0;
+
+            void add(const RayHitOpt& hit);
+            void write(AOVBuffers& aovs, uint32_t i, uint32_t j) const;
+        };
+
+        void traceCameraRays(const SampleDirections& directions, std::span<RayHitOpt> hits) const;
+        void renderPixel(uint32_t i, uint32_t j, std::span<const RayHitOpt> hits, LightCutsSeed* seed = nullptr);
+        void renderTile(uint32_t minI, uint32_t minJ, uint32_t maxI, uint32_t maxJ);
+        std::vector<TileMessage> getTiles() const;
+        void renderTiles();
+        void renderTilesInWorkers();
+
+        // wavefront path tracing
+        // the path states of a depth, one field per array
+        struct PathQueue{
+            std::vector<uint32_t> _Pixel = {}; // index of the pixel in the wave
+            std::vector<float> _OriginX = {};
+            std::vector<float> _OriginY = {};
+            std::vector<float> _OriginZ = {};
+            std::vector<float> _DirectionX = {};
+            std::vector<float> _DirectionY = {};
+            std::vector<float> _DirectionZ = {};
+            std::vector<float> _ConeWidth = {};
+            std::vector<float> _ConeSpread = {};
+            std::vector<float> _Weight = {}; // factor of the radiance brought back by the path
+
+            size_t size() const {return _Pixel.size();}
+            void resize(size_t size);
+            void set(size_t index, uint32_t pixel, const Ray& ray, float weight);
+            Ray getRay(size_t index) const;
+        };
+
+        // the shadow rays of the direct lighting, with the radiance they bring if not occluded
+        struct ShadowQueue{
+            std::vector<uint32_t> _Pixel = {};
+            std::vector<float> _OriginX = {};
+            std::vector<float> _OriginY = {};
+            std::vector<float> _OriginZ = {};
+            std::vector<float> _DirectionX = {};
+            std::vector<float> _DirectionY = {};
+            std::vector<float> _DirectionZ = {};
+            std::vector<float> _TMax = {};
+            std::vector<float> _RadianceR = {};
+            std::vector<float> _RadianceG = {};
+            std::vector<float> _RadianceB = {};
+
+            size_t size() const {return _Pixel.size();}
+            void resize(size_t size);
+            void set(size_t index, uint32_t pixel, const Ray& ray, const Vector3& radiance);
+            Ray getRay(size_t index) const;
+        };
+
+        // the rays of a wave handed to a thread at once
+        static constexpr size_t WAVEFRONT_BLOCK_SIZE = 64;
+        void renderWavefront();
+        template<typename Queue>
+        void getRayOrder(const Queue& queue, std::vector<uint32_t>& order) const;
+        void renderWave(std::span<const TileMessage> tiles);
+        template<typename LightPtr>
+        Vector3 shadeDirect(const RayHit& rayHit, const LightPtr& light, Ray* deferredShadowRay) const;
+        template<BRDFModel BRDF, typename LightPtr>
+        Vector3 shadeDirect(const RayHit& rayHit, const LightPtr& light, Ray* deferredShadowRay) const;
+        // the light reaching a hit, before the BRDF and the occlusion, the shadow ray stops at the light
+        Vector3 getIncidentLight(const RayHit& rayHit, PointLightPtr light, Vector3& toLight, Ray& shadowRay) const;
+        Vector3 getIncidentLight(const RayHit& rayHit, DirectionalLightPtr light, Vector3& toLight, Ray& shadowRay) const;
+        Vector3 getIncidentLight(const RayHit& rayHit, OrientedLightPtr light, Vector3& toLight, Ray& shadowRay) const;
+        // the direct lighting of GGX and Disney in two steps, the BRDFs of a wave are then evaluated in batches
+        template<typename LightPtr>
+        Vector3 setBRDFInputs(const RayHit& rayHit, const LightPtr& light, BRDFBatch& batch, size_t index, Ray& shadowRay) const;
+        // the path tracing integrator, one instance per combination of the settings so that the
+        // BRDF, the sampling and the traversal are inlined, the run picks its instance once
+        using ShadeFunction = Vector3 (RayTracer::*)(const RayHitOpt& hit, uint32_t depth) const;
+        ShadeFunction _Shade = nullptr;
+        ShadeFunction getShadeFunction() const;
+        template<BRDFModel BRDF>
+        ShadeFunction getShadeFunction() const;
+        template<BRDFModel BRDF, SamplingDistribution SAMPLING>
+        ShadeFunction getShadeFunction() const;
+        template<BRDFModel BRDF, SamplingDistribution SAMPLING, BoundingVolumeMethod METHOD>
+        Vector3 shade(const RayHitOpt& hit, uint32_t depth) const;
+        template<BRDFModel BRDF, BoundingVolumeMethod METHOD>
+        Vector3 getDirectLight(const RayHit& rayHit) const;
+        Vector3 shadeLightCuts(const RayHitOpt& hit, uint32_t depth = 0, LightCutsSeed* seed = nullptr) const;
+        Vector3 shadeLightCutsBounces(const RayHit& closestHit, uint32_t depth) const;
+        Vector3 shadeGatherPoint(const RayHitOpt& hit, GatherTree& gatherTree) const;
         
-        RayHits getHits(RayPtr curRay) const;
-        RayHits getHitsNaive(RayPtr curRay) const;        
-        RayHits getHitsBSH(RayPtr curRay) const;
-        RayHits getHitsBVH(RayPtr curRay) const;
+        RayHitOpt getClosestHit(const Ray& curRay) const;
+        template<BoundingVolumeMethod METHOD>
+        RayHitOpt getClosestHit(const Ray& curRay) const;
 
-        RayPtr sampleNewRay(const RayHit& rayHit) const;
+        // spread angle of the ray cones after a bounce, the textures are only filtered coarsely there
+        static constexpr float BOUNCE_CONE_SPREAD = 0.1f;
+        Ray sampleNewRay(const RayHit& rayHit) const;
+        template<SamplingDistribution SAMPLING>
+        Ray sampleNewRay(const RayHit& rayHit) const;
 
         Vector3 colorBRDF(const RayHit& rayHit) const;
         Vector3 normalBRDF(const RayHit& rayHit) const;
 
         // Vector3 getErrorBoundLambertBRDF(const RayHit& rayHit, LightCutsTree::LightNodePtr curNode) const;
         Vector3 lambertBRDF(const RayHit& rayHit) const;
-        Vector3 lambertBRDF(const RayHit& rayHit, PointLightPtr light) const;
-        Vector3 lambertBRDF(const RayHit& rayHit, DirectionalLightPtr light) const;
+        Vector3 lambertBRDF(const RayHit& rayHit, PointLightPtr light, Ray* deferredShadowRay = nullptr) const;
+        Vector3 lambertBRDF(const RayHit& rayHit, DirectionalLightPtr light, Ray* deferredShadowRay = nullptr) const;
+        Vector3 lambertBRDF(const RayHit& rayHit, OrientedLightPtr light, Ray* deferredShadowRay = nullptr) const;
         Vector3 lambertBRDF(const RayHit& rayHit, 
             const std::vector<PointLightPtr>& pointLights,
-            const std::vector<DirectionalLightPtr>& directionalLights 
+            const std::vector<DirectionalLightPtr>& directionalLights,
+            const std::vector<OrientedLightPtr>& orientedLights
         ) const;
 
         // Vector3 getErrorBoundGgxBRDF(const RayHit& rayHit, LightCutsTree::LightNodePtr curNode) const;
         Vector3 ggxBRDF(const RayHit& rayHit) const;
-        Vector3 ggxBRDF(const RayHit& rayHit, PointLightPtr light) const;
-        Vector3 ggxBRDF(const RayHit& rayHit, DirectionalLightPtr light) const;
+        Vector3 ggxBRDF(const RayHit& rayHit, PointLightPtr light, Ray* deferredShadowRay = nullptr) const;
+        Vector3 ggxBRDF(const RayHit& rayHit, DirectionalLightPtr light, Ray* deferredShadowRay = nullptr) const;
+        Vector3 ggxBRDF(const RayHit& rayHit, OrientedLightPtr light, Ray* deferredShadowRay = nullptr) const;
         Vector3 ggxBRDF(const RayHit& rayHit, 
             const std::vector<PointLightPtr>& pointLights,
-            const std::vector<DirectionalLightPtr>& directionalLights 
+            const std::vector<DirectionalLightPtr>& directionalLights,
+            const std::vector<OrientedLightPtr>& orientedLights
         ) const;
 
         Vector3 disneyBRDF(const RayHit& rayHit) const;
-        Vector3 disneyBRDF(const RayHit& rayHit, PointLightPtr light) const;
-        Vector3 disneyBRDF(const RayHit& rayHit, DirectionalLightPtr light) const;
+        Vector3 disneyBRDF(const RayHit& rayHit, PointLightPtr light, Ray* deferredShadowRay = nullptr) const;
+        Vector3 disneyBRDF(const RayHit& rayHit, DirectionalLightPtr light, Ray* deferredShadowRay = nullptr) const;
+        Vector3 disneyBRDF(const RayHit& rayHit, OrientedLightPtr light, Ray* deferredShadowRay = nullptr) const;
         Vector3 disneyBRDF(const RayHit& rayHit, 
             const std::vector<PointLightPtr>& pointLights,
-            const std::vector<DirectionalLightPtr>& directionalLights 
+            const std::vector<DirectionalLightPtr>& directionalLights,
+            const std::vector<OrientedLightPtr>& orientedLights
+        ) const;
+
+        // instancing
+        // the triangles and the analytic primitives of a model in object space, shared by all its instances
+        struct InstancedMesh{
+            std::vector<Triangle> _Triangles = {}; // _WorldPos* hold the object space positions
+            BSHPtr _BSH = nullptr;
+            BVHPtr _BVH = nullptr;
+            AxisAlignedBoundingBox _Bounds{};
+            // the analytic primitives in the order of the leaves of their hierarchy, whatever the method
+            std::vector<AnalyticPrimitive> _Primitives = {};
+            std::vector<BoxHierarchy::Node> _PrimitiveNodes = {};
+            // the triangles, the analytic primitives and their hierarchies of a mesh of a prepared scene, in its mapping
+            std::span<const TriangleAttributes> _PreparedTriangles{};
+            std::span<const BoxHierarchy::Node> _PreparedNodes{};
+            std::span<const AnalyticPrimitive> _PreparedPrimitives{};
+            std::span<const BoxHierarchy::Node> _PreparedPrimitiveNodes{};
+
+            bool hasPrimitives() const {
+                return !_PrimitiveNodes.empty() || !_PreparedPrimitiveNodes.empty();
+            }
+        };
+
+        // an object of the scene, placing a mesh in the world, the hits point to its shading data
+        struct Instance : RayHitInstance{
+            uint32_t _Mesh = 0;
+            Matrix4x4 _ModelInv{}; // world to object
+            AxisAlignedBoundingBox _Bounds{}; // world space
+        };
+
+        // the top level structure, a binary tree with one instance per leaf
+        struct InstanceTree{
+            static constexpr uint32_t NO_NODE = UINT32_MAX;
+            static constexpr uint32_t MAX_DEPTH = 64;
+
+            struct InstanceNode{
+                AxisAlignedBoundingBox _Bounds{};
+                uint32_t _Instance = NO_NODE;   // leaves only
+                uint32_t _RightChild = NO_NODE; // left child is always the next node
+            };
+
+            // depth first order, the root is the first node
+            std::vector<InstanceNode> _Nodes = {};
+
+            void build(const std::vector<Instance>& instances);
+
+            bool isLeaf(uint32_t node) const {
+                return _Nodes[node]._RightChild == NO_NODE;
+            }
+
+            private:
+                uint32_t addNode(const std::vector<Instance>& instances, std::vector<uint32_t>& indices, uint32_t begin, uint32_t end);
+        };
+
+        std::vector<InstancedMesh> _Meshes = {};
+        std::vector<Instance> _Instances = {};
+        InstanceTree _InstanceTree{};
+
+        void addMeshToAccelerationStructures(InstancedMesh& mesh);
+        void getInstanceHit(uint32_t instance, Ray& curRay, RayHitOpt& closestHit, RayTracingCounters& counters) const;
+        template<BoundingVolumeMethod METHOD>
+        void getInstanceHit(uint32_t instance, Ray& curRay, RayHitOpt& closestHit, RayTracingCounters& counters) const;
+
+        // packet traversal, the lanes go on one by one where they stop being coherent,
+        // and through the meshes without packet structure (prepared scenes, analytic primitives)
+        template<uint32_t N>
+        void getInstanceHits(uint32_t instance, RayPacket<N>& packet, std::array<RayHitOpt, N>& closestHits, uint32_t mask,
+            RayTracingCounters& counters
         ) const;
+        template<uint32_t N>
+        void traceRayPacket(RayPacket<N>& packet, std::array<RayHitOpt, N>& closestHits, bool isShadowRay) const;
+        template<uint32_t N>
+        void traceRayPackets(std::span<const Ray> rays, std::span<RayHitOpt> hits, bool isShadowRay) const;
+        // trace consecutive rays in packets of _PacketSize, the shadow rays only look for an occluder
+        void traceRays(std::span<const Ray> rays, std::span<RayHitOpt> hits, bool isShadowRay) const;
+        RayHitOpt traceRay(Ray& curRay, bool isShadowRay) const;
+        template<BoundingVolumeMethod METHOD>
+        RayHitOpt traceRay(Ray& curRay, bool isShadowRay) const;
+        bool isInShadow(const Ray& shadowRay, float distToLight = INFINITY) const;
+
+        /**
+         * The radiance of a light at a hit if nothing occludes it
+         * @param radiance The unoccluded radiance, no ray is traced when it is zero
+         * @param shadowRay The ray toward the light
+         * @param distToLight The distance to the light
+         * @param deferredShadowRay Where to store the shadow ray instead of tracing it, null to trace it now
+         * @return The radiance, or black if the light is occluded
+        */
+        Vector3 getVisibleRadiance(const Vector3& radiance, const Ray& shadowRay, float distToLight, Ray* deferredShadowRay) const;
+
+        // instant radiosity
+        std::vector<OrientedLightPtr> generateVirtualPointLights() const;
+
+        // lightcuts
+        static constexpr uint32_t LIGHTCUTS_MAX_CUT_SIZE = 256; // capacity of the on-stack cut
+        static constexpr uint32_t LIGHTCUTS_MAX_PRODUCT_CUT_SIZE = 1024; // capacity of the on-stack multidimensional cut
+
+        static void getOrthonormalBasis(const Vector3& normal, Vector3& tangent, Vector3& bitangent);
 
-        void addObjectToAccelerationStructures(const std::vector<Triangle>& triangles);
-        bool isInShadow(RayPtr shadowRay, float distToLight = INFINITY) const;
+        struct LightCutsShadingPoint{
+            Vector3 _Pos{};
+            Vector3 _Normal{};
+            Vector3 _Tangent{};
+            Vector3 _Bitangent{};
+            Vector3 _Albedo{};
 
-        Vector3 getClusterEstimate(const RayHit& rayHit, const LightCutsTree::LightNodePtr cluster) const;
-        Vector3 getClusterError(const RayHit& rayHit, const LightCutsTree::LightNodePtr cluster) const;
+            LightCutsShadingPoint(const RayHit& rayHit);
+        };
 
         struct CutHeap{
-            LightCutsTree::LightNodePtr _Cluster = nullptr;
-            Vector3 _ClusterError{};
-            Vector3 _ClusterEstimate{};
+            uint32_t _Cluster;
+            float _Error;
+            std::array<float, 3> _ClusterEstimate;
+
+            Vector3 getEstimate() const {
+                return {_ClusterEstimate[0], _ClusterEstimate[1], _ClusterEstimate[2]};
+            }
+        };
+
+        // finished cut of the previous pixel, reused as a starting point
+        struct LightCutsSeed{
+            std::array<uint32_t, LIGHTCUTS_MAX_CUT_SIZE> _Clusters;
+            uint32_t _Size = 0;
+        };
+
+        // the first hits of a pixel's samples, clustered in a binary tree
+        // see https://www.cs.cornell.edu/~kb/projects/mdlc/
+        struct GatherTree{
+            static constexpr uint32_t NO_NODE = UINT32_MAX;
+
+            struct GatherNode{
+                Vector3 _Center{};
+                Vector3 _HalfExtent{};
+                // bounding cone of the normals
+                Vector3 _NormalAxis{};
+                Vector3 _NormalTangent{};
+                Vector3 _NormalBitangent{};
+                float _NormalCosHalfAngle = 1.f;
+                float _NormalSinHalfAngle = 0.f;
+                // per channel maximum of the albedos
+                Vector3 _MaxAlbedo{};
+                float _Weight = 0.f;
+                uint32_t _Representative = 0;   // index of a gather point of the node
+                uint32_t _RightChild = NO_NODE; // left child is always the next node
+            };
+
+            std::vector<RayHit> _Hits = {};
+            std::vector<LightCutsShadingPoint> _Points = {};
+            std::vector<float> _Weights = {};
+            // depth first order, the root is the first node
+            std::vector<GatherNode> _Nodes = {};
+
+            void addGatherPoint(const RayHit& rayHit, float weight = 1.f);
+            void build();
+
+            uint32_t size() const {
+                return _Nodes.size();
+            }
+
+            bool isLeaf(uint32_t node) const {
+                return _Nodes[node]._RightChild == NO_NODE;
+            }
+
+            private:
+                uint32_t addNode(std::vector<uint32_t>& points, uint32_t begin, uint32_t end);
         };
 
-        static float getCutHeapError(const CutHeap& cut) {
-            if(cut._Cluster->isLeaf()){
+        // a pair of a gather cluster and a light cluster
+        struct ProductCutHeap{
+            uint32_t _GatherCluster;
+            uint32_t _LightCluster;
+            float _Error;
+            std::array<float, 3> _ClusterEstimate;
+
+            Vector3 getEstimate() const {
+                return {_ClusterEstimate[0], _ClusterEstimate[1], _ClusterEstimate[2]};
+            }
+        };
+
+        static bool cutHeapComparator(const CutHeap& c1, const CutHeap& c2){
+            return c1._Error < c2._Error;
+        }
+
+        static bool productCutHeapComparator(const ProductCutHeap& c1, const ProductCutHeap& c2){
+            return c1._Error < c2._Error;
+        }
+
+        static float getCutHeapError(bool isLeaf, const Vector3& clusterError, const Vector3& clusterEstimate) {
+            if(isLeaf){
                 return 0.f;
             }
 
-            // return _Error;
-            auto err = cut._ClusterError - cut._ClusterEstimate;
+            auto err = clusterError - clusterEstimate;
             // max of err.r, err.g, err.b
             float errR = std::fabs(err.r());
             float errG = std::fabs(err.g());
             float errB = std::fabs(err.b());
 
-            float realErrR = cut._ClusterError.r() == 0.f ? cut._ClusterEstimate.r() : errR / cut._ClusterError.r();
-            float realErrG = cut._ClusterError.g() == 0.f ? cut._ClusterEstimate.g() : errG / cut._ClusterError.g();
-            float realErrB = cut._ClusterError.b() == 0.f ? cut._ClusterEstimate.b() : errB / cut._ClusterError.b();
+            float realErrR = clusterError.r() == 0.f ? clusterEstimate.r() : errR / clusterError.r();
+            float realErrG = clusterError.g() == 0.f ? clusterEstimate.g() : errG / clusterError.g();
+            float realErrB = clusterError.b() == 0.f ? clusterEstimate.b() : errB / clusterError.b();
 
             return std::max(
                     realErrR,
@@ -165,25 +550,22 @@ class RayTracer{
                         realErrB
                     )
                 );
-            // return 1.f;
-        }
-        static bool cutHeapComparator(const CutHeap& c1, const CutHeap& c2){
-            return getCutHeapError(c1) < getCutHeapError(c2);
         }
 
-        void setError(const RayHit& rayHit, const LightCutsTree::LightNodePtr cluster) const {
-            // from Stochastic Lightcuts
-            float dlen2 = cluster->_AABB.getDistance(rayHit.getWorldPos());
-            dlen2 *= dlen2;
-            if (dlen2 < 1) dlen2 = 1; // bound the distance
-            // float atten = 1 / dlen2;
+        CutHeap createCutHeap(const LightCutsShadingPoint& point, uint32_t cluster, const Vector3& clusterEstimate) const;
+        Vector3 getClusterEstimate(const RayHit& rayHit, uint32_t cluster) const;
+        Vector3 getClusterError(const LightCutsShadingPoint& point, uint32_t cluster) const;
+        uint32_t seedLightCut(const RayHit& rayHit, const LightCutsShadingPoint& point, 
+            const LightCutsSeed& seed, CutHeap* cutHeap
+        ) const;
+        Vector3 getLightCutsRadiance(const RayHit& rayHit, LightCutsSeed* seed = nullptr) const;
 
-            float colorIntens = (cluster->_TotalColor.r() + cluster->_TotalColor.g() + cluster->_TotalColor.b()) / 3.0f;
-            if (colorIntens < _LightcutsMinIntensity){
-                colorIntens = _LightcutsMinIntensity;
-            }
-            // cluster->_Error = atten * colorIntens;
-        }
+        // multidimensional lightcuts
+        Vector3 getProductClusterError(const GatherTree& gatherTree, uint32_t gatherCluster, uint32_t lightCluster) const;
+        ProductCutHeap createProductCutHeap(const GatherTree& gatherTree, uint32_t gatherCluster, uint32_t lightCluster, 
+            const Vector3& clusterEstimate
+        ) const;
+        Vector3 getMultidimensionalLightCutsRadiance(const GatherTree& gatherTree) const;
 };
 
 }
\ No newline at end of file
@@ -0,0 +1,434 @@
+#include "be_textureCache.hpp"
+
+#include "be_color.hpp"
+#include "be_errorHandler.hpp"
+
+#define STBI_FAILURE_USERMSG
+#include <stb_image.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <random>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <unistd.h>
+#endif
+
+namespace be{
+
+namespace{
+
+/**
+ * The header of a tiled mip-map file, followed by the tiles of every level
+*/
+struct CacheFileHeader{
+    std::array<char, 4> _Magic = {'B', 'E', 'T', 'X'};
+    uint32_t _Version = 1;
+    uint32_t _Width = 0;
+    uint32_t _Height = 0;
+    uint32_t _Channels = 0;
+    uint32_t _TileSize = 0;
+
+    bool operator==(const CacheFileHeader& header) const = default;
+};
+
+/**
+ * Getter for a suffix of temporary files, unique among the processes and the caches writing the same file
+ * @param owner The object writing the file
+ * @return The suffix
+*/
+std::string getTemporarySuffix(const void* owner){
+    #if defined(__unix__) || defined(__APPLE__)
+    uint64_t process = static_cast<uint64_t>(getpid());
+    #else
+    uint64_t process = std::random_device{}();
+    #endif
+    return ".tmp" + std::to_string(process) + "_" + std::to_string(reinterpret_cast<uintptr_t>(owner));
+}
+
+}
+
+const std::array<float, 256> TextureCache::SRGB_TO_LINEAR = [](){
+    std::array<float, 256> table{};
+    for(uint32_t i = 0; i<256; i++){
+        table[i] = Color::sRGBToLinear(i / 255.f);
+    }
+    return table;
+}();
+
+TextureCache::TextureCache(size_t memoryBudget, const std::filesystem::path& cacheDirectory)
+    : _CacheDirectory(cacheDirectory), _MemoryBudget(memoryBudget), _ID([]{
+        static std::atomic<uint64_t> nextID{1};
+        return nextID.fetch_add(1, std::memory_order_relaxed);
+    }()){
+    std::error_code error{};
+    std::filesystem::create_directories(_CacheDirectory, error);
+    if(error){
+        ErrorHandler::handle(
+            __FILE__, __LINE__,
+            ErrorCode::IO_ERROR,
+            "Cannot create the texture cache directory `" + _CacheDirectory.string() + "': " + error.message() + "!\n"
+        );
+    }
+}
+
+TextureCache::Texture TextureCache::getLayout(uint32_t width, uint32_t height, uint32_t channels, bool isSRGB) const{
+    Texture texture{};
+    texture._Channels = channels;
+    texture._IsSRGB = isSRGB;
+    uint32_t nbTiles = 0;
+    while(true){
+        Level level{};
+        level._Width = width;
+        level._Height = height;
+        level._NbTilesX = (width + TILE_SIZE - 1) / TILE_SIZE;
+        level._NbTilesY = (height + TILE_SIZE - 1) / TILE_SIZE;
+        level._FirstTile = nbTiles;
+        nbTiles += level._NbTilesX * level._NbTilesY;
+        texture._Levels.push_back(level);
+        if(width == 1 && height == 1){
+            break;
+        }
+        width = std::max(1u, width / 2);
+        height = std::max(1u, height / 2);
+    }
+    return texture;
+}
+
+TextureCache::TextureID TextureCache::load(const std::string& path, uint32_t channels, bool isSRGB){
+    std::string key = path + "#" + std::to_string(channels) + (isSRGB ? "#srgb" : "");
+    auto found = _TextureIDs.find(key);
+    if(found != _TextureIDs.end()){
+        return found->second;
+    }
+
+    int width = 0;
+    int height = 0;
+    int fileChannels = 0;
+    if(channels == 0 || channels > 4 || !stbi_info(path.c_str(), &width, &height, &fileChannels)){
+        ErrorHandler::handle(
+            __FILE__, __LINE__,
+            ErrorCode::STB_IMAGE_ERROR,
+            "Failed to load texture image: `" + path + "'\n\t" + (channels == 0 || channels > 4 ? "bad number of channels" : stbi_failure_reason()) + "\n"
+        );
+        return NO_TEXTURE;
+    }
+
+    Texture texture = getLayout(width, height, channels, isSRGB);
+
+    // the cache file changes with the image
+    std::error_code error{};
+    auto fileSize = std::filesystem::file_size(path, error);
+    auto writeTime = std::filesystem::last_write_time(path, error).time_since_epoch().count();
+    size_t hash = std::hash<std::string>{}(
+        std::filesystem::absolute(path).string() + "#" + std::to_string(fileSize) + "#" + std::to_string(writeTime) + "#" + key
+    );
+    char fileName[32];
+    snprintf(fileName, sizeof(fileName), "%016zx.betex", hash);
+    texture._CacheFile = (_CacheDirectory / fileName).string();
+
+    CacheFileHeader expected{};
+    expected._Width = width;
+    expected._Height = height;
+    expected._Channels = channels;
+    expected._TileSize = TILE_SIZE;
+    CacheFileHeader header{};
+    std::ifstream file(texture._CacheFile, std::ios::binary);
+    if(!file || !file.read(reinterpret_cast<char*>(&header), sizeof(CacheFileHeader)) || !(header == expected)){
+        file.close();
+        buildCacheFile(path, texture, width, height);
+    }
+
+    TextureID id = _Textures.size();
+    _Textures.push_back(texture);
+    _TextureIDs[key] = id;
+    return id;
+}
+
+TextureCache::MaterialTextureIDs TextureCache::load(const MaterialTextures& textures){
+    MaterialTextureIDs ids{};
+    if(!textures._BaseColor.empty()){
+        ids._BaseColor = load(textures._BaseColor, 3, true);
+    }
+    if(!textures._Roughness.empty()){
+        ids._Roughness = load(textures._Roughness, 1, false);
+    }
+    if(!textures._Metallic.empty()){
+        ids._Metallic = load(textures._Metallic, 1, false);
+    }
+    return ids;
+}
+
+void TextureCache::buildCacheFile(const std::string& path, const Texture& texture, uint32_t width, uint32_t height) const{
+    int loadedWidth = 0;
+    int loadedHeight = 0;
+    int fileChannels = 0;
+    const uint32_t channels = texture._Channels;
+    stbi_uc* pixels = stbi_load(path.c_str(), &loadedWidth, &loadedHeight, &fileChannels, channels);
+    if(!pixels){
+        ErrorHandler::handle(
+            __FILE__, __LINE__,
+            ErrorCode::STB_IMAGE_ERROR,
+            "Failed to load texture image: `" + path + "'\n\t" + stbi_failure_reason() + "\n"
+        );
+        return;
+    }
+    std::vector<uint8_t> level(pixels, pixels + static_cast<size_t>(width) * height * channels);
+    stbi_image_free(pixels);
+
+    // written aside then renamed, so that concurrent renderers never read a partial file
+    std::string tmpFile = texture._CacheFile + getTemporarySuffix(this);
+    std::ofstream file(tmpFile, std::ios::binary);
+    if(!file){
+        ErrorHandler::handle(
+            __FILE__, __LINE__,
+            ErrorCode::IO_ERROR,
+            "Cannot open the file `" + tmpFile + "', to store the texture tiles!\n"
+        );
+        return;
+    }
+    CacheFileHeader header{};
+    header._Width = width;
+    header._Height = height;
+    header._Channels = channels;
+    header._TileSize = TILE_SIZE;
+    file.write(reinterpret_cast<const char*>(&header), sizeof(CacheFileHeader));
+
+    Tile tile(TILE_SIZE * TILE_SIZE * channels);
+    for(size_t levelIndex = 0; levelIndex<texture._Levels.size(); levelIndex++){
+        const Level& curLevel = texture._Levels[levelIndex];
+        // the borders are padded with the last texels
+        for(uint32_t tileY = 0; tileY<curLevel._NbTilesY; tileY++){
+            for(uint32_t tileX = 0; tileX<curLevel._NbTilesX; tileX++){
+                for(uint32_t y = 0; y<TILE_SIZE; y++){
+                    uint32_t srcY = std::min(tileY * TILE_SIZE + y, curLevel._Height - 1);
+                    for(uint32_t x = 0; x<TILE_SIZE; x++){
+                        uint32_t srcX = std::min(tileX * TILE_SIZE + x, curLevel._Width - 1);
+                        const uint8_t* src = &level[(static_cast<size_t>(srcY) * curLevel._Width + srcX) * channels];
+                        std::copy(src, src + channels, &tile[(y * TILE_SIZE + x) * channels]);
+                    }
+                }
+                file.write(reinterpret_cast<const char*>(tile.data()), tile.size());
+            }
+        }
+
+        if(levelIndex + 1 == texture._Levels.size()){
+            break;
+        }
+
+        // box filter of the next level, in linear space for the colors
+        const Level& nextLevel = texture._Levels[levelIndex + 1];
+        std::vector<uint8_t> next(static_cast<size_t>(nextLevel._Width) * nextLevel._Height * channels);
+        for(uint32_t y = 0; y<nextLevel._Height; y++){
+            for(uint32_t x = 0; x<nextLevel._Width; x++){
+                for(uint32_t c = 0; c<channels; c++){
+                    float sum = 0.f;
+                    for(uint32_t k = 0; k<4; k++){
+                        uint32_t srcX = std::min(2 * x + (k & 1), curLevel._Width - 1);
+                        uint32_t srcY = std::min(2 * y + (k >> 1), curLevel._Height - 1);
+                        uint8_t value = level[(static_cast<size_t>(srcY) * curLevel._Width + srcX) * channels + c];
+                        sum += texture._IsSRGB ? SRGB_TO_LINEAR[value] : value / 255.f;
+                    }
+                    float average = 0.25f * sum;
+                    if(texture._IsSRGB){
+                        average = Color::linearToSRGB(average);
+                    }
+                    next[(static_cast<size_t>(y) * nextLevel._Width + x) * channels + c] =
+                        static_cast<uint8_t>(std::clamp(average * 255.f + 0.5f, 0.f, 255.f));
+                }
+            }
+        }
+        level = std::move(next);
+    }
+    file.close();
+
+    // a short write must never become the cache file
+    std::error_code error{};
+    if(!file){
+        std::filesystem::remove(tmpFile, error);
+        ErrorHandler::handle(
+            __FILE__, __LINE__,
+            ErrorCode::IO_ERROR,
+            "Cannot write the texture tiles in `" + tmpFile + "'!\n"
+        );
+        return;
+    }
+    std::filesystem::rename(tmpFile, texture._CacheFile, error);
+    if(error){
+        ErrorHandler::handle(
+            __FILE__, __LINE__,
+            ErrorCode::IO_ERROR,
+            "Cannot store the texture tiles in `" + texture._CacheFile + "': " + error.message() + "!\n"
+        );
+    }
+}
+
+TextureCache::ThreadTiles& TextureCache::getThreadTiles() const{
+    thread_local ThreadTiles threadTiles{};
+    if(threadTiles._CacheID != _ID){
+        threadTiles._CacheID = _ID;
+        threadTiles._Tiles.fill(nullptr);
+        threadTiles._FileName.clear();
+        threadTiles._File.close();
+    }
+    return threadTiles;
+}
+
+TextureCache::TilePtr TextureCache::readTile(const Texture& texture, uint32_t tile, ThreadTiles& threadTiles) const{
+    size_t tileBytes = TILE_SIZE * TILE_SIZE * texture._Channels;
+    auto data = std::make_shared<Tile>(tileBytes);
+    // the file of the previous miss stays open, the misses of a texture come in bursts
+    std::ifstream& file = threadTiles._File;
+    if(threadTiles._FileName != texture._CacheFile){
+        file.close();
+        file.open(texture._CacheFile, std::ios::binary);
+        threadTiles._FileName = texture._CacheFile;
+    }
+    file.clear();
+    file.seekg(sizeof(CacheFileHeader) + static_cast<std::streamoff>(tile) * tileBytes);
+    if(!file.read(reinterpret_cast<char*>(data->data()), tileBytes)){
+        ErrorHandler::handle(
+            __FILE__, __LINE__,
+            ErrorCode::IO_ERROR,
+            "Cannot read a tile of the texture cache `" + texture._CacheFile + "'!\n"
+        );
+    }
+    return data;
+}
+
+TextureCache::TilePtr TextureCache::getTile(TextureID texture, uint32_t level, uint32_t tile) const{
+    const Texture& curTexture = _Textures[texture];
+    uint32_t fileTile = curTexture._Levels[level]._FirstTile + tile;
+    uint64_t key = (static_cast<uint64_t>(texture) << 32) | fileTile;
+
+    // the tiles never change once read, the handles of the thread need no lock
+    ThreadTiles& threadTiles = getThreadTiles();
+    uint32_t slot = static_cast<uint32_t>((key * 0x9e3779b97f4a7c15ull) >> 32) & (THREAD_TILES - 1);
+    if(threadTiles._Tiles[slot] != nullptr && threadTiles._Keys[slot] == key){
+        return threadTiles._Tiles[slot];
+    }
+    threadTiles._Keys[slot] = key;
+    threadTiles._Tiles[slot] = getSharedTile(texture, key, threadTiles);
+    return threadTiles._Tiles[slot];
+}
+
+TextureCache::TilePtr TextureCache::getSharedTile(TextureID texture, uint64_t key, ThreadTiles& threadTiles) const{
+    {
+        std::lock_guard<std::mutex> lock(_TilesMutex);
+        auto found = _Tiles.find(key);
+        if(found != _Tiles.end()){
+            _LRU.splice(_LRU.begin(), _LRU, found->second._LRU);
+            return found->second._Tile;
+        }
+    }
+
+    // read without holding the lock, another thread may load the same tile meanwhile
+    TilePtr loaded = readTile(_Textures[texture], static_cast<uint32_t>(key), threadTiles);
+
+    std::lock_guard<std::mutex> lock(_TilesMutex);
+    auto [cached, isNew] = _Tiles.try_emplace(key);
+    if(!isNew){
+        _LRU.splice(_LRU.begin(), _LRU, cached->second._LRU);
+        return cached->second._Tile;
+    }
+    _LRU.push_front(key);
+    cached->second = {loaded, _LRU.begin()};
+    _MemoryUsed += loaded->size();
+    _NbTileLoads++;
+
+    // the tiles being sampled by other threads stay alive through their shared pointers
+    while(_MemoryUsed > _MemoryBudget && _LRU.size() > 1){
+        auto evicted = _Tiles.find(_LRU.back());
+        _MemoryUsed -= evicted->second._Tile->size();
+        _Tiles.erase(evicted);
+        _LRU.pop_back();
+    }
+    return loaded;
+}
+
+void TextureCache::fetchTexel(TextureID texture, uint32_t level, uint32_t x, uint32_t y, TilePtr& tile, uint32_t& tileIndex, float texel[4]) const{
+    const Texture& curTexture = _Textures[texture];
+    const Level& curLevel = curTexture._Levels[level];
+    uint32_t curTileIndex = (y / TILE_SIZE) * curLevel._NbTilesX + x / TILE_SIZE;
+    // neighbour texels are most often in the same tile
+    if(tile == nullptr || curTileIndex != tileIndex){
+        tile = getTile(texture, level, curTileIndex);
+        tileIndex = curTileIndex;
+    }
+    const uint8_t* value = &(*tile)[((y % TILE_SIZE) * TILE_SIZE + x % TILE_SIZE) * curTexture._Channels];
+    for(uint32_t c = 0; c<curTexture._Channels; c++){
+        texel[c] = curTexture._IsSRGB ? SRGB_TO_LINEAR[value[c]] : value[c] / 255.f;
+    }
+}
+
+Vector4 TextureCache::sampleBilinear(TextureID texture, const Vector2& uv, uint32_t level) const{
+    const Texture& curTexture = _Textures[texture];
+    level = std::min(level, static_cast<uint32_t>(curTexture._Levels.size() - 1));
+    const Level& curLevel = curTexture._Levels[level];
+
+    // wrapping addressing, texel centers at half integers
+    auto getCoordinates = [](float coord, uint32_t size, uint32_t& first, uint32_t& second, float& weight){
+        float x = (coord - std::floor(coord)) * size - 0.5f;
+        float floorX = std::floor(x);
+        weight = x - floorX;
+        int64_t index = static_cast<int64_t>(floorX);
+        first = static_cast<uint32_t>((index % size + size) % size);
+        second = (first + 1) % size;
+    };
+    uint32_t x0, x1, y0, y1;
+    float weightX, weightY;
+    getCoordinates(uv.x(), curLevel._Width, x0, x1, weightX);
+    getCoordinates(uv.y(), curLevel._Height, y0, y1, weightY);
+
+    TilePtr tile = nullptr;
+    uint32_t tileIndex = 0;
+    float t00[4] = {}, t10[4] = {}, t01[4] = {}, t11[4] = {};
+    fetchTexel(texture, level, x0, y0, tile, tileIndex, t00);
+    fetchTexel(texture, level, x1, y0, tile, tileIndex, t10);
+    fetchTexel(texture, level, x0, y1, tile, tileIndex, t01);
+    fetchTexel(texture, level, x1, y1, tile, tileIndex, t11);
+
+    Vector4 result{};
+    for(int c = 0; c<4; c++){
+        float top = t00[c] + weightX * (t10[c] - t00[c]);
+        float bottom = t01[c] + weightX * (t11[c] - t01[c]);
+        result[c] = top + weightY * (bottom - top);
+    }
+    return result;
+}
+
+Vector4 TextureCache::sample(TextureID texture, const Vector2& uv, float footprint) const{
+    const Texture& curTexture = _Textures[texture];
+    uint32_t lastLevel = curTexture._Levels.size() - 1;
+    const Level& base = curTexture._Levels[0];
+
+    // level where one texel covers the footprint
+    float lod = std::log2(std::max(footprint * std::max(base._Width, base._Height), 1e-8f));
+    if(lod <= 0.f){
+        return sampleBilinear(texture, uv, 0);
+    }
+    if(lod >= lastLevel){
+        return sampleBilinear(texture, uv, lastLevel);
+    }
+    uint32_t level = static_cast<uint32_t>(lod);
+    float weight = lod - level;
+    Vector4 fine = sampleBilinear(texture, uv, level);
+    Vector4 coarse = sampleBilinear(texture, uv, level + 1);
+    return fine + weight * (coarse - fine);
+}
+
+size_t TextureCache::getMemoryUsed() const{
+    std::lock_guard<std::mutex> lock(_TilesMutex);
+    return _MemoryUsed;
+}
+
+uint64_t TextureCache::getNbTileLoads() const{
+    std::lock_guard<std::mutex> lock(_TilesMutex);
+    return _NbTileLoads;
+}
+
+}
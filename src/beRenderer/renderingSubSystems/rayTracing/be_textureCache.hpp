@@ -0,0 +1,175 @@
+#pragma once
+
+#include "be_material.hpp"
+#include "be_vector2.hpp"
+#include "be_vector4.hpp"
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace be{
+
+class TextureCache;
+using TextureCachePtr = std::shared_ptr<TextureCache>;
+
+/**
+ * The textures of the ray tracer, mip-mapped and split in tiles streamed from disk
+ * @note Each image is decoded once into a tiled mip-map file of the cache directory,
+ * then only the tiles that are sampled live in memory, within a budget, the least
+ * recently used tiles are evicted first
+ * @note Each thread keeps a few handles on the tiles it sampled last, read without any lock;
+ * they may outlive their eviction, by at most THREAD_TILES tiles per thread
+ * @note Loading is not thread safe, sampling is
+*/
+class TextureCache{
+    public:
+        using TextureID = uint32_t;
+        static constexpr TextureID NO_TEXTURE = UINT32_MAX;
+
+        /**
+         * The width and height of a tile, in texels
+        */
+        static constexpr uint32_t TILE_SIZE = 64;
+
+        /**
+         * The number of tile handles of each thread, a power of two
+        */
+        static constexpr uint32_t THREAD_TILES = 32;
+
+        /**
+         * The textures of a material
+         * @see MaterialTextures
+        */
+        struct MaterialTextureIDs{
+            TextureID _BaseColor = NO_TEXTURE;
+            TextureID _Roughness = NO_TEXTURE;
+            TextureID _Metallic = NO_TEXTURE;
+        };
+
+    private:
+        struct Level{
+            uint32_t _Width = 0;
+            uint32_t _Height = 0;
+            uint32_t _NbTilesX = 0;
+            uint32_t _NbTilesY = 0;
+            uint32_t _FirstTile = 0; // index of the first tile of the level in the file
+        };
+
+        struct Texture{
+            std::string _CacheFile = "";
+            uint32_t _Channels = 0;
+            bool _IsSRGB = false;
+            std::vector<Level> _Levels = {};
+        };
+
+        // texels of a tile, 8 bits per channel
+        using Tile = std::vector<uint8_t>;
+        using TilePtr = std::shared_ptr<const Tile>;
+
+        struct CachedTile{
+            TilePtr _Tile = nullptr;
+            std::list<uint64_t>::iterator _LRU{};
+        };
+
+        // the last tiles and file of a thread, direct mapped by key
+        struct ThreadTiles{
+            uint64_t _CacheID = 0;
+            std::array<uint64_t, THREAD_TILES> _Keys{};
+            std::array<TilePtr, THREAD_TILES> _Tiles{};
+            std::string _FileName = "";
+            std::ifstream _File{};
+        };
+
+        std::vector<Texture> _Textures = {};
+        std::unordered_map<std::string, TextureID> _TextureIDs = {};
+        std::filesystem::path _CacheDirectory{};
+        size_t _MemoryBudget = 0;
+
+        /**
+         * Unique among the caches of the process, so that a thread never reuses the handles of another cache
+        */
+        const uint64_t _ID;
+
+        // the tiles in memory, keyed by texture, level and tile
+        mutable std::mutex _TilesMutex{};
+        mutable std::unordered_map<uint64_t, CachedTile> _Tiles = {};
+        mutable std::list<uint64_t> _LRU = {}; // most recently used first
+        mutable size_t _MemoryUsed = 0;
+        mutable uint64_t _NbTileLoads = 0;
+
+        static const std::array<float, 256> SRGB_TO_LINEAR;
+
+    public:
+        /**
+         * @param memoryBudget The maximum size of the tiles in memory, in bytes
+         * @param cacheDirectory The directory of the tiled mip-map files
+        */
+        TextureCache(
+            size_t memoryBudget = 256 * 1024 * 1024,
+            const std::filesystem::path& cacheDirectory = std::filesystem::temp_directory_path() / "BigoudiEngine_textures"
+        );
+
+        /**
+         * Load a texture, its tiled mip-map file is only built once
+         * @param path The path of the image
+         * @param channels The channels to keep, 1 for the scalar maps, 3 for the colors
+         * @param isSRGB If the texels are sRGB encoded, they are sampled as linear values
+         * @return The id of the texture
+        */
+        TextureID load(const std::string& path, uint32_t channels, bool isSRGB);
+
+        /**
+         * Load the maps of a material
+         * @param textures The paths of the maps
+         * @return The ids, NO_TEXTURE for the missing maps
+        */
+        MaterialTextureIDs load(const MaterialTextures& textures);
+
+        /**
+         * Sample a texture with a wrapping addressing
+         * @param texture The texture to sample
+         * @param uv The texture coordinates
+         * @param footprint The width of the pixel footprint in texture coordinates, from the ray differentials
+         * @return The filtered value, bilinear when magnified, trilinear otherwise, the missing channels are 0
+        */
+        Vector4 sample(TextureID texture, const Vector2& uv, float footprint) const;
+
+        /**
+         * Sample a level of a texture with a bilinear filtering
+         * @param texture The texture to sample
+         * @param uv The texture coordinates
+         * @param level The mip level
+         * @return The filtered value
+        */
+        Vector4 sampleBilinear(TextureID texture, const Vector2& uv, uint32_t level) const;
+
+        uint32_t getNbLevels(TextureID texture) const {return _Textures[texture]._Levels.size();}
+        size_t getMemoryBudget() const {return _MemoryBudget;}
+        size_t getMemoryUsed() const;
+
+        /**
+         * Getter for the number of tiles read from disk
+         * @return The number of cache misses since the creation of the cache
+        */
+        uint64_t getNbTileLoads() const;
+
+    private:
+        void buildCacheFile(const std::string& path, const Texture& texture, uint32_t width, uint32_t height) const;
+        Texture getLayout(uint32_t width, uint32_t height, uint32_t channels, bool isSRGB) const;
+        TilePtr getTile(TextureID texture, uint32_t level, uint32_t tile) const;
+        TilePtr readTile(const Texture& texture, uint32_t tile, ThreadTiles& threadTiles) const;
+        ThreadTiles& getThreadTiles() const;
+        TilePtr getSharedTile(TextureID texture, uint64_t key, ThreadTiles& threadTiles) const;
+        void fetchTexel(TextureID texture, uint32_t level, uint32_t x, uint32_t y, TilePtr& tile, uint32_t& tileIndex, float texel[4]) const;
+};
+
+}
@@ -0,0 +1,276 @@
+#include "be_tileWorkers.hpp"
+
+#include "be_errorHandler.hpp"
+#include "be_utilityFunctions.hpp"
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <string>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#define BE_TILE_WORKERS
+#endif
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0 // a dead worker must not kill the coordinator with SIGPIPE
+#endif
+
+namespace be{
+
+#ifdef BE_TILE_WORKERS
+
+bool TileWorkers::readAll(int socket, void* data, size_t size){
+    char* bytes = static_cast<char*>(data);
+    while(size > 0){
+        ssize_t nbRead = recv(socket, bytes, size, 0);
+        if(nbRead < 0 && errno == EINTR){
+            continue;
+        }
+        if(nbRead <= 0){
+            return false;
+        }
+        bytes += nbRead;
+        size -= static_cast<size_t>(nbRead);
+    }
+    return true;
+}
+
+bool TileWorkers::writeAll(int socket, const void* data, size_t size){
+    const char* bytes = static_cast<const char*>(data);
+    while(size > 0){
+        ssize_t nbWritten = send(socket, bytes, size, MSG_NOSIGNAL);
+        if(nbWritten < 0 && errno == EINTR){
+            continue;
+        }
+        if(nbWritten <= 0){
+            return false;
+        }
+        bytes += nbWritten;
+        size -= static_cast<size_t>(nbWritten);
+    }
+    return true;
+}
+
+bool TileWorkers::serve(int socket, const RenderTile& renderTile, RayTracingCounterRegistry& threadCounters){
+    threadCounters.reset();
+    std::vector<float> pixels{};
+    TileMessage tile{};
+    while(readAll(socket, &tile, sizeof(TileMessage))){
+        if(tile._Tile == TileMessage::STOP){
+            RayTracingCounters counters = threadCounters.merge();
+            return writeAll(socket, &counters, sizeof(RayTracingCounters));
+        }
+        pixels.resize(tile.getNbFloats());
+        renderTile(tile, pixels);
+        if(!writeAll(socket, &tile, sizeof(TileMessage))
+            || !writeAll(socket, pixels.data(), pixels.size() * sizeof(float))){
+            return false;
+        }
+    }
+    return false;
+}
+
+RayTracingCounters TileWorkers::render(
+        uint32_t nbWorkers,
+        const std::vector<TileMessage>& tiles,
+        const RenderTile& renderTile,
+        const StoreTile& storeTile,
+        RayTracingCounterRegistry& threadCounters
+    ){
+    static constexpr size_t NO_TILE = SIZE_MAX;
+    struct Worker{
+        pid_t _Pid = -1;
+        int _Socket = -1;
+        size_t _Tile = NO_TILE; // the tile in flight
+    };
+
+    RayTracingCounters counters{};
+    if(tiles.empty() || nbWorkers == 0){
+        return counters;
+    }
+
+    fflush(stdout);
+    fflush(stderr);
+
+    std::vector<Worker> workers{};
+    for(uint32_t k = 0; k<nbWorkers; k++){
+        int sockets[2];
+        if(socketpair(AF_UNIX, SOCK_STREAM, 0, sockets) != 0){
+            ErrorHandler::handle(
+                __FILE__, __LINE__,
+                ErrorCode::SYSTEM_ERROR,
+                "Cannot create the socket of a worker: " + std::string(strerror(errno)) + "!\n"
+            );
+        }
+        pid_t pid = fork();
+        if(pid < 0){
+            ErrorHandler::handle(
+                __FILE__, __LINE__,
+                ErrorCode::SYSTEM_ERROR,
+                "Cannot fork a worker: " + std::string(strerror(errno)) + "!\n"
+            );
+        }
+        if(pid == 0){
+            // worker, only its end of its own socket stays open
+            for(const auto& worker : workers){
+                close(worker._Socket);
+            }
+            close(sockets[0]);
+            bool isServed = serve(sockets[1], renderTile, threadCounters);
+            close(sockets[1]);
+            // skip the destructors and exit handlers of the coordinator state
+            _exit(isServed ? EXIT_SUCCESS : EXIT_FAILURE);
+        }
+        close(sockets[1]);
+        workers.push_back({pid, sockets[0], NO_TILE});
+    }
+
+    std::deque<size_t> pendingTiles{};
+    for(size_t tile = 0; tile<tiles.size(); tile++){
+        pendingTiles.push_back(tile);
+    }
+    size_t nbAliveWorkers = workers.size();
+    size_t nbDoneTiles = 0;
+
+    auto killWorker = [&](Worker& worker){
+        if(worker._Tile != NO_TILE){
+            pendingTiles.push_front(worker._Tile);
+        }
+        close(worker._Socket);
+        waitpid(worker._Pid, nullptr, 0);
+        worker = Worker{};
+        nbAliveWorkers--;
+        ErrorHandler::handle(
+            __FILE__, __LINE__,
+            ErrorCode::SYSTEM_ERROR,
+            "A ray tracing worker was lost, its tiles go to the others!\n",
+            nbAliveWorkers > 0 ? ErrorLevel::WARNING : ErrorLevel::FATAL
+        );
+    };
+    auto sendTile = [&](Worker& worker){
+        while(worker._Socket >= 0 && !pendingTiles.empty()){
+            worker._Tile = pendingTiles.front();
+            pendingTiles.pop_front();
+            if(writeAll(worker._Socket, &tiles[worker._Tile], sizeof(TileMessage))){
+                return;
+            }
+            killWorker(worker);
+        }
+    };
+
+    for(auto& worker : workers){
+        sendTile(worker);
+    }
+
+    std::vector<pollfd> pollFds{};
+    std::vector<float> pixels{};
+    while(nbDoneTiles < tiles.size()){
+        pollFds.clear();
+        for(const auto& worker : workers){
+            if(worker._Socket >= 0 && worker._Tile != NO_TILE){
+                pollFds.push_back({worker._Socket, POLLIN, 0});
+            }
+        }
+        if(poll(pollFds.data(), pollFds.size(), -1) < 0){
+            if(errno == EINTR){
+                continue;
+            }
+            ErrorHandler::handle(
+                __FILE__, __LINE__,
+                ErrorCode::SYSTEM_ERROR,
+                "Cannot poll the workers: " + std::string(strerror(errno)) + "!\n"
+            );
+        }
+
+        for(auto& worker : workers){
+            if(worker._Socket < 0 || worker._Tile == NO_TILE){
+                continue;
+            }
+            bool isReady = false;
+            for(const auto& pollFd : pollFds){
+                isReady |= pollFd.fd == worker._Socket && pollFd.revents != 0;
+            }
+            if(!isReady){
+                continue;
+            }
+
+            const TileMessage& expected = tiles[worker._Tile];
+            TileMessage tile{};
+            pixels.resize(expected.getNbFloats());
+            if(!readAll(worker._Socket, &tile, sizeof(TileMessage))
+                || tile._Tile != expected._Tile
+                || !readAll(worker._Socket, pixels.data(), pixels.size() * sizeof(float))){
+                killWorker(worker);
+                // the lost tile may be the only one left
+                for(auto& idleWorker : workers){
+                    if(idleWorker._Socket >= 0 && idleWorker._Tile == NO_TILE){
+                        sendTile(idleWorker);
+                    }
+                }
+                continue;
+            }
+
+            storeTile(expected, pixels);
+            worker._Tile = NO_TILE;
+            nbDoneTiles++;
+            displayProgressBar(static_cast<float>(nbDoneTiles) / tiles.size());
+            sendTile(worker);
+        }
+    }
+
+    // collect the counters of the workers
+    for(auto& worker : workers){
+        if(worker._Socket < 0){
+            continue;
+        }
+        TileMessage stop{};
+        RayTracingCounters workerCounters{};
+        if(writeAll(worker._Socket, &stop, sizeof(TileMessage))
+            && readAll(worker._Socket, &workerCounters, sizeof(RayTracingCounters))){
+            counters.merge(workerCounters);
+        }
+        close(worker._Socket);
+        waitpid(worker._Pid, nullptr, 0);
+    }
+    return counters;
+}
+
+#else
+
+bool TileWorkers::readAll(int, void*, size_t){
+    return false;
+}
+
+bool TileWorkers::writeAll(int, const void*, size_t){
+    return false;
+}
+
+bool TileWorkers::serve(int, const RenderTile&, RayTracingCounterRegistry&){
+    ErrorHandler::handle(
+        __FILE__, __LINE__,
+        ErrorCode::UNIMPLEMENTED_ERROR,
+        "Ray tracing workers are only available on posix systems!\n"
+    );
+    return false;
+}
+
+RayTracingCounters TileWorkers::render(uint32_t, const std::vector<TileMessage>&, const RenderTile&, const StoreTile&,
+        RayTracingCounterRegistry&){
+    ErrorHandler::handle(
+        __FILE__, __LINE__,
+        ErrorCode::UNIMPLEMENTED_ERROR,
+        "Ray tracing workers are only available on posix systems!\n"
+    );
+    return {};
+}
+
+#endif
+
+}
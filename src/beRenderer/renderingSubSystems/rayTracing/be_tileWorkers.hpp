@@ -0,0 +1,97 @@
+#pragma once
+
+#include "be_image.hpp"
+#include "be_rayTracingStats.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <span>
+#include <vector>
+
+namespace be{
+
+/**
+ * A block of pixels, the message exchanged with the workers
+ * @note Sent as is over the socket, both ends run the same binary
+*/
+struct TileMessage{
+    static constexpr uint32_t STOP = UINT32_MAX;
+
+    uint32_t _Tile = STOP;
+    uint32_t _MinI = 0;
+    uint32_t _MinJ = 0;
+    uint32_t _MaxI = 0; // the column after the tile
+    uint32_t _MaxJ = 0; // the row after the tile
+    uint32_t _NbFloatsPerPixel = Image::CHANNELS; // more than the color when the pixels carry other values
+
+    /**
+     * Getter for the size of the pixels of the tile
+     * @return The number of floats, rows are packed without padding
+    */
+    size_t getNbFloats() const {
+        return static_cast<size_t>(_MaxI - _MinI) * (_MaxJ - _MinJ) * _NbFloatsPerPixel;
+    }
+};
+
+/**
+ * Render the tiles of an image in worker processes, each one with its own address space
+ * @note The workers are forked once the scene is ready, so they share its acceleration
+ * structures copy on write instead of loading it again
+ * @note Protocol over a connected stream socket: the coordinator sends a TileMessage,
+ * the worker answers with the same TileMessage followed by the floats of the tile;
+ * a STOP message is answered with the RayTracingCounters of the worker, which then exits
+*/
+class TileWorkers{
+    public:
+        /**
+         * Render a tile
+         * @param tile The tile to render
+         * @param pixels The output, tile.getNbFloats() floats
+        */
+        using RenderTile = std::function<void(const TileMessage& tile, std::span<float> pixels)>;
+
+        /**
+         * Store a rendered tile
+         * @param tile The rendered tile
+         * @param pixels The floats of the tile
+        */
+        using StoreTile = std::function<void(const TileMessage& tile, std::span<const float> pixels)>;
+
+    private:
+        TileWorkers(){}
+
+    public:
+        /**
+         * Render every tile in worker processes, the tiles of a dead worker go to the others
+         * @param nbWorkers The number of worker processes
+         * @param tiles The tiles to render
+         * @param renderTile The rendering of a tile, called in the workers only
+         * @param storeTile The storage of a tile, called in the coordinator as tiles come back
+         * @param threadCounters The counters that renderTile writes, reset and merged in each worker
+         * @return The merged counters of the workers
+         * @note Posix only, the workers are forked from the calling thread
+        */
+        static RayTracingCounters render(
+            uint32_t nbWorkers,
+            const std::vector<TileMessage>& tiles,
+            const RenderTile& renderTile,
+            const StoreTile& storeTile,
+            RayTracingCounterRegistry& threadCounters
+        );
+
+        /**
+         * The loop of a worker, until the coordinator sends STOP or hangs up
+         * @param socket A stream socket connected to the coordinator
+         * @param renderTile The rendering of a tile
+         * @param threadCounters The counters that renderTile writes
+         * @return false if the connection was lost
+        */
+        static bool serve(int socket, const RenderTile& renderTile, RayTracingCounterRegistry& threadCounters);
+
+    private:
+        static bool readAll(int socket, void* data, size_t size);
+        static bool writeAll(int socket, const void* data, size_t size);
+};
+
+}